@@ -23,6 +23,9 @@ set(SOURCEDIR ${CMAKE_SOURCE_DIR})
 
 # HEADER FILES
 check_include_file(argp.h HAVE_ARGP_H)
+check_include_file(sys/inotify.h HAVE_SYS_INOTIFY_H)
+check_include_file(sys/sendfile.h HAVE_SYS_SENDFILE_H)
+check_include_file(linux/fs.h HAVE_LINUX_FS_H)
 
 # FUNCTIONS
 if (NOT LINUX)
@@ -43,6 +46,13 @@ if (HAVE_LIBDL)
     set(CMAKE_REQUIRED_LIBRARIES ${CMAKE_REQUIRED_LIBRARIES} ${DLFCN_LIBRARY})
 endif (HAVE_LIBDL)
 
+# THREADS
+find_package(Threads)
+if (CMAKE_USE_PTHREADS_INIT)
+    set(HAVE_PTHREAD 1)
+    set(CMAKE_REQUIRED_LIBRARIES ${CMAKE_REQUIRED_LIBRARIES} ${CMAKE_THREAD_LIBS_INIT})
+endif (CMAKE_USE_PTHREADS_INIT)
+
 check_function_exists(asprintf HAVE_ASPRINTF)
 if(NOT HAVE_ASPRINTF)
     if(MINGW)
@@ -62,6 +72,14 @@ endif()
 check_function_exists(strerror_r HAVE_STRERROR_R)
 check_function_exists(utimes HAVE_UTIMES)
 check_function_exists(lstat HAVE_LSTAT)
+check_function_exists(fstatat HAVE_FSTATAT)
+check_function_exists(openat HAVE_OPENAT)
+check_function_exists(fdopendir HAVE_FDOPENDIR)
+check_function_exists(getdents64 HAVE_GETDENTS64)
+check_function_exists(statx HAVE_STATX)
+check_function_exists(copy_file_range HAVE_COPY_FILE_RANGE)
+check_function_exists(sendfile HAVE_SENDFILE)
+check_function_exists(fdatasync HAVE_FDATASYNC)
 check_function_exists(asprintf HAVE_ASPRINTF)
 if (UNIX AND HAVE_ASPRINTF)
   add_definitions(-D_GNU_SOURCE)
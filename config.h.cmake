@@ -9,17 +9,29 @@
 #cmakedefine SOURCEDIR "${SOURCEDIR}"
 
 #cmakedefine HAVE_CLOCK_GETTIME
+#cmakedefine HAVE_PTHREAD 1
 
 #cmakedefine WITH_LOG4C 1
 #cmakedefine WITH_ICONV 1
 
 #cmakedefine HAVE_ARGP_H 1
+#cmakedefine HAVE_SYS_INOTIFY_H 1
+#cmakedefine HAVE_SYS_SENDFILE_H 1
+#cmakedefine HAVE_LINUX_FS_H 1
 #cmakedefine HAVE_ICONV_H 1
 #cmakedefine HAVE_SYS_ICONV_H 1
 
 #cmakedefine HAVE_STRERROR_R 1
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
+#cmakedefine HAVE_FSTATAT 1
+#cmakedefine HAVE_OPENAT 1
+#cmakedefine HAVE_FDOPENDIR 1
+#cmakedefine HAVE_GETDENTS64 1
+#cmakedefine HAVE_STATX 1
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+#cmakedefine HAVE_SENDFILE 1
+#cmakedefine HAVE_FDATASYNC 1
 #cmakedefine HAVE_FNMATCH 1
 #cmakedefine HAVE___MINGW_ASPRINTF 1
 #cmakedefine HAVE_ICONV 1
@@ -26,10 +26,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <neon/ne_basic.h>
 #include <neon/ne_socket.h>
 #include <neon/ne_session.h>
+#include <neon/ne_ssl.h>
 #include <neon/ne_request.h>
 #include <neon/ne_props.h>
 #include <neon/ne_auth.h>
@@ -46,6 +48,10 @@
 #include "vio/csync_vio_module.h"
 #include "vio/csync_vio_file_stat.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #ifdef NDEBUG
 #define DEBUG_WEBDAV(...)
 #else
@@ -78,6 +84,7 @@ typedef unsigned long dav_size_t;
 typedef struct resource {
     char *uri;           /* The complete uri */
     char *name;          /* The filename only */
+    char *etag;          /* The ETag, changes with anything below a collection */
 
     enum resource_type type;
     dav_size_t         size;
@@ -110,6 +117,7 @@ static void free_fetchCtx( struct listdir_context *ctx )
     while( res ) {
         SAFE_FREE(res->uri);
         SAFE_FREE(res->name);
+        SAFE_FREE(res->etag);
 
         newres = res->next;
         SAFE_FREE(res);
@@ -125,20 +133,34 @@ static void free_fetchCtx( struct listdir_context *ctx )
  * transmission.
  */
 struct transfer_context {
-  ne_request *req;            /* the neon request */
   int         fd;             /* file descriptor of the file to read or write from */
   const char  *method;        /* the HTTP method, either PUT or GET  */
   ne_decompress *decompress;  /* the decompress context */
   char        *url;
+  off_t       offset;         /* where a get or put starts, see owncloud_lseek */
+  int         range_error;    /* the server sent another range than asked for */
 };
 
-/* Struct with the WebDAV session */
+/*
+ * Struct with the WebDAV sessions. Every request runs on a session taken
+ * from the pool, so several threads can talk to the server at once. The
+ * sessions are created with the same connection parameters and share the
+ * credentials and the accepted SSL certificate.
+ */
 struct dav_session_s {
-    ne_session *ctx;
     char *user;
     char *pwd;
 
-    char *error_string;
+    char  protocol[6];
+    char *host;
+    unsigned int port;
+    int   useSSL;
+    char  ssl_digest[NE_SSL_DIGESTLEN]; /* digest of the accepted certificate */
+
+    ne_session **pool;   /* the idle sessions */
+    int idle;            /* number of idle sessions */
+    int count;           /* number of sessions, idle or in use */
+    int pool_size;       /* maximum number of sessions */
 };
 
 /* The list of properties that is fetched in PropFind on a collection */
@@ -146,6 +168,7 @@ static const ne_propname ls_props[] = {
     { "DAV:", "getlastmodified" },
     { "DAV:", "getcontentlength" },
     { "DAV:", "resourcetype" },
+    { "DAV:", "getetag" },
     { NULL, NULL }
 };
 
@@ -153,10 +176,39 @@ static const ne_propname ls_props[] = {
  * local variables.
  */
 
-struct dav_session_s dav_session; /* The DAV Session, initialised in dav_connect */
+/* The number of sessions, ie. connections to the server used at most */
+#define DEFAULT_SESSION_POOL_SIZE 4
+
+struct dav_session_s dav_session = { /* The DAV Session, initialised in dav_connect */
+    .pool_size = DEFAULT_SESSION_POOL_SIZE
+};
 int _connected;                   /* flag to indicate if a connection exists, ie.
                                      the dav_session is valid */
-csync_vio_file_stat_t _fs;
+
+/*
+ * _session_lock guards the session pool and the _lastDir cache.
+ * _auth_lock guards the credentials and the accepted certificate. It is
+ * held while the user is asked, so only one thread asks and the others
+ * use the answer. The session lock is never taken with it held.
+ */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t _session_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _session_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t _auth_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SESSION_LOCK() pthread_mutex_lock(&_session_lock)
+#define SESSION_UNLOCK() pthread_mutex_unlock(&_session_lock)
+#define AUTH_LOCK() pthread_mutex_lock(&_auth_lock)
+#define AUTH_UNLOCK() pthread_mutex_unlock(&_auth_lock)
+#else
+#define SESSION_LOCK()
+#define SESSION_UNLOCK()
+#define AUTH_LOCK()
+#define AUTH_UNLOCK()
+#endif
+
+/* the readdir 'cache' for stat and the last error belong to the calling thread */
+static CSYNC_THREAD csync_vio_file_stat_t _fs;
+static CSYNC_THREAD char _error_string[512];
 
 csync_auth_callback _authcb;
 csync_file_progress_callback    _file_progress_cb;
@@ -167,13 +219,20 @@ void *_userdata;
 
 char _buffer[PUT_BUFFER_SIZE];
 
+/* Files larger than the chunk size are uploaded in chunks, 0 disables it */
+#define DEFAULT_CHUNK_SIZE (10 * 1024 * 1024)
+/* How often the upload of one chunk is tried */
+#define CHUNK_ATTEMPTS 3
+
+int64_t _chunk_size = DEFAULT_CHUNK_SIZE;
+
 /* ***************************************************************************** */
 
 static void set_error_message( const char *msg )
 {
-    SAFE_FREE(dav_session.error_string);
+    _error_string[0] = '\0';
     if( msg )
-        dav_session.error_string = c_strdup(msg);
+        snprintf( _error_string, sizeof(_error_string), "%s", msg );
 }
 
 
@@ -239,8 +298,8 @@ static void set_errno_from_http_errcode( int err ) {
     errno = new_errno;
 }
 
-static int http_result_code_from_session() {
-    const char *p = ne_get_error( dav_session.ctx );
+static int http_result_code_from_session( ne_session *session ) {
+    const char *p = ne_get_error( session );
     char *q;
     int err;
 
@@ -253,8 +312,8 @@ static int http_result_code_from_session() {
     return err;
 }
 
-static void set_errno_from_session() {
-    int err = http_result_code_from_session();
+static void set_errno_from_session( ne_session *session ) {
+    int err = http_result_code_from_session( session );
 
     if( err == EIO || err == ERRNO_ERROR_STRING) {
         errno = err;
@@ -263,7 +322,7 @@ static void set_errno_from_session() {
     }
 }
 
-static void set_errno_from_neon_errcode( int neon_code ) {
+static void set_errno_from_neon_errcode( ne_session *session, int neon_code ) {
 
     if( neon_code != NE_OK ) {
         DEBUG_WEBDAV("Neon error code was %d", neon_code);
@@ -272,7 +331,7 @@ static void set_errno_from_neon_errcode( int neon_code ) {
     switch(neon_code) {
     case NE_OK:     /* Success, but still the possiblity of problems */
     case NE_ERROR:  /* Generic error; use ne_get_error(session) for message */
-        set_errno_from_session(); /* Something wrong with http communication */
+        set_errno_from_session( session ); /* Something wrong with http communication */
         break;
     case NE_LOOKUP:  /* Server or proxy hostname lookup failed */
         errno = ERRNO_LOOKUP_ERROR;
@@ -349,11 +408,22 @@ static int verify_sslcert(void *userdata, int failures,
 {
     char problem[LEN];
     char buf[NE_ABUFSIZ];
+    char digest[NE_SSL_DIGESTLEN];
     int ret = -1;
 
-    (void) cert;
     memset( problem, 0, LEN );
 
+    /* the other sessions of the pool don't ask again for the same certificate */
+    if( ne_ssl_cert_digest( cert, digest ) != 0 ) {
+        digest[0] = '\0';
+    }
+    AUTH_LOCK();
+    if( digest[0] != '\0' && c_streq( digest, dav_session.ssl_digest )) {
+        AUTH_UNLOCK();
+        DEBUG_WEBDAV("## VERIFY_SSL CERT: accepted before");
+        return 0;
+    }
+
     addSSLWarning( problem, "There are problems with the SSL certificate:\n", LEN );
     if( failures & NE_SSL_NOTYETVALID ) {
         addSSLWarning( problem, " * The certificate is not yet valid.\n", LEN );
@@ -385,8 +455,10 @@ static int verify_sslcert(void *userdata, int failures,
         (*_authcb) ( problem, buf, NE_ABUFSIZ-1, 1, 0, userdata );
         if( strcmp( buf, "yes" ) == 0 ) {
             ret = 0;
+            snprintf( dav_session.ssl_digest, NE_SSL_DIGESTLEN, "%s", digest );
         }
     }
+    AUTH_UNLOCK();
     DEBUG_WEBDAV("## VERIFY_SSL CERT: %d", ret  );
     return ret;
 }
@@ -406,6 +478,8 @@ static int ne_auth( void *userdata, const char *realm, int attempt,
     /* DEBUG_WEBDAV( "Authentication required %s, realm ); */
     if( username && password ) {
         DEBUG_WEBDAV( "Authentication required %s", username );
+        /* the entered credentials are kept for the other sessions of the pool */
+        AUTH_LOCK();
         if( dav_session.user ) {
             /* allow user without password */
             snprintf(username, NE_ABUFSIZ, "%s", dav_session.user);
@@ -415,17 +489,21 @@ static int ne_auth( void *userdata, const char *realm, int attempt,
             } else {
                 (*_authcb) ("Enter your password: ", buf, NE_ABUFSIZ-1, 0, 0, userdata );
                 snprintf(password, NE_ABUFSIZ, "%s", buf );
+                dav_session.pwd = c_strdup( buf );
             }
         } else if( _authcb != NULL ){
             /* call the csync callback */
             DEBUG_WEBDAV("Call the csync callback for %s", realm );
             (*_authcb) ("Enter your username: ", buf, NE_ABUFSIZ-1, 1, 0, userdata );
             snprintf(username, NE_ABUFSIZ, "%s", buf );
+            dav_session.user = c_strdup( buf );
             (*_authcb) ("Enter your password: ", buf, NE_ABUFSIZ-1, 0, 0, userdata );
             snprintf(password, NE_ABUFSIZ, "%s", buf );
+            dav_session.pwd = c_strdup( buf );
         } else {
             DEBUG_WEBDAV("I can not authenticate!");
         }
+        AUTH_UNLOCK();
     }
     return attempt;
 }
@@ -448,15 +526,15 @@ static void ne_notify_status_cb (void *userdata, ne_session_status status,
 
 /*
  * Connect to a DAV server
- * This function sets the flag _connected if the connection is established
- * and returns if the flag is set, so calling it frequently is save.
+ * This function parses the connection parameters the sessions of the pool
+ * are created with. It sets the flag _connected if the connection is
+ * established and returns if the flag is set, so calling it frequently is
+ * save. It is called with the session lock held.
  */
 static int dav_connect(const char *base_url) {
-    int timeout = 30;
     int useSSL = 0;
     int rc;
     char protocol[6];
-    char uaBuf[256];
     char *path = NULL;
     char *scheme = NULL;
     char *host = NULL;
@@ -466,7 +544,9 @@ static int dav_connect(const char *base_url) {
         return 0;
     }
 
+    AUTH_LOCK();
     rc = c_parse_uri( base_url, &scheme, &dav_session.user, &dav_session.pwd, &host, &port, &path );
+    AUTH_UNLOCK();
     if( rc < 0 ) {
         DEBUG_WEBDAV("Failed to parse uri %s", base_url );
         goto out;
@@ -502,30 +582,21 @@ static int dav_connect(const char *base_url) {
         goto out;
     }
 
-    dav_session.ctx = ne_session_create( protocol, host, port);
-
-    if (dav_session.ctx == NULL) {
-        DEBUG_WEBDAV("Session create with protocol %s failed", protocol );
-        rc = -1;
-        goto out;
-    }
-
-    ne_set_read_timeout(dav_session.ctx, timeout);
-    snprintf( uaBuf, sizeof(uaBuf), "csyncoC/%s",CSYNC_STRINGIFY( LIBCSYNC_VERSION ));
-    ne_set_useragent( dav_session.ctx, c_strdup( uaBuf ));
-    ne_set_server_auth(dav_session.ctx, ne_auth, 0 );
-
     if( useSSL ) {
         if (!ne_has_support(NE_FEATURE_SSL)) {
             DEBUG_WEBDAV("Error: SSL is not enabled.");
             rc = -1;
             goto out;
         }
-
-        ne_ssl_trust_default_ca( dav_session.ctx );
-        ne_ssl_set_verify( dav_session.ctx, verify_sslcert, 0 );
     }
 
+    strncpy( dav_session.protocol, protocol, 6 );
+    SAFE_FREE( dav_session.host );
+    dav_session.host = host;
+    host = NULL;
+    dav_session.port = port;
+    dav_session.useSSL = useSSL;
+
     _connected = 1;
     rc = 0;
 out:
@@ -536,6 +607,99 @@ out:
     return rc;
 }
 
+/*
+ * Creates a session to the server connected to with dav_connect.
+ */
+static ne_session *dav_session_new(void) {
+    int timeout = 30;
+    char uaBuf[256];
+    ne_session *session = NULL;
+
+    session = ne_session_create( dav_session.protocol, dav_session.host, dav_session.port );
+
+    if (session == NULL) {
+        DEBUG_WEBDAV("Session create with protocol %s failed", dav_session.protocol );
+        return NULL;
+    }
+
+    ne_set_read_timeout(session, timeout);
+    snprintf( uaBuf, sizeof(uaBuf), "csyncoC/%s",CSYNC_STRINGIFY( LIBCSYNC_VERSION ));
+    ne_set_useragent( session, uaBuf );
+    ne_set_server_auth(session, ne_auth, 0 );
+
+    if( dav_session.useSSL ) {
+        ne_ssl_trust_default_ca( session );
+        ne_ssl_set_verify( session, verify_sslcert, 0 );
+    }
+
+    return session;
+}
+
+/*
+ * Takes a session out of the pool to run requests on. A new session is
+ * created as long as the pool holds less than pool_size sessions, otherwise
+ * the caller waits until another thread puts its session back. Every
+ * session taken has to be handed back with dav_session_put.
+ */
+static ne_session *dav_session_get(const char *base_url) {
+    ne_session **pool = NULL;
+    ne_session *session = NULL;
+
+    SESSION_LOCK();
+    if (dav_connect(base_url) < 0) {
+        SESSION_UNLOCK();
+        errno = EINVAL;
+        return NULL;
+    }
+
+#ifdef HAVE_PTHREAD
+    while (dav_session.idle == 0 && dav_session.count >= dav_session.pool_size) {
+        pthread_cond_wait(&_session_cond, &_session_lock);
+    }
+#endif
+
+    if (dav_session.idle > 0) {
+        session = dav_session.pool[--dav_session.idle];
+    } else {
+        /* make room to put the new session back later */
+        pool = c_realloc( dav_session.pool, (dav_session.count + 1) * sizeof(ne_session *) );
+        if (pool != NULL) {
+            dav_session.pool = pool;
+            session = dav_session_new();
+        }
+        if (session != NULL) {
+            dav_session.count++;
+        } else {
+            errno = ENOMEM;
+        }
+    }
+    SESSION_UNLOCK();
+
+    return session;
+}
+
+/* Hands a session taken with dav_session_get back to the pool. */
+static void dav_session_put(ne_session *session) {
+    if (session == NULL) {
+        return;
+    }
+
+    SESSION_LOCK();
+    /* the pool got smaller in the meantime */
+    if (dav_session.count > dav_session.pool_size) {
+        dav_session.count--;
+        SESSION_UNLOCK();
+        ne_session_destroy( session );
+        return;
+    }
+
+    dav_session.pool[dav_session.idle++] = session;
+#ifdef HAVE_PTHREAD
+    pthread_cond_signal(&_session_cond);
+#endif
+    SESSION_UNLOCK();
+}
+
 /*
  * result parsing list.
  * This function is called to parse the result of the propfind request
@@ -551,6 +715,7 @@ static void results(void *userdata,
     struct resource *newres = 0;
     const char *clength, *modtime = NULL;
     const char *resourcetype = NULL;
+    const char *etag = NULL;
     const ne_status *status = NULL;
     char *path = ne_path_unescape( uri->path );
 
@@ -582,6 +747,7 @@ static void results(void *userdata,
     modtime      = ne_propset_value( set, &ls_props[0] );
     clength      = ne_propset_value( set, &ls_props[1] );
     resourcetype = ne_propset_value( set, &ls_props[2] );
+    etag         = ne_propset_value( set, &ls_props[3] );
 
     newres->type = resr_normal;
     if( clength == NULL && resourcetype && strncmp( resourcetype, "<DAV:collection>", 16 ) == 0) {
@@ -591,6 +757,9 @@ static void results(void *userdata,
     if (modtime)
         newres->modtime = ne_httpdate_parse(modtime);
 
+    if (etag)
+        newres->etag = c_strdup(etag);
+
     if (clength) {
         char *p;
 
@@ -611,7 +780,8 @@ static void results(void *userdata,
  * fetches a resource list from the WebDAV server. This is equivalent to list dir.
  */
 
-static int fetch_resource_list( const char *uri,
+static int fetch_resource_list( ne_session *session,
+                                const char *uri,
                                 int depth,
                                 struct listdir_context *fetchCtx )
 {
@@ -634,7 +804,7 @@ static int fetch_resource_list( const char *uri,
   fetchCtx->currResource = NULL;
 
   /* do a propfind request and parse the results in the results function, set as callback */
-  hdl = ne_propfind_create(dav_session.ctx, curi, depth);
+  hdl = ne_propfind_create(session, curi, depth);
 
   if(hdl) {
     ret = ne_propfind_named(hdl, ls_props, results, fetchCtx);
@@ -657,7 +827,7 @@ static int fetch_resource_list( const char *uri,
     if( ret == NE_ERROR && req_status->code == 404) {
       errno = ENOENT;
     } else {
-      set_errno_from_neon_errcode(ret);
+      set_errno_from_neon_errcode(session, ret);
     }
   }
 
@@ -678,7 +848,7 @@ static int fetch_resource_list( const char *uri,
   }
 #ifndef NDEBUG
   if( ret != NE_OK ) {
-    const char *err = ne_get_error(dav_session.ctx);
+    const char *err = ne_get_error(session);
     DEBUG_WEBDAV("WRN: propfind named failed with %d, request error: %s", ret, err ? err : "<nil>");
   }
 #endif /* NDEBUG */
@@ -689,7 +859,7 @@ static int fetch_resource_list( const char *uri,
 
 #ifndef NDEBUG
   if (ret == NE_REDIRECT) {
-    const ne_uri *redir_ne_uri = ne_redirect_location(dav_session.ctx);
+    const ne_uri *redir_ne_uri = ne_redirect_location(session);
     if (redir_ne_uri) {
       char *redir_uri = ne_uri_unparse(redir_ne_uri);
       DEBUG_WEBDAV("Permanently moved to %s", redir_uri);
@@ -705,6 +875,26 @@ static int fetch_resource_list( const char *uri,
   return 0;
 }
 
+/* WebDAV does not deliver permissions. Set a default here. */
+static int _stat_perms( int type ) {
+    int ret = 0;
+
+    if( type == CSYNC_VIO_FILE_TYPE_DIRECTORY ) {
+        /* DEBUG_WEBDAV("Setting mode in stat (dir)); */
+        /* directory permissions */
+        ret = S_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR /* directory, rwx for user */
+                | S_IRGRP | S_IXGRP                       /* rx for group */
+                | S_IROTH | S_IXOTH;                      /* rx for others */
+    } else {
+        /* regualar file permissions */
+        /* DEBUG_WEBDAV("Setting mode in stat (file)); */
+        ret = S_IFREG | S_IRUSR | S_IWUSR /* regular file, user read & write */
+                | S_IRGRP                         /* group read perm */
+                | S_IROTH;                        /* others read perm */
+    }
+    return ret;
+}
+
 /*
  * helper: convert a resource struct to file_stat struct.
  */
@@ -738,28 +928,15 @@ static csync_vio_file_stat_t *resourceToFileStat( struct resource *res )
     lfs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
     lfs->size  = res->size;
     lfs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+    lfs->mode  = _stat_perms( lfs->type );
+    lfs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
 
-    return lfs;
-}
-
-/* WebDAV does not deliver permissions. Set a default here. */
-static int _stat_perms( int type ) {
-    int ret = 0;
-
-    if( type == CSYNC_VIO_FILE_TYPE_DIRECTORY ) {
-        /* DEBUG_WEBDAV("Setting mode in stat (dir)); */
-        /* directory permissions */
-        ret = S_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR /* directory, rwx for user */
-                | S_IRGRP | S_IXGRP                       /* rx for group */
-                | S_IROTH | S_IXOTH;                      /* rx for others */
-    } else {
-        /* regualar file permissions */
-        /* DEBUG_WEBDAV("Setting mode in stat (file)); */
-        ret = S_IFREG | S_IRUSR | S_IWUSR /* regular file, user read & write */
-                | S_IRGRP                         /* group read perm */
-                | S_IROTH;                        /* others read perm */
+    if( res->etag ) {
+        lfs->etag = c_strdup( res->etag );
+        lfs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
     }
-    return ret;
+
+    return lfs;
 }
 
 /*
@@ -772,6 +949,7 @@ static int owncloud_stat(const char *uri, csync_vio_file_stat_t *buf) {
      *   size
      */
     int rc = 0;
+    ne_session *session = NULL;
     csync_vio_file_stat_t *lfs = NULL;
     struct listdir_context  *fetchCtx = NULL;
     char *curi = NULL;
@@ -805,6 +983,9 @@ static int owncloud_stat(const char *uri, csync_vio_file_stat_t *buf) {
         buf->mtime  = _fs.mtime;
         buf->size   = _fs.size;
         buf->mode   = _stat_perms( _fs.type );
+        if( _fs.fields & CSYNC_VIO_FILE_STAT_FIELDS_ETAG ) {
+            buf->etag = c_strdup( _fs.etag );
+        }
     } else {
         /* fetch data via a propfind call. */
         fetchCtx = c_malloc( sizeof( struct listdir_context ));
@@ -827,15 +1008,24 @@ static int owncloud_stat(const char *uri, csync_vio_file_stat_t *buf) {
         fetchCtx->include_target = 1;
         fetchCtx->currResource = NULL;
 
-        rc = fetch_resource_list( curi, NE_DEPTH_ONE, fetchCtx );
+        session = dav_session_get( uri );
+        if( ! session ) {
+            SAFE_FREE(curi);
+            SAFE_FREE(fetchCtx);
+            return -1;
+        }
+
+        rc = fetch_resource_list( session, curi, NE_DEPTH_ONE, fetchCtx );
         if( rc != NE_OK ) {
           if( errno != ENOENT ) {
-            set_errno_from_session();
+            set_errno_from_session( session );
           }
+          dav_session_put( session );
           DEBUG_WEBDAV("stat fails with errno %d", errno );
 
           return -1;
         }
+        dav_session_put( session );
 
         if( fetchCtx ) {
             struct resource *res = fetchCtx->list;
@@ -868,6 +1058,9 @@ static int owncloud_stat(const char *uri, csync_vio_file_stat_t *buf) {
                 buf->mtime  = lfs->mtime;
                 buf->size   = lfs->size;
                 buf->mode   = _stat_perms( lfs->type );
+                /* hand the etag over */
+                buf->etag   = lfs->etag;
+                lfs->etag   = NULL;
 
                 csync_vio_file_stat_destroy( lfs );
             }
@@ -886,6 +1079,8 @@ static int owncloud_stat(const char *uri, csync_vio_file_stat_t *buf) {
 static ssize_t owncloud_write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
 
   struct transfer_context *writeCtx;
+  ne_session *session = NULL;
+  ne_request *req = NULL;
   int rc = 0;
   int neon_stat;
   const ne_status *status;
@@ -894,16 +1089,23 @@ static ssize_t owncloud_write(csync_vio_method_handle_t *fhandle, const void *bu
 
   if (fhandle == NULL) {
       errno = EBADF;
-      rc = -1;
+      return -1;
+  }
+
+  /* the handle was opened, so the server is connected already */
+  session = dav_session_get( NULL );
+  if( session == NULL ) {
+      return -1;
   }
+  req = ne_request_create( session, "PUT", writeCtx->url );
 
-  ne_set_request_body_buffer(writeCtx->req, buf, count );
+  ne_set_request_body_buffer(req, buf, count );
 
   /* Start the request. */
-  neon_stat = ne_request_dispatch( writeCtx->req );
-  set_errno_from_neon_errcode( neon_stat );
+  neon_stat = ne_request_dispatch( req );
+  set_errno_from_neon_errcode( session, neon_stat );
 
-  status = ne_get_status( writeCtx->req );
+  status = ne_get_status( req );
   if( status->klass != 2 ) {
     DEBUG_WEBDAV("sendfile request failed with http status %d!", status->code);
     set_errno_from_http_errcode( status->code );
@@ -919,6 +1121,8 @@ static ssize_t owncloud_write(csync_vio_method_handle_t *fhandle, const void *bu
   } else {
     DEBUG_WEBDAV("write request all ok, result code %d", status->code);
   }
+  ne_request_destroy( req );
+  dav_session_put( session );
 
   return rc;
 }
@@ -967,12 +1171,32 @@ static void install_content_reader( ne_request *req, void *userdata, const ne_st
     const char *enc = NULL;
     struct transfer_context *writeCtx = userdata;
 
-    (void) status;
     if( !writeCtx ) {
         DEBUG_WEBDAV("Error: install_content_reader called without valid write context!");
         return;
     }
 
+    /* a ranged get is answered with the rest or, if the file changed, all of it */
+    if( writeCtx->offset > 0 && status && status->code == 206 ) {
+        const char *range = ne_get_response_header( req, "Content-Range" );
+        long long start = -1;
+
+        if( range == NULL || sscanf( range, "bytes %lld-", &start ) != 1 ||
+            start != (long long) writeCtx->offset ) {
+            DEBUG_WEBDAV("Got the range <%s> instead of %lld-", range ? range : "empty",
+                         (long long) writeCtx->offset );
+            writeCtx->range_error = 1;
+            return;
+        }
+    } else if( writeCtx->offset > 0 && status && status->code == 200 ) {
+        DEBUG_WEBDAV("The file changed, getting it from the start");
+        if( ftruncate( writeCtx->fd, 0 ) < 0 || lseek( writeCtx->fd, 0, SEEK_SET ) != 0 ) {
+            writeCtx->range_error = 1;
+            return;
+        }
+        writeCtx->offset = 0;
+    }
+
     enc = ne_get_response_header( req, "Content-Encoding" );
     if( status && status->code != 200 ) {
       DEBUG_WEBDAV("Content encoding ist <%s> with status %d", enc ? enc : "empty",
@@ -997,12 +1221,18 @@ static char*_lastDir = NULL;
  *  bool atomar_copy_support
  *  bool put_support
  *  bool get_support
+ *  bool readdir_stat_support
+ *  bool concurrent_session_support
  */
 
 static struct csync_vio_capabilities_s _owncloud_capabilities = {
     .atomar_copy_support = true,
     .get_support = true,
     .put_support = true,
+    .readdir_stat_support = true,
+#ifdef HAVE_PTHREAD
+    .concurrent_session_support = true,
+#endif
 };
 
 static csync_vio_capabilities_t *owncloud_get_capabilities(void)
@@ -1014,8 +1244,8 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
                                                 int flags,
                                                 mode_t mode) {
     char *dir = NULL;
-    char getUrl[PATH_MAX];
     int put = 0;
+    int known = 0;
     int rc = NE_OK;
 #ifdef _WIN32
     int gtp = 0;
@@ -1028,13 +1258,17 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
 
     struct transfer_context *writeCtx = NULL;
     csync_stat_t statBuf;
-    memset( getUrl, '\0', PATH_MAX );
 
     (void) mode; /* unused on webdav server */
     DEBUG_WEBDAV( "=> open called for %s", durl );
 
-    if( rc == NE_OK )
-        dav_connect( durl );
+    /* the requests are sent with a session of the pool in put, get and write */
+    SESSION_LOCK();
+    if( dav_connect( durl ) < 0 ) {
+        errno = EINVAL;
+        rc = NE_ERROR;
+    }
+    SESSION_UNLOCK();
 
     if (flags & O_WRONLY) {
         put = 1;
@@ -1054,13 +1288,18 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
         return NULL;
       }
       DEBUG_WEBDAV("Stating directory %s", dir );
-      if( c_streq( dir, _lastDir )) {
+      SESSION_LOCK();
+      known = c_streq( dir, _lastDir );
+      SESSION_UNLOCK();
+      if( known ) {
         DEBUG_WEBDAV("Dir %s is there, we know it already.", dir);
       } else {
         if( owncloud_stat( dir, (csync_vio_method_handle_t*)(&statBuf) ) == 0 ) {
           DEBUG_WEBDAV("Directory of file to open exists.");
+          SESSION_LOCK();
           SAFE_FREE( _lastDir );
           _lastDir = c_strdup(dir);
+          SESSION_UNLOCK();
 
         } else {
           DEBUG_WEBDAV("Directory %s of file to open does NOT exist.", dir );
@@ -1072,6 +1311,11 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
       }
     }
 
+    if( rc != NE_OK ) {
+        SAFE_FREE( dir );
+        return NULL;
+    }
+
     writeCtx = c_malloc( sizeof(struct transfer_context) );
 
     writeCtx->url = _cleanPath( durl );
@@ -1083,24 +1327,14 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
 
     if( rc == NE_OK && put) {
         DEBUG_WEBDAV("PUT request on %s!", writeCtx->url);
-        writeCtx->req = ne_request_create(dav_session.ctx, "PUT", writeCtx->url);
         writeCtx->method = "PUT";
     }
 
     if( rc == NE_OK && ! put ) {
-        writeCtx->req = 0;
         writeCtx->method = "GET";
 
-        /* the download via the get function requires a full uri */
-        snprintf( getUrl, PATH_MAX, "%s://%s%s", ne_get_scheme( dav_session.ctx),
-                  ne_get_server_hostport( dav_session.ctx ), writeCtx->url );
-        DEBUG_WEBDAV("GET request on %s", getUrl );
-
-        writeCtx->req = ne_request_create( dav_session.ctx, "GET", getUrl );
-
         /* Call the progress callback */
         if (_file_progress_cb) {
-            ne_set_notifier(dav_session.ctx, ne_notify_status_cb, writeCtx);
             _file_progress_cb( writeCtx->url, CSYNC_NOTIFY_START_DOWNLOAD, 0 , 0, _userdata);
         }
     }
@@ -1125,6 +1359,177 @@ static csync_vio_method_handle_t *owncloud_creat(const char *durl, mode_t mode)
     return handle;
 }
 
+/*
+ * Uploads one chunk of a chunked upload. Returns 0 on success, 1 if the
+ * server refused the chunk and -1 if it could be retried.
+ */
+static int put_chunk( ne_session *session, const char *url, int fd,
+                      off_t offset, off_t length ) {
+    ne_request *req = NULL;
+    const ne_status *status;
+    int neon_stat;
+    int rc = 0;
+
+    req = ne_request_create( session, "PUT", url );
+    ne_add_request_header( req, "OC-Chunked", "1" );
+    ne_set_request_body_fd( req, fd, offset, length );
+
+    neon_stat = ne_request_dispatch( req );
+    set_errno_from_neon_errcode( session, neon_stat );
+
+    if( neon_stat != NE_OK ) {
+        /* the connection broke, neon reconnects with the next request */
+        DEBUG_WEBDAV("Chunk upload failed: Neon: %d, errno %d", neon_stat, errno);
+        rc = -1;
+    } else {
+        status = ne_get_status( req );
+        if( status->klass != 2 ) {
+            DEBUG_WEBDAV("Chunk upload failed with http status %d!", status->code);
+            set_errno_from_http_errcode( status->code );
+            /* the server errors might be gone with the next attempt */
+            rc = status->klass == 5 ? -1 : 1;
+        }
+    }
+    ne_request_destroy( req );
+
+    return rc;
+}
+
+/*
+ * Creates the id the chunks of one upload are named with. It has to be
+ * unique over all clients uploading to the server, otherwise the server
+ * mixes up the chunks of different uploads.
+ */
+static unsigned int chunk_transfer_id( void ) {
+    unsigned int id = 0;
+    ssize_t n = -1;
+    int fd;
+
+    fd = open( "/dev/urandom", O_RDONLY );
+    if( fd != -1 ) {
+        n = read( fd, &id, sizeof(id) );
+        close( fd );
+    }
+    if( n != sizeof(id) ) {
+        /* no random device, e.g. on Windows */
+        DEBUG_WEBDAV("Could not read /dev/urandom, using rand()");
+        id = ((unsigned int) rand() << 16) ^ (unsigned int) rand() ^ (unsigned int) time(NULL);
+    }
+
+    return id;
+}
+
+/*
+ * Deletes the chunks 0 to last of an upload which failed, the server
+ * would keep them until its chunk cache expires otherwise.
+ */
+static void delete_chunks( ne_session *session, const char *url,
+                           unsigned int transfer_id, off_t chunk_count,
+                           off_t last ) {
+    char *chunk_url = NULL;
+    off_t chunk;
+    int neon_stat;
+
+    for( chunk = 0; chunk <= last; chunk++ ) {
+        if( asprintf( &chunk_url, "%s-chunking-%u-%lld-%lld", url, transfer_id,
+                      (long long) chunk_count, (long long) chunk ) < 0 ) {
+            return;
+        }
+        neon_stat = ne_delete( session, chunk_url );
+        DEBUG_WEBDAV("DELETE chunk %s: %d", chunk_url, neon_stat );
+        SAFE_FREE( chunk_url );
+    }
+}
+
+/*
+ * Puts a file in chunks of _chunk_size, each with its own request. The
+ * chunks are named <url>-chunking-<transfer id>-<count>-<index> and the
+ * server assembles the file after it got the last one. A failed chunk is
+ * uploaded again, not the whole file.
+ *
+ * If the server refuses a chunk, the chunks already uploaded are deleted. If
+ * the connection fails, they are kept: the offset of the handle is left
+ * after the last chunk the server has and vfs->etag is set to the transfer
+ * id and the chunk size. Given these again, the upload continues with the
+ * next chunk.
+ */
+static int owncloud_put_chunked( ne_session *session,
+                                 struct transfer_context *write_ctx, int fd,
+                                 const csync_stat_t *sb,
+                                 csync_vio_file_stat_t *vfs ) {
+    char *chunk_url = NULL;
+    unsigned int transfer_id;
+    long long chunk_size = 0;
+    off_t chunk_count;
+    off_t chunk = 0;
+    off_t offset;
+    off_t length;
+    int attempt;
+    int err;
+    int rc = 0;
+
+    chunk_count = (sb->st_size + _chunk_size - 1) / _chunk_size;
+
+    /* the chunks of an interrupted upload are only found with the same names */
+    if( write_ctx->offset > 0 && vfs->etag != NULL &&
+        sscanf( vfs->etag, "%u-%lld", &transfer_id, &chunk_size ) == 2 &&
+        chunk_size == _chunk_size && write_ctx->offset % _chunk_size == 0 &&
+        write_ctx->offset < sb->st_size ) {
+        chunk = write_ctx->offset / _chunk_size;
+        DEBUG_WEBDAV("Continuing upload %u with chunk %lld", transfer_id,
+                     (long long) chunk + 1 );
+    } else {
+        transfer_id = chunk_transfer_id();
+        write_ctx->offset = 0;
+    }
+
+    SAFE_FREE( vfs->etag );
+    if( asprintf( &vfs->etag, "%u-%lld", transfer_id, (long long) _chunk_size ) < 0 ) {
+        vfs->etag = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for( ; chunk < chunk_count && rc == 0; chunk++ ) {
+        offset = chunk * _chunk_size;
+        length = sb->st_size - offset < _chunk_size ? sb->st_size - offset : _chunk_size;
+
+        if( asprintf( &chunk_url, "%s-chunking-%u-%lld-%lld", write_ctx->url,
+                      transfer_id, (long long) chunk_count, (long long) chunk ) < 0 ) {
+            errno = ENOMEM;
+            return -1;
+        }
+        DEBUG_WEBDAV("PUT chunk %lld of %lld: %s", (long long) chunk + 1,
+                     (long long) chunk_count, chunk_url );
+
+        rc = -1;
+        for( attempt = 0; attempt < CHUNK_ATTEMPTS && rc < 0; attempt++ ) {
+            rc = put_chunk( session, chunk_url, fd, offset, length );
+        }
+        SAFE_FREE( chunk_url );
+
+        if( rc == 0 ) {
+            write_ctx->offset = offset + length;
+            if( _file_progress_cb ) {
+                _file_progress_cb( write_ctx->url, CSYNC_NOTIFY_PROGRESS,
+                                   offset + length, sb->st_size, _userdata );
+            }
+        }
+    }
+
+    if( rc > 0 ) {
+        err = errno;
+        /* the failed chunk might have arrived although the answer did not */
+        delete_chunks( session, write_ctx->url, transfer_id, chunk_count, chunk - 1 );
+        write_ctx->offset = 0;
+        SAFE_FREE( vfs->etag );
+        errno = err;
+    }
+
+    /* individual file errors don't abort the sync */
+    return rc == 0 ? 0 : 1;
+}
+
 /*
  * Puts a file read from the open file descriptor to the ownCloud URL.
 */
@@ -1137,6 +1542,7 @@ static int owncloud_put(csync_vio_method_handle_t *flocal,
   csync_stat_t sb;
   struct transfer_context *write_ctx = (struct transfer_context*) fremote;
   int fd;
+  ne_session *session = NULL;
   ne_request *request = NULL;
 
   fd = csync_vio_getfd(flocal);
@@ -1149,9 +1555,8 @@ static int owncloud_put(csync_vio_method_handle_t *flocal,
       errno = EINVAL;
       return -1;
   }
-  request = write_ctx->req;
 
-  if( request == NULL) {
+  if( ! c_streq( write_ctx->method, "PUT" )) {
     errno = EINVAL;
     return -1;
   }
@@ -1161,14 +1566,29 @@ static int owncloud_put(csync_vio_method_handle_t *flocal,
     if( sb.st_size != vfs->size ) {
       DEBUG_WEBDAV("WRN: Stat size differs from vfs size!");
     }
+
+    session = dav_session_get( NULL );
+    if( session == NULL ) {
+      return -1;
+    }
+    if( _chunk_size > 0 && sb.st_size > _chunk_size ) {
+      rc = owncloud_put_chunked( session, write_ctx, fd, &sb, vfs );
+      dav_session_put( session );
+      return rc;
+    }
+    /* a single request can't be continued */
+    write_ctx->offset = 0;
+    SAFE_FREE( vfs->etag );
+    request = ne_request_create( session, "PUT", write_ctx->url );
+
     /* Attach the request to the file descriptor */
     ne_set_request_body_fd(request, fd, 0, sb.st_size);
     DEBUG_WEBDAV("Put file size: %lld, variable sizeof: %ld", (long long int) sb.st_size,
                  sizeof(sb.st_size));
 
     /* Start the request. */
-    neon_stat = ne_request_dispatch( write_ctx->req );
-    set_errno_from_neon_errcode( neon_stat );
+    neon_stat = ne_request_dispatch( request );
+    set_errno_from_neon_errcode( session, neon_stat );
 
     status = ne_get_status( request );
     if( status->klass != 2 ) {
@@ -1186,6 +1606,8 @@ static int owncloud_put(csync_vio_method_handle_t *flocal,
     } else {
       DEBUG_WEBDAV("http request all cool, result code %d", status->code);
     }
+    ne_request_destroy( request );
+    dav_session_put( session );
   } else {
     DEBUG_WEBDAV("Could not stat file descriptor");
     rc = 1;
@@ -1194,7 +1616,15 @@ static int owncloud_put(csync_vio_method_handle_t *flocal,
   return rc;
 }
 
-/* Gets a file from the owncloud url to the open file descriptor. */
+/*
+ * Gets a file from the owncloud url to the open file descriptor.
+ *
+ * If the offset of the handle is set, the file descriptor already holds
+ * that much of the file, and vfs->etag has the ETag it was got with. Only
+ * the rest is asked for, unless the file changed on the server since. Then,
+ * or without an ETag, the file is got from the start. After the request,
+ * vfs->etag is the ETag of what the file descriptor holds.
+ */
 static int owncloud_get(csync_vio_method_handle_t *flocal,
                         csync_vio_method_handle_t *fremote,
                         csync_vio_file_stat_t *vfs) {
@@ -1202,9 +1632,13 @@ static int owncloud_get(csync_vio_method_handle_t *flocal,
   int neon_stat;
   const ne_status *status;
   int fd;
+  char getUrl[PATH_MAX];
+  char range[64];
+  const char *etag;
+  ne_session *session = NULL;
+  ne_request *req = NULL;
 
   struct transfer_context *write_ctx = (struct transfer_context*) fremote;
-  (void) vfs; /* stat information of the source file */
 
   fd = csync_vio_getfd(flocal);
   if (fd == -1) {
@@ -1218,7 +1652,7 @@ static int owncloud_get(csync_vio_method_handle_t *flocal,
     return -1;
   }
 
-  if( write_ctx->req == NULL ) {
+  if( ! c_streq( write_ctx->method, "GET" )) {
     errno = EINVAL;
     return -1;
   }
@@ -1226,26 +1660,59 @@ static int owncloud_get(csync_vio_method_handle_t *flocal,
   DEBUG_WEBDAV("  -- GET on %s", write_ctx->url);
 
   write_ctx->fd = fd;
+  write_ctx->range_error = 0;
+
+  if( write_ctx->offset > 0 && vfs->etag == NULL ) {
+    if( ftruncate( fd, 0 ) < 0 || lseek( fd, 0, SEEK_SET ) != 0 ) {
+      return -1;
+    }
+    write_ctx->offset = 0;
+  }
+
+  session = dav_session_get( NULL );
+  if( session == NULL ) {
+    return -1;
+  }
+
+  /* the download via the get function requires a full uri */
+  snprintf( getUrl, PATH_MAX, "%s://%s%s", ne_get_scheme( session ),
+            ne_get_server_hostport( session ), write_ctx->url );
+  DEBUG_WEBDAV("GET request on %s", getUrl );
+
+  req = ne_request_create( session, "GET", getUrl );
+
+  /* Call the progress callback */
+  if (_file_progress_cb) {
+    ne_set_notifier(session, ne_notify_status_cb, write_ctx);
+  }
 
-  /* Allow compressed content by setting the header */
-  ne_add_request_header( write_ctx->req, "Accept-Encoding", "gzip,deflate" );
+  if( write_ctx->offset > 0 ) {
+    /* the range is of the uncompressed file, so don't ask for compression */
+    DEBUG_WEBDAV("Continuing GET at %lld", (long long) write_ctx->offset );
+    snprintf( range, sizeof(range), "bytes=%lld-", (long long) write_ctx->offset );
+    ne_add_request_header( req, "Range", range );
+    ne_add_request_header( req, "If-Range", vfs->etag );
+  } else {
+    /* Allow compressed content by setting the header */
+    ne_add_request_header( req, "Accept-Encoding", "gzip,deflate" );
+  }
 
   /* hook called before the content is parsed to set the correct reader,
          * either the compressed- or uncompressed reader.
          */
-  ne_hook_post_headers( dav_session.ctx, install_content_reader, write_ctx );
+  ne_hook_post_headers( session, install_content_reader, write_ctx );
 
-  neon_stat = ne_request_dispatch(write_ctx->req );
+  neon_stat = ne_request_dispatch( req );
   /* possible return codes are:
    *  NE_OK, NE_AUTH, NE_CONNECT, NE_TIMEOUT, NE_ERROR (from ne_request.h)
    */
 
   if( neon_stat != NE_OK ) {
-    set_errno_from_neon_errcode(neon_stat);
+    set_errno_from_neon_errcode(session, neon_stat);
     DEBUG_WEBDAV("Error GET: Neon: %d, errno %d", neon_stat, errno);
     rc = -1;
   } else {
-    status = ne_get_status( write_ctx->req );
+    status = ne_get_status( req );
     if( status->klass != 2 ) {
       DEBUG_WEBDAV("sendfile request failed with http status %d!", status->code);
       set_errno_from_http_errcode( status->code );
@@ -1258,19 +1725,35 @@ static int owncloud_get(csync_vio_method_handle_t *flocal,
       } else {
         rc = 1;
       }
+    } else if( write_ctx->range_error ) {
+      errno = EIO;
+      rc = 1;
     } else {
       DEBUG_WEBDAV("http request all cool, result code %d (%s)", status->code,
                    status->reason_phrase ? status->reason_phrase : "<empty>");
     }
   }
 
+  /* a weak ETag can't be continued with */
+  etag = ne_get_response_header( req, "ETag" );
+  SAFE_FREE( vfs->etag );
+  if( etag != NULL && strncmp( etag, "W/", 2 ) != 0 && !write_ctx->range_error ) {
+    vfs->etag = c_strdup( etag );
+  }
+
   /* delete the hook again, otherwise they get chained as they are with the session */
-  ne_unhook_post_headers( dav_session.ctx, install_content_reader, write_ctx );
+  ne_unhook_post_headers( session, install_content_reader, write_ctx );
+  if (_file_progress_cb) {
+    ne_set_notifier(session, 0, 0);
+  }
 
   /* if the compression handle is set through the post_header hook, delete it. */
   if( write_ctx->decompress ) {
     ne_decompress_destroy( write_ctx->decompress );
+    write_ctx->decompress = NULL;
   }
+  ne_request_destroy( req );
+  dav_session_put( session );
 
   return rc;
 }
@@ -1290,8 +1773,7 @@ static int owncloud_close(csync_vio_method_handle_t *fhandle) {
     /* handle the PUT request */
     if( ret != -1 && strcmp( writeCtx->method, "PUT" ) == 0 ) {
       notify_tag = CSYNC_NOTIFY_FINISHED_UPLOAD;
-      ne_request_destroy( writeCtx->req );
-      _fs.name = NULL;
+      SAFE_FREE( _fs.name );
     } else  {
       /* Its a GET request. */
       notify_tag = CSYNC_NOTIFY_FINISHED_DOWNLOAD;
@@ -1299,11 +1781,10 @@ static int owncloud_close(csync_vio_method_handle_t *fhandle) {
 
     /* Finish callback */
     if (_file_progress_cb) {
-        ne_set_notifier(dav_session.ctx, 0, 0);
         _file_progress_cb(writeCtx->url, notify_tag, 0, 0, _userdata );
     }
 
-    /* free mem. Note that the request mem is freed by the ne_request_destroy call */
+    /* free mem. The requests are destroyed with the put, get and write calls */
     SAFE_FREE( writeCtx->url );
     SAFE_FREE( writeCtx );
 
@@ -1320,12 +1801,36 @@ static ssize_t owncloud_read(csync_vio_method_handle_t *fhandle, void *buf, size
   return 0;
 }
 
+/*
+ * There is no file position on the server. The offset is where the next get
+ * or put starts, and a put leaves it after the part the server has.
+ */
 static off_t owncloud_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
-    (void) fhandle;
-    (void) offset;
-    (void) whence;
+    struct transfer_context *writeCtx = (struct transfer_context*) fhandle;
 
-    return -1;
+    if( writeCtx == NULL ) {
+        errno = EBADF;
+        return -1;
+    }
+
+    switch( whence ) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += writeCtx->offset;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    if( offset < 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+    writeCtx->offset = offset;
+
+    return offset;
 }
 
 /*
@@ -1333,6 +1838,7 @@ static off_t owncloud_lseek(csync_vio_method_handle_t *fhandle, off_t offset, in
  */
 static csync_vio_method_handle_t *owncloud_opendir(const char *uri) {
     int rc;
+    ne_session *session = NULL;
     struct listdir_context *fetchCtx = NULL;
     struct resource *reslist = NULL;
     char *curi = _cleanPath( uri );
@@ -1345,7 +1851,11 @@ static csync_vio_method_handle_t *owncloud_opendir(const char *uri) {
         return NULL;
     }
 
-    dav_connect( uri );
+    session = dav_session_get( uri );
+    if( ! session ) {
+        SAFE_FREE( curi );
+        return NULL;
+    }
 
     fetchCtx = c_malloc( sizeof( struct listdir_context ));
 
@@ -1354,11 +1864,13 @@ static csync_vio_method_handle_t *owncloud_opendir(const char *uri) {
     fetchCtx->include_target = 0;
     fetchCtx->currResource = NULL;
 
-    rc = fetch_resource_list( curi, NE_DEPTH_ONE, fetchCtx );
+    rc = fetch_resource_list( session, curi, NE_DEPTH_ONE, fetchCtx );
     if( rc != NE_OK ) {
-        set_errno_from_session();
+        set_errno_from_session( session );
+        dav_session_put( session );
         return NULL;
     } else {
+        dav_session_put( session );
         fetchCtx->currResource = fetchCtx->list;
         DEBUG_WEBDAV("opendir returning handle %p", (void*) fetchCtx );
         return fetchCtx;
@@ -1378,12 +1890,17 @@ static int owncloud_closedir(csync_vio_method_handle_t *dhandle) {
         rnext = r->next;
         SAFE_FREE(r->uri);
         SAFE_FREE(r->name);
+        SAFE_FREE(r->etag);
         SAFE_FREE(r);
         r = rnext;
     }
     SAFE_FREE( fetchCtx->target );
 
     SAFE_FREE( dhandle );
+
+    /* the stat 'cache' of this thread is only valid while listing */
+    SAFE_FREE( _fs.name );
+    SAFE_FREE( _fs.etag );
     return 0;
 }
 
@@ -1405,11 +1922,17 @@ static csync_vio_file_stat_t *owncloud_readdir(csync_vio_method_handle_t *dhandl
         fetchCtx->currResource = fetchCtx->currResource->next;
 
         /* fill the static stat buf as input for the stat function */
-        _fs.name   = lfs->name;
+        /* the caller frees lfs, keep a copy of the name */
+        SAFE_FREE( _fs.name );
+        _fs.name   = c_strdup( lfs->name );
         _fs.mtime  = lfs->mtime;
         _fs.fields = lfs->fields;
         _fs.type   = lfs->type;
         _fs.size   = lfs->size;
+        SAFE_FREE( _fs.etag );
+        if( lfs->fields & CSYNC_VIO_FILE_STAT_FIELDS_ETAG ) {
+            _fs.etag = c_strdup( lfs->etag );
+        }
     }
 
     // DEBUG_WEBDAV("LFS fields: %s: %d, lfs->name, lfs->type );
@@ -1418,6 +1941,7 @@ static csync_vio_file_stat_t *owncloud_readdir(csync_vio_method_handle_t *dhandl
 
 static int owncloud_mkdir(const char *uri, mode_t mode) {
     int rc = NE_OK;
+    ne_session *session = NULL;
     char buf[PATH_MAX +1];
     int len = 0;
 
@@ -1428,9 +1952,9 @@ static int owncloud_mkdir(const char *uri, mode_t mode) {
         errno = EINVAL;
         rc = -1;
     }
-    rc = dav_connect(uri);
-    if (rc < 0) {
-        errno = EINVAL;
+    session = dav_session_get(uri);
+    if (session == NULL) {
+        rc = -1;
     }
 
     /* the uri path is required to have a trailing slash */
@@ -1443,11 +1967,12 @@ static int owncloud_mkdir(const char *uri, mode_t mode) {
       }
 
       DEBUG_WEBDAV("MKdir on %s", buf );
-      rc = ne_mkcol(dav_session.ctx, buf );
+      rc = ne_mkcol(session, buf );
       if (rc != NE_OK ) {
-          set_errno_from_session();
+          set_errno_from_session( session );
       }
     }
+    dav_session_put( session );
     SAFE_FREE( path );
 
     if( rc < 0 || rc != NE_OK ) {
@@ -1458,6 +1983,7 @@ static int owncloud_mkdir(const char *uri, mode_t mode) {
 
 static int owncloud_rmdir(const char *uri) {
     int rc = NE_OK;
+    ne_session *session = NULL;
     char* curi = _cleanPath( uri );
 
     if ( ! curi) {
@@ -1466,17 +1992,18 @@ static int owncloud_rmdir(const char *uri) {
         return -1;
     }
 
-    rc = dav_connect(uri);
-    if (rc < 0) {
-        errno = EINVAL;
+    session = dav_session_get(uri);
+    if (session == NULL) {
+        rc = -1;
     }
 
     if( rc >= 0 ) {
-        rc = ne_delete(dav_session.ctx, curi);
+        rc = ne_delete(session, curi);
         if ( rc != NE_OK ) {
-          set_errno_from_session();
+          set_errno_from_session( session );
         }
     }
+    dav_session_put( session );
     SAFE_FREE( curi );
     if( rc < 0 || rc != NE_OK ) {
         return -1;
@@ -1488,12 +2015,13 @@ static int owncloud_rmdir(const char *uri) {
 static int owncloud_rename(const char *olduri, const char *newuri) {
     char *src = NULL;
     char *target = NULL;
+    ne_session *session = NULL;
     int rc = NE_OK;
 
 
-    rc = dav_connect(olduri);
-    if (rc < 0) {
-        errno = EINVAL;
+    session = dav_session_get(olduri);
+    if (session == NULL) {
+        rc = -1;
     }
 
     src    = _cleanPath( olduri );
@@ -1511,12 +2039,13 @@ static int owncloud_rename(const char *olduri, const char *newuri) {
     }
     if( rc >= 0 ) {
         DEBUG_WEBDAV("MOVE: %s => %s: %d", src, target, rc );
-        rc = ne_move(dav_session.ctx, 1, src, target );
+        rc = ne_move(session, 1, src, target );
 
         if (rc != NE_OK ) {
-          set_errno_from_session();
+          set_errno_from_session( session );
         }
     }
+    dav_session_put( session );
     SAFE_FREE( src );
     SAFE_FREE( target );
 
@@ -1527,6 +2056,7 @@ static int owncloud_rename(const char *olduri, const char *newuri) {
 
 static int owncloud_unlink(const char *uri) {
     int rc = NE_OK;
+    ne_session *session = NULL;
     char *path = _cleanPath( uri );
 
     if( ! path ) {
@@ -1534,16 +2064,17 @@ static int owncloud_unlink(const char *uri) {
         errno = EINVAL;
     }
     if( rc == NE_OK ) {
-        rc = dav_connect(uri);
-        if (rc < 0) {
-            errno = EINVAL;
+        session = dav_session_get(uri);
+        if (session == NULL) {
+            rc = NE_ERROR;
         }
     }
     if( rc == NE_OK ) {
-        rc = ne_delete( dav_session.ctx, path );
+        rc = ne_delete( session, path );
         if ( rc != NE_OK )
-            set_errno_from_session();
+            set_errno_from_session( session );
     }
+    dav_session_put( session );
     SAFE_FREE( path );
 
     return 0;
@@ -1577,6 +2108,27 @@ static int owncloud_set_property(const char *key, void *data) {
         _file_progress_cb = *(csync_file_progress_callback*)(data);
         return 0;
     }
+    if (c_streq(key, "session_pool_size")) {
+        /* the number of connections to the server used at most */
+        if (*(int*)(data) < 1) {
+            return -1;
+        }
+        SESSION_LOCK();
+        dav_session.pool_size = *(int*)(data);
+#ifdef HAVE_PTHREAD
+        pthread_cond_broadcast(&_session_cond);
+#endif
+        SESSION_UNLOCK();
+        return 0;
+    }
+    if (c_streq(key, "chunk_size")) {
+        /* in bytes, 0 puts every file with one request */
+        if (*(int64_t*)(data) < 0) {
+            return -1;
+        }
+        _chunk_size = *(int64_t*)(data);
+        return 0;
+    }
 
     return -1;
 }
@@ -1584,13 +2136,14 @@ static int owncloud_set_property(const char *key, void *data) {
 
 static char *owncloud_error_string()
 {
-    return dav_session.error_string;
+    return _error_string[0] != '\0' ? _error_string : NULL;
 }
 
 static int owncloud_utimes(const char *uri, const struct timeval *times) {
 
     ne_proppatch_operation ops[2];
     ne_propname pname;
+    ne_session *session = NULL;
     int rc = NE_OK;
     char val[255];
     char *curi;
@@ -1602,6 +2155,7 @@ static int owncloud_utimes(const char *uri, const struct timeval *times) {
         return -1;
     }
     if( !times ) {
+        SAFE_FREE(curi);
         errno = EACCES;
         return -1; /* FIXME: Find good errno */
     }
@@ -1617,7 +2171,13 @@ static int owncloud_utimes(const char *uri, const struct timeval *times) {
 
     ops[1].name = NULL;
 
-    rc = ne_proppatch( dav_session.ctx, curi, ops );
+    session = dav_session_get( uri );
+    if( session == NULL ) {
+        SAFE_FREE(curi);
+        return -1;
+    }
+    rc = ne_proppatch( session, curi, ops );
+    dav_session_put( session );
     SAFE_FREE(curi);
 
     if( rc != NE_OK ) {
@@ -1667,15 +2227,22 @@ csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
 void vio_module_shutdown(csync_vio_method_t *method) {
     (void) method;
 
+    SAFE_FREE( _fs.name );
+    SAFE_FREE( _fs.etag );
     SAFE_FREE( dav_session.user );
     SAFE_FREE( dav_session.pwd );
-
-    SAFE_FREE( dav_session.error_string );
+    SAFE_FREE( dav_session.host );
+    dav_session.ssl_digest[0] = '\0';
 
     SAFE_FREE( _lastDir );
 
-    if( dav_session.ctx )
-        ne_session_destroy( dav_session.ctx );
+    /* all requests are done, so every session is back in the pool */
+    while( dav_session.idle > 0 ) {
+        ne_session_destroy( dav_session.pool[--dav_session.idle] );
+    }
+    SAFE_FREE( dav_session.pool );
+    dav_session.count = 0;
+    _connected = 0;
 }
 
 
@@ -625,10 +625,42 @@ static ssize_t _sftp_write(csync_vio_method_handle_t *fhandle, const void *buf,
 }
 
 static off_t _sftp_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
-  /* FIXME: really implement seek for lseek? */
-  (void) whence;
-  sftp_seek(fhandle, offset);
-  return 0;
+  sftp_attributes attrs;
+  int64_t pos;
+
+  switch (whence) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = (int64_t) sftp_tell64(fhandle) + offset;
+      break;
+    case SEEK_END:
+      /* a resumed transfer appends to the temporary file */
+      attrs = sftp_fstat(fhandle);
+      if (attrs == NULL) {
+        errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+        return -1;
+      }
+      pos = (int64_t) attrs->size + offset;
+      sftp_attributes_free(attrs);
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  if (pos < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (sftp_seek64(fhandle, (uint64_t) pos) < 0) {
+    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    return -1;
+  }
+
+  return (off_t) pos;
 }
 
 /*
@@ -664,6 +696,58 @@ static int _sftp_closedir(csync_vio_method_handle_t *dhandle) {
   return rc;
 }
 
+/* fill the stat fields from the attributes of the sftp server */
+static void _sftp_attributes_to_stat(sftp_attributes attrs,
+    csync_vio_file_stat_t *buf) {
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  switch (attrs->type) {
+    case SSH_FILEXFER_TYPE_REGULAR:
+      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+      break;
+    case SSH_FILEXFER_TYPE_DIRECTORY:
+      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      break;
+    case SSH_FILEXFER_TYPE_SYMLINK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    case SSH_FILEXFER_TYPE_SPECIAL:
+    case SSH_FILEXFER_TYPE_UNKNOWN:
+      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
+      break;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+
+  buf->mode = attrs->permissions;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+
+  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+    /* FIXME: handle symlink */
+    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
+  } else {
+    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
+
+  buf->uid = attrs->uid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
+
+  buf->gid = attrs->gid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
+
+  buf->size = attrs->size;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+
+  buf->atime = attrs->atime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
+
+  buf->mtime = attrs->mtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  buf->ctime = attrs->createtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+}
+
 static csync_vio_file_stat_t *_sftp_readdir(csync_vio_method_handle_t *dhandle) {
   sftp_attributes dirent = NULL;
   csync_vio_file_stat_t *fs = NULL;
@@ -682,22 +766,9 @@ static csync_vio_file_stat_t *_sftp_readdir(csync_vio_method_handle_t *dhandle)
   }
 
   fs->name = c_strdup(dirent->name);
-  fs->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
 
-  switch (dirent->type) {
-    case SSH_FILEXFER_TYPE_REGULAR:
-      fs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-      fs->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      break;
-    case SSH_FILEXFER_TYPE_DIRECTORY:
-      fs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-      fs->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      break;
-    case SSH_FILEXFER_TYPE_SYMLINK:
-    case SSH_FILEXFER_TYPE_SPECIAL:
-    case SSH_FILEXFER_TYPE_UNKNOWN:
-      break;
-  }
+  /* the listing carries the same attributes as sftp_lstat() */
+  _sftp_attributes_to_stat(dirent, fs);
 
   sftp_attributes_free(dirent);
   return fs;
@@ -759,53 +830,7 @@ static int _sftp_stat(const char *uri, csync_vio_file_stat_t *buf) {
     csync_vio_file_stat_destroy(buf);
     goto out;
   }
-  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-
-  switch (attrs->type) {
-    case SSH_FILEXFER_TYPE_REGULAR:
-      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      break;
-    case SSH_FILEXFER_TYPE_DIRECTORY:
-      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      break;
-    case SSH_FILEXFER_TYPE_SYMLINK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-    case SSH_FILEXFER_TYPE_SPECIAL:
-    case SSH_FILEXFER_TYPE_UNKNOWN:
-      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-      break;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-
-  buf->mode = attrs->permissions;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
-
-  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
-    /* FIXME: handle symlink */
-    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
-  } else {
-    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
-
-  buf->uid = attrs->uid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
-
-  buf->uid = attrs->gid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
-
-  buf->size = attrs->size;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-
-  buf->atime = attrs->atime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
-
-  buf->mtime = attrs->mtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-
-  buf->ctime = attrs->createtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+  _sftp_attributes_to_stat(attrs, buf);
 
   rc = 0;
 out:
@@ -946,7 +971,8 @@ static int _sftp_utimes(const char *uri, const struct timeval *times) {
 }
 
 static struct csync_vio_capabilities_s _sftp_capabilities = {
-    .atomar_copy_support = false
+    .atomar_copy_support = false,
+    .readdir_stat_support = true
 };
 
 static struct csync_vio_capabilities_s *_sftp_get_capabilities(void)
@@ -247,6 +247,83 @@ static int _closedir(csync_vio_method_handle_t *dhandle) {
   return rc;
 }
 
+/* fill the stat fields from the stat result of libsmbclient */
+static void _fill_stat(csync_stat_t *sb, csync_vio_file_stat_t *buf) {
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  switch(sb->st_mode & S_IFMT) {
+    case S_IFBLK:
+      buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
+      break;
+    case S_IFCHR:
+      buf->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
+      break;
+    case S_IFDIR:
+      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      break;
+    case S_IFIFO:
+      buf->type = CSYNC_VIO_FILE_TYPE_FIFO;
+      break;
+    case S_IFLNK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    case S_IFREG:
+      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+      break;
+    case S_IFSOCK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    default:
+      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
+      break;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+
+  buf->mode = sb->st_mode;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+
+  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+    /* FIXME: handle symlink */
+    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
+  } else {
+    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
+
+  buf->device = sb->st_dev;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DEVICE;
+
+  buf->inode = sb->st_ino;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
+
+  buf->nlink = sb->st_nlink;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
+
+  buf->uid = sb->st_uid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
+
+  buf->gid = sb->st_gid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
+
+  buf->size = sb->st_size;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+
+  buf->blksize = sb->st_blksize;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_BLOCK_SIZE;
+
+  buf->blkcount = sb->st_blocks;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_BLOCK_COUNT;
+
+  buf->atime = sb->st_atime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
+
+  buf->mtime = sb->st_mtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  buf->ctime = sb->st_ctime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+}
+
 static csync_vio_file_stat_t *_readdir(csync_vio_method_handle_t *dhandle) {
   struct smbc_dirent *dirent = NULL;
   smb_dhandle_t *handle = NULL;
@@ -255,6 +332,29 @@ static csync_vio_file_stat_t *_readdir(csync_vio_method_handle_t *dhandle) {
   handle = (smb_dhandle_t *) dhandle;
 
   errno = 0;
+#ifdef HAVE_SMBC_READDIRPLUS2
+  {
+    const struct libsmb_file_info *info = NULL;
+    csync_stat_t sb;
+
+    /* the directory listing of SMB2 and later carries the file attributes */
+    info = smbc_readdirplus2(handle->dh, &sb);
+    if (info == NULL) {
+      return NULL;
+    }
+
+    file_stat = c_malloc(sizeof(csync_vio_file_stat_t));
+    if (file_stat == NULL) {
+      return NULL;
+    }
+
+    file_stat->name = c_strdup(info->name);
+    _fill_stat(&sb, file_stat);
+
+    return file_stat;
+  }
+#endif
+
   dirent = smbc_readdir(handle->dh);
   if (dirent == NULL) {
     return NULL;
@@ -314,79 +414,7 @@ static int _stat(const char *uri, csync_vio_file_stat_t *buf) {
     csync_vio_file_stat_destroy(buf);
     return -1;
   }
-  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-
-  switch(sb.st_mode & S_IFMT) {
-    case S_IFBLK:
-      buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
-      break;
-    case S_IFCHR:
-      buf->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
-      break;
-    case S_IFDIR:
-      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      break;
-    case S_IFIFO:
-      buf->type = CSYNC_VIO_FILE_TYPE_FIFO;
-      break;
-    case S_IFLNK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-    case S_IFREG:
-      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      break;
-    case S_IFSOCK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-    default:
-      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-      break;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-
-  buf->mode = sb.st_mode;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
-
-  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
-    /* FIXME: handle symlink */
-    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
-  } else {
-    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
-
-  buf->device = sb.st_dev;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DEVICE;
-
-  buf->inode = sb.st_ino;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
-
-  buf->nlink = sb.st_nlink;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
-
-  buf->uid = sb.st_uid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
-
-  buf->gid = sb.st_gid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
-
-  buf->size = sb.st_size;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-
-  buf->blksize = sb.st_blksize;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_BLOCK_SIZE;
-
-  buf->blkcount = sb.st_blocks;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_BLOCK_COUNT;
-
-  buf->atime = sb.st_atime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
-
-  buf->mtime = sb.st_mtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-
-  buf->ctime = sb.st_ctime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+  _fill_stat(&sb, buf);
 
   return 0;
 }
@@ -418,7 +446,12 @@ static int _utimes(const char *uri, const struct timeval *times) {
 }
 
 static struct csync_vio_capabilities_s _smb_capabilities = {
-    .atomar_copy_support = false
+    .atomar_copy_support = false,
+#ifdef HAVE_SMBC_READDIRPLUS2
+    .readdir_stat_support = true
+#else
+    .readdir_stat_support = false
+#endif
 };
 
 static struct csync_vio_capabilities_s *_smb_get_capabilities(void)
@@ -45,7 +45,9 @@
 #include "csync_config.h"
 #include "csync_exclude.h"
 #include "csync_lock.h"
+#include "csync_path.h"
 #include "csync_statedb.h"
+#include "csync_watch.h"
 #include "csync_time.h"
 #include "csync_util.h"
 #include "csync_misc.h"
@@ -60,35 +62,44 @@
 #include "csync_log.h"
 #include "c_strerror.h"
 
-static int _key_cmp(const void *key, const void *data) {
-  uint64_t a;
-  csync_file_stat_t *b;
-
-  a = *(uint64_t *) (key);
-  b = (csync_file_stat_t *) data;
+/*
+ * The records of a replica are allocated from its arena and their paths
+ * from the path pool, so a tree is released without visiting the records.
+ */
+static int _csync_trees_create(CSYNC *ctx) {
+  ctx->local.arena = c_arena_new(0);
+  ctx->remote.arena = c_arena_new(0);
+  ctx->paths = csync_path_pool_new();
+  if (ctx->local.arena == NULL || ctx->remote.arena == NULL ||
+      ctx->paths == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
 
-  if (a < b->phash) {
+  ctx->local.tree = c_hash_new(0);
+  ctx->remote.tree = c_hash_new(0);
+  if (ctx->local.tree == NULL || ctx->remote.tree == NULL) {
+    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     return -1;
-  } else if (a > b->phash) {
-    return 1;
   }
 
   return 0;
 }
 
-static int _data_cmp(const void *key, const void *data) {
-  csync_file_stat_t *a, *b;
+static void _csync_trees_free(CSYNC *ctx) {
+  c_hash_free(ctx->local.tree);
+  ctx->local.tree = NULL;
+  c_hash_free(ctx->remote.tree);
+  ctx->remote.tree = NULL;
 
-  a = (csync_file_stat_t *) key;
-  b = (csync_file_stat_t *) data;
+  c_arena_free(ctx->local.arena);
+  ctx->local.arena = NULL;
+  c_arena_free(ctx->remote.arena);
+  ctx->remote.arena = NULL;
 
-  if (a->phash < b->phash) {
-    return -1;
-  } else if (a->phash > b->phash) {
-    return 1;
-  }
-
-  return 0;
+  /* the records don't drop their paths, the pool goes with the trees */
+  csync_path_pool_free(ctx->paths);
+  ctx->paths = NULL;
 }
 
 int csync_create(CSYNC **csync, const char *local, const char *remote) {
@@ -129,6 +140,14 @@ int csync_create(CSYNC **csync, const char *local, const char *remote) {
   ctx->options.unix_extensions = 0;
   ctx->options.with_conflict_copys=false;
   ctx->options.local_only_mode = false;
+  ctx->options.walker_threads = 0;
+  ctx->options.preload_statedb = true;
+  ctx->options.full_scan_interval = 0;
+  ctx->options.reconcile_threads = 0;
+  ctx->options.propagation_threads = 0;
+  ctx->options.min_xfer_buffer_size = MIN_XFER_BUF_SIZE;
+  ctx->options.max_xfer_buffer_size = MAX_XFER_BUF_SIZE;
+  ctx->options.delta_transfer = true;
 
   ctx->pwd.uid = getuid();
   ctx->pwd.euid = geteuid();
@@ -338,14 +357,7 @@ retry_vio_init:
       }
   }
 
-  if (c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp) < 0) {
-    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
-    rc = -1;
-    goto out;
-  }
-
-  if (c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp) < 0) {
-    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+  if (_csync_trees_create(ctx) < 0) {
     rc = -1;
     goto out;
   }
@@ -365,8 +377,10 @@ out:
 }
 
 int csync_update(CSYNC *ctx) {
+  csync_ftw_job_t *remote = NULL;
   int rc = -1;
-  struct timespec start, finish;
+  int rrc = 0;
+  struct timespec start, finish, rstart;
 
   if (ctx == NULL) {
     errno = EBADF;
@@ -377,42 +391,131 @@ int csync_update(CSYNC *ctx) {
 
   csync_memstat_check();
 
+  /* read the statedb once instead of querying it for every file */
+  if (ctx->options.preload_statedb && ctx->statedb.db != NULL &&
+      ctx->statedb.index == NULL && csync_get_statedb_exists(ctx)) {
+    csync_gettime(&start);
+    ctx->statedb.index = csync_statedb_index_load(ctx->statedb.db, ctx->paths);
+    csync_gettime(&finish);
+    if (ctx->statedb.index != NULL) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+                "Preloading %zu statedb entries took %.2f seconds",
+                csync_statedb_index_count(ctx->statedb.index),
+                c_secdiff(finish, start));
+      /* both replicas hold about as many entries as the last run */
+      c_hash_reserve(ctx->local.tree, csync_statedb_index_count(ctx->statedb.index));
+      c_hash_reserve(ctx->remote.tree, csync_statedb_index_count(ctx->statedb.index));
+    } else {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+                "Unable to preload the statedb, querying it per file");
+    }
+  }
+
+  /* decide if unchanged directories can be skipped in this run */
+  ctx->statedb.incremental = 0;
+  ctx->statedb.last_scan = 0;
+  if (ctx->statedb.db != NULL) {
+    int64_t last_scan = 0;
+
+    if (csync_statedb_get_value(ctx->statedb.db, "scan_start",
+          &last_scan) == 0) {
+      ctx->statedb.last_scan = (time_t) last_scan;
+    }
+  }
+  if (csync_watch_load(ctx) == 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+              "Walking the changed directories of the local replica");
+  } else if (ctx->options.full_scan_interval > 0 && ctx->statedb.db != NULL &&
+      csync_get_statedb_exists(ctx)) {
+    int64_t runs = 0;
+
+    if (csync_statedb_get_value(ctx->statedb.db, "incremental_runs",
+          &runs) < 0 || ctx->statedb.last_scan == 0) {
+      /* the path index has to be created by a full run first */
+      runs = ctx->options.full_scan_interval;
+    }
+    if (runs + 1 < ctx->options.full_scan_interval) {
+      ctx->statedb.incremental = 1;
+      runs++;
+    } else {
+      runs = 0;
+    }
+    csync_statedb_set_value(ctx->statedb.db, "incremental_runs", runs);
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%s scan of the local replica",
+              ctx->statedb.incremental ? "Incremental" : "Full");
+  }
+
+  /* the partial copies of the last run are skipped by the walkers */
+  if (csync_update_partials_load(ctx) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+
+  ctx->statedb.scan_start = time(NULL);
+  if (ctx->statedb.db != NULL) {
+    /* directories changed later than this are walked by the next run */
+    csync_statedb_set_value(ctx->statedb.db, "scan_start",
+        ctx->statedb.scan_start);
+  }
+
+  /* the remote walk is latency bound, run it while the local one runs */
+  if (!ctx->options.local_only_mode) {
+    ctx->current = REMOTE_REPLICA;
+    ctx->replica = ctx->remote.type;
+
+    csync_gettime(&rstart);
+    remote = csync_ftw_start(ctx, ctx->remote.uri, csync_walker, MAX_DEPTH);
+  }
+
   /* update detection for local replica */
   csync_gettime(&start);
   ctx->current = LOCAL_REPLICA;
   ctx->replica = ctx->local.type;
 
-  rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+  rc = csync_ftw_local(ctx, ctx->local.uri, MAX_DEPTH,
+      ctx->options.walker_threads);
 
   csync_gettime(&finish);
+  csync_watch_clear(ctx);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for local replica took %.2f seconds walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+            c_secdiff(finish, start), c_hash_size(ctx->local.tree));
   csync_memstat_check();
 
+  if (remote != NULL) {
+    rrc = csync_ftw_join(ctx, remote);
+    csync_gettime(&finish);
+    start = rstart;
+  }
+
   if (rc < 0) {
+    csync_update_partials_free(ctx);
     ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     return -1;
   }
 
   /* update detection for remote replica */
   if( ! ctx->options.local_only_mode ) {
-    csync_gettime(&start);
-    ctx->current = REMOTE_REPLICA;
-    ctx->replica = ctx->remote.type;
+    if (remote == NULL) {
+      csync_gettime(&start);
+      ctx->current = REMOTE_REPLICA;
+      ctx->replica = ctx->remote.type;
 
-    rc = csync_ftw(ctx, ctx->remote.uri, csync_walker, MAX_DEPTH);
+      rrc = csync_ftw_parallel(ctx, ctx->remote.uri, csync_walker, MAX_DEPTH,
+          ctx->options.walker_threads);
 
-    csync_gettime(&finish);
+      csync_gettime(&finish);
+    }
+    csync_update_partials_free(ctx);
 
     CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
               "Update detection for remote replica took %.2f seconds "
               "walking %zu files.",
-              c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+              c_secdiff(finish, start), c_hash_size(ctx->remote.tree));
     csync_memstat_check();
 
-    if (rc < 0) {
+    if (rrc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
           ctx->status_code = CSYNC_STATUS_UPDATE_ERROR;
       }
@@ -420,6 +523,7 @@ int csync_update(CSYNC *ctx) {
       return -1;
     }
   }
+  csync_update_partials_free(ctx);
   ctx->status |= CSYNC_STATUS_UPDATE;
 
   return 0;
@@ -435,40 +539,17 @@ int csync_reconcile(CSYNC *ctx) {
   }
   ctx->status_code = CSYNC_STATUS_OK;
 
-  /* Reconciliation for local replica */
+  /* Reconciliation of both replicas at once */
   csync_gettime(&start);
 
-  ctx->current = LOCAL_REPLICA;
-  ctx->replica = ctx->local.type;
-
   rc = csync_reconcile_updates(ctx);
 
   csync_gettime(&finish);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-      "Reconciliation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
-
-  if (rc < 0) {
-      if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
-          ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
-      }
-      return -1;
-  }
-
-  /* Reconciliation for local replica */
-  csync_gettime(&start);
-
-  ctx->current = REMOTE_REPLICA;
-  ctx->replica = ctx->remote.type;
-
-  rc = csync_reconcile_updates(ctx);
-
-  csync_gettime(&finish);
-
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-      "Reconciliation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      "Reconciliation took %.2f seconds visiting %zu local and %zu remote files.",
+      c_secdiff(finish, start), c_hash_size(ctx->local.tree),
+      c_hash_size(ctx->remote.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -514,7 +595,7 @@ int csync_propagate(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Propagation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+      c_secdiff(finish, start), c_hash_size(ctx->local.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -535,7 +616,7 @@ int csync_propagate(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Propagation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      c_secdiff(finish, start), c_hash_size(ctx->remote.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -555,7 +636,7 @@ int csync_propagate(CSYNC *ctx) {
 static int _csync_treewalk_visitor( void *obj, void *data ) {
     csync_file_stat_t *cur;
     CSYNC *ctx;
-    c_rbtree_visit_func *visitor;
+    csync_treewalk_visit_func *visitor;
     _csync_treewalk_context *twctx;
     TREE_WALK_FILE trav;
 
@@ -577,9 +658,18 @@ static int _csync_treewalk_visitor( void *obj, void *data ) {
         return 0;
     }
 
-    visitor = (c_rbtree_visit_func*)(twctx->user_visitor);
+    visitor = twctx->user_visitor;
     if (visitor != NULL) {
-      trav.path =   cur->path;
+      char *path;
+      int rc;
+
+      path = csync_file_stat_path(cur);
+      if (path == NULL) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+      }
+
+      trav.path =   path;
       trav.modtime = cur->modtime;
       trav.uid =    cur->uid;
       trav.gid =    cur->gid;
@@ -587,7 +677,10 @@ static int _csync_treewalk_visitor( void *obj, void *data ) {
       trav.type =   cur->type;
       trav.instruction = cur->instruction;
 
-      return (*visitor)(&trav, twctx->userdata);
+      rc = (*visitor)(&trav, twctx->userdata);
+      SAFE_FREE(path);
+
+      return rc;
     }
 
     ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
@@ -598,11 +691,11 @@ static int _csync_treewalk_visitor( void *obj, void *data ) {
  * treewalk function, called from its wrappers below.
  *
  * it encapsulates the user visitor function, the filter and the userdata
- * into a treewalk_context structure and calls the rb treewalk function,
+ * into a treewalk_context structure and calls the tree walk function,
  * which calls the local _csync_treewalk_visitor in this module.
  * The user visitor is called from there.
  */
-static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_func *visitor, int filter)
+static int _csync_walk_tree(CSYNC *ctx, c_hash_t *tree, csync_treewalk_visit_func *visitor, int filter)
 {
     _csync_treewalk_context tw_ctx;
     int rc = -1;
@@ -622,7 +715,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
 
     ctx->callbacks.userdata = &tw_ctx;
 
-    rc = c_rbtree_walk(tree, (void*) ctx, _csync_treewalk_visitor);
+    rc = c_hash_walk(tree, (void*) ctx, _csync_treewalk_visitor);
 
     ctx->callbacks.userdata = tw_ctx.userdata;
 
@@ -634,7 +727,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
  */
 int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_hash_t *tree = NULL;
 
     if (ctx != NULL) {
         ctx->status_code = CSYNC_STATUS_OK;
@@ -649,7 +742,7 @@ int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int
  */
 int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_hash_t *tree = NULL;
 
     if (ctx != NULL) {
         ctx->status_code = CSYNC_STATUS_OK;
@@ -659,19 +752,17 @@ int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int fi
     return _csync_walk_tree(ctx, tree, visitor, filter);
 }
 
-static void _tree_destructor(void *data) {
-  csync_file_stat_t *freedata = NULL;
-
-  freedata = (csync_file_stat_t *) data;
-  SAFE_FREE(freedata);
-}
-
 static int  _merge_and_write_statedb(CSYNC *ctx) {
   struct timespec start, finish;
   char errbuf[256] = {0};
+  c_list_t *it = NULL;
   int jwritten = 0;
   int rc = 0;
 
+  /* the preloaded records are outdated from now on */
+  csync_statedb_index_free(ctx->statedb.index);
+  ctx->statedb.index = NULL;
+
   /* if we have a statedb */
   if (ctx->statedb.db != NULL) {
     /* and we have successfully synchronized */
@@ -692,7 +783,7 @@ static int  _merge_and_write_statedb(CSYNC *ctx) {
           csync_gettime(&finish);
           CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
               "Writing the statedb of %zu files to disk took %.2f seconds",
-              c_rbtree_size(ctx->local.tree), c_secdiff(finish, start));
+              c_hash_size(ctx->local.tree), c_secdiff(finish, start));
         } else {
           c_strerror_r(errno, errbuf, sizeof(errbuf));
           CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Unable to write statedb: %s",
@@ -709,6 +800,12 @@ static int  _merge_and_write_statedb(CSYNC *ctx) {
     }
   }
 
+  for (it = ctx->remote.etags; it != NULL; it = c_list_next(it)) {
+    SAFE_FREE(it->data);
+  }
+  c_list_free(ctx->remote.etags);
+  ctx->remote.etags = NULL;
+
   return rc;
 }
 
@@ -738,21 +835,9 @@ int csync_commit(CSYNC *ctx) {
     goto out;
   }
 
-  /* destroy the rbtrees */
-  rc = c_rbtree_size(ctx->local.tree);
-  if (rc > 0) {
-    c_rbtree_destroy(ctx->local.tree, _tree_destructor);
-  }
-
-  rc = c_rbtree_size(ctx->remote.tree);
-  if (rc > 0) {
-    c_rbtree_destroy(ctx->remote.tree, _tree_destructor);
-  }
-
   /* free memory */
-  c_rbtree_free(ctx->local.tree);
+  _csync_trees_free(ctx);
   c_list_free(ctx->local.list);
-  c_rbtree_free(ctx->remote.tree);
   c_list_free(ctx->remote.list);
 
   ctx->local.list = 0;
@@ -780,15 +865,8 @@ int csync_commit(CSYNC *ctx) {
   }
 
   /* Create new trees */
-  rc = c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp);
-  if (rc < 0) {
-    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
-    goto out;
-  }
-
-  rc = c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp);
+  rc = _csync_trees_create(ctx);
   if (rc < 0) {
-    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     goto out;
   }
 
@@ -839,21 +917,9 @@ int csync_destroy(CSYNC *ctx) {
   }
 #endif
 
-  /* destroy the rbtrees */
-  rc = c_rbtree_size(ctx->local.tree);
-  if (rc > 0) {
-    c_rbtree_destroy(ctx->local.tree, _tree_destructor);
-  }
-
-  rc = c_rbtree_size(ctx->remote.tree);
-  if (rc > 0) {
-    c_rbtree_destroy(ctx->remote.tree, _tree_destructor);
-  }
-
   /* free memory */
-  c_rbtree_free(ctx->local.tree);
+  _csync_trees_free(ctx);
   c_list_free(ctx->local.list);
-  c_rbtree_free(ctx->remote.tree);
   c_list_free(ctx->remote.list);
   SAFE_FREE(ctx->local.uri);
   SAFE_FREE(ctx->remote.uri);
@@ -1079,16 +1145,29 @@ const char *csync_get_status_string(CSYNC *ctx)
 }
 
 #ifdef WITH_ICONV
+static CSYNC_THREAD char _iconv_codec[64];
+
 int csync_set_iconv_codec(const char *from)
 {
   c_close_iconv();
+  _iconv_codec[0] = '\0';
 
   if (from != NULL) {
     c_setup_iconv(from);
+    strncpy(_iconv_codec, from, sizeof(_iconv_codec) - 1);
   }
 
   return 0;
 }
+
+const char *csync_get_iconv_codec(void)
+{
+  if (_iconv_codec[0] == '\0') {
+    return NULL;
+  }
+
+  return _iconv_codec;
+}
 #endif
 
 int csync_set_module_property(CSYNC* ctx, const char* key, void* value)
@@ -152,7 +152,7 @@ enum csync_instructions_e {
  * CSync File Traversal structure.
  *
  * This structure is passed to the visitor function for every file
- * which is seen.
+ * which is seen. The path is only valid during the call of the visitor.
  * Note: The file size is missing here because type off_t is depending
  *       on the large file support in your build. Make sure to check
  *       that cmake and the callback app are compiled with the same
@@ -182,6 +182,8 @@ typedef struct csync_tree_walk_file_s TREE_WALK_FILE;
  */
 typedef struct csync_s CSYNC;
 
+typedef struct csync_watch_s CSYNC_WATCH;
+
 typedef int (*csync_auth_callback) (const char *prompt, char *buf, size_t len,
     int echo, int verify, void *userdata);
 
@@ -428,6 +430,11 @@ csync_log_callback csync_get_log_callback(void);
 /**
  * @brief Set the logging callback.
  *
+ * The callback is handed on to the threads of the update, reconcile and
+ * propagation phases, so it is called from several threads. csync
+ * serializes the calls, but the callback must not rely on running in the
+ * thread which set it and must not log through csync itself.
+ *
  * @param cb            The logging callback.
  *
  * @return              0 on success, less than 0 if an error occured.
@@ -534,6 +541,32 @@ const char *csync_get_status_string(CSYNC *ctx);
 int csync_set_iconv_codec(const char *from);
 #endif
 
+/**
+ * @brief Start recording the changes of a local replica.
+ *
+ * A thread watches the local replica with inotify and records the changed
+ * directories in a journal next to the statedb. As long as it is running the
+ * update detection only walks the changed directories. Otherwise or if
+ * events got lost it walks everything as before.
+ *
+ * @param watch         The watcher variable to allocate.
+ *
+ * @param local         The local replica, the same as for csync_create().
+ *
+ * @return              0 on success, less than 0 if an error occured with
+ *                      errno set, ENOSYS if not supported.
+ */
+int csync_watch_start(CSYNC_WATCH **watch, const char *local);
+
+/**
+ * @brief Stop and free a watcher started with csync_watch_start().
+ *
+ * @param watch         The watcher to stop.
+ *
+ * @return              0 on success, less than 0 if an error occured.
+ */
+int csync_watch_stop(CSYNC_WATCH *watch);
+
 /**
  * @brief Set a property to module
  *
@@ -0,0 +1,182 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include "c_lib.h"
+
+#include "csync_buffer.h"
+
+/* buffers of the same size kept for reuse */
+#define CSYNC_BUFFER_POOL_KEEP 8
+
+/* the sizes are powers of two, a class per size */
+#define CSYNC_BUFFER_POOL_CLASSES 32
+
+/* a buffer in the pool, it links to the next one through its first bytes */
+struct _csync_buffer_s {
+  struct _csync_buffer_s *next;
+};
+
+struct csync_buffer_pool_s {
+  size_t min;
+  size_t max;
+  struct _csync_buffer_s *free[CSYNC_BUFFER_POOL_CLASSES];
+  size_t nfree[CSYNC_BUFFER_POOL_CLASSES];
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+#endif
+};
+
+static void _csync_buffer_pool_lock(csync_buffer_pool_t *pool) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&pool->lock);
+#else
+  (void) pool;
+#endif
+}
+
+static void _csync_buffer_pool_unlock(csync_buffer_pool_t *pool) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&pool->lock);
+#else
+  (void) pool;
+#endif
+}
+
+/* the class of a power of two */
+static unsigned int _csync_buffer_class(size_t size) {
+  unsigned int c = 0;
+
+  while (size > 1) {
+    size >>= 1;
+    c++;
+  }
+
+  return c;
+}
+
+static size_t _csync_buffer_round(size_t size) {
+  size_t n = sizeof(struct _csync_buffer_s);
+
+  while (n < size && n < ((size_t) 1 << (CSYNC_BUFFER_POOL_CLASSES - 1))) {
+    n <<= 1;
+  }
+
+  return n;
+}
+
+csync_buffer_pool_t *csync_buffer_pool_new(size_t min, size_t max) {
+  csync_buffer_pool_t *pool = NULL;
+
+  pool = c_malloc(sizeof(csync_buffer_pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  pool->min = _csync_buffer_round(min);
+  pool->max = _csync_buffer_round(max);
+  if (pool->max < pool->min) {
+    pool->max = pool->min;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&pool->lock, NULL);
+#endif
+
+  return pool;
+}
+
+void csync_buffer_pool_free(csync_buffer_pool_t *pool) {
+  struct _csync_buffer_s *b = NULL;
+  unsigned int c;
+
+  if (pool == NULL) {
+    return;
+  }
+
+  for (c = 0; c < CSYNC_BUFFER_POOL_CLASSES; c++) {
+    while (pool->free[c] != NULL) {
+      b = pool->free[c];
+      pool->free[c] = b->next;
+      SAFE_FREE(b);
+    }
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&pool->lock);
+#endif
+  SAFE_FREE(pool);
+}
+
+size_t csync_buffer_size(csync_buffer_pool_t *pool, int64_t size, bool local) {
+  size_t max = pool->max;
+  size_t n = pool->min;
+
+  if (local && max > CSYNC_BUFFER_LOCAL_MAX) {
+    max = MAX(pool->min, CSYNC_BUFFER_LOCAL_MAX);
+  }
+
+  while (n < max && (int64_t) n < size) {
+    n <<= 1;
+  }
+
+  return n;
+}
+
+void *csync_buffer_get(csync_buffer_pool_t *pool, size_t size) {
+  struct _csync_buffer_s *b = NULL;
+  unsigned int c = _csync_buffer_class(size);
+
+  _csync_buffer_pool_lock(pool);
+  b = pool->free[c];
+  if (b != NULL) {
+    pool->free[c] = b->next;
+    pool->nfree[c]--;
+  }
+  _csync_buffer_pool_unlock(pool);
+
+  if (b == NULL) {
+    b = c_malloc(size);
+  }
+
+  return b;
+}
+
+void csync_buffer_put(csync_buffer_pool_t *pool, void *buf, size_t size) {
+  struct _csync_buffer_s *b = (struct _csync_buffer_s *) buf;
+  unsigned int c = _csync_buffer_class(size);
+
+  if (b == NULL) {
+    return;
+  }
+
+  _csync_buffer_pool_lock(pool);
+  if (pool->nfree[c] < CSYNC_BUFFER_POOL_KEEP) {
+    b->next = pool->free[c];
+    pool->free[c] = b;
+    pool->nfree[c]++;
+    b = NULL;
+  }
+  _csync_buffer_pool_unlock(pool);
+
+  SAFE_FREE(b);
+}
+
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
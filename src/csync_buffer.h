@@ -0,0 +1,85 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_BUFFER_H
+#define _CSYNC_BUFFER_H
+
+#include "csync_private.h"
+
+/**
+ * @file csync_buffer.h
+ *
+ * @brief Transfer buffers of the propagation
+ *
+ * A file is copied through a buffer sized for it: a power of two large
+ * enough for the whole file, but not smaller than the minimum and not larger
+ * than the maximum buffer size of the pool. Transfers between two local
+ * replicas don't gain from more than CSYNC_BUFFER_LOCAL_MAX, a module pays
+ * for every call and gets up to the maximum.
+ *
+ * Buffers given back are kept for the next transfer of the same size. The
+ * pool has its own lock, it may be used by parallel propagation workers.
+ *
+ * @defgroup csyncBufferInternals csync transfer buffer internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+/* largest buffer for a copy between two local replicas */
+#define CSYNC_BUFFER_LOCAL_MAX (1024 * 1024)
+
+/**
+ * @brief Create an empty buffer pool.
+ *
+ * @param min      The smallest buffer size, rounded up to a power of two.
+ * @param max      The largest buffer size, rounded up to a power of two.
+ *
+ * @return The pool, NULL if out of memory.
+ */
+csync_buffer_pool_t *csync_buffer_pool_new(size_t min, size_t max);
+
+/**
+ * @brief Free the pool and the buffers kept in it.
+ */
+void csync_buffer_pool_free(csync_buffer_pool_t *pool);
+
+/**
+ * @brief The buffer size to copy a file with.
+ *
+ * @param pool     The buffer pool.
+ * @param size     The size of the file.
+ * @param local    True if both replicas are local.
+ *
+ * @return The size to pass to csync_buffer_get().
+ */
+size_t csync_buffer_size(csync_buffer_pool_t *pool, int64_t size, bool local);
+
+/* Get a buffer of a size returned by csync_buffer_size(), NULL if out of memory */
+void *csync_buffer_get(csync_buffer_pool_t *pool, size_t size);
+
+/* Give a buffer back to the pool, size is the one it was taken with */
+void csync_buffer_put(csync_buffer_pool_t *pool, void *buf, size_t size);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_BUFFER_H */
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
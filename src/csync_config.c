@@ -34,7 +34,15 @@ enum csync_config_opcode_e {
     COC_UNSUPPORTED = -1,
     COC_MAX_TIMEDIFF,
     COC_MAX_DEPTH,
-    COC_WITH_CONFLICT_COPY
+    COC_WITH_CONFLICT_COPY,
+    COC_WALKER_THREADS,
+    COC_PRELOAD_STATEDB,
+    COC_FULL_SCAN_INTERVAL,
+    COC_RECONCILE_THREADS,
+    COC_PROPAGATION_THREADS,
+    COC_MIN_XFER_BUFFER_SIZE,
+    COC_MAX_XFER_BUFFER_SIZE,
+    COC_DELTA_TRANSFER
 };
 
 struct csync_config_keyword_table_s {
@@ -46,6 +54,14 @@ static struct csync_config_keyword_table_s csync_config_keyword_table[] = {
     { "max_depth", COC_MAX_DEPTH },
     { "max_time_difference", COC_MAX_TIMEDIFF },
     { "with_confilct_copies", COC_WITH_CONFLICT_COPY },
+    { "walker_threads", COC_WALKER_THREADS },
+    { "preload_statedb", COC_PRELOAD_STATEDB },
+    { "full_scan_interval", COC_FULL_SCAN_INTERVAL },
+    { "reconcile_threads", COC_RECONCILE_THREADS },
+    { "propagation_threads", COC_PROPAGATION_THREADS },
+    { "min_xfer_buffer_size", COC_MIN_XFER_BUFFER_SIZE },
+    { "max_xfer_buffer_size", COC_MAX_XFER_BUFFER_SIZE },
+    { "delta_transfer", COC_DELTA_TRANSFER },
     { NULL, COC_UNSUPPORTED }
 };
 
@@ -191,6 +207,8 @@ static const char *csync_config_get_str_tok(char **str, const char *def) {
 static int csync_config_get_yesno(char **str, int notfound) {
     const char *p;
 
+    /* skip the '=' */
+    csync_config_get_token(str);
     p = csync_config_get_str_tok(str, NULL);
     if (p == NULL) {
         return notfound;
@@ -258,6 +276,58 @@ static int csync_config_parse_line(CSYNC *ctx,
                 ctx->options.with_conflict_copys = false;
             }
             break;
+        case COC_WALKER_THREADS:
+            i = csync_config_get_int(&s, 0);
+            if (i >= 0) {
+                ctx->options.walker_threads = i;
+            }
+            break;
+        case COC_PRELOAD_STATEDB:
+            i = csync_config_get_yesno(&s, -1);
+            if (i > 0) {
+                ctx->options.preload_statedb = true;
+            } else if (i == 0) {
+                ctx->options.preload_statedb = false;
+            }
+            break;
+        case COC_FULL_SCAN_INTERVAL:
+            i = csync_config_get_int(&s, 0);
+            if (i >= 0) {
+                ctx->options.full_scan_interval = i;
+            }
+            break;
+        case COC_RECONCILE_THREADS:
+            i = csync_config_get_int(&s, 0);
+            if (i >= 0) {
+                ctx->options.reconcile_threads = i;
+            }
+            break;
+        case COC_PROPAGATION_THREADS:
+            i = csync_config_get_int(&s, 0);
+            if (i >= 0) {
+                ctx->options.propagation_threads = i;
+            }
+            break;
+        case COC_MIN_XFER_BUFFER_SIZE:
+            i = csync_config_get_int(&s, 64);
+            if (i > 0) {
+                ctx->options.min_xfer_buffer_size = (size_t) i * 1024;
+            }
+            break;
+        case COC_MAX_XFER_BUFFER_SIZE:
+            i = csync_config_get_int(&s, 4096);
+            if (i > 0) {
+                ctx->options.max_xfer_buffer_size = (size_t) i * 1024;
+            }
+            break;
+        case COC_DELTA_TRANSFER:
+            i = csync_config_get_yesno(&s, -1);
+            if (i > 0) {
+                ctx->options.delta_transfer = true;
+            } else if (i == 0) {
+                ctx->options.delta_transfer = false;
+            }
+            break;
         case COC_UNSUPPORTED:
             CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
                       "Unsupported option: %s, line: %d\n",
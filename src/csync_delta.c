@@ -0,0 +1,414 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "c_lib.h"
+#include "c_jhash.h"
+
+#include "csync_delta.h"
+
+#define CSYNC_DELTA_MIN_BLOCK 2048
+#define CSYNC_DELTA_MAX_BLOCK (128 * 1024)
+
+/* the new version is read this many blocks at a time */
+#define CSYNC_DELTA_WINDOW 16
+
+struct _csync_delta_block_s {
+  uint32_t weak;
+  /* the next block in the bucket plus one, 0 ends the bucket */
+  uint32_t next;
+  uint64_t strong;
+};
+
+/*
+ * The blocks of the old version in the order of the file, the blocks with
+ * the same weak checksum are chained in a bucket.
+ */
+struct csync_delta_sig_s {
+  size_t blocksize;
+  size_t nblocks;
+  size_t size;
+  struct _csync_delta_block_s *blocks;
+  /* the first block of a bucket plus one */
+  uint32_t *buckets;
+  size_t mask;
+};
+
+/* the checksum of rsync, two 16 bit sums which can be rolled by a byte */
+struct _csync_delta_sum_s {
+  uint32_t a;
+  uint32_t b;
+};
+
+static void _csync_delta_sum(struct _csync_delta_sum_s *sum,
+                             const uint8_t *p, size_t len) {
+  size_t i;
+
+  sum->a = sum->b = 0;
+  for (i = 0; i < len; i++) {
+    sum->a += p[i];
+    sum->b += (uint32_t) (len - i) * p[i];
+  }
+}
+
+static void _csync_delta_roll(struct _csync_delta_sum_s *sum, size_t len,
+                              uint8_t out, uint8_t in) {
+  sum->a += in - out;
+  sum->b += sum->a - (uint32_t) len * out;
+}
+
+static uint32_t _csync_delta_weak(const struct _csync_delta_sum_s *sum) {
+  return (sum->a & 0xffff) | (sum->b << 16);
+}
+
+static size_t _csync_delta_bucket(uint32_t weak, size_t mask) {
+  return (size_t) ((weak * 0x9E3779B1U) >> 7) & mask;
+}
+
+uint64_t csync_delta_hash(uint64_t hash, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *) buf;
+
+  /* FNV-1a */
+  while (len-- > 0) {
+    hash ^= *p++;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+size_t csync_delta_block_size(int64_t size) {
+  size_t bs = CSYNC_DELTA_MIN_BLOCK;
+
+  /* about the square root of the size, like rsync */
+  while (bs < CSYNC_DELTA_MAX_BLOCK && (int64_t) bs * (int64_t) bs < size) {
+    bs <<= 1;
+  }
+
+  return bs;
+}
+
+/* read until the buffer is full or the end is reached */
+static ssize_t _csync_delta_read_full(csync_delta_read_fn readfn,
+    void *userdata, uint8_t *buf, size_t count) {
+  size_t len = 0;
+  ssize_t n;
+
+  while (len < count) {
+    n = readfn(userdata, buf + len, count - len);
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    len += n;
+  }
+
+  return len;
+}
+
+static int _csync_delta_sig_index(csync_delta_sig_t *sig) {
+  size_t nbuckets = 16;
+  size_t i;
+
+  while (nbuckets < sig->nblocks * 2) {
+    nbuckets <<= 1;
+  }
+
+  sig->buckets = c_malloc(nbuckets * sizeof(uint32_t));
+  if (sig->buckets == NULL) {
+    return -1;
+  }
+  sig->mask = nbuckets - 1;
+
+  /* chained back to front, so a bucket lists the first block first */
+  for (i = sig->nblocks; i > 0; i--) {
+    size_t b = _csync_delta_bucket(sig->blocks[i - 1].weak, sig->mask);
+
+    sig->blocks[i - 1].next = sig->buckets[b];
+    sig->buckets[b] = (uint32_t) i;
+  }
+
+  return 0;
+}
+
+csync_delta_sig_t *csync_delta_signature(size_t blocksize,
+    csync_delta_read_fn readfn, void *userdata) {
+  struct _csync_delta_block_s *blocks = NULL;
+  struct _csync_delta_sum_s sum;
+  csync_delta_sig_t *sig = NULL;
+  uint8_t *buf = NULL;
+  ssize_t n;
+
+  sig = c_malloc(sizeof(csync_delta_sig_t));
+  buf = c_malloc(blocksize);
+  if (sig == NULL || buf == NULL) {
+    goto err;
+  }
+  sig->blocksize = blocksize;
+
+  for (;;) {
+    n = _csync_delta_read_full(readfn, userdata, buf, blocksize);
+    if (n < 0) {
+      goto err;
+    }
+    if ((size_t) n < blocksize) {
+      break;
+    }
+
+    if (sig->nblocks == sig->size) {
+      if (sig->size >= UINT32_MAX / 2) {
+        errno = EFBIG;
+        goto err;
+      }
+      sig->size = sig->size ? sig->size * 2 : 256;
+      blocks = c_realloc(sig->blocks,
+          sig->size * sizeof(struct _csync_delta_block_s));
+      if (blocks == NULL) {
+        goto err;
+      }
+      sig->blocks = blocks;
+    }
+
+    _csync_delta_sum(&sum, buf, blocksize);
+    sig->blocks[sig->nblocks].weak = _csync_delta_weak(&sum);
+    sig->blocks[sig->nblocks].strong = c_jhash64(buf, blocksize, 0);
+    sig->nblocks++;
+  }
+
+  if (_csync_delta_sig_index(sig) < 0) {
+    goto err;
+  }
+
+  SAFE_FREE(buf);
+  return sig;
+err:
+  SAFE_FREE(buf);
+  csync_delta_sig_free(sig);
+  return NULL;
+}
+
+size_t csync_delta_sig_blocks(csync_delta_sig_t *sig) {
+  return sig->nblocks;
+}
+
+void csync_delta_sig_free(csync_delta_sig_t *sig) {
+  if (sig == NULL) {
+    return;
+  }
+
+  SAFE_FREE(sig->blocks);
+  SAFE_FREE(sig->buckets);
+  SAFE_FREE(sig);
+}
+
+/*
+ * Find the block of a window, -1 if there is none. The block following the
+ * last copy is tried first, a run of equal blocks stays one copy then.
+ */
+static ssize_t _csync_delta_find(csync_delta_sig_t *sig, uint32_t weak,
+    const uint8_t *p, size_t hint) {
+  struct _csync_delta_block_s *block = NULL;
+  uint64_t strong = 0;
+  int have_strong = 0;
+  uint32_t i;
+
+  if (hint < sig->nblocks && sig->blocks[hint].weak == weak) {
+    strong = c_jhash64(p, sig->blocksize, 0);
+    have_strong = 1;
+    if (sig->blocks[hint].strong == strong) {
+      return hint;
+    }
+  }
+
+  for (i = sig->buckets[_csync_delta_bucket(weak, sig->mask)]; i != 0;
+       i = block->next) {
+    block = &sig->blocks[i - 1];
+    if (block->weak != weak) {
+      continue;
+    }
+    if (!have_strong) {
+      strong = c_jhash64(p, sig->blocksize, 0);
+      have_strong = 1;
+    }
+    if (block->strong == strong) {
+      return i - 1;
+    }
+  }
+
+  return -1;
+}
+
+struct _csync_delta_out_s {
+  csync_delta_copy_fn copyfn;
+  csync_delta_literal_fn literalfn;
+  void *wdata;
+  /* a copy is held back until the next one can't be merged with it */
+  int64_t offset;
+  size_t len;
+  int64_t literal;
+};
+
+static int _csync_delta_flush_copy(struct _csync_delta_out_s *out) {
+  if (out->len > 0) {
+    if (out->copyfn(out->wdata, out->offset, out->len) < 0) {
+      return -1;
+    }
+    out->len = 0;
+  }
+
+  return 0;
+}
+
+static int _csync_delta_literal(struct _csync_delta_out_s *out,
+    const uint8_t *p, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  if (_csync_delta_flush_copy(out) < 0 ||
+      out->literalfn(out->wdata, p, len) < 0) {
+    return -1;
+  }
+  out->literal += len;
+
+  return 0;
+}
+
+static int _csync_delta_copy(struct _csync_delta_out_s *out, int64_t offset,
+    size_t len) {
+  if (out->len > 0 && out->offset + (int64_t) out->len == offset) {
+    out->len += len;
+    return 0;
+  }
+  if (_csync_delta_flush_copy(out) < 0) {
+    return -1;
+  }
+  out->offset = offset;
+  out->len = len;
+
+  return 0;
+}
+
+int csync_delta_generate(csync_delta_sig_t *sig,
+    csync_delta_read_fn readfn, void *rdata,
+    csync_delta_copy_fn copyfn, csync_delta_literal_fn literalfn, void *wdata,
+    uint64_t *hash, int64_t *literal) {
+  struct _csync_delta_out_s out;
+  struct _csync_delta_sum_s sum;
+  size_t bs = sig->blocksize;
+  size_t cap = bs * CSYNC_DELTA_WINDOW;
+  uint8_t *buf = NULL;
+  /* bytes in the buffer, start of the window and of the pending literal */
+  size_t len = 0;
+  size_t pos = 0;
+  size_t lit = 0;
+  int have_sum = 0;
+  int eof = 0;
+  uint64_t h = CSYNC_DELTA_HASH_INIT;
+  ssize_t match;
+  ssize_t n;
+  int rc = -1;
+
+  ZERO_STRUCT(out);
+  out.copyfn = copyfn;
+  out.literalfn = literalfn;
+  out.wdata = wdata;
+
+  buf = c_malloc(cap);
+  if (buf == NULL) {
+    return -1;
+  }
+
+  for (;;) {
+    if (len - pos < bs && !eof) {
+      /* send the literal before the window and refill behind it */
+      if (_csync_delta_literal(&out, buf + lit, pos - lit) < 0) {
+        goto out;
+      }
+      memmove(buf, buf + pos, len - pos);
+      len -= pos;
+      pos = lit = 0;
+
+      while (len < cap && !eof) {
+        n = readfn(rdata, buf + len, cap - len);
+        if (n < 0) {
+          goto out;
+        }
+        if (n == 0) {
+          eof = 1;
+        }
+        h = csync_delta_hash(h, buf + len, n);
+        len += n;
+      }
+      continue;
+    }
+
+    if (len - pos < bs) {
+      /* the rest is shorter than a block */
+      break;
+    }
+
+    if (!have_sum) {
+      _csync_delta_sum(&sum, buf + pos, bs);
+      have_sum = 1;
+    }
+
+    match = _csync_delta_find(sig, _csync_delta_weak(&sum), buf + pos,
+        out.len > 0 ? (size_t) ((out.offset + out.len) / bs) : 0);
+    if (match >= 0) {
+      if (_csync_delta_literal(&out, buf + lit, pos - lit) < 0 ||
+          _csync_delta_copy(&out, (int64_t) match * bs, bs) < 0) {
+        goto out;
+      }
+      pos += bs;
+      lit = pos;
+      have_sum = 0;
+      continue;
+    }
+
+    if (pos + bs < len) {
+      _csync_delta_roll(&sum, bs, buf[pos], buf[pos + bs]);
+    } else {
+      have_sum = 0;
+    }
+    pos++;
+  }
+
+  if (_csync_delta_literal(&out, buf + lit, len - lit) < 0 ||
+      _csync_delta_flush_copy(&out) < 0) {
+    goto out;
+  }
+
+  *hash = h;
+  if (literal != NULL) {
+    *literal = out.literal;
+  }
+  rc = 0;
+out:
+  SAFE_FREE(buf);
+  return rc;
+}
+
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -0,0 +1,113 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_DELTA_H
+#define _CSYNC_DELTA_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * @file csync_delta.h
+ *
+ * @brief Delta transfer of changed files
+ *
+ * The old version of a file is split into blocks, each block gets a weak
+ * rolling checksum and a strong hash, that is the signature. The new version
+ * is scanned byte by byte with the rolling checksum, a window matching a
+ * block of the signature is sent as a copy of that block, everything else
+ * as literal data. Applied to a reflink of the old version, a copy of a
+ * block at the same offset needs no write at all.
+ *
+ * The engine doesn't do any I/O itself, it reads and writes through
+ * callbacks.
+ *
+ * @defgroup csyncDeltaInternals csync delta transfer internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+/* files smaller than this are sent as a whole */
+#define CSYNC_DELTA_MIN_SIZE (1024 * 1024)
+
+typedef struct csync_delta_sig_s csync_delta_sig_t;
+
+/* read like read(2), 0 at the end */
+typedef ssize_t (*csync_delta_read_fn)(void *userdata, void *buf, size_t count);
+
+/* copy len bytes from offset of the old version, returns -1 on error */
+typedef int (*csync_delta_copy_fn)(void *userdata, int64_t offset, size_t len);
+
+/* write literal data, returns -1 on error */
+typedef int (*csync_delta_literal_fn)(void *userdata, const void *buf, size_t len);
+
+/* The start value of csync_delta_hash() */
+#define CSYNC_DELTA_HASH_INIT 0xcbf29ce484222325ULL
+
+/* Hash a stream in pieces of any size, the hash of the whole file is compared */
+uint64_t csync_delta_hash(uint64_t hash, const void *buf, size_t len);
+
+/* The block size of the signature of a file */
+size_t csync_delta_block_size(int64_t size);
+
+/**
+ * @brief Build the signature of the old version of a file.
+ *
+ * @param blocksize  The block size, see csync_delta_block_size().
+ * @param readfn     Reads the old version from the start.
+ * @param userdata   Passed to readfn.
+ *
+ * @return The signature, NULL on error with errno set.
+ */
+csync_delta_sig_t *csync_delta_signature(size_t blocksize,
+    csync_delta_read_fn readfn, void *userdata);
+
+/* The number of blocks in the signature, a short last block isn't used */
+size_t csync_delta_sig_blocks(csync_delta_sig_t *sig);
+
+void csync_delta_sig_free(csync_delta_sig_t *sig);
+
+/**
+ * @brief Turn the new version of a file into copies and literal data.
+ *
+ * Copies of consecutive blocks are merged into one.
+ *
+ * @param sig        The signature of the old version.
+ * @param readfn     Reads the new version from the start.
+ * @param rdata      Passed to readfn.
+ * @param copyfn     Called for the data found in the old version.
+ * @param literalfn  Called for the data not found.
+ * @param wdata      Passed to copyfn and literalfn.
+ * @param hash       Set to the csync_delta_hash() of the new version.
+ * @param literal    Set to the number of literal bytes, may be NULL.
+ *
+ * @return 0 on success, -1 if a callback failed or out of memory.
+ */
+int csync_delta_generate(csync_delta_sig_t *sig,
+    csync_delta_read_fn readfn, void *rdata,
+    csync_delta_copy_fn copyfn, csync_delta_literal_fn literalfn, void *wdata,
+    uint64_t *hash, int64_t *literal);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_DELTA_H */
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -26,6 +26,7 @@
 #include <unistd.h>
 
 #include "c_lib.h"
+#include "c_jhash.h"
 
 #include "csync_private.h"
 #include "csync_exclude.h"
@@ -34,6 +35,464 @@
 #define CSYNC_LOG_CATEGORY_NAME "csync.exclude"
 #include "csync_log.h"
 
+/* the statedb and its temporary files */
+#define CSYNC_EXCLUDE_JOURNAL ".csync_journal.db"
+
+/*
+ * The exclude list is compiled into a matcher when it is loaded. Patterns
+ * without wildcards are kept in a hash table, "name*" and "*name" patterns in
+ * a trie of the prefixes and of the reversed suffixes. Patterns with only '*'
+ * wildcards are matched by _csync_exclude_glob(), anything else is left to
+ * csync_fnmatch(). All of them match like csync_fnmatch() with no flags.
+ */
+enum _csync_exclude_type_e {
+  CSYNC_EXCLUDE_LITERAL,
+  CSYNC_EXCLUDE_PREFIX,
+  CSYNC_EXCLUDE_SUFFIX,
+  CSYNC_EXCLUDE_GLOB,
+  CSYNC_EXCLUDE_FNMATCH
+};
+
+/* node 0 is the root, it is never a child, so 0 also marks no node */
+struct _csync_exclude_node_s {
+  size_t child;
+  size_t next;
+  unsigned char c;
+  unsigned char terminal;
+};
+
+struct _csync_exclude_trie_s {
+  struct _csync_exclude_node_s *nodes;
+  size_t count;
+  size_t size;
+};
+
+struct csync_exclude_matcher_s {
+  char **literals;
+  size_t literals_mask;
+  struct _csync_exclude_trie_s prefixes;
+  struct _csync_exclude_trie_s suffixes;
+  c_strlist_t *globs;
+  c_strlist_t *fnmatch;
+};
+
+static int _csync_exclude_trie_add(struct _csync_exclude_trie_s *trie,
+    const char *str, size_t len, int reverse) {
+  size_t node = 0;
+  size_t i;
+
+  if (trie->count == 0) {
+    trie->nodes = c_malloc(64 * sizeof(struct _csync_exclude_node_s));
+    if (trie->nodes == NULL) {
+      return -1;
+    }
+    trie->size = 64;
+    trie->count = 1;
+  }
+
+  for (i = 0; i < len; i++) {
+    unsigned char c = str[reverse ? len - i - 1 : i];
+    size_t n;
+
+    for (n = trie->nodes[node].child; n != 0; n = trie->nodes[n].next) {
+      if (trie->nodes[n].c == c) {
+        break;
+      }
+    }
+    if (n == 0) {
+      if (trie->count == trie->size) {
+        struct _csync_exclude_node_s *nodes;
+
+        nodes = c_realloc(trie->nodes,
+            2 * trie->size * sizeof(struct _csync_exclude_node_s));
+        if (nodes == NULL) {
+          return -1;
+        }
+        trie->nodes = nodes;
+        trie->size *= 2;
+      }
+      n = trie->count++;
+      trie->nodes[n].c = c;
+      trie->nodes[n].terminal = 0;
+      trie->nodes[n].child = 0;
+      trie->nodes[n].next = trie->nodes[node].child;
+      trie->nodes[node].child = n;
+    }
+    node = n;
+  }
+  trie->nodes[node].terminal = 1;
+
+  return 0;
+}
+
+/* Check if a pattern of the trie is a prefix, or a suffix if reverse is set */
+static int _csync_exclude_trie_match(const struct _csync_exclude_trie_s *trie,
+    const char *str, size_t len, int reverse) {
+  size_t node = 0;
+  size_t i;
+
+  if (trie->count == 0) {
+    return 0;
+  }
+
+  for (i = 0; !trie->nodes[node].terminal; i++) {
+    unsigned char c;
+    size_t n;
+
+    if (i == len) {
+      return 0;
+    }
+    c = str[reverse ? len - i - 1 : i];
+    for (n = trie->nodes[node].child; n != 0; n = trie->nodes[n].next) {
+      if (trie->nodes[n].c == c) {
+        break;
+      }
+    }
+    if (n == 0) {
+      return 0;
+    }
+    node = n;
+  }
+
+  return 1;
+}
+
+static size_t _csync_exclude_literal_slot(const char *str, size_t len,
+    size_t mask) {
+  return (size_t) c_jhash64((uint8_t *) str, len, 0) & mask;
+}
+
+static int _csync_exclude_literal_match(const csync_exclude_matcher_t *m,
+    const char *str, size_t len) {
+  size_t i;
+
+  if (m->literals == NULL) {
+    return 0;
+  }
+
+  for (i = _csync_exclude_literal_slot(str, len, m->literals_mask);
+       m->literals[i] != NULL;
+       i = (i + 1) & m->literals_mask) {
+    if (strncmp(m->literals[i], str, len) == 0 && m->literals[i][len] == '\0') {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Match a pattern with '*' as the only wildcard like csync_fnmatch() */
+static int _csync_exclude_glob(const char *p, const char *str, size_t len) {
+  const char *star = NULL;
+  size_t backtrack = 0;
+  size_t i = 0;
+
+  while (i < len) {
+    const char *next;
+    char c;
+
+    if (*p == '*') {
+      while (*p == '*') {
+        p++;
+      }
+      if (*p == '\0') {
+        return 1;
+      }
+      star = p;
+      backtrack = i;
+      continue;
+    }
+
+    c = *p;
+    next = p + 1;
+    if (c == '\\') {
+      c = p[1];
+      next = p + 2;
+    }
+    if (c != '\0' && c == str[i]) {
+      p = next;
+      i++;
+    } else if (star != NULL) {
+      /* let the last star eat one more character */
+      p = star;
+      i = ++backtrack;
+    } else {
+      return 0;
+    }
+  }
+
+  while (*p == '*') {
+    p++;
+  }
+
+  return *p == '\0';
+}
+
+/*
+ * Sort a pattern into one of the matcher classes. For a literal, prefix or
+ * suffix pattern the name without the wildcards and escapes is returned in
+ * lit.
+ */
+static enum _csync_exclude_type_e _csync_exclude_classify(const char *pattern,
+    char **lit) {
+#ifdef HAVE_FNMATCH
+  const char *p;
+  size_t len;
+  size_t lead = 0;
+  size_t trail = 0;
+  size_t n = 0;
+  int inner = 0;
+  char *buf;
+
+  *lit = NULL;
+
+  len = strlen(pattern);
+  buf = c_malloc(len + 1);
+  if (buf == NULL) {
+    return CSYNC_EXCLUDE_FNMATCH;
+  }
+
+  for (p = pattern; *p != '\0'; p++) {
+    switch (*p) {
+      case '?':
+      case '[':
+        SAFE_FREE(buf);
+        return CSYNC_EXCLUDE_FNMATCH;
+      case '\\':
+        if (p[1] == '\0') {
+          SAFE_FREE(buf);
+          return CSYNC_EXCLUDE_FNMATCH;
+        }
+        p++;
+        if (trail > 0) {
+          inner = 1;
+        }
+        trail = 0;
+        buf[n++] = *p;
+        break;
+      case '*':
+        if (n == 0) {
+          lead++;
+        } else {
+          trail++;
+        }
+        break;
+      default:
+        if (trail > 0) {
+          inner = 1;
+        }
+        trail = 0;
+        buf[n++] = *p;
+        break;
+    }
+  }
+  buf[n] = '\0';
+
+  if (inner || (lead > 0 && trail > 0)) {
+    SAFE_FREE(buf);
+    return CSYNC_EXCLUDE_GLOB;
+  }
+
+  *lit = buf;
+  if (lead > 0) {
+    return CSYNC_EXCLUDE_SUFFIX;
+  }
+  if (trail > 0) {
+    return CSYNC_EXCLUDE_PREFIX;
+  }
+
+  return CSYNC_EXCLUDE_LITERAL;
+#else
+  /* the Windows matcher has its own rules */
+  (void) pattern;
+  *lit = NULL;
+
+  return CSYNC_EXCLUDE_FNMATCH;
+#endif
+}
+
+static void _csync_exclude_matcher_free(csync_exclude_matcher_t *m) {
+  size_t i;
+
+  if (m == NULL) {
+    return;
+  }
+
+  if (m->literals != NULL) {
+    for (i = 0; i <= m->literals_mask; i++) {
+      SAFE_FREE(m->literals[i]);
+    }
+    SAFE_FREE(m->literals);
+  }
+  SAFE_FREE(m->prefixes.nodes);
+  SAFE_FREE(m->suffixes.nodes);
+  c_strlist_destroy(m->globs);
+  c_strlist_destroy(m->fnmatch);
+  SAFE_FREE(m);
+}
+
+static int _csync_exclude_strlist_add(c_strlist_t **list, const char *str) {
+  c_strlist_t *tmp;
+
+  if (*list == NULL) {
+    *list = c_strlist_new(8);
+    if (*list == NULL) {
+      return -1;
+    }
+  }
+
+  if ((*list)->count == (*list)->size) {
+    tmp = c_strlist_expand(*list, 2 * (*list)->size);
+    if (tmp == NULL) {
+      return -1;
+    }
+    *list = tmp;
+  }
+
+  return c_strlist_add(*list, str);
+}
+
+static csync_exclude_matcher_t *_csync_exclude_compile(c_strlist_t *excludes) {
+  csync_exclude_matcher_t *m = NULL;
+  size_t size = 16;
+  size_t i;
+  int rc = 0;
+
+  m = c_malloc(sizeof(csync_exclude_matcher_t));
+  if (m == NULL) {
+    return NULL;
+  }
+
+  /* keep the literal table at most half full */
+  while (size < 2 * excludes->count) {
+    size *= 2;
+  }
+  m->literals = c_malloc(size * sizeof(char *));
+  if (m->literals == NULL) {
+    goto err;
+  }
+  m->literals_mask = size - 1;
+
+  for (i = 0; rc == 0 && i < excludes->count; i++) {
+    const char *pattern = excludes->vector[i];
+    char *lit = NULL;
+    size_t len;
+    size_t slot;
+
+    switch (_csync_exclude_classify(pattern, &lit)) {
+      case CSYNC_EXCLUDE_LITERAL:
+        len = strlen(lit);
+        if (_csync_exclude_literal_match(m, lit, len)) {
+          SAFE_FREE(lit);
+          break;
+        }
+        slot = _csync_exclude_literal_slot(lit, len, m->literals_mask);
+        while (m->literals[slot] != NULL) {
+          slot = (slot + 1) & m->literals_mask;
+        }
+        m->literals[slot] = lit;
+        break;
+      case CSYNC_EXCLUDE_PREFIX:
+        rc = _csync_exclude_trie_add(&m->prefixes, lit, strlen(lit), 0);
+        SAFE_FREE(lit);
+        break;
+      case CSYNC_EXCLUDE_SUFFIX:
+        rc = _csync_exclude_trie_add(&m->suffixes, lit, strlen(lit), 1);
+        SAFE_FREE(lit);
+        break;
+      case CSYNC_EXCLUDE_GLOB:
+        rc = _csync_exclude_strlist_add(&m->globs, pattern);
+        break;
+      case CSYNC_EXCLUDE_FNMATCH:
+        rc = _csync_exclude_strlist_add(&m->fnmatch, pattern);
+        break;
+    }
+  }
+  if (rc < 0) {
+    goto err;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "Compiled %zu exclude patterns, %zu prefix and %zu suffix trie nodes, "
+      "%zu globs, %zu fnmatch patterns", excludes->count,
+      m->prefixes.count, m->suffixes.count,
+      m->globs ? m->globs->count : 0, m->fnmatch ? m->fnmatch->count : 0);
+
+  return m;
+err:
+  _csync_exclude_matcher_free(m);
+  return NULL;
+}
+
+static int _csync_exclude_match(const csync_exclude_matcher_t *m,
+    const char *str, size_t len) {
+  size_t i;
+
+  if (_csync_exclude_literal_match(m, str, len) ||
+      _csync_exclude_trie_match(&m->prefixes, str, len, 0) ||
+      _csync_exclude_trie_match(&m->suffixes, str, len, 1)) {
+    return 1;
+  }
+
+  for (i = 0; m->globs != NULL && i < m->globs->count; i++) {
+    if (_csync_exclude_glob(m->globs->vector[i], str, len)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* csync_fnmatch() needs terminated strings */
+static int _csync_exclude_fnmatch(const csync_exclude_matcher_t *m,
+    const char *str) {
+  size_t i;
+
+  for (i = 0; m->fnmatch != NULL && i < m->fnmatch->count; i++) {
+    if (csync_fnmatch(m->fnmatch->vector[i], str, 0) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * The same name as c_basename() returns, but pointing into the path. It is
+ * only terminated if the path has no trailing slashes.
+ */
+static const char *_csync_exclude_basename(const char *path, size_t *len) {
+  size_t plen = strlen(path);
+  size_t end;
+  size_t start;
+
+  if (plen == 0) {
+    *len = 1;
+    return ".";
+  }
+
+  end = plen;
+  while (end > 0 && path[end - 1] == '/') {
+    --end;
+  }
+  if (end == 0) {
+    *len = 1;
+    return "/";
+  }
+
+  start = end;
+  while (start > 0 && path[start - 1] != '/') {
+    --start;
+  }
+  if (start == 0) {
+    *len = plen;
+    return path;
+  }
+
+  *len = end - start;
+  return path + start;
+}
+
 static int _csync_exclude_add(CSYNC *ctx, const char *string) {
     c_strlist_t *list;
 
@@ -123,6 +582,16 @@ int csync_exclude_load(CSYNC *ctx, const char *fname) {
     }
   }
 
+  /* compile the whole list again, it is loaded from several files */
+  if (ctx->excludes != NULL) {
+    _csync_exclude_matcher_free(ctx->exclude_matcher);
+    ctx->exclude_matcher = _csync_exclude_compile(ctx->excludes);
+    if (ctx->exclude_matcher == NULL) {
+      rc = -1;
+      goto out;
+    }
+  }
+
   rc = 0;
 out:
   SAFE_FREE(buf);
@@ -131,14 +600,17 @@ out:
 }
 
 void csync_exclude_destroy(CSYNC *ctx) {
+  _csync_exclude_matcher_free(ctx->exclude_matcher);
+  ctx->exclude_matcher = NULL;
   c_strlist_destroy(ctx->excludes);
 }
 
 int csync_excluded(CSYNC *ctx, const char *path) {
-  size_t i;
+  const csync_exclude_matcher_t *m = ctx->exclude_matcher;
   const char *p;
-  char *bname;
-  int rc;
+  const char *bname;
+  char *tmp = NULL;
+  size_t blen;
   int match = 0;
 
   if (! ctx->options.unix_extensions) {
@@ -159,40 +631,34 @@ int csync_excluded(CSYNC *ctx, const char *path) {
     }
   }
 
-  rc = csync_fnmatch(".csync_journal.db*", path, 0);
-  if (rc == 0) {
-      return 1;
-  }
+  bname = _csync_exclude_basename(path, &blen);
 
-  bname = c_basename(path);
-  if (bname == NULL) {
-      return 0;
+  if (strncmp(path, CSYNC_EXCLUDE_JOURNAL, sizeof(CSYNC_EXCLUDE_JOURNAL) - 1) == 0 ||
+      (blen >= sizeof(CSYNC_EXCLUDE_JOURNAL) - 1 &&
+       strncmp(bname, CSYNC_EXCLUDE_JOURNAL, sizeof(CSYNC_EXCLUDE_JOURNAL) - 1) == 0)) {
+    return 1;
   }
 
-  rc = csync_fnmatch(".csync_journal.db*", bname, 0);
-  if (rc == 0) {
-      match = 1;
-      goto out;
+  if (m == NULL) {
+    return 0;
   }
 
-  if (ctx->excludes == NULL) {
-      goto out;
+  if (_csync_exclude_match(m, path, strlen(path)) ||
+      _csync_exclude_match(m, bname, blen)) {
+    return 1;
   }
 
-  for (i = 0; match == 0 && i < ctx->excludes->count; i++) {
-      rc = csync_fnmatch(ctx->excludes->vector[i], path, 0);
-      if (rc == 0) {
-          match = 1;
-      }
-
-      rc = csync_fnmatch(ctx->excludes->vector[i], bname, 0);
-      if (rc == 0) {
-          match = 1;
+  if (m->fnmatch != NULL) {
+    if (bname[blen] != '\0') {
+      tmp = c_strndup(bname, blen);
+      if (tmp == NULL) {
+        return 0;
       }
+      bname = tmp;
+    }
+    match = _csync_exclude_fnmatch(m, path) || _csync_exclude_fnmatch(m, bname);
+    SAFE_FREE(tmp);
   }
 
-out:
-  free(bname);
   return match;
 }
-
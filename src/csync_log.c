@@ -37,6 +37,11 @@ CSYNC_THREAD int csync_log_level;
 CSYNC_THREAD csync_log_callback csync_log_cb;
 CSYNC_THREAD void *csync_log_userdata;
 
+#ifdef HAVE_PTHREAD
+/* the callback is copied into the worker threads, call it one at a time */
+static pthread_mutex_t csync_log_cb_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static int current_timestring(int hires, char *buf, size_t len)
 {
     char tbuf[64];
@@ -71,6 +76,11 @@ static void csync_log_stderr(int verbosity,
     int rc;
 
     rc = current_timestring(1, date, sizeof(date));
+
+    /* the walks log from several threads, keep the lines together */
+#ifndef _WIN32
+    flockfile(stderr);
+#endif
     if (rc == 0) {
         fprintf(stderr, "[%s, %d] %s:", date, verbosity, function);
     } else {
@@ -78,6 +88,9 @@ static void csync_log_stderr(int verbosity,
     }
 
     fprintf(stderr, "  %s\n", buffer);
+#ifndef _WIN32
+    funlockfile(stderr);
+#endif
 }
 static void csync_log_function(int verbosity,
                                const char *function,
@@ -89,10 +102,16 @@ static void csync_log_function(int verbosity,
 
         snprintf(buf, sizeof(buf), "%s: %s", function, buffer);
 
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&csync_log_cb_lock);
+#endif
         log_fn(verbosity,
                function,
                buf,
                csync_get_log_userdata());
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&csync_log_cb_lock);
+#endif
         return;
     }
 
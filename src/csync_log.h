@@ -54,13 +54,20 @@ enum csync_log_priority_e {
     CSYNC_LOG_PRIORITY_UNKNOWN,
 };
 
+/* the arguments are only evaluated if the message is logged */
 #define CSYNC_LOG(priority, ...) \
-  csync_log(priority, __func__, __VA_ARGS__)
+  do { \
+    if ((priority) <= csync_get_log_level()) { \
+      csync_log(priority, __func__, __VA_ARGS__); \
+    } \
+  } while (0)
 
 void csync_log(int verbosity,
                const char *function,
                const char *format, ...) PRINTF_ATTRIBUTE(3, 4);
 
+int csync_get_log_level(void);
+
 /**
  * }@
  */
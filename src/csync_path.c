@@ -0,0 +1,431 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "c_lib.h"
+#include "c_jhash.h"
+
+#include "csync_path.h"
+
+#define CSYNC_PATH_POOL_MIN_SLOTS 64
+
+/*
+ * The referenced paths are kept in an open addressing table, NULL marks a
+ * free slot. The paths and the directories are allocated from the arena.
+ */
+struct csync_path_pool_s {
+  csync_path_t **slots;
+  size_t mask;
+  size_t count;
+  /* csync_dir_t by the hash of the path, kept until the pool is freed */
+  c_hash_t *dirs;
+  c_arena_t *arena;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+#endif
+};
+
+static void _csync_path_pool_lock(csync_path_pool_t *pool) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&pool->lock);
+#else
+  (void) pool;
+#endif
+}
+
+static void _csync_path_pool_unlock(csync_path_pool_t *pool) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&pool->lock);
+#else
+  (void) pool;
+#endif
+}
+
+static size_t _csync_path_slot(uint64_t phash, size_t mask) {
+  uint64_t h = phash * 0x9E3779B97F4A7C15ULL;
+
+  return (size_t) (h >> 32) & mask;
+}
+
+/* the table is kept half empty */
+static int _csync_path_pool_grow(csync_path_pool_t *pool) {
+  csync_path_t **slots = NULL;
+  size_t nslots = (pool->mask + 1) * 2;
+  size_t n;
+
+  slots = c_malloc(nslots * sizeof(csync_path_t *));
+  if (slots == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (n = 0; n <= pool->mask; n++) {
+    size_t i;
+
+    if (pool->slots[n] == NULL) {
+      continue;
+    }
+    i = _csync_path_slot(pool->slots[n]->phash, nslots - 1);
+    while (slots[i] != NULL) {
+      i = (i + 1) & (nslots - 1);
+    }
+    slots[i] = pool->slots[n];
+  }
+
+  SAFE_FREE(pool->slots);
+  pool->slots = slots;
+  pool->mask = nslots - 1;
+
+  return 0;
+}
+
+/* Returns NULL if the path collides with another directory. */
+static const csync_dir_t *_csync_path_dir_intern(csync_path_pool_t *pool,
+                                                 const char *path, size_t len) {
+  csync_dir_t *dir = NULL;
+  uint64_t h;
+
+  h = c_jhash64((uint8_t *) path, len, 0);
+
+  dir = c_hash_find(pool->dirs, h);
+  if (dir != NULL) {
+    if (dir->pathlen == len && memcmp(dir->path, path, len) == 0) {
+      return dir;
+    }
+    return NULL;
+  }
+
+  dir = c_arena_alloc(pool->arena, offsetof(csync_dir_t, path) + len + 1);
+  if (dir == NULL) {
+    return NULL;
+  }
+  dir->phash = h;
+  dir->pathlen = len;
+  memcpy(dir->path, path, len);
+  dir->path[len] = '\0';
+
+  if (c_hash_insert(pool->dirs, h, dir) < 0) {
+    return NULL;
+  }
+
+  return dir;
+}
+
+static csync_path_t *_csync_path_new(csync_path_pool_t *pool, uint64_t phash,
+                                     const char *path, size_t len) {
+  csync_path_t *p = NULL;
+  const csync_dir_t *dir = NULL;
+  const char *name = path + len;
+  size_t namelen;
+
+  while (name > path && name[-1] != '/') {
+    name--;
+  }
+  if (name > path) {
+    dir = _csync_path_dir_intern(pool, path, name - path - 1);
+  }
+  if (dir == NULL) {
+    /* keep the whole path in the name */
+    name = path;
+  }
+  namelen = len - (name - path);
+
+  p = c_arena_alloc(pool->arena, offsetof(csync_path_t, name) + namelen + 1);
+  if (p == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  p->phash = phash;
+  p->dir = dir;
+  p->refcount = 1;
+  p->namelen = namelen;
+  memcpy(p->name, name, namelen);
+  p->name[namelen] = '\0';
+
+  return p;
+}
+
+static int _csync_path_equal(const csync_path_t *p, const char *path,
+                             size_t len) {
+  if (csync_path_len(p) != len) {
+    return 0;
+  }
+
+  if (p->dir != NULL) {
+    if (memcmp(p->dir->path, path, p->dir->pathlen) != 0) {
+      return 0;
+    }
+    path += p->dir->pathlen + 1;
+  }
+
+  return memcmp(p->name, path, p->namelen) == 0;
+}
+
+csync_path_pool_t *csync_path_pool_new(void) {
+  csync_path_pool_t *pool = NULL;
+
+  pool = c_malloc(sizeof(csync_path_pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  pool->slots = c_malloc(CSYNC_PATH_POOL_MIN_SLOTS * sizeof(csync_path_t *));
+  pool->mask = CSYNC_PATH_POOL_MIN_SLOTS - 1;
+  pool->dirs = c_hash_new(0);
+  pool->arena = c_arena_new(0);
+  if (pool->slots == NULL || pool->dirs == NULL || pool->arena == NULL) {
+    SAFE_FREE(pool->slots);
+    c_hash_free(pool->dirs);
+    c_arena_free(pool->arena);
+    SAFE_FREE(pool);
+    return NULL;
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&pool->lock, NULL);
+#endif
+
+  return pool;
+}
+
+void csync_path_pool_free(csync_path_pool_t *pool) {
+  if (pool == NULL) {
+    return;
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&pool->lock);
+#endif
+  SAFE_FREE(pool->slots);
+  c_hash_free(pool->dirs);
+  c_arena_free(pool->arena);
+  SAFE_FREE(pool);
+}
+
+size_t csync_path_pool_count(csync_path_pool_t *pool) {
+  size_t count;
+
+  if (pool == NULL) {
+    return 0;
+  }
+
+  _csync_path_pool_lock(pool);
+  count = pool->count;
+  _csync_path_pool_unlock(pool);
+
+  return count;
+}
+
+const csync_path_t *csync_path_get(csync_path_pool_t *pool, uint64_t phash,
+                                   const char *path, size_t len) {
+  csync_path_t *p = NULL;
+  size_t i;
+
+  if (pool == NULL || path == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (len > UINT32_MAX) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  _csync_path_pool_lock(pool);
+
+  for (i = _csync_path_slot(phash, pool->mask); pool->slots[i] != NULL; i = (i + 1) & pool->mask) {
+    p = pool->slots[i];
+    if (p->phash != phash) {
+      continue;
+    }
+    if (!_csync_path_equal(p, path, len)) {
+      errno = EEXIST;
+      p = NULL;
+      goto out;
+    }
+    p->refcount++;
+    goto out;
+  }
+
+  if ((pool->count + 1) * 2 > pool->mask + 1) {
+    if (_csync_path_pool_grow(pool) < 0) {
+      p = NULL;
+      goto out;
+    }
+    i = _csync_path_slot(phash, pool->mask);
+    while (pool->slots[i] != NULL) {
+      i = (i + 1) & pool->mask;
+    }
+  }
+
+  p = _csync_path_new(pool, phash, path, len);
+  if (p == NULL) {
+    goto out;
+  }
+  pool->slots[i] = p;
+  pool->count++;
+
+out:
+  _csync_path_pool_unlock(pool);
+  return p;
+}
+
+const csync_path_t *csync_path_ref(csync_path_pool_t *pool,
+                                   const csync_path_t *path) {
+  if (pool == NULL || path == NULL) {
+    return path;
+  }
+
+  _csync_path_pool_lock(pool);
+  ((csync_path_t *) path)->refcount++;
+  _csync_path_pool_unlock(pool);
+
+  return path;
+}
+
+void csync_path_put(csync_path_pool_t *pool, const csync_path_t *path) {
+  csync_path_t *p = (csync_path_t *) path;
+  size_t i;
+  size_t j;
+
+  if (pool == NULL || p == NULL) {
+    return;
+  }
+
+  _csync_path_pool_lock(pool);
+  if (--p->refcount > 0) {
+    goto out;
+  }
+
+  for (i = _csync_path_slot(p->phash, pool->mask); pool->slots[i] != p; i = (i + 1) & pool->mask) {
+    if (pool->slots[i] == NULL) {
+      goto out;
+    }
+  }
+  pool->slots[i] = NULL;
+  pool->count--;
+
+  /* move the following paths back which can't be found anymore */
+  for (j = (i + 1) & pool->mask; pool->slots[j] != NULL; j = (j + 1) & pool->mask) {
+    size_t k = _csync_path_slot(pool->slots[j]->phash, pool->mask);
+
+    if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+      pool->slots[i] = pool->slots[j];
+      pool->slots[j] = NULL;
+      i = j;
+    }
+  }
+
+out:
+  _csync_path_pool_unlock(pool);
+}
+
+size_t csync_path_len(const csync_path_t *path) {
+  if (path->dir == NULL) {
+    return path->namelen;
+  }
+
+  return path->dir->pathlen + 1 + path->namelen;
+}
+
+char *csync_path_str(const csync_path_t *path) {
+  char *str = NULL;
+  size_t len;
+
+  len = csync_path_len(path);
+  str = c_malloc(len + 1);
+  if (str == NULL) {
+    return NULL;
+  }
+
+  if (path->dir != NULL) {
+    memcpy(str, path->dir->path, path->dir->pathlen);
+    str[path->dir->pathlen] = '/';
+  }
+  memcpy(str + len - path->namelen, path->name, path->namelen + 1);
+
+  return str;
+}
+
+/* the character at position i of the path, 0 at the end */
+static unsigned char _csync_path_char(const csync_path_t *path, size_t i) {
+  if (path->dir != NULL) {
+    if (i < path->dir->pathlen) {
+      return path->dir->path[i];
+    } else if (i == path->dir->pathlen) {
+      return '/';
+    }
+    i -= path->dir->pathlen + 1;
+  }
+
+  return i < path->namelen ? path->name[i] : '\0';
+}
+
+int csync_path_cmp(const csync_path_t *a, const csync_path_t *b) {
+  size_t i;
+
+  /* the pool stores every path once */
+  if (a == b) {
+    return 0;
+  }
+
+  for (i = 0;; i++) {
+    unsigned char ca = _csync_path_char(a, i);
+    unsigned char cb = _csync_path_char(b, i);
+
+    if (ca != cb) {
+      return ca < cb ? -1 : 1;
+    }
+    if (ca == '\0') {
+      return 0;
+    }
+  }
+}
+
+int csync_path_is_below(const csync_path_t *path, const csync_path_t *dir) {
+  size_t len;
+  size_t i;
+
+  if (path->dir == NULL) {
+    return 0;
+  }
+
+  len = csync_path_len(dir);
+  if (path->dir->pathlen < len) {
+    return 0;
+  }
+  if (path->dir->pathlen > len && path->dir->path[len] != '/') {
+    return 0;
+  }
+
+  for (i = 0; i < len; i++) {
+    if ((unsigned char) path->dir->path[i] != _csync_path_char(dir, i)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -0,0 +1,102 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_PATH_H
+#define _CSYNC_PATH_H
+
+#include "csync_private.h"
+
+/**
+ * @file csync_path.h
+ *
+ * @brief Path pool shared by the replicas
+ *
+ * Every relative path is stored once per context, keyed by the hash of the
+ * path the update detection computes. The records of the local and the remote
+ * tree and the records read from the statedb point to the same csync_path_t,
+ * so two records have the same path if they have the same path pointer.
+ *
+ * A path is counted for every record pointing to it. The records of the trees
+ * and of the preloaded statedb index keep their reference until the pool is
+ * freed, records returned by the statedb queries drop it when they are freed.
+ * A path nobody refers to anymore is taken out of the pool, its memory is
+ * released with the pool.
+ *
+ * The pool has its own lock, it may be used by parallel walkers.
+ *
+ * @defgroup csyncPathInternals csync path pool internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+/**
+ * @brief Create an empty path pool.
+ *
+ * @return The pool, NULL if out of memory.
+ */
+csync_path_pool_t *csync_path_pool_new(void);
+
+/**
+ * @brief Free the pool and all paths in it.
+ */
+void csync_path_pool_free(csync_path_pool_t *pool);
+
+/* The number of paths referenced at the moment */
+size_t csync_path_pool_count(csync_path_pool_t *pool);
+
+/**
+ * @brief Get a reference to a path, it is added if it isn't in the pool.
+ *
+ * @param pool     The path pool.
+ * @param phash    The hash of the path.
+ * @param path     The relative path.
+ * @param len      The length of the path.
+ *
+ * @return The path, NULL on error with errno set. EEXIST means another path
+ *         with the same hash is in the pool.
+ */
+const csync_path_t *csync_path_get(csync_path_pool_t *pool, uint64_t phash,
+                                   const char *path, size_t len);
+
+/* Take another reference to a path of the pool */
+const csync_path_t *csync_path_ref(csync_path_pool_t *pool,
+                                   const csync_path_t *path);
+
+/* Drop a reference taken with csync_path_get() or csync_path_ref() */
+void csync_path_put(csync_path_pool_t *pool, const csync_path_t *path);
+
+/* The length of a relative path */
+size_t csync_path_len(const csync_path_t *path);
+
+/* Build the relative path as a string, the caller has to free it */
+char *csync_path_str(const csync_path_t *path);
+
+/* Compare two paths like strcmp() */
+int csync_path_cmp(const csync_path_t *a, const csync_path_t *b);
+
+/* Returns 1 if the path is somewhere below the directory, 0 otherwise */
+int csync_path_is_below(const csync_path_t *path, const csync_path_t *dir);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_PATH_H */
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
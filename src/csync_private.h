@@ -32,6 +32,7 @@
 #ifndef _CSYNC_PRIVATE_H
 #define _CSYNC_PRIVATE_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <sqlite3.h>
@@ -48,6 +49,10 @@
 #include <sys/iconv.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "vio/csync_vio_method.h"
 #include "csync_macros.h"
 
@@ -62,10 +67,13 @@
 #define MAX_TIME_DIFFERENCE 10
 
 /**
- * Maximum size of a buffer for transfer
+ * Minimum and maximum size of a buffer for transfer, see csync_buffer.h
  */
+#ifndef MIN_XFER_BUF_SIZE
+#define MIN_XFER_BUF_SIZE (64 * 1024)
+#endif
 #ifndef MAX_XFER_BUF_SIZE
-#define MAX_XFER_BUF_SIZE (16 * 1024)
+#define MAX_XFER_BUF_SIZE (4 * 1024 * 1024)
 #endif
 
 #define CSYNC_STATUS_INIT 1 << 0
@@ -83,6 +91,11 @@ enum csync_replica_e {
   REMOTE_REPLICA
 };
 
+typedef struct csync_statedb_index_s csync_statedb_index_t;
+typedef struct csync_exclude_matcher_s csync_exclude_matcher_t;
+typedef struct csync_path_pool_s csync_path_pool_t;
+typedef struct csync_buffer_pool_s csync_buffer_pool_t;
+
 /**
  * @brief csync public structure
  */
@@ -94,26 +107,55 @@ struct csync_s {
       void *userdata;
   } callbacks;
   c_strlist_t *excludes;
+  /* the excludes compiled by csync_exclude_load() */
+  csync_exclude_matcher_t *exclude_matcher;
+
+  /* the paths of the records of both replicas and of the statedb */
+  csync_path_pool_t *paths;
 
   struct {
     char *file;
     sqlite3 *db;
     int exists;
     int disabled;
+    /* preloaded metadata table, used for the lookups if set */
+    csync_statedb_index_t *index;
+    /* take unchanged local directories from the statedb in this run */
+    int incremental;
+    /* start of the local walk in the last and in this run */
+    time_t last_scan;
+    time_t scan_start;
   } statedb;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_hash_t *tree;
+    /* the records of the tree, released at once */
+    c_arena_t *arena;
     c_list_t *list;
     enum csync_replica_e type;
+    /* the partial copies of unfinished transfers, keyed like the tree */
+    c_hash_t *partials;
   } local;
 
+  /* changes recorded by a watcher, see csync_watch.h */
+  struct {
+    c_strlist_t *dirty;
+    c_strlist_t *tree;
+    int enabled;
+  } watch;
+
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_hash_t *tree;
+    /* the records of the tree, released at once */
+    c_arena_t *arena;
     c_list_t *list;
     enum csync_replica_e type;
+    /* the partial copies of unfinished transfers, keyed like the tree */
+    c_hash_t *partials;
+    /* csync_etag_t of the remote directories seen in this run */
+    c_list_t *etags;
   } remote;
 
   struct {
@@ -131,6 +173,14 @@ struct csync_s {
     char *config_dir;
     bool with_conflict_copys;
     bool local_only_mode;
+    int walker_threads;
+    bool preload_statedb;
+    int full_scan_interval;
+    int reconcile_threads;
+    int propagation_threads;
+    size_t min_xfer_buffer_size;
+    size_t max_xfer_buffer_size;
+    bool delta_transfer;
 #if defined(HAVE_ICONV) && defined(WITH_ICONV)
     iconv_t iconv_cd;
 #endif
@@ -157,6 +207,19 @@ struct csync_s {
   /* csync error code */
   enum csync_status_codes_e status_code;
 
+#ifdef HAVE_PTHREAD
+  /* guards the replica tree and the statedb during a parallel walk */
+  pthread_mutex_t *walk_lock;
+  /* guards the progress and the cleanup lists during a parallel propagation */
+  pthread_mutex_t *propagate_lock;
+#endif
+
+  /* a propagation worker runs on a copy, this is the context it was copied from */
+  struct csync_s *propagate_ctx;
+
+  /* the transfer buffers of a propagation */
+  csync_buffer_pool_t *buffers;
+
   char *error_string;
 
   int status;
@@ -168,33 +231,97 @@ enum csync_ftw_type_e {
   CSYNC_FTW_TYPE_DIR
 };
 
-#ifdef _MSC_VER
-#pragma pack(1)
-#endif
+/*
+ * A directory of the path pool. Its path is stored once and shared by the
+ * paths of the entries in it.
+ */
+struct csync_dir_s {
+  uint64_t phash;
+  size_t pathlen;
+  char path[1];
+};
+
+typedef struct csync_dir_s csync_dir_t;
+
+/*
+ * A relative path in the path pool, the path of its directory, a slash and
+ * the name. A path without a directory, like an entry of the top directory,
+ * has the whole relative path as name. The records of both replicas and of
+ * the statedb point to the same path, see csync_path.h.
+ */
+struct csync_path_s {
+  uint64_t phash;
+  const csync_dir_t *dir;
+  uint32_t refcount;
+  uint32_t namelen;
+  char name[1];
+};
+
+typedef struct csync_path_s csync_path_t;
+
 struct csync_file_stat_s {
-  uint64_t phash;   /* u64 */
-  time_t modtime;   /* u64 */
-  off_t size;       /* u64 */
-  size_t pathlen;   /* u64 */
-  ino_t inode;      /* u64 */
-  uid_t uid;        /* u32 */
-  gid_t gid;        /* u32 */
-  mode_t mode;      /* u32 */
-  int nlink;        /* u32 */
-  int type;         /* u32 */
-  enum csync_instructions_e instruction; /* u32 */
-  char path[1]; /* u8 */
-}
-#if !defined(__SUNPRO_C) && !defined(_MSC_VER)
-__attribute__ ((packed))
-#endif
-#ifdef _MSC_VER
-#pragma pack()
-#endif
-;
+  uint64_t phash;
+  time_t modtime;
+  off_t size;
+  ino_t inode;
+  const csync_path_t *path;
+  /* the path before a local rename, only set with CSYNC_INSTRUCTION_RENAME */
+  const csync_path_t *old_path;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t mode;
+  uint32_t nlink;
+  uint16_t instruction; /* enum csync_instructions_e */
+  uint8_t type;         /* enum csync_ftw_type_e */
+};
 
 typedef struct csync_file_stat_s csync_file_stat_t;
 
+/* print the path of a record without building it */
+#define CSYNC_PATH_FMT "%s%s%s"
+#define CSYNC_PATH_ARGS(st) \
+  ((st)->path->dir ? (st)->path->dir->path : ""), \
+  ((st)->path->dir ? "/" : ""), (st)->path->name
+
+/*
+ * ETag of a remote directory. The server changes it whenever anything below
+ * the directory changes. The etag string is stored behind the path.
+ */
+struct csync_etag_s {
+  uint64_t phash;
+  size_t pathlen;
+  char *etag;
+  char path[1];
+};
+
+typedef struct csync_etag_s csync_etag_t;
+
+/* the longest token of a module transfer which is kept */
+#define CSYNC_TRANSFER_TOKEN_SIZE 256
+
+/*
+ * A copy to a temporary file which didn't finish. The next run continues it
+ * if the source is unchanged. The temporary name is stored behind the record,
+ * it is empty if a module writes the file in place.
+ */
+struct csync_transfer_s {
+  uint64_t phash;
+  /* the replica the file is copied from */
+  int replica;
+  int64_t size;
+  time_t modtime;
+  ino_t inode;
+  /* the bytes of the temporary file which are on disk */
+  int64_t offset;
+  /* csync_delta_hash() of these bytes, checked before they are used */
+  uint64_t checksum;
+  /* what the module continues a get or put with, see csync_vio_get() */
+  char token[CSYNC_TRANSFER_TOKEN_SIZE];
+  char tmpname[1];
+};
+
+typedef struct csync_transfer_s csync_transfer_t;
+
 /*
  * context for the treewalk function
  */
@@ -206,6 +333,18 @@ struct _csync_treewalk_context_s
 };
 typedef struct _csync_treewalk_context_s _csync_treewalk_context;
 
+#ifdef WITH_ICONV
+/**
+ * @brief Get the iconv source codec set with csync_set_iconv_codec().
+ *
+ * The iconv descriptors are thread local, so worker threads use this to set up
+ * their own conversion.
+ *
+ * @return The codec name or NULL if none is set.
+ */
+const char *csync_get_iconv_codec(void);
+#endif
+
 /**
  * }@
  */
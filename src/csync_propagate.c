@@ -27,11 +27,16 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "csync_private.h"
+#include "csync_buffer.h"
+#include "csync_delta.h"
 #include "csync_misc.h"
+#include "csync_path.h"
 #include "csync_propagate.h"
 #include "csync_statedb.h"
 #include "vio/csync_vio_local.h"
@@ -42,13 +47,18 @@
 #include "c_strerror.h"
 #include "csync_util.h"
 
+/* smaller files are copied again from the start */
+#define CSYNC_TRANSFER_MIN_SIZE (16 * 1024 * 1024)
+/* the bytes copied between two records of a resumable transfer */
+#define CSYNC_TRANSFER_SYNC_SIZE (64 * 1024 * 1024)
+
 static int _csync_cleanup_cmp(const void *a, const void *b) {
   csync_file_stat_t *st_a, *st_b;
 
   st_a = (csync_file_stat_t *) a;
   st_b = (csync_file_stat_t *) b;
 
-  return strcmp(st_a->path, st_b->path);
+  return csync_file_stat_pathcmp(st_a, st_b);
 }
 
 static bool _push_to_tmp_first(CSYNC *ctx)
@@ -73,6 +83,505 @@ static bool _module_supports_get(CSYNC *ctx)
     return ( ctx->module.capabilities.get_support );
 }
 
+/*
+ * The progress and the cleanup lists are kept in the context the workers of
+ * a parallel propagation were started from. Returns that context locked.
+ */
+static CSYNC *_csync_propagation_lock(CSYNC *ctx) {
+#ifdef HAVE_PTHREAD
+  if (ctx->propagate_lock != NULL) {
+    pthread_mutex_lock(ctx->propagate_lock);
+  }
+#endif
+
+  return ctx->propagate_ctx != NULL ? ctx->propagate_ctx : ctx;
+}
+
+static void _csync_propagation_unlock(CSYNC *ctx) {
+#ifdef HAVE_PTHREAD
+  if (ctx->propagate_lock != NULL) {
+    pthread_mutex_unlock(ctx->propagate_lock);
+  }
+#else
+  (void) ctx;
+#endif
+}
+
+static void _csync_propagation_progress(CSYNC *ctx, const char *uri,
+                                        const csync_file_stat_t *st) {
+  CSYNC *shared = NULL;
+
+  if (ctx->callbacks.overall_progress_cb == NULL) {
+    return;
+  }
+
+  /* the callback sees one transfer at a time */
+  shared = _csync_propagation_lock(ctx);
+  shared->progress.byte_current += st->size;
+  ctx->callbacks.overall_progress_cb(uri,
+                                     shared->progress.current_file_no++,
+                                     shared->progress.file_count,
+                                     shared->progress.byte_current,
+                                     shared->progress.byte_sum,
+                                     ctx->callbacks.userdata);
+  _csync_propagation_unlock(ctx);
+}
+
+/*
+ * The csync_delta_hash() of the first len bytes of a file. Returns -1 if it
+ * can't be read or is shorter.
+ */
+static int _csync_file_hash(CSYNC *ctx, csync_vio_handle_t *fp, int64_t len,
+                            uint64_t *hash) {
+  uint64_t h = CSYNC_DELTA_HASH_INIT;
+  size_t bufsize;
+  char *buf = NULL;
+  ssize_t n;
+  int rc = -1;
+
+  bufsize = csync_buffer_size(ctx->buffers, len, true);
+  buf = csync_buffer_get(ctx->buffers, bufsize);
+  if (buf == NULL || csync_vio_lseek(ctx, fp, 0, SEEK_SET) != 0) {
+    goto out;
+  }
+
+  while (len > 0) {
+    n = csync_vio_read(ctx, fp, buf, MIN((int64_t) bufsize, len));
+    if (n <= 0) {
+      goto out;
+    }
+    h = csync_delta_hash(h, buf, n);
+    len -= n;
+  }
+
+  *hash = h;
+  rc = 0;
+out:
+  csync_buffer_put(ctx->buffers, buf, bufsize);
+  return rc;
+}
+
+/*
+ * A delta transfer between two local replicas. The temporary file starts as
+ * a reflink of the old version, only the data which isn't at the same offset
+ * in the old version is written to it.
+ */
+struct _csync_delta_io_s {
+  CSYNC *ctx;
+  /* the new version, read by the generator */
+  csync_vio_handle_t *sfp;
+  /* the temporary file to write and to read the signature from */
+  csync_vio_handle_t *dfp;
+  csync_vio_handle_t *rfp;
+  char *buf;
+  size_t bufsize;
+  /* where the next data of the new version goes, the offset of dfp */
+  int64_t pos;
+  int64_t dpos;
+  /* the bytes written */
+  int64_t written;
+};
+
+static ssize_t _csync_delta_read_old(void *userdata, void *buf, size_t count) {
+  struct _csync_delta_io_s *io = (struct _csync_delta_io_s *) userdata;
+
+  return csync_vio_read(io->ctx, io->rfp, buf, count);
+}
+
+static ssize_t _csync_delta_read_new(void *userdata, void *buf, size_t count) {
+  struct _csync_delta_io_s *io = (struct _csync_delta_io_s *) userdata;
+
+  return csync_vio_read(io->ctx, io->sfp, buf, count);
+}
+
+static int _csync_delta_write(void *userdata, const void *buf, size_t len) {
+  struct _csync_delta_io_s *io = (struct _csync_delta_io_s *) userdata;
+
+  if (io->dpos != io->pos) {
+    if (csync_vio_lseek(io->ctx, io->dfp, io->pos, SEEK_SET) != io->pos) {
+      return -1;
+    }
+    io->dpos = io->pos;
+  }
+  if (csync_vio_write(io->ctx, io->dfp, buf, len) != (ssize_t) len) {
+    return -1;
+  }
+  io->pos += len;
+  io->dpos += len;
+  io->written += len;
+
+  return 0;
+}
+
+/*
+ * A block at the same offset is already in the reflink. A moved one is read
+ * from the new version again, the old one may be overwritten by now.
+ */
+static int _csync_delta_copy(void *userdata, int64_t offset, size_t len) {
+  struct _csync_delta_io_s *io = (struct _csync_delta_io_s *) userdata;
+  int64_t next;
+  ssize_t n;
+
+  if (offset == io->pos) {
+    io->pos += len;
+    return 0;
+  }
+
+  next = csync_vio_lseek(io->ctx, io->sfp, 0, SEEK_CUR);
+  if (next < 0 ||
+      csync_vio_lseek(io->ctx, io->sfp, io->pos, SEEK_SET) != io->pos) {
+    return -1;
+  }
+  while (len > 0) {
+    n = csync_vio_read(io->ctx, io->sfp, io->buf, MIN(len, io->bufsize));
+    if (n <= 0 || _csync_delta_write(io, io->buf, n) < 0) {
+      return -1;
+    }
+    len -= n;
+  }
+
+  return csync_vio_lseek(io->ctx, io->sfp, next, SEEK_SET) == next ? 0 : -1;
+}
+
+/*
+ * Turn the empty temporary file into the new version of a changed file with
+ * the least writes. The old version is reflinked into it and only the
+ * changed blocks are written, the signature is read from the reflink. That
+ * only pays off where csync reads the old version itself, on the local
+ * replica, a module would have to compute the signature on the server.
+ *
+ * Returns 0 on success, 1 if the file has to be copied as a whole and -1 on
+ * a fatal error. The temporary file may have to be truncated for the copy.
+ */
+static int _csync_push_delta(CSYNC *ctx, csync_file_stat_t *st,
+    csync_vio_handle_t *sfp, csync_vio_handle_t *dfp, const char *duri,
+    const char *turi) {
+  struct _csync_delta_io_s io;
+  csync_vio_handle_t *ofp = NULL;
+  csync_delta_sig_t *sig = NULL;
+  char errbuf[256] = {0};
+  uint64_t hash = 0;
+  uint64_t written = 0;
+  int rc = 1;
+
+  ZERO_STRUCT(io);
+  io.ctx = ctx;
+  io.sfp = sfp;
+  io.dfp = dfp;
+
+  ofp = csync_vio_open(ctx, duri, O_RDONLY|O_NOFOLLOW, 0);
+  if (ofp == NULL) {
+    goto out;
+  }
+  /* without a reflink every block would be written anyway */
+  if (csync_vio_copy(ctx, ofp, dfp, CSYNC_VIO_COPY_REFLINK) < 0) {
+    goto out;
+  }
+  io.dpos = csync_vio_lseek(ctx, dfp, 0, SEEK_CUR);
+
+  io.rfp = csync_vio_open(ctx, turi, O_RDONLY|O_NOFOLLOW, 0);
+  if (io.rfp == NULL) {
+    goto out;
+  }
+  sig = csync_delta_signature(csync_delta_block_size(st->size),
+      _csync_delta_read_old, &io);
+  if (sig == NULL || csync_delta_sig_blocks(sig) == 0) {
+    goto out;
+  }
+
+  io.bufsize = csync_buffer_size(ctx->buffers, st->size, true);
+  io.buf = csync_buffer_get(ctx->buffers, io.bufsize);
+  if (io.buf == NULL) {
+    errno = ENOMEM;
+    goto out;
+  }
+
+  if (csync_delta_generate(sig, _csync_delta_read_new, &io,
+        _csync_delta_copy, _csync_delta_write, &io, &hash, NULL) < 0) {
+    goto out;
+  }
+
+  /* the new version may be shorter */
+  if (csync_vio_ftruncate(ctx, dfp, io.pos) < 0 ||
+      csync_vio_lseek(ctx, dfp, io.pos, SEEK_SET) != io.pos) {
+    goto out;
+  }
+
+  /*
+   * Blocks are matched by a weak sum and c_jhash64(), a block which only
+   * collides with the old one stays in the reflink. Compare the result with
+   * the hash of the new version.
+   */
+  if (_csync_file_hash(ctx, io.rfp, io.pos, &written) < 0) {
+    goto out;
+  }
+  if (written != hash) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "file: %s, delta transfer produced a different file, copying the "
+        "whole file", duri);
+    errno = EIO;
+    goto out;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "DELTA   file: %s, %lld of %lld bytes written",
+      duri, (long long) io.written, (long long) io.pos);
+  rc = 0;
+
+out:
+  if (rc != 0) {
+    if (errno == ENOMEM) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+    } else {
+      c_strerror_r(errno, errbuf, sizeof(errbuf));
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+          "file: %s, delta transfer failed, copying the whole file: %s",
+          duri, errbuf);
+    }
+  }
+  csync_buffer_put(ctx->buffers, io.buf, io.bufsize);
+  csync_delta_sig_free(sig);
+  csync_vio_close(ctx, io.rfp);
+  csync_vio_close(ctx, ofp);
+
+  return rc;
+}
+
+/*
+ * Let the kernel or the module copy the rest of the source in one of the ways
+ * in how. Returns 0 if it copied the file, 1 if the caller has to do it and
+ * -1 on error.
+ */
+static int _csync_push_copy(CSYNC *ctx, csync_vio_handle_t *sfp,
+    csync_vio_handle_t *dfp, int how, const char *duri) {
+  char errbuf[256] = {0};
+
+  if (csync_vio_copy(ctx, sfp, dfp, how) == 0) {
+    return 0;
+  }
+  if (errno == ENOTSUP) {
+    return 1;
+  }
+
+  ctx->status_code = csync_errno_to_status(errno,
+                                           CSYNC_STATUS_PROPAGATE_ERROR);
+  c_strerror_r(errno, errbuf, sizeof(errbuf));
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+            "file: %s, command: copy, error: %s",
+            duri,
+            errbuf);
+
+  return -1;
+}
+
+/* a put of the module writes the file itself, not a temporary file */
+static bool _csync_push_in_place(CSYNC *ctx, enum csync_replica_e srep) {
+  return srep == ctx->local.type && _module_supports_put(ctx) &&
+         !_push_to_tmp_first(ctx);
+}
+
+/*
+ * A copy through a temporary file can be continued by the next run. So can
+ * the get and put of a module, the module continues them at the offset of
+ * the remote handle if it can.
+ */
+static bool _csync_push_resumable(CSYNC *ctx, csync_file_stat_t *st,
+                                  enum csync_replica_e srep) {
+  if (st->size < CSYNC_TRANSFER_MIN_SIZE) {
+    return false;
+  }
+
+  return _push_to_tmp_first(ctx) || _csync_push_in_place(ctx, srep);
+}
+
+/* statement cache of the statedb handle is shared by the workers */
+static csync_transfer_t *_csync_transfer_get(CSYNC *ctx, uint64_t phash) {
+  csync_transfer_t *t = NULL;
+  CSYNC *shared = NULL;
+
+  shared = _csync_propagation_lock(ctx);
+  t = csync_statedb_get_transfer(shared->statedb.db, phash);
+  _csync_propagation_unlock(ctx);
+
+  return t;
+}
+
+static int _csync_transfer_set(CSYNC *ctx, const csync_transfer_t *t) {
+  CSYNC *shared = NULL;
+  int rc;
+
+  shared = _csync_propagation_lock(ctx);
+  rc = csync_statedb_set_transfer(shared->statedb.db, t);
+  _csync_propagation_unlock(ctx);
+
+  return rc;
+}
+
+static void _csync_transfer_drop(CSYNC *ctx, uint64_t phash) {
+  CSYNC *shared = NULL;
+
+  shared = _csync_propagation_lock(ctx);
+  csync_statedb_drop_transfer(shared->statedb.db, phash);
+  _csync_propagation_unlock(ctx);
+}
+
+/*
+ * Record how far the temporary file got, the first hashed bytes of it have
+ * the given checksum. A file on the local replica is flushed first, the
+ * writes of a module are acknowledged by the server.
+ */
+static int _csync_transfer_checkpoint(CSYNC *ctx, csync_transfer_t *t,
+                                      csync_vio_handle_t *dfp,
+                                      enum csync_replica_e drep,
+                                      int64_t hashed, uint64_t checksum) {
+  off_t offset;
+
+  ctx->replica = drep;
+  offset = csync_vio_lseek(ctx, dfp, 0, SEEK_CUR);
+  if (hashed <= 0 || offset < hashed) {
+    return -1;
+  }
+  if (csync_vio_fsync(ctx, dfp) < 0 && errno != ENOTSUP) {
+    return -1;
+  }
+
+  t->offset = hashed;
+  t->checksum = checksum;
+
+  return _csync_transfer_set(ctx, t);
+}
+
+/* Check the temporary file still starts with the bytes of the checkpoint */
+static int _csync_transfer_verify(CSYNC *ctx, csync_transfer_t *t,
+                                  csync_vio_handle_t *dfp) {
+  uint64_t checksum = 0;
+
+  if (_csync_file_hash(ctx, dfp, t->offset, &checksum) < 0) {
+    return -1;
+  }
+
+  return checksum == t->checksum ? 0 : -1;
+}
+
+/*
+ * Continue the copy of an earlier run. It is only safe if the source is
+ * unchanged and the copied part still has its checksum, else the temporary
+ * file is removed. Returns the opened
+ * temporary file with both files at the offset to continue at, NULL if the
+ * copy has to start over.
+ *
+ * A put of a module in place can't be read back, there the checksum is the
+ * one of the part of the source which the server has.
+ */
+static csync_vio_handle_t *_csync_transfer_resume(CSYNC *ctx,
+    csync_file_stat_t *st, csync_transfer_t *t,
+    enum csync_replica_e srep, csync_vio_handle_t *sfp,
+    enum csync_replica_e drep, const char *duri) {
+  csync_vio_handle_t *dfp = NULL;
+  size_t len = strlen(duri);
+  off_t offset = (off_t) t->offset;
+  bool in_place = _csync_push_in_place(ctx, srep);
+  bool unchanged = false;
+  uint64_t checksum = 0;
+
+  /* only remove our own temporary files */
+  if (in_place ? t->tmpname[0] != '\0' :
+      strncmp(t->tmpname, duri, len) != 0 || t->tmpname[len] != '.' ||
+      strlen(t->tmpname + len) != 7) {
+    return NULL;
+  }
+
+  unchanged = t->replica == (int) ctx->current && t->size == st->size &&
+      t->modtime == st->modtime && t->inode == st->inode && offset > 0 &&
+      offset <= st->size;
+  if (unchanged && in_place) {
+    ctx->replica = srep;
+    if (_csync_file_hash(ctx, sfp, offset, &checksum) == 0 &&
+        checksum == t->checksum &&
+        csync_vio_lseek(ctx, sfp, offset, SEEK_SET) == offset) {
+      ctx->replica = drep;
+      dfp = csync_vio_open(ctx, duri, O_WRONLY|O_NOCTTY, 0);
+      if (dfp != NULL && csync_vio_lseek(ctx, dfp, offset, SEEK_SET) == offset) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+            "RESUME  file: %s, at %lld of %lld bytes",
+            duri, (long long) offset, (long long) st->size);
+        return dfp;
+      }
+      csync_vio_close(ctx, dfp);
+    }
+    /* the source is read from the start */
+    ctx->replica = srep;
+    csync_vio_lseek(ctx, sfp, 0, SEEK_SET);
+  } else if (unchanged) {
+    ctx->replica = drep;
+    dfp = csync_vio_open(ctx, t->tmpname, O_RDWR|O_NOFOLLOW|O_NOCTTY, 0);
+    if (dfp != NULL &&
+        csync_vio_lseek(ctx, dfp, 0, SEEK_END) >= offset &&
+        _csync_transfer_verify(ctx, t, dfp) == 0 &&
+        csync_vio_lseek(ctx, dfp, offset, SEEK_SET) == offset) {
+      ctx->replica = srep;
+      if (csync_vio_lseek(ctx, sfp, offset, SEEK_SET) == offset) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+            "RESUME  file: %s, at %lld of %lld bytes",
+            duri, (long long) offset, (long long) st->size);
+        return dfp;
+      }
+      /* the source is read from the start */
+      csync_vio_lseek(ctx, sfp, 0, SEEK_SET);
+    }
+    ctx->replica = drep;
+    csync_vio_close(ctx, dfp);
+  }
+
+  ctx->replica = drep;
+  if (in_place) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, starting the interrupted put over", duri);
+  } else {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, discarding the partial copy %s", duri, t->tmpname);
+    csync_vio_unlink(ctx, t->tmpname);
+  }
+
+  return NULL;
+}
+
+/*
+ * A get or put of a module stopped, find out how far it got and the checksum
+ * of that part. A get wrote the temporary file up to its offset, a put sent
+ * the source up to the offset of the remote handle.
+ */
+static void _csync_transfer_stopped(CSYNC *ctx, csync_file_stat_t *st,
+    enum csync_replica_e srep, csync_vio_handle_t *sfp,
+    enum csync_replica_e drep, csync_vio_handle_t *dfp, const char *turi,
+    int64_t *hashed, uint64_t *checksum) {
+  csync_vio_handle_t *fp = NULL;
+  off_t offset;
+
+  *hashed = -1;
+  ctx->replica = drep;
+  offset = csync_vio_lseek(ctx, dfp, 0, SEEK_CUR);
+  if (offset <= 0 || offset > st->size) {
+    return;
+  }
+
+  if (srep == ctx->local.type) {
+    ctx->replica = srep;
+    fp = sfp;
+  } else {
+    /* the temporary file is open for writing only */
+    fp = csync_vio_open(ctx, turi, O_RDONLY|O_NOFOLLOW, 0);
+  }
+  if (fp != NULL && _csync_file_hash(ctx, fp, offset, checksum) == 0) {
+    *hashed = offset;
+  }
+  if (fp != sfp) {
+    csync_vio_close(ctx, fp);
+  }
+  ctx->replica = drep;
+}
+
 static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   enum csync_replica_e srep = -1;
   enum csync_replica_e drep = -1;
@@ -87,11 +596,17 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   csync_vio_handle_t *dfp = NULL;
 
   csync_vio_file_stat_t *tstat = NULL;
+  csync_transfer_t *transfer = NULL;
 
   char errbuf[256] = {0};
-  char buf[MAX_XFER_BUF_SIZE] = {0};
+  char *buf = NULL;
+  size_t bufsize = 0;
   ssize_t bread = 0;
   ssize_t bwritten = 0;
+  int64_t unsynced = 0;
+  /* the bytes at the start of the temporary file and their checksum */
+  int64_t hashed = 0;
+  uint64_t checksum = CSYNC_DELTA_HASH_INIT;
   struct timeval times[2];
 
   int rc = -1;
@@ -99,6 +614,8 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   int flags = 0;
 
   bool transmission_done = false;
+  bool resumed = false;
+  bool keep = false;
 
   rep_bak = ctx->replica;
 
@@ -106,12 +623,12 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     case LOCAL_REPLICA:
       srep = ctx->local.type;
       drep = ctx->remote.type;
-      if (asprintf(&suri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&suri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
       }
-      if (asprintf(&duri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&duri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
@@ -120,12 +637,12 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     case REMOTE_REPLICA:
       srep = ctx->remote.type;
       drep = ctx->local.type;
-      if (asprintf(&suri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&suri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
       }
-      if (asprintf(&duri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&duri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
@@ -162,7 +679,32 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     goto out;
   }
 
-  if (_push_to_tmp_first(ctx)) {
+  /* continue the copy of an earlier run */
+  if (_csync_push_resumable(ctx, st, srep)) {
+    transfer = _csync_transfer_get(ctx, st->phash);
+    if (transfer != NULL) {
+      dfp = _csync_transfer_resume(ctx, st, transfer, srep, sfp, drep, duri);
+      if (dfp != NULL) {
+        turi = c_strdup(_csync_push_in_place(ctx, srep) ? duri :
+                                                          transfer->tmpname);
+        if (turi == NULL) {
+          ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+          rc = -1;
+          goto out;
+        }
+        resumed = true;
+        hashed = transfer->offset;
+        checksum = transfer->checksum;
+      } else {
+        _csync_transfer_drop(ctx, st->phash);
+        SAFE_FREE(transfer);
+      }
+    }
+  }
+
+  if (resumed) {
+    /* the temporary file is open */
+  } else if (_push_to_tmp_first(ctx)) {
     /* create the temporary file name */
     if (asprintf(&turi, "%s.XXXXXX", duri) < 0) {
       ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
@@ -189,7 +731,8 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   /* Create the destination file */
   ctx->replica = drep;
-  while ((dfp = csync_vio_open(ctx, turi, O_CREAT|O_EXCL|O_WRONLY|O_NOCTTY,
+  while (!resumed &&
+         (dfp = csync_vio_open(ctx, turi, O_CREAT|O_EXCL|O_WRONLY|O_NOCTTY,
           C_FILE_MODE)) == NULL) {
     ctx->status_code = csync_errno_to_status(errno,
                                              CSYNC_STATUS_PROPAGATE_ERROR);
@@ -253,12 +796,32 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   }
 
+  /* record the copy, so the next run can continue it */
+  if (!resumed && _csync_push_resumable(ctx, st, srep)) {
+    transfer = csync_statedb_transfer_new(_csync_push_in_place(ctx, srep) ?
+                                          "" : turi);
+    if (transfer == NULL) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+      goto out;
+    }
+    transfer->phash = st->phash;
+    transfer->replica = ctx->current;
+    transfer->size = st->size;
+    transfer->modtime = st->modtime;
+    transfer->inode = st->inode;
+    if (_csync_transfer_set(ctx, transfer) < 0) {
+      SAFE_FREE(transfer);
+    }
+  }
+
   /* Check if we have put/get */
   if (_module_supports_put(ctx)) {
     if (srep == ctx->local.type) {
       /* get case: get from remote to a local file descriptor */
-      rc = csync_vio_put(ctx, sfp, dfp, st);
-      if (rc < 0) {
+      rc = csync_vio_put(ctx, sfp, dfp, st,
+          transfer != NULL ? transfer->token : NULL, sizeof(transfer->token));
+      if (rc != 0) {
         ctx->status_code = csync_errno_to_status(errno,
                                                  CSYNC_STATUS_PROPAGATE_ERROR);
         c_strerror_r(errno, errbuf, sizeof(errbuf));
@@ -266,6 +829,10 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
                   "file: %s, command: put, error %s",
                   duri,
                   errbuf);
+        if (transfer != NULL) {
+          _csync_transfer_stopped(ctx, st, srep, sfp, drep, dfp, turi,
+                                  &hashed, &checksum);
+        }
         rc = 1;
         goto out;
       }
@@ -275,8 +842,9 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   if (_module_supports_get(ctx)) {
     if (srep == ctx->remote.type) {
       /* put case: put from a local file descriptor to remote. */
-      rc = csync_vio_get(ctx, dfp, sfp, st);
-      if (rc < 0) {
+      rc = csync_vio_get(ctx, dfp, sfp, st,
+          transfer != NULL ? transfer->token : NULL, sizeof(transfer->token));
+      if (rc != 0) {
         ctx->status_code = csync_errno_to_status(errno,
                                                  CSYNC_STATUS_PROPAGATE_ERROR);
         c_strerror_r(errno, errbuf, sizeof(errbuf));
@@ -284,6 +852,10 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
                   "file: %s, command: get, error: %s",
                   duri,
                   errbuf);
+        if (transfer != NULL) {
+          _csync_transfer_stopped(ctx, st, srep, sfp, drep, dfp, turi,
+                                  &hashed, &checksum);
+        }
         rc = 1;
         goto out;
       }
@@ -291,11 +863,76 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     }
   }
 
+  /* both files on the same replica, let the file system copy them if it can */
+  ctx->replica = srep;
+  if (!transmission_done && srep == drep && csync_vio_copy_support(ctx)) {
+    rc = _csync_push_copy(ctx, sfp, dfp, CSYNC_VIO_COPY_OFFLOAD, duri);
+    if (rc < 0) {
+      rc = 1;
+      goto out;
+    }
+    transmission_done = rc == 0;
+  }
+
+  /* else a changed file on the local replica only needs the changed blocks */
+  if (!transmission_done && !resumed && srep == drep &&
+      srep == LOCAL_REPLICA && _push_to_tmp_first(ctx) &&
+      ctx->options.delta_transfer &&
+      st->instruction == CSYNC_INSTRUCTION_SYNC &&
+      st->size >= CSYNC_DELTA_MIN_SIZE &&
+      csync_vio_lseek(ctx, sfp, 0, SEEK_CUR) == 0 &&
+      csync_vio_lseek(ctx, dfp, 0, SEEK_CUR) == 0) {
+    rc = _csync_push_delta(ctx, st, sfp, dfp, duri, turi);
+    if (rc < 0) {
+      goto out;
+    } else if (rc == 0) {
+      transmission_done = true;
+    } else if (csync_vio_ftruncate(ctx, dfp, 0) < 0 ||
+               csync_vio_lseek(ctx, sfp, 0, SEEK_SET) != 0 ||
+               csync_vio_lseek(ctx, dfp, 0, SEEK_SET) != 0) {
+      /* start over with a whole copy */
+      ctx->status_code = csync_errno_to_status(errno,
+                                               CSYNC_STATUS_PROPAGATE_ERROR);
+      c_strerror_r(errno, errbuf, sizeof(errbuf));
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+                "file: %s, command: ftruncate, error: %s",
+                duri,
+                errbuf);
+      rc = 1;
+      goto out;
+    }
+  }
+
+  /* the kernel still copies faster than a buffer in user space */
+  if (!transmission_done && srep == drep && csync_vio_copy_support(ctx)) {
+    rc = _csync_push_copy(ctx, sfp, dfp, CSYNC_VIO_COPY_SENDFILE, duri);
+    if (rc < 0) {
+      rc = 1;
+      goto out;
+    }
+    transmission_done = rc == 0;
+  }
+
   if (!transmission_done) {
     /* no get and put, copy file through own buffers. */
+    bufsize = csync_buffer_size(ctx->buffers, st->size,
+        ctx->local.type == ctx->remote.type);
+    buf = csync_buffer_get(ctx->buffers, bufsize);
+    if (buf == NULL) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+      goto out;
+    }
+
+    /* a kernel copy stopped halfway, what it wrote isn't hashed */
+    ctx->replica = drep;
+    if (transfer != NULL && csync_vio_lseek(ctx, dfp, 0, SEEK_CUR) != hashed) {
+      hashed = -1;
+    }
+
     for (;;) {
       ctx->replica = srep;
-      bread = csync_vio_read(ctx, sfp, buf, MAX_XFER_BUF_SIZE);
+      bread = csync_vio_read(ctx, sfp, buf, bufsize);
 
       if (bread < 0) {
         /* read error */
@@ -328,6 +965,17 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
         rc = 1;
         goto out;
       }
+
+      if (hashed >= 0) {
+        checksum = csync_delta_hash(checksum, buf, bwritten);
+        hashed += bwritten;
+      }
+
+      unsynced += bwritten;
+      if (transfer != NULL && unsynced >= CSYNC_TRANSFER_SYNC_SIZE) {
+        _csync_transfer_checkpoint(ctx, transfer, dfp, drep, hashed, checksum);
+        unsynced = 0;
+      }
     }
   }
 
@@ -470,15 +1118,7 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   st->instruction = CSYNC_INSTRUCTION_UPDATED;
 
   /* Notify the overall progress */
-  if (ctx->callbacks.overall_progress_cb) {
-      ctx->progress.byte_current += st->size;
-      ctx->callbacks.overall_progress_cb(duri,
-                                         ctx->progress.current_file_no++,
-                                         ctx->progress.file_count,
-                                         ctx->progress.byte_current,
-                                         ctx->progress.byte_sum,
-                                         ctx->callbacks.userdata);
-  }
+  _csync_propagation_progress(ctx, duri, st);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "PUSHED  file: %s", duri);
 
@@ -488,19 +1128,34 @@ out:
   ctx->replica = srep;
   csync_vio_close(ctx, sfp);
 
+  /* keep what was copied for the next run */
+  if (rc != 0 && transfer != NULL && dfp != NULL &&
+      _csync_transfer_checkpoint(ctx, transfer, dfp, drep, hashed,
+        checksum) == 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, keeping %lld bytes in %s for the next run",
+        duri, (long long) transfer->offset, turi);
+    keep = true;
+  }
+
   ctx->replica = drep;
   csync_vio_close(ctx, dfp);
 
   csync_vio_file_stat_destroy(tstat);
+  csync_buffer_put(ctx->buffers, buf, bufsize);
 
   /* set instruction for the statedb merger */
   if (rc != 0) {
     st->instruction = CSYNC_INSTRUCTION_ERROR;
-    if (turi != NULL) {
+    if (turi != NULL && !keep) {
       csync_vio_unlink(ctx, turi);
     }
   }
+  if (transfer != NULL && !keep) {
+    _csync_transfer_drop(ctx, st->phash);
+  }
 
+  SAFE_FREE(transfer);
   SAFE_FREE(suri);
   SAFE_FREE(duri);
   SAFE_FREE(turi);
@@ -511,10 +1166,11 @@ out:
   return rc;
 }
 
-static int _backup_path(char** duri, const char* uri, const char* path)
+static int _backup_path(char** duri, const char* uri, const csync_file_stat_t *st)
 {
 	int rc=0;
 	C_PATHINFO *info=NULL;
+	char *path=NULL;
 
 	struct tm *curtime;
 	time_t sec;
@@ -523,7 +1179,15 @@ static int _backup_path(char** duri, const char* uri, const char* path)
 	curtime = localtime(&sec);
 	strftime(timestring, 16,   "%Y%m%d-%H%M%S",curtime);
 
+	path=csync_file_stat_path(st);
+	if (path == NULL) {
+		return -1;
+	}
 	info=c_split_path(path);
+	SAFE_FREE(path);
+	if (info == NULL) {
+		return -1;
+	}
 	CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"directory: %s",info->directory);
 	CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"filename : %s",info->filename);
 	CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"extension: %s",info->extension);
@@ -556,13 +1220,13 @@ static int _csync_backup_file(CSYNC *ctx, csync_file_stat_t *st, char **duri) {
     switch (ctx->current) {
     case LOCAL_REPLICA:
       drep = ctx->remote.type;
-      if (asprintf(&suri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&suri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
       }
 
-      if (_backup_path(duri, ctx->remote.uri,st->path) < 0) {
+      if (_backup_path(duri, ctx->remote.uri, st) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
@@ -570,13 +1234,13 @@ static int _csync_backup_file(CSYNC *ctx, csync_file_stat_t *st, char **duri) {
       break;
     case REMOTE_REPLICA:
       drep = ctx->local.type;
-      if (asprintf(&suri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&suri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
       }
 
-      if ( _backup_path(duri, ctx->local.uri, st->path) < 0) {
+      if ( _backup_path(duri, ctx->local.uri, st) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         rc = -1;
         goto out;
@@ -673,7 +1337,7 @@ static int _csync_conflict_file(CSYNC *ctx, csync_file_stat_t *st) {
   if( rc >= 0 ) {
     /* if its the local repository, check if both files are equal. */
     if( ctx->current == REMOTE_REPLICA ) {
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         return -1;
       }
 
@@ -692,6 +1356,181 @@ static int _csync_conflict_file(CSYNC *ctx, csync_file_stat_t *st) {
   return rc;
 }
 
+/*
+ * Move a record from its old path to the new one on the other replica.
+ * Returns 0 on success, 1 if the move failed and < 0 on a fatal error.
+ */
+static int _csync_move(CSYNC *ctx, csync_file_stat_t *st) {
+  enum csync_replica_e replica_bak;
+  char errbuf[256] = {0};
+  char *oldpath = NULL;
+  char *olduri = NULL;
+  char *uri = NULL;
+  char *dir = NULL;
+  const char *base = NULL;
+  int rc = -1;
+
+  replica_bak = ctx->replica;
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      ctx->replica = ctx->remote.type;
+      base = ctx->remote.uri;
+      break;
+    case REMOTE_REPLICA:
+      ctx->replica = ctx->local.type;
+      base = ctx->local.uri;
+      break;
+    default:
+      break;
+  }
+
+  oldpath = csync_path_str(st->old_path);
+  if (oldpath == NULL ||
+      asprintf(&olduri, "%s/%s", base, oldpath) < 0 ||
+      asprintf(&uri, "%s/" CSYNC_PATH_FMT, base, CSYNC_PATH_ARGS(st)) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    rc = -1;
+    goto out;
+  }
+
+  rc = csync_vio_rename(ctx, olduri, uri);
+  if (rc < 0 && errno == ENOENT) {
+    /* the directories are created after the files */
+    dir = c_dirname(uri);
+    if (dir != NULL && csync_vio_mkdirs(ctx, dir, C_DIR_MODE) == 0) {
+      rc = csync_vio_rename(ctx, olduri, uri);
+    }
+  }
+
+  if (rc < 0) {
+    c_strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "%s: %s, command: rename, error: %s",
+        st->type == CSYNC_FTW_TYPE_DIR ? "dir" : "file",
+        uri,
+        errbuf);
+    rc = 1;
+    goto out;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "RENAMED  %s: %s -> %s",
+      st->type == CSYNC_FTW_TYPE_DIR ? " dir" : "file", olduri, uri);
+
+  rc = 0;
+out:
+  ctx->replica = replica_bak;
+
+  SAFE_FREE(oldpath);
+  SAFE_FREE(olduri);
+  SAFE_FREE(uri);
+  SAFE_FREE(dir);
+
+  return rc;
+}
+
+/* The tree of the replica the renamed records are moved on */
+static c_hash_t *_csync_other_tree(CSYNC *ctx) {
+  if (ctx->current == LOCAL_REPLICA) {
+    return ctx->remote.tree;
+  }
+
+  return ctx->local.tree;
+}
+
+/*
+ * If the move fails the file is transferred and the old path removed, like
+ * it would have been without the rename detection.
+ */
+static int _csync_rename_file(CSYNC *ctx, csync_file_stat_t *st) {
+  csync_file_stat_t *other = NULL;
+  int rc;
+
+  rc = _csync_move(ctx, st);
+  if (rc < 0) {
+    return -1;
+  }
+
+  if (rc > 0) {
+    /* the old path is removed in the propagation of the other replica */
+    other = c_hash_find(_csync_other_tree(ctx), st->old_path->phash);
+    if (other != NULL) {
+      other->instruction = CSYNC_INSTRUCTION_REMOVE;
+    }
+
+    return _csync_push_file(ctx, st);
+  }
+
+  /* set instruction for the statedb merger */
+  st->instruction = CSYNC_INSTRUCTION_UPDATED;
+
+  return 0;
+}
+
+/*
+ * The reconciler moved the records below a renamed directory along with it.
+ * If the move of the directory fails, the directory is created and the
+ * records below the old path get the instructions they had before: the
+ * files are moved one by one and the old directory is removed.
+ */
+static void _csync_rename_dir_undo(CSYNC *ctx, csync_file_stat_t *st) {
+  c_hash_t *tree = NULL;
+  c_hash_t *other = NULL;
+  size_t n;
+
+  tree = ctx->current == LOCAL_REPLICA ? ctx->local.tree : ctx->remote.tree;
+  other = _csync_other_tree(ctx);
+
+  for (n = 0; n < c_hash_size(other); n++) {
+    csync_file_stat_t *o = c_hash_at(other, n);
+
+    if (o->path == st->old_path || csync_path_is_below(o->path, st->old_path)) {
+      o->instruction = CSYNC_INSTRUCTION_REMOVE;
+    }
+  }
+
+  for (n = 0; n < c_hash_size(tree); n++) {
+    csync_file_stat_t *cur = c_hash_at(tree, n);
+    csync_file_stat_t *o = NULL;
+
+    if (cur->old_path == NULL || cur->instruction != CSYNC_INSTRUCTION_NONE ||
+        !csync_path_is_below(cur->path, st->path)) {
+      continue;
+    }
+
+    if (cur->type == CSYNC_FTW_TYPE_FILE) {
+      cur->instruction = CSYNC_INSTRUCTION_RENAME;
+      o = c_hash_find(other, cur->old_path->phash);
+      if (o != NULL) {
+        o->instruction = CSYNC_INSTRUCTION_NONE;
+      }
+    } else {
+      cur->instruction = CSYNC_INSTRUCTION_NEW;
+    }
+  }
+
+  st->instruction = CSYNC_INSTRUCTION_NEW;
+}
+
+static int _csync_rename_dir(CSYNC *ctx, csync_file_stat_t *st) {
+  int rc;
+
+  rc = _csync_move(ctx, st);
+  if (rc < 0) {
+    return -1;
+  }
+
+  if (rc > 0) {
+    _csync_rename_dir_undo(ctx, st);
+    return 0;
+  }
+
+  /* set instruction for the statedb merger */
+  st->instruction = CSYNC_INSTRUCTION_UPDATED;
+
+  return 0;
+}
+
 static int _csync_remove_file(CSYNC *ctx, csync_file_stat_t *st) {
   char errbuf[256] = {0};
   char *uri = NULL;
@@ -699,13 +1538,13 @@ static int _csync_remove_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
@@ -756,7 +1595,6 @@ static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
   enum csync_replica_e replica_bak;
   char errbuf[256] = {0};
   char *uri = NULL;
-  struct timeval times[2];
   int rc = -1;
 
   replica_bak = ctx->replica;
@@ -764,14 +1602,14 @@ static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
   switch (ctx->current) {
     case LOCAL_REPLICA:
       dest = ctx->remote.type;
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
       dest = ctx->local.type;
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
@@ -800,41 +1638,11 @@ static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
     goto out;
   }
 
-  /* chmod is if it is not the default mode */
-  if ((st->mode & 07777) != C_DIR_MODE) {
-    if (csync_vio_chmod(ctx, uri, st->mode) < 0) {
-      ctx->status_code = csync_errno_to_status(errno,
-                                               CSYNC_STATUS_PROPAGATE_ERROR);
-      switch (errno) {
-        case ENOMEM:
-          rc = -1;
-          break;
-        default:
-          rc = 1;
-          break;
-      }
-      c_strerror_r(errno, errbuf, sizeof(errbuf));
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-          "dir: %s, command: chmod, error: %s",
-          uri,
-          errbuf);
-      goto out;
-    }
-  }
-
-  /* set owner and group if possible */
-  if (ctx->pwd.euid == 0) {
-    csync_vio_chown(ctx, uri, st->uid, st->gid);
-  }
-
-  times[0].tv_sec = times[1].tv_sec = st->modtime;
-  times[0].tv_usec = times[1].tv_usec = 0;
-
-  csync_vio_utimes(ctx, uri, times);
-
-  /* set instruction for the statedb merger */
-  st->instruction = CSYNC_INSTRUCTION_UPDATED;
-
+  /*
+   * The attributes are set by _csync_sync_dir() once the children are
+   * propagated, creating them changes the modification time and they may
+   * need a writable directory.
+   */
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "CREATED  dir: %s", uri);
   ctx->replica = replica_bak;
 
@@ -863,14 +1671,14 @@ static int _csync_sync_dir(CSYNC *ctx, csync_file_stat_t *st) {
   switch (ctx->current) {
     case LOCAL_REPLICA:
       dest = ctx->remote.type;
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
       dest = ctx->local.type;
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
@@ -932,6 +1740,7 @@ out:
 }
 
 static int _csync_remove_dir(CSYNC *ctx, csync_file_stat_t *st) {
+  CSYNC *shared = NULL;
   c_list_t *list = NULL;
   char errbuf[256] = {0};
   char *uri = NULL;
@@ -939,13 +1748,13 @@ static int _csync_remove_dir(CSYNC *ctx, csync_file_stat_t *st) {
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(st)) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
@@ -967,26 +1776,29 @@ static int _csync_remove_dir(CSYNC *ctx, csync_file_stat_t *st) {
         rc = -1;
         break;
       case ENOTEMPTY:
+        shared = _csync_propagation_lock(ctx);
         switch (ctx->current) {
           case LOCAL_REPLICA:
-            list = c_list_prepend(ctx->local.list, (void *) st);
-            if (list == NULL) {
-              ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-              return -1;
+            list = c_list_prepend(shared->local.list, (void *) st);
+            if (list != NULL) {
+              shared->local.list = list;
             }
-            ctx->local.list = list;
             break;
           case REMOTE_REPLICA:
-            list = c_list_prepend(ctx->remote.list, (void *) st);
-            if (list == NULL) {
-              ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-              return -1;
+            list = c_list_prepend(shared->remote.list, (void *) st);
+            if (list != NULL) {
+              shared->remote.list = list;
             }
-            ctx->remote.list = list;
             break;
           default:
             break;
         }
+        _csync_propagation_unlock(ctx);
+        if (list == NULL) {
+          ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+          SAFE_FREE(uri);
+          return -1;
+        }
         rc = 0;
         break;
       default:
@@ -1018,6 +1830,49 @@ out:
   return rc;
 }
 
+/*
+ * Only the copies which failed in this run are continued by the next one,
+ * the partial copies of files which are gone or synced are removed.
+ */
+static void _csync_transfer_cleanup(CSYNC *ctx, c_hash_t *tree) {
+  enum csync_replica_e rep_bak = ctx->replica;
+  c_list_t *list = NULL;
+  c_list_t *walk = NULL;
+
+  if (csync_statedb_get_transfers(ctx->statedb.db, &list) < 0) {
+    return;
+  }
+
+  ctx->replica = ctx->current == LOCAL_REPLICA ? ctx->remote.type :
+                                                 ctx->local.type;
+  for (walk = list; walk != NULL; walk = c_list_next(walk)) {
+    csync_transfer_t *t = (csync_transfer_t *) walk->data;
+    csync_file_stat_t *st = NULL;
+
+    if (t->replica != (int) ctx->current) {
+      continue;
+    }
+
+    st = (csync_file_stat_t *) c_hash_find(tree, t->phash);
+    if (st != NULL && st->instruction == CSYNC_INSTRUCTION_ERROR) {
+      continue;
+    }
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "CLEANUP file: %s", t->tmpname);
+    /* a module put in place has no temporary file */
+    if (t->tmpname[0] != '\0') {
+      csync_vio_unlink(ctx, t->tmpname);
+    }
+    csync_statedb_drop_transfer(ctx->statedb.db, t->phash);
+  }
+  ctx->replica = rep_bak;
+
+  for (walk = list; walk != NULL; walk = c_list_next(walk)) {
+    SAFE_FREE(walk->data);
+  }
+  c_list_free(list);
+}
+
 static int _csync_propagation_cleanup(CSYNC *ctx) {
   c_list_t *list = NULL;
   c_list_t *walk = NULL;
@@ -1053,7 +1908,7 @@ static int _csync_propagation_cleanup(CSYNC *ctx) {
 
     st = (csync_file_stat_t *) walk->data;
 
-    if (asprintf(&dir, "%s/%s", uri, st->path) < 0) {
+    if (asprintf(&dir, "%s/" CSYNC_PATH_FMT, uri, CSYNC_PATH_ARGS(st)) < 0) {
       ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
       return -1;
     }
@@ -1115,49 +1970,54 @@ static int _csync_propagation_file_count_visitor(void *obj, void *data) {
 }
 
 
-static int _csync_propagation_file_visitor(void *obj, void *data) {
+/*
+ * The renamed directories are moved before the files are propagated, the
+ * files below them are transferred on top of the move.
+ */
+static int _csync_propagation_rename_visitor(void *obj, void *data) {
   csync_file_stat_t *st = NULL;
   CSYNC *ctx = NULL;
 
   st = (csync_file_stat_t *) obj;
   ctx = (CSYNC *) data;
 
-  switch(st->type) {
-    case CSYNC_FTW_TYPE_SLINK:
+  if (st->type == CSYNC_FTW_TYPE_DIR &&
+      st->instruction == CSYNC_INSTRUCTION_RENAME) {
+    if (_csync_rename_dir(ctx, st) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int _csync_propagate_file(CSYNC *ctx, csync_file_stat_t *st) {
+  switch (st->instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+      if (_csync_new_file(ctx, st) < 0) {
+        goto err;
+      }
       break;
-    case CSYNC_FTW_TYPE_FILE:
-      switch (st->instruction) {
-        case CSYNC_INSTRUCTION_NEW:
-          if (_csync_new_file(ctx, st) < 0) {
-            goto err;
-          }
-          break;
-        case CSYNC_INSTRUCTION_SYNC:
-          if (_csync_sync_file(ctx, st) < 0) {
-            goto err;
-          }
-          break;
-        case CSYNC_INSTRUCTION_REMOVE:
-          if (_csync_remove_file(ctx, st) < 0) {
-            goto err;
-          }
-          break;
-        case CSYNC_INSTRUCTION_CONFLICT:
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"case CSYNC_INSTRUCTION_CONFLICT: %s",st->path);
-          if (_csync_conflict_file(ctx, st) < 0) {
-            goto err;
-          }
-          break;
-        default:
-          break;
+    case CSYNC_INSTRUCTION_SYNC:
+      if (_csync_sync_file(ctx, st) < 0) {
+        goto err;
       }
       break;
-    case CSYNC_FTW_TYPE_DIR:
-      /*
-       * We have to walk over the files first. If you create or rename a file
-       * in a directory on unix. The modification time of the directory gets
-       * changed.
-       */
+    case CSYNC_INSTRUCTION_RENAME:
+      if (_csync_rename_file(ctx, st) < 0) {
+        goto err;
+      }
+      break;
+    case CSYNC_INSTRUCTION_REMOVE:
+      if (_csync_remove_file(ctx, st) < 0) {
+        goto err;
+      }
+      break;
+    case CSYNC_INSTRUCTION_CONFLICT:
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"case CSYNC_INSTRUCTION_CONFLICT: " CSYNC_PATH_FMT, CSYNC_PATH_ARGS(st));
+      if (_csync_conflict_file(ctx, st) < 0) {
+        goto err;
+      }
       break;
     default:
       break;
@@ -1168,53 +2028,392 @@ err:
   return -1;
 }
 
-static int _csync_propagation_dir_visitor(void *obj, void *data) {
-  csync_file_stat_t *st = NULL;
-  CSYNC *ctx = NULL;
+/*
+ * We have to propagate the files first. If you create or rename a file in a
+ * directory on unix. The modification time of the directory gets changed.
+ */
+static int _csync_propagate_dir(CSYNC *ctx, csync_file_stat_t *st) {
+  switch (st->instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+      if (_csync_sync_dir(ctx, st) < 0) {
+        goto err;
+      }
+      break;
+    case CSYNC_INSTRUCTION_CONFLICT:
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"directory attributes different");
+      if (_csync_sync_dir(ctx, st) < 0) {
+        goto err;
+      }
+      break;
+    case CSYNC_INSTRUCTION_REMOVE:
+      if (_csync_remove_dir(ctx, st) < 0) {
+        goto err;
+      }
+      break;
+    default:
+      break;
+  }
 
-  st = (csync_file_stat_t *) obj;
-  ctx = (CSYNC *) data;
+  return 0;
+err:
+  return -1;
+}
 
-  switch(st->type) {
-    case CSYNC_FTW_TYPE_SLINK:
-      /* FIXME: implement symlink support */
-      break;
+typedef int (*csync_propagate_fn)(CSYNC *ctx, csync_file_stat_t *st);
+
+/*
+ * A job may only start once the number of finished jobs has reached its
+ * barrier. Jobs are started in order, so the barrier is the position of the
+ * first job of its group and everything before that group is done.
+ */
+struct _csync_propagate_job_s {
+  csync_file_stat_t *st;
+  csync_propagate_fn fn;
+  size_t barrier;
+};
+
+struct _csync_propagate_s {
+  CSYNC *ctx;
+  struct _csync_propagate_job_s *jobs;
+  size_t njobs;
+  size_t size;
+
+  /* the directories to create and to finish, see _csync_propagate_collect() */
+  csync_file_stat_t **dirs;
+  size_t ndirs;
+  size_t dsize;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t next;
+  size_t done;
+  int abort;
+
+  /* the log and iconv settings are per thread */
+  int log_level;
+  csync_log_callback log_cb;
+  void *log_userdata;
+  const char *iconv_codec;
+#endif
+};
+
+static int _csync_propagate_add(struct _csync_propagate_s *p,
+    csync_file_stat_t *st, csync_propagate_fn fn, size_t barrier) {
+  struct _csync_propagate_job_s *jobs = NULL;
+
+  if (p->njobs == p->size) {
+    p->size = p->size ? p->size * 2 : 64;
+    jobs = c_realloc(p->jobs, p->size * sizeof(struct _csync_propagate_job_s));
+    if (jobs == NULL) {
+      return -1;
+    }
+    p->jobs = jobs;
+  }
+
+  p->jobs[p->njobs].st = st;
+  p->jobs[p->njobs].fn = fn;
+  p->jobs[p->njobs].barrier = barrier;
+  p->njobs++;
+
+  return 0;
+}
+
+/* The number of directories above a record plus one */
+static size_t _csync_propagate_depth(const csync_file_stat_t *st) {
+  const char *p;
+  size_t depth = 1;
+
+  if (st->path->dir != NULL) {
+    depth++;
+    for (p = st->path->dir->path; *p != '\0'; p++) {
+      if (*p == '/') {
+        depth++;
+      }
+    }
+  }
+
+  return depth;
+}
+
+static int _csync_propagate_depth_cmp(const void *a, const void *b) {
+  size_t da = _csync_propagate_depth(*(csync_file_stat_t * const *) a);
+  size_t db = _csync_propagate_depth(*(csync_file_stat_t * const *) b);
+
+  return da < db ? -1 : da > db;
+}
+
+/*
+ * Collect the records to propagate. The files go to the jobs, the
+ * directories are ordered and added by _csync_propagate_stages().
+ */
+static int _csync_propagate_collect(void *obj, void *data) {
+  struct _csync_propagate_s *p = (struct _csync_propagate_s *) data;
+  csync_file_stat_t *st = (csync_file_stat_t *) obj;
+  csync_file_stat_t **dirs = NULL;
+
+  switch (st->type) {
     case CSYNC_FTW_TYPE_FILE:
+      switch (st->instruction) {
+        case CSYNC_INSTRUCTION_NEW:
+        case CSYNC_INSTRUCTION_SYNC:
+        case CSYNC_INSTRUCTION_RENAME:
+        case CSYNC_INSTRUCTION_REMOVE:
+        case CSYNC_INSTRUCTION_CONFLICT:
+          return _csync_propagate_add(p, st, _csync_propagate_file, 0);
+        default:
+          break;
+      }
       break;
     case CSYNC_FTW_TYPE_DIR:
       switch (st->instruction) {
         case CSYNC_INSTRUCTION_NEW:
-          if (_csync_new_dir(ctx, st) < 0) {
-            goto err;
-          }
-          break;
         case CSYNC_INSTRUCTION_SYNC:
-          if (_csync_sync_dir(ctx, st) < 0) {
-            goto err;
-          }
-          break;
         case CSYNC_INSTRUCTION_CONFLICT:
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"directory attributes different");
-          if (_csync_sync_dir(ctx, st) < 0) {
-            goto err;
-          }
-          break;
         case CSYNC_INSTRUCTION_REMOVE:
-          if (_csync_remove_dir(ctx, st) < 0) {
-            goto err;
+          if (p->ndirs == p->dsize) {
+            p->dsize = p->dsize ? p->dsize * 2 : 64;
+            dirs = c_realloc(p->dirs, p->dsize * sizeof(csync_file_stat_t *));
+            if (dirs == NULL) {
+              return -1;
+            }
+            p->dirs = dirs;
           }
+          p->dirs[p->ndirs++] = st;
           break;
         default:
           break;
       }
       break;
     default:
+      /* FIXME: implement symlink support */
       break;
   }
 
   return 0;
-err:
-  return -1;
+}
+
+/*
+ * Order the jobs in three stages:
+ *
+ * 1. The new directories, parents before their children. A depth only starts
+ *    when the one above it is created.
+ * 2. The files, they don't depend on each other.
+ * 3. The attributes and removals of the directories, children before their
+ *    parents. A depth only starts when everything below it is finished.
+ */
+static int _csync_propagate_stages(struct _csync_propagate_s *p) {
+  struct _csync_propagate_job_s *files = p->jobs;
+  size_t nfiles = p->njobs;
+  size_t barrier = 0;
+  size_t depth = 0;
+  size_t i;
+  int rc = -1;
+
+  p->jobs = NULL;
+  p->njobs = p->size = 0;
+
+  if (p->ndirs > 0) {
+    qsort(p->dirs, p->ndirs, sizeof(csync_file_stat_t *),
+        _csync_propagate_depth_cmp);
+  }
+
+  for (i = 0; i < p->ndirs; i++) {
+    if (p->dirs[i]->instruction != CSYNC_INSTRUCTION_NEW) {
+      continue;
+    }
+    if (_csync_propagate_depth(p->dirs[i]) != depth) {
+      depth = _csync_propagate_depth(p->dirs[i]);
+      barrier = p->njobs;
+    }
+    if (_csync_propagate_add(p, p->dirs[i], _csync_new_dir, barrier) < 0) {
+      goto out;
+    }
+  }
+
+  barrier = p->njobs;
+  for (i = 0; i < nfiles; i++) {
+    if (_csync_propagate_add(p, files[i].st, files[i].fn, barrier) < 0) {
+      goto out;
+    }
+  }
+
+  depth = 0;
+  for (i = p->ndirs; i > 0; i--) {
+    if (_csync_propagate_depth(p->dirs[i - 1]) != depth) {
+      depth = _csync_propagate_depth(p->dirs[i - 1]);
+      barrier = p->njobs;
+    }
+    if (_csync_propagate_add(p, p->dirs[i - 1], _csync_propagate_dir,
+          barrier) < 0) {
+      goto out;
+    }
+  }
+
+  rc = 0;
+out:
+  SAFE_FREE(files);
+  return rc;
+}
+
+#ifdef HAVE_PTHREAD
+struct _csync_propagate_worker_s {
+  struct _csync_propagate_s *p;
+  /* the worker's own context, the local replica needs no other session */
+  CSYNC ctx;
+  pthread_t thread;
+};
+
+static void _csync_propagate_jobs(struct _csync_propagate_s *p, CSYNC *ctx) {
+  struct _csync_propagate_job_s *job = NULL;
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (!p->abort && p->next < p->njobs &&
+           p->done < p->jobs[p->next].barrier) {
+      pthread_cond_wait(&p->cond, &p->lock);
+    }
+    if (p->abort || p->next == p->njobs) {
+      break;
+    }
+    job = &p->jobs[p->next++];
+    pthread_mutex_unlock(&p->lock);
+
+    if (job->fn(ctx, job->st) < 0) {
+      pthread_mutex_lock(&p->lock);
+      p->abort = 1;
+      pthread_cond_broadcast(&p->cond);
+      break;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->done++;
+    if (p->next < p->njobs && p->done == p->jobs[p->next].barrier) {
+      pthread_cond_broadcast(&p->cond);
+    }
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+static void *_csync_propagate_worker(void *arg) {
+  struct _csync_propagate_worker_s *w = (struct _csync_propagate_worker_s *) arg;
+  struct _csync_propagate_s *p = w->p;
+
+  csync_set_log_level(p->log_level);
+  if (p->log_cb != NULL) {
+    csync_set_log_callback(p->log_cb);
+  }
+  csync_set_log_userdata(p->log_userdata);
+#ifdef WITH_ICONV
+  if (p->iconv_codec != NULL) {
+    csync_set_iconv_codec(p->iconv_codec);
+  }
+#endif
+
+  _csync_propagate_jobs(p, &w->ctx);
+
+#ifdef WITH_ICONV
+  c_close_iconv();
+#endif
+
+  return NULL;
+}
+
+/* Run the jobs on a worker pool, every worker has a copy of the context. */
+static int _csync_propagate_run(struct _csync_propagate_s *p, int threads) {
+  struct _csync_propagate_worker_s *workers = NULL;
+  CSYNC *ctx = p->ctx;
+  int started = 0;
+  int i;
+
+  workers = c_malloc(threads * sizeof(struct _csync_propagate_worker_s));
+  if (workers == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  p->log_level = csync_get_log_level();
+  p->log_cb = csync_get_log_callback();
+  p->log_userdata = csync_get_log_userdata();
+#ifdef WITH_ICONV
+  p->iconv_codec = csync_get_iconv_codec();
+#endif
+
+  ctx->propagate_lock = &p->lock;
+  for (i = 0; i < threads; i++) {
+    workers[i].p = p;
+    workers[i].ctx = *ctx;
+    workers[i].ctx.propagate_ctx = ctx;
+    if (pthread_create(&workers[i].thread, NULL, _csync_propagate_worker,
+          &workers[i]) != 0) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+          "Unable to start propagation thread %d, continuing with %d threads",
+          i, started);
+      break;
+    }
+    started++;
+  }
+
+  if (started == 0) {
+    /* nothing is running, propagate in this thread */
+    _csync_propagate_jobs(p, &workers[0].ctx);
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  ctx->propagate_lock = NULL;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Propagated %zu jobs with %d threads",
+      p->njobs, started ? started : 1);
+
+  /* report the errors of the workers like a sequential run would */
+  for (i = 0; i < MAX(started, 1); i++) {
+    if (workers[i].ctx.status_code != CSYNC_STATUS_OK) {
+      ctx->status_code = workers[i].ctx.status_code;
+    }
+  }
+
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->lock);
+  SAFE_FREE(workers);
+
+  return p->abort ? -1 : 0;
+}
+#endif /* HAVE_PTHREAD */
+
+/* Returns the number of threads to propagate with, 1 runs in the caller. */
+static int _csync_propagate_threads(CSYNC *ctx, size_t njobs) {
+#ifdef HAVE_PTHREAD
+  long threads = ctx->options.propagation_threads;
+
+  if (threads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    threads = 1;
+#endif
+  }
+
+  /* every worker needs a session of its own for the transfers */
+  if (ctx->remote.type == REMOTE_REPLICA &&
+      !ctx->module.capabilities.concurrent_session_support) {
+    threads = 1;
+  }
+
+  if ((size_t) threads > njobs) {
+    threads = njobs;
+  }
+
+  return threads > 1 ? (int) threads : 1;
+#else
+  (void) ctx;
+  (void) njobs;
+
+  return 1;
+#endif
 }
 
 /* Count the files to transmit for both up- and download, ie. in both replicas. */
@@ -1233,7 +2432,7 @@ int csync_init_overall_progress(CSYNC *ctx) {
     ctx->current = REMOTE_REPLICA;
     ctx->replica = ctx->remote.type;
 
-    rc = c_rbtree_walk(ctx->remote.tree,
+    rc = c_hash_walk(ctx->remote.tree,
                        (void *)ctx,
                        _csync_propagation_file_count_visitor);
     if (rc < 0) {
@@ -1243,7 +2442,7 @@ int csync_init_overall_progress(CSYNC *ctx) {
     ctx->current = LOCAL_REPLICA;
     ctx->replica = ctx->local.type;
 
-    rc = c_rbtree_walk(ctx->local.tree,
+    rc = c_hash_walk(ctx->local.tree,
                        (void *)ctx,
                        _csync_propagation_file_count_visitor);
     if (rc < 0) {
@@ -1266,7 +2465,11 @@ int csync_init_overall_progress(CSYNC *ctx) {
 }
 
 int csync_propagate_files(CSYNC *ctx) {
-  c_rbtree_t *tree = NULL;
+  struct _csync_propagate_s p;
+  c_hash_t *tree = NULL;
+  size_t i;
+  int threads;
+  int rc = -1;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
@@ -1279,17 +2482,52 @@ int csync_propagate_files(CSYNC *ctx) {
       break;
   }
 
-  if (c_rbtree_walk(tree, (void *) ctx, _csync_propagation_file_visitor) < 0) {
+  ZERO_STRUCT(p);
+  p.ctx = ctx;
+
+  ctx->buffers = csync_buffer_pool_new(ctx->options.min_xfer_buffer_size,
+                                       ctx->options.max_xfer_buffer_size);
+  if (ctx->buffers == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
     return -1;
   }
 
-  if (c_rbtree_walk(tree, (void *) ctx, _csync_propagation_dir_visitor) < 0) {
-    return -1;
+  if (c_hash_walk(tree, (void *) ctx, _csync_propagation_rename_visitor) < 0) {
+    goto out;
+  }
+
+  if (c_hash_walk(tree, (void *) &p, _csync_propagate_collect) < 0 ||
+      _csync_propagate_stages(&p) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
   }
 
+  threads = _csync_propagate_threads(ctx, p.njobs);
+  if (threads > 1) {
+#ifdef HAVE_PTHREAD
+    if (_csync_propagate_run(&p, threads) < 0) {
+      goto out;
+    }
+#endif
+  } else {
+    for (i = 0; i < p.njobs; i++) {
+      if (p.jobs[i].fn(ctx, p.jobs[i].st) < 0) {
+        goto out;
+      }
+    }
+  }
+
+  _csync_transfer_cleanup(ctx, tree);
+
   if (_csync_propagation_cleanup(ctx) < 0) {
-    return -1;
+    goto out;
   }
 
-  return 0;
+  rc = 0;
+out:
+  csync_buffer_pool_free(ctx->buffers);
+  ctx->buffers = NULL;
+  SAFE_FREE(p.jobs);
+  SAFE_FREE(p.dirs);
+  return rc;
 }
@@ -20,7 +20,14 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "c_jhash.h"
+
 #include "csync_private.h"
+#include "csync_path.h"
 #include "csync_reconcile.h"
 #include "csync_util.h"
 
@@ -39,32 +46,14 @@
  * file with the the source file. If the destination file is newer
  * (timestamp is newer), it is not overwritten. If both files, on the
  * source and the destination, have been changed, the newer file wins.
+ *
+ * other is the record of the same file on the opposite replica, NULL if the
+ * file is only found on the current replica.
  */
-static int _csync_merge_algorithm_visitor(void *obj, void *data) {
-  csync_file_stat_t *cur = NULL;
-  csync_file_stat_t *other = NULL;
-  CSYNC *ctx = NULL;
-  c_rbtree_t *tree = NULL;
-  c_rbnode_t *node = NULL;
-
-  cur = (csync_file_stat_t *) obj;
-  ctx = (CSYNC *) data;
-
-  /* we need the opposite tree! */
-  switch (ctx->current) {
-    case LOCAL_REPLICA:
-      tree = ctx->remote.tree;
-      break;
-    case REMOTE_REPLICA:
-      tree = ctx->local.tree;
-      break;
-    default:
-      break;
-  }
-
-  node = c_rbtree_find(tree, &cur->phash);
+static void _csync_merge_algorithm(CSYNC *ctx, csync_file_stat_t *cur,
+                                   csync_file_stat_t *other) {
   /* file only found on current replica */
-  if (node == NULL) {
+  if (other == NULL) {
     switch(cur->instruction) {
       /* file has been modified */
       case CSYNC_INSTRUCTION_EVAL:
@@ -74,8 +63,11 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
       case CSYNC_INSTRUCTION_NONE:
         cur->instruction = CSYNC_INSTRUCTION_REMOVE;
         break;
+      /* a moved file is resolved after all ranges are reconciled */
       case CSYNC_INSTRUCTION_RENAME:
-        cur->instruction = CSYNC_INSTRUCTION_NEW;
+        if (cur->old_path == NULL) {
+          cur->instruction = CSYNC_INSTRUCTION_NEW;
+        }
         break;
       default:
         break;
@@ -84,7 +76,11 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
     /*
      * file found on the other replica
      */
-    other = (csync_file_stat_t *) node->data;
+
+    /* the new path of a renamed file is taken on the other replica too */
+    if (cur->instruction == CSYNC_INSTRUCTION_RENAME) {
+      cur->instruction = CSYNC_INSTRUCTION_NEW;
+    }
 
     switch (cur->instruction) {
       /* file on current replica is new */
@@ -96,7 +92,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"file new on both, cur is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"file new on both, cur is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 				other->instruction = CSYNC_INSTRUCTION_NONE;
 			  }
@@ -110,7 +106,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"file new on both, other is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"file new on both, other is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 				other->instruction = CSYNC_INSTRUCTION_CONFLICT;
 			  }
@@ -133,7 +129,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, cur is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, cur is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 			  }
 			  else
@@ -146,7 +142,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, other is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, other is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 			  }
 			  else
@@ -173,7 +169,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, cur is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, cur is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 			  }
 			  else
@@ -185,7 +181,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, other is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, other is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 			  }
 			  else
@@ -201,7 +197,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"both modified, cur is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"both modified, cur is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 				other->instruction= CSYNC_INSTRUCTION_NONE;
 			  }
@@ -215,7 +211,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"both modified, other is newer PATH=./%s",cur->path);
+				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"both modified, other is newer PATH=./" CSYNC_PATH_FMT, CSYNC_PATH_ARGS(cur));
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 				other->instruction=CSYNC_INSTRUCTION_CONFLICT;
 			  }
@@ -245,16 +241,16 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
       if(cur->type == CSYNC_FTW_TYPE_DIR)
       {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
-        "%-20s  dir: %s",
+        "%-20s  dir: " CSYNC_PATH_FMT,
         csync_instruction_str(cur->instruction),
-        cur->path);
+        CSYNC_PATH_ARGS(cur));
       }
       else
       {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
-        "%-20s file: %s",
+        "%-20s file: " CSYNC_PATH_FMT,
         csync_instruction_str(cur->instruction),
-        cur->path);   
+        CSYNC_PATH_ARGS(cur));   
       }
   }
   else
@@ -262,41 +258,655 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
       if(cur->type == CSYNC_FTW_TYPE_DIR)
       {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-        "%-20s  dir: %s",
+        "%-20s  dir: " CSYNC_PATH_FMT,
         csync_instruction_str(cur->instruction),
-        cur->path);
+        CSYNC_PATH_ARGS(cur));
       }
       else
       {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-        "%-20s file: %s",
+        "%-20s file: " CSYNC_PATH_FMT,
         csync_instruction_str(cur->instruction),
-        cur->path);   
+        CSYNC_PATH_ARGS(cur));   
       }
   }
-  
+}
+
+/* each thread gets at least this many records */
+#define CSYNC_RECONCILE_MIN_PART 16384
+
+/* records per bucket on average, a bucket is sorted by insertion */
+#define CSYNC_RECONCILE_BUCKET_SIZE 8
+
+/* a record and its phash, ordering doesn't have to touch the records */
+struct _csync_reconcile_key_s {
+  uint64_t phash;
+  csync_file_stat_t *st;
+};
+
+/*
+ * The records of both replicas in buckets by the top bits of the phash. A
+ * bucket only holds hashes larger than the ones of the buckets before it.
+ * first[b] is the position of the first key of bucket b, first[nbuckets]
+ * the number of keys.
+ */
+struct _csync_reconcile_s {
+  CSYNC *ctx;
+  unsigned int bits;
+  size_t nbuckets;
+  struct _csync_reconcile_key_s *local;
+  size_t *lfirst;
+  struct _csync_reconcile_key_s *remote;
+  size_t *rfirst;
+};
+
+/* The buckets of a thread, they don't overlap with the other threads. */
+struct _csync_reconcile_part_s {
+  struct _csync_reconcile_s *r;
+  size_t begin;
+  size_t end;
+  /* renamed files found in the buckets, they are resolved by the caller */
+  csync_file_stat_t **renames;
+  size_t nrenames;
+  size_t size;
+#ifdef HAVE_PTHREAD
+  pthread_t thread;
+  int started;
+  /* the log settings are per thread */
+  int log_level;
+  csync_log_callback log_cb;
+  void *log_userdata;
+#endif
+};
+
+static size_t _csync_reconcile_bucket(uint64_t phash, unsigned int bits) {
+  return bits ? (size_t) (phash >> (64 - bits)) : 0;
+}
+
+static int _csync_reconcile_cmp(const void *a, const void *b) {
+  const struct _csync_reconcile_key_s *key_a = a;
+  const struct _csync_reconcile_key_s *key_b = b;
+
+  if (key_a->phash < key_b->phash) {
+    return -1;
+  }
+
+  return key_a->phash > key_b->phash;
+}
+
+static void _csync_reconcile_sort(struct _csync_reconcile_key_s *keys, size_t n) {
+  size_t i;
+
+  /* the hashes are spread evenly, the buckets are small */
+  if (n > 8 * CSYNC_RECONCILE_BUCKET_SIZE) {
+    qsort(keys, n, sizeof(struct _csync_reconcile_key_s), _csync_reconcile_cmp);
+    return;
+  }
+
+  for (i = 1; i < n; i++) {
+    struct _csync_reconcile_key_s key = keys[i];
+    size_t j = i;
+
+    while (j > 0 && keys[j - 1].phash > key.phash) {
+      keys[j] = keys[j - 1];
+      j--;
+    }
+    keys[j] = key;
+  }
+}
+
+/* Put the records of a tree into the buckets, first has nbuckets + 1 slots. */
+static struct _csync_reconcile_key_s *_csync_reconcile_split(c_hash_t *tree,
+    unsigned int bits, size_t nbuckets, size_t *first) {
+  struct _csync_reconcile_key_s *keys = NULL;
+  size_t *pos = NULL;
+  size_t n;
+  size_t b;
+
+  keys = c_malloc((c_hash_size(tree) + 1) * sizeof(struct _csync_reconcile_key_s));
+  pos = c_malloc(nbuckets * sizeof(size_t));
+  if (keys == NULL || pos == NULL) {
+    SAFE_FREE(keys);
+    SAFE_FREE(pos);
+    return NULL;
+  }
+
+  for (n = 0; n < c_hash_size(tree); n++) {
+    csync_file_stat_t *st = c_hash_at(tree, n);
+
+    pos[_csync_reconcile_bucket(st->phash, bits)]++;
+  }
+  first[0] = 0;
+  for (b = 0; b < nbuckets; b++) {
+    first[b + 1] = first[b] + pos[b];
+    pos[b] = first[b];
+  }
+
+  for (n = 0; n < c_hash_size(tree); n++) {
+    csync_file_stat_t *st = c_hash_at(tree, n);
+
+    b = pos[_csync_reconcile_bucket(st->phash, bits)]++;
+    keys[b].phash = st->phash;
+    keys[b].st = st;
+  }
+  SAFE_FREE(pos);
+
+  return keys;
+}
+
+/* A file only found on one replica, a rename which can't be kept is new. */
+static void _csync_reconcile_one(struct _csync_reconcile_part_s *part,
+                                 csync_file_stat_t *st) {
+  csync_file_stat_t **renames = NULL;
+
+  _csync_merge_algorithm(part->r->ctx, st, NULL);
+  if (st->instruction != CSYNC_INSTRUCTION_RENAME) {
+    return;
+  }
+
+  if (part->nrenames == part->size) {
+    size_t size = MAX(part->size * 2, 16);
+
+    renames = c_realloc(part->renames, size * sizeof(csync_file_stat_t *));
+    if (renames == NULL) {
+      st->instruction = CSYNC_INSTRUCTION_NEW;
+      return;
+    }
+    part->renames = renames;
+    part->size = size;
+  }
+  part->renames[part->nrenames++] = st;
+}
+
+/* A directory renamed on one replica and the records below its old path */
+struct _csync_reconcile_dir_s {
+  csync_file_stat_t *st;
+  csync_file_stat_t *other;
+  csync_file_stat_t **below;
+  size_t nbelow;
+  size_t size;
+};
+
+static int _csync_reconcile_dir_cmp(const void *a, const void *b) {
+  const struct _csync_reconcile_dir_s *dir_a = a;
+  const struct _csync_reconcile_dir_s *dir_b = b;
+  size_t len_a = csync_path_len(dir_a->st->path);
+  size_t len_b = csync_path_len(dir_b->st->path);
+
+  if (len_a < len_b) {
+    return -1;
+  }
+
+  return len_a > len_b;
+}
+
+static int _csync_reconcile_dir_add(struct _csync_reconcile_dir_s *dir,
+                                    csync_file_stat_t *st) {
+  csync_file_stat_t **below = NULL;
+
+  if (dir->nbelow == dir->size) {
+    size_t size = MAX(dir->size * 2, 16);
+
+    below = c_realloc(dir->below, size * sizeof(csync_file_stat_t *));
+    if (below == NULL) {
+      return -1;
+    }
+    dir->below = below;
+    dir->size = size;
+  }
+  dir->below[dir->nbelow++] = st;
+
   return 0;
 }
 
+/* The record at the path a record below the old path gets by the move */
+static csync_file_stat_t *_csync_reconcile_dir_target(c_hash_t *tree,
+    const struct _csync_reconcile_dir_s *dir, const csync_file_stat_t *st) {
+  csync_file_stat_t *target = NULL;
+  char *oldpath = NULL;
+  char *newpath = NULL;
+  char *path = NULL;
+  size_t oldlen;
+  size_t newlen;
+  size_t len;
+
+  oldpath = csync_path_str(st->path);
+  newpath = csync_path_str(dir->st->path);
+  if (oldpath == NULL || newpath == NULL) {
+    goto out;
+  }
+  oldlen = csync_path_len(dir->st->old_path);
+  newlen = csync_path_len(dir->st->path);
+  len = newlen + strlen(oldpath + oldlen);
+
+  path = c_malloc(len + 1);
+  if (path == NULL) {
+    goto out;
+  }
+  memcpy(path, newpath, newlen);
+  memcpy(path + newlen, oldpath + oldlen, len - newlen + 1);
+
+  target = c_hash_find(tree, c_jhash64((uint8_t *) path, len, 0));
+
+out:
+  SAFE_FREE(oldpath);
+  SAFE_FREE(newpath);
+  SAFE_FREE(path);
+  return target;
+}
+
+/*
+ * A renamed directory is moved as a whole if everything below its old path
+ * on the other replica is unchanged there and is found below the new path,
+ * moved along or modified. The moved records don't need to be propagated,
+ * the modified files are transferred on top of the move.
+ */
+static int _csync_reconcile_dir_apply(c_hash_t *tree,
+                                      struct _csync_reconcile_dir_s *dir) {
+  size_t n;
+
+  /* moved along with a directory renamed further up */
+  if (dir->other == NULL || dir->st->instruction != CSYNC_INSTRUCTION_RENAME) {
+    return 0;
+  }
+
+  for (n = 0; n < dir->nbelow; n++) {
+    csync_file_stat_t *st = dir->below[n];
+    csync_file_stat_t *target = NULL;
+
+    if (st->instruction != CSYNC_INSTRUCTION_REMOVE) {
+      return 0;
+    }
+    target = _csync_reconcile_dir_target(tree, dir, st);
+    if (target == NULL || target->type != st->type) {
+      return 0;
+    }
+    if (target->old_path == st->path) {
+      if (target->instruction != CSYNC_INSTRUCTION_RENAME) {
+        return 0;
+      }
+    } else if (target->old_path != NULL ||
+               target->instruction != CSYNC_INSTRUCTION_NEW) {
+      return 0;
+    }
+  }
+
+  dir->other->instruction = CSYNC_INSTRUCTION_NONE;
+  for (n = 0; n < dir->nbelow; n++) {
+    csync_file_stat_t *st = dir->below[n];
+    csync_file_stat_t *target = _csync_reconcile_dir_target(tree, dir, st);
+
+    st->instruction = CSYNC_INSTRUCTION_NONE;
+    /* the old path is kept to tell a moved record from an unchanged one */
+    if (target->old_path == st->path) {
+      target->instruction = CSYNC_INSTRUCTION_NONE;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Find the records below the old paths of the renamed directories on the
+ * other replica. The directories above a record are looked up by the hash
+ * of their path, like the update detection computes it.
+ */
+static int _csync_reconcile_dirs(CSYNC *ctx, c_hash_t *tree, c_hash_t *other,
+                                 struct _csync_reconcile_dir_s *dirs,
+                                 size_t ndirs) {
+  c_hash_t *index = NULL;
+  size_t n;
+  int rc = -1;
+
+  qsort(dirs, ndirs, sizeof(struct _csync_reconcile_dir_s),
+        _csync_reconcile_dir_cmp);
+
+  index = c_hash_new(ndirs);
+  if (index == NULL) {
+    goto out;
+  }
+  for (n = 0; n < ndirs; n++) {
+    int ret = c_hash_insert(index, dirs[n].st->old_path->phash, &dirs[n]);
+
+    if (ret < 0) {
+      goto out;
+    }
+    /* a second directory claiming the same old path is moved file by file */
+    if (ret > 0) {
+      dirs[n].other = NULL;
+    }
+  }
+
+  for (n = 0; n < c_hash_size(other); n++) {
+    csync_file_stat_t *st = c_hash_at(other, n);
+    const csync_dir_t *parent = st->path->dir;
+    size_t len;
+
+    if (parent == NULL) {
+      continue;
+    }
+
+    len = parent->pathlen;
+    while (len > 0) {
+      uint64_t h;
+      struct _csync_reconcile_dir_s *dir = NULL;
+
+      if (len == parent->pathlen) {
+        h = parent->phash;
+      } else {
+        h = c_jhash64((uint8_t *) parent->path, len, 0);
+      }
+      dir = c_hash_find(index, h);
+      if (dir != NULL && dir->st->old_path->phash == h &&
+          _csync_reconcile_dir_add(dir, st) < 0) {
+        goto out;
+      }
+
+      while (len > 0 && parent->path[len - 1] != '/') {
+        len--;
+      }
+      if (len > 0) {
+        len--;
+      }
+    }
+  }
+
+  for (n = 0; n < ndirs; n++) {
+    csync_file_stat_t *st = dirs[n].st;
+
+    if (_csync_reconcile_dir_apply(tree, &dirs[n])) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%-20s  dir: " CSYNC_PATH_FMT
+          " -> " CSYNC_PATH_FMT ", %zu records below",
+          csync_instruction_str(st->instruction),
+          CSYNC_PATH_ARGS(dirs[n].other), CSYNC_PATH_ARGS(st),
+          dirs[n].nbelow);
+    } else if (st->instruction == CSYNC_INSTRUCTION_RENAME) {
+      st->instruction = CSYNC_INSTRUCTION_NEW;
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%-20s  dir: " CSYNC_PATH_FMT,
+          csync_instruction_str(st->instruction), CSYNC_PATH_ARGS(st));
+    }
+  }
+  rc = 0;
+
+out:
+  c_hash_free(index);
+  if (rc < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+  }
+  return rc;
+}
+
+/*
+ * A file renamed on one replica is moved on the other one if the file is
+ * still at the old path there and unchanged, which the merge algorithm
+ * turned into a removal. Otherwise it is transferred as a new file. This
+ * runs after all ranges are done, the old path is in another range.
+ *
+ * The renamed directories are resolved first, the records they move along
+ * aren't renamed on their own anymore. A directory which can't be moved as
+ * a whole is created, the files below it are moved one by one.
+ */
+static int _csync_reconcile_renames(CSYNC *ctx,
+                                    struct _csync_reconcile_part_s *parts,
+                                    size_t nparts, enum csync_replica_e replica) {
+  struct _csync_reconcile_dir_s *dirs = NULL;
+  c_hash_t *tree = NULL;
+  c_hash_t *other = NULL;
+  size_t ndirs = 0;
+  size_t t;
+  size_t n;
+  int rc = -1;
+
+  if (replica == LOCAL_REPLICA) {
+    tree = ctx->local.tree;
+    other = ctx->remote.tree;
+  } else {
+    tree = ctx->remote.tree;
+    other = ctx->local.tree;
+  }
+
+  for (t = 0; t < nparts; t++) {
+    for (n = 0; n < parts[t].nrenames; n++) {
+      csync_file_stat_t *st = parts[t].renames[n];
+      csync_file_stat_t *old = NULL;
+      struct _csync_reconcile_dir_s *tmp = NULL;
+
+      if (st->type != CSYNC_FTW_TYPE_DIR || c_hash_find(tree, st->phash) != st) {
+        continue;
+      }
+      old = c_hash_find(other, st->old_path->phash);
+      if (old == NULL || old->type != CSYNC_FTW_TYPE_DIR ||
+          old->instruction != CSYNC_INSTRUCTION_REMOVE) {
+        st->instruction = CSYNC_INSTRUCTION_NEW;
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%-20s  dir: " CSYNC_PATH_FMT,
+            csync_instruction_str(st->instruction), CSYNC_PATH_ARGS(st));
+        continue;
+      }
+
+      tmp = c_realloc(dirs, (ndirs + 1) * sizeof(struct _csync_reconcile_dir_s));
+      if (tmp == NULL) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        goto out;
+      }
+      dirs = tmp;
+      ZERO_STRUCT(dirs[ndirs]);
+      dirs[ndirs].st = st;
+      dirs[ndirs].other = old;
+      ndirs++;
+    }
+  }
+
+  if (ndirs > 0 && _csync_reconcile_dirs(ctx, tree, other, dirs, ndirs) < 0) {
+    goto out;
+  }
+
+  for (t = 0; t < nparts; t++) {
+    for (n = 0; n < parts[t].nrenames; n++) {
+      csync_file_stat_t *st = parts[t].renames[n];
+      csync_file_stat_t *old = NULL;
+
+      if (st->type == CSYNC_FTW_TYPE_DIR ||
+          st->instruction != CSYNC_INSTRUCTION_RENAME ||
+          c_hash_find(tree, st->phash) != st) {
+        continue;
+      }
+
+      old = c_hash_find(other, st->old_path->phash);
+      if (st->type != CSYNC_FTW_TYPE_FILE || old == NULL ||
+          old->type != CSYNC_FTW_TYPE_FILE ||
+          old->instruction != CSYNC_INSTRUCTION_REMOVE) {
+        st->instruction = CSYNC_INSTRUCTION_NEW;
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%-20s file: " CSYNC_PATH_FMT,
+            csync_instruction_str(st->instruction), CSYNC_PATH_ARGS(st));
+        continue;
+      }
+
+      /* the move takes the file away from the old path */
+      old->instruction = CSYNC_INSTRUCTION_NONE;
+
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%-20s file: " CSYNC_PATH_FMT " -> "
+          CSYNC_PATH_FMT, csync_instruction_str(st->instruction),
+          CSYNC_PATH_ARGS(old), CSYNC_PATH_ARGS(st));
+    }
+  }
+  rc = 0;
+
+out:
+  for (n = 0; n < ndirs; n++) {
+    SAFE_FREE(dirs[n].below);
+  }
+  SAFE_FREE(dirs);
+  return rc;
+}
+
+/*
+ * The buckets of both replicas are sorted by phash and merged in one pass.
+ * A file found on both replicas is reconciled for the local record first
+ * and then for the remote one, like walking the local and then the remote
+ * tree would do.
+ */
+static void _csync_reconcile_part(struct _csync_reconcile_part_s *part) {
+  struct _csync_reconcile_s *r = part->r;
+  struct _csync_reconcile_key_s *local = r->local;
+  struct _csync_reconcile_key_s *remote = r->remote;
+  size_t b;
+
+  for (b = part->begin; b < part->end; b++) {
+    size_t i = r->lfirst[b];
+    size_t j = r->rfirst[b];
+    size_t nlocal = r->lfirst[b + 1];
+    size_t nremote = r->rfirst[b + 1];
+
+    _csync_reconcile_sort(local + i, nlocal - i);
+    _csync_reconcile_sort(remote + j, nremote - j);
+
+    while (i < nlocal || j < nremote) {
+      if (j == nremote || (i < nlocal && local[i].phash < remote[j].phash)) {
+        _csync_reconcile_one(part, local[i++].st);
+      } else if (i == nlocal || remote[j].phash < local[i].phash) {
+        _csync_reconcile_one(part, remote[j++].st);
+      } else {
+        _csync_merge_algorithm(r->ctx, local[i].st, remote[j].st);
+        _csync_merge_algorithm(r->ctx, remote[j].st, local[i].st);
+        i++;
+        j++;
+      }
+    }
+  }
+}
+
+#ifdef HAVE_PTHREAD
+static void *_csync_reconcile_worker(void *arg) {
+  struct _csync_reconcile_part_s *part = (struct _csync_reconcile_part_s *) arg;
+
+  csync_set_log_level(part->log_level);
+  if (part->log_cb != NULL) {
+    csync_set_log_callback(part->log_cb);
+  }
+  csync_set_log_userdata(part->log_userdata);
+
+  _csync_reconcile_part(part);
+
+  return NULL;
+}
+#endif
+
+/* Returns the number of threads to reconcile with, 1 runs in the caller. */
+static size_t _csync_reconcile_threads(CSYNC *ctx, size_t count) {
+#ifdef HAVE_PTHREAD
+  long threads = ctx->options.reconcile_threads;
+
+  if (threads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    threads = 1;
+#endif
+  }
+
+  /* starting a thread for a few records doesn't pay off */
+  if (threads > 1 && (size_t) threads > count / CSYNC_RECONCILE_MIN_PART) {
+    threads = count / CSYNC_RECONCILE_MIN_PART;
+  }
+
+  return threads > 1 ? (size_t) threads : 1;
+#else
+  (void) ctx;
+  (void) count;
+
+  return 1;
+#endif
+}
+
 int csync_reconcile_updates(CSYNC *ctx) {
-  int rc;
-  c_rbtree_t *tree = NULL;
+  struct _csync_reconcile_s r;
+  struct _csync_reconcile_part_s *parts = NULL;
+  size_t count;
+  size_t nthreads;
+  size_t t;
+  int rc = -1;
+
+  ZERO_STRUCT(r);
+  r.ctx = ctx;
+
+  count = MAX(c_hash_size(ctx->local.tree), c_hash_size(ctx->remote.tree));
+  while (r.bits < 32 &&
+         ((size_t) 1 << r.bits) * CSYNC_RECONCILE_BUCKET_SIZE < count) {
+    r.bits++;
+  }
+  r.nbuckets = (size_t) 1 << r.bits;
+
+  nthreads = _csync_reconcile_threads(ctx, c_hash_size(ctx->local.tree) +
+                                           c_hash_size(ctx->remote.tree));
+  nthreads = MIN(nthreads, r.nbuckets);
+
+  parts = c_malloc(nthreads * sizeof(struct _csync_reconcile_part_s));
+  r.lfirst = c_malloc((r.nbuckets + 1) * sizeof(size_t));
+  r.rfirst = c_malloc((r.nbuckets + 1) * sizeof(size_t));
+  if (parts == NULL || r.lfirst == NULL || r.rfirst == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
+  }
+
+  r.local = _csync_reconcile_split(ctx->local.tree, r.bits, r.nbuckets, r.lfirst);
+  r.remote = _csync_reconcile_split(ctx->remote.tree, r.bits, r.nbuckets, r.rfirst);
+  if (r.local == NULL || r.remote == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
+  }
 
-  switch (ctx->current) {
-    case LOCAL_REPLICA:
-      tree = ctx->local.tree;
-      break;
-    case REMOTE_REPLICA:
-      tree = ctx->remote.tree;
-      break;
-    default:
-      break;
+  for (t = 0; t < nthreads; t++) {
+    parts[t].r = &r;
+    parts[t].begin = r.nbuckets * t / nthreads;
+    parts[t].end = r.nbuckets * (t + 1) / nthreads;
   }
 
-  rc = c_rbtree_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
-  if( rc < 0 ) {
-    ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
+  if (nthreads == 1) {
+    _csync_reconcile_part(&parts[0]);
+    goto renames;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Reconciling in %zu threads", nthreads);
+
+#ifdef HAVE_PTHREAD
+  for (t = 0; t < nthreads; t++) {
+    parts[t].log_level = csync_get_log_level();
+    parts[t].log_cb = csync_get_log_callback();
+    parts[t].log_userdata = csync_get_log_userdata();
+    if (pthread_create(&parts[t].thread, NULL, _csync_reconcile_worker,
+          &parts[t]) == 0) {
+      parts[t].started = 1;
+    }
+  }
+
+  /* the buckets of a thread which didn't start are reconciled here */
+  for (t = 0; t < nthreads; t++) {
+    if (parts[t].started) {
+      pthread_join(parts[t].thread, NULL);
+    } else {
+      _csync_reconcile_part(&parts[t]);
+    }
+  }
+#endif
+
+renames:
+  if (_csync_reconcile_renames(ctx, parts, nthreads, LOCAL_REPLICA) < 0 ||
+      _csync_reconcile_renames(ctx, parts, nthreads, REMOTE_REPLICA) < 0) {
+    goto out;
+  }
+  rc = 0;
+
+out:
+  if (parts != NULL) {
+    for (t = 0; t < nthreads; t++) {
+      SAFE_FREE(parts[t].renames);
+    }
   }
+  SAFE_FREE(r.local);
+  SAFE_FREE(r.remote);
+  SAFE_FREE(r.lfirst);
+  SAFE_FREE(r.rfirst);
+  SAFE_FREE(parts);
   return rc;
 }
 
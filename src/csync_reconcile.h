@@ -42,7 +42,12 @@
  */
 
 /**
- * @brief Reconcile the files.
+ * @brief Reconcile the files of the local and the remote replica.
+ *
+ * The records of both replicas are split into phash ranges. The ranges are
+ * reconciled by a thread each, see the reconcile_threads option. In a range
+ * the records are sorted by phash and reconciled in a single pass over both
+ * replicas.
  *
  * @param  ctx          The csync context to use.
  *
@@ -26,6 +26,7 @@
 #endif
 
 #include <sqlite3.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -34,15 +35,45 @@
 
 #include "c_lib.h"
 #include "csync_private.h"
+#include "csync_path.h"
 #include "csync_statedb.h"
 #include "csync_util.h"
 #include "csync_time.h"
+#include "c_jhash.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.statedb"
 #include "csync_log.h"
 
 #define BUF_SIZE 16
 
+/* wait up to 12 seconds for a lock on the database to clear */
+#define CSYNC_STATEDB_BUSY_TIMEOUT 12000
+
+#define CSYNC_STATEDB_SELECT_METADATA \
+  "SELECT phash, pathlen, path, inode, uid, gid, mode, modtime FROM metadata"
+
+/*
+ * The statements prepared with csync_statedb_prepare(), keyed by the hash of
+ * their SQL. A statement another caller is still stepping is not handed out
+ * again, a second one is prepared and chained behind it.
+ */
+struct _csync_statedb_stmt_s {
+  sqlite3_stmt *stmt;
+  struct _csync_statedb_stmt_s *next;
+};
+
+/* the statement cache of a database handle */
+struct _csync_statedb_cache_s {
+  sqlite3 *db;
+  c_hash_t *stmts;
+  struct _csync_statedb_cache_s *next;
+};
+
+static struct _csync_statedb_cache_s *_csync_statedb_caches;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t _csync_statedb_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 void csync_set_statedb_exists(CSYNC *ctx, int val) {
   ctx->statedb.exists = val;
 }
@@ -52,24 +83,77 @@ int csync_get_statedb_exists(CSYNC *ctx) {
 }
 
 static int _csync_check_db_integrity(sqlite3 *db) {
-    c_strlist_t *result = NULL;
+    sqlite3_stmt *stmt = NULL;
+    const char *result = NULL;
     int rc = -1;
 
-    result = csync_statedb_query(db, "PRAGMA quick_check;");
-    if (result != NULL) {
+    stmt = csync_statedb_prepare(db, "PRAGMA quick_check;");
+    if (stmt == NULL) {
+        return -1;
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
         /* There is  a result */
-        if (result->count > 0) {
-            if (c_streq(result->vector[0], "ok")) {
-                rc = 0;
-            }
+        result = (const char *) sqlite3_column_text(stmt, 0);
+        if (result != NULL && c_streq(result, "ok")) {
+            rc = 0;
         }
-        c_strlist_destroy(result);
     }
+    sqlite3_reset(stmt);
 
     return rc;
 
 }
 
+static int _csync_statedb_cache_free_visitor(void *obj, void *data) {
+  struct _csync_statedb_stmt_s *e = obj;
+  struct _csync_statedb_stmt_s *next;
+
+  (void) data;
+
+  for (; e != NULL; e = next) {
+    next = e->next;
+    SAFE_FREE(e);
+  }
+
+  return 0;
+}
+
+/* The cached statements have to be finalized before closing the handle. */
+static void _csync_statedb_finalize_all(sqlite3 *db) {
+  struct _csync_statedb_cache_s **pc;
+  struct _csync_statedb_cache_s *cache = NULL;
+  sqlite3_stmt *stmt;
+
+  if (db == NULL) {
+    return;
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&_csync_statedb_caches_lock);
+#endif
+  for (pc = &_csync_statedb_caches; *pc != NULL; pc = &(*pc)->next) {
+    if ((*pc)->db == db) {
+      cache = *pc;
+      *pc = cache->next;
+      break;
+    }
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&_csync_statedb_caches_lock);
+#endif
+
+  if (cache != NULL) {
+    c_hash_walk(cache->stmts, NULL, _csync_statedb_cache_free_visitor);
+    c_hash_free(cache->stmts);
+    SAFE_FREE(cache);
+  }
+
+  while ((stmt = sqlite3_next_stmt(db, NULL)) != NULL) {
+    sqlite3_finalize(stmt);
+  }
+}
+
 static int _csync_statedb_check(const char *statedb) {
   int fd = -1, rc;
   ssize_t r;
@@ -95,8 +179,10 @@ static int _csync_statedb_check(const char *statedb) {
       buf[BUF_SIZE - 1] = '\0';
       if (c_streq(buf, "SQLite format 3")) {
         if (sqlite3_open(statedb, &db ) == SQLITE_OK) {
+          sqlite3_busy_timeout(db, CSYNC_STATEDB_BUSY_TIMEOUT);
           rc = _csync_check_db_integrity(db);
 
+          _csync_statedb_finalize_all(db);
           sqlite3_close(db);
 
           if(rc >= 0) {
@@ -131,22 +217,78 @@ static int _csync_statedb_check(const char *statedb) {
 }
 
 static int _csync_statedb_is_empty(sqlite3 *db) {
-  c_strlist_t *result = NULL;
-  int rc = 0;
+  sqlite3_stmt *stmt = NULL;
 
-  result = csync_statedb_query(db, "SELECT COUNT(phash) FROM metadata LIMIT 1 OFFSET 0;");
-  if (result == NULL) {
-    rc = 1;
+  /* fails to compile if there is no metadata table */
+  stmt = csync_statedb_prepare(db, "SELECT COUNT(phash) FROM metadata LIMIT 1 OFFSET 0;");
+  if (stmt == NULL) {
+    return 1;
   }
-  c_strlist_destroy(result);
 
-  return rc;
+  return 0;
+}
+
+static int _csync_statedb_create_transfer(sqlite3 *db) {
+  return csync_statedb_exec(db,
+      "CREATE TABLE IF NOT EXISTS transfer("
+      "phash INTEGER(8),"
+      "replica INTEGER,"
+      "size INTEGER(8),"
+      "modtime INTEGER(8),"
+      "inode INTEGER,"
+      "offset INTEGER(8),"
+      "checksum INTEGER(8),"
+      "tmpname VARCHAR(4096),"
+      "token VARCHAR(256),"
+      "PRIMARY KEY(phash)"
+      ");");
+}
+
+/*
+ * A run which didn't write the statedb leaves its temporary copy behind. The
+ * transfers it recorded are still valid, the temporary files are there.
+ */
+static void _csync_statedb_take_transfers(sqlite3 *db, const char *previous) {
+  sqlite3_stmt *stmt = NULL;
+  int found = 0;
+
+  /* these run once, don't keep them in the statement cache */
+  if (sqlite3_prepare_v2(db, "ATTACH DATABASE ?1 AS previous;", -1,
+        &stmt, NULL) != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return;
+  }
+  sqlite3_bind_text(stmt, 1, previous, -1, SQLITE_STATIC);
+  found = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+  if (!found) {
+    return;
+  }
+
+  stmt = NULL;
+  found = 0;
+  if (sqlite3_prepare_v2(db,
+        "SELECT name FROM previous.sqlite_master "
+        "WHERE type='table' AND name='transfer';", -1, &stmt, NULL) == SQLITE_OK) {
+    found = sqlite3_step(stmt) == SQLITE_ROW;
+  }
+  sqlite3_finalize(stmt);
+
+  if (found && _csync_statedb_create_transfer(db) == 0 &&
+      csync_statedb_exec(db,
+        "INSERT OR REPLACE INTO transfer SELECT * FROM previous.transfer;") == 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "Took over the transfers of an unfinished run");
+  }
+
+  csync_statedb_exec(db, "DETACH DATABASE previous;");
 }
 
 int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
   int rc = -1;
-  c_strlist_t *result = NULL;
   char *statedb_tmp = NULL;
+  char *statedb_previous = NULL;
+  int previous = 0;
   sqlite3 *db = NULL;
 
   rc = _csync_statedb_check(statedb);
@@ -166,6 +308,15 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
     goto out;
   }
 
+  rc = asprintf(&statedb_previous, "%s.ctmp.previous", statedb);
+  if (rc < 0) {
+    rc = -1;
+    goto out;
+  }
+  if (c_isfile(statedb_tmp) && c_rename(statedb_tmp, statedb_previous) == 0) {
+    previous = 1;
+  }
+
   rc = c_copy(statedb, statedb_tmp, 0644);
   if (rc < 0) {
     goto out;
@@ -178,6 +329,9 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
   }
   SAFE_FREE(statedb_tmp);
 
+  /* let sqlite wait for locks instead of failing with SQLITE_BUSY */
+  sqlite3_busy_timeout(db, CSYNC_STATEDB_BUSY_TIMEOUT);
+
   if (_csync_statedb_is_empty(db)) {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "statedb doesn't exist");
     csync_set_statedb_exists(ctx, 0);
@@ -186,15 +340,29 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
   }
 
   /* optimization for speeding up SQLite */
-  result = csync_statedb_query(db, "PRAGMA default_synchronous = FULL;");
-  c_strlist_destroy(result);
+  csync_statedb_exec(db, "PRAGMA default_synchronous = FULL;");
+
+  if (previous) {
+    _csync_statedb_take_transfers(db, statedb_previous);
+  }
 
   *pdb = db;
+  rc = 0;
+  db = NULL;
 
-  return 0;
 out:
+  if (previous && rc < 0) {
+    /* keep the transfers for the next run */
+    c_rename(statedb_previous, statedb_tmp);
+  } else if (previous) {
+    mbchar_t *mb_previous = c_utf8_to_locale(statedb_previous);
+    _tunlink(mb_previous);
+    c_free_locale_string(mb_previous);
+  }
+  _csync_statedb_finalize_all(db);
   sqlite3_close(db);
   SAFE_FREE(statedb_tmp);
+  SAFE_FREE(statedb_previous);
   return rc;
 }
 
@@ -236,6 +404,12 @@ int csync_statedb_write(CSYNC *ctx, sqlite3 *db)
                 "## INSERT took %.2f seconds",
                 c_secdiff(finish, start));
 
+  /* insert etags */
+  rc = csync_statedb_insert_etags(ctx, db);
+  if (rc < 0) {
+    return -1;
+  }
+
   return 0;
 }
 
@@ -245,6 +419,7 @@ int csync_statedb_close(const char *statedb, sqlite3 *db, int jwritten) {
   mbchar_t *mb_statedb = NULL;
 
   /* close the temporary database */
+  _csync_statedb_finalize_all(db);
   sqlite3_close(db);
 
   if (asprintf(&statedb_tmp, "%s.ctmp", statedb) < 0) {
@@ -287,14 +462,14 @@ int csync_statedb_close(const char *statedb, sqlite3 *db, int jwritten) {
 }
 
 int csync_statedb_create_tables(sqlite3 *db) {
-  c_strlist_t *result = NULL;
+  int rc;
 
   /*
    * Create temorary table to work on, this speeds up the
    * creation of the statedb if we later just rename it to its
    * final name metadata
    */
-  result = csync_statedb_query(db,
+  rc = csync_statedb_exec(db,
       "CREATE TABLE IF NOT EXISTS metadata_temp("
       "phash INTEGER(8),"
       "pathlen INTEGER,"
@@ -308,17 +483,16 @@ int csync_statedb_create_tables(sqlite3 *db) {
       ");"
       );
 
-  if (result == NULL) {
+  if (rc < 0) {
     return -1;
   }
-  c_strlist_destroy(result);
 
   /*
    * Create the 'real' table in case it does not exist. This is important
    * for first time sync. Otherwise other functions that query metadata
    * table whine about the table not existing.
    */
-  result = csync_statedb_query(db,
+  rc = csync_statedb_exec(db,
       "CREATE TABLE IF NOT EXISTS metadata("
       "phash INTEGER(8),"
       "pathlen INTEGER,"
@@ -332,31 +506,41 @@ int csync_statedb_create_tables(sqlite3 *db) {
       ");"
       );
 
-  if (result == NULL) {
+  if (rc < 0) {
     return -1;
   }
-  c_strlist_destroy(result);
-
 
-  return 0;
-}
+  /* ETags of the remote directories, see csync_statedb_insert_etags() */
+  rc = csync_statedb_exec(db,
+      "CREATE TABLE IF NOT EXISTS etag("
+      "phash INTEGER(8),"
+      "path VARCHAR(4096),"
+      "etag VARCHAR(256),"
+      "PRIMARY KEY(phash)"
+      ");"
+      );
 
-int csync_statedb_drop_tables(sqlite3* db) {
-  c_strlist_t *result = NULL;
+  if (rc < 0) {
+    return -1;
+  }
 
-  result = csync_statedb_query(db,
-      "DROP TABLE IF EXISTS metadata_temp;"
-      );
-  if (result == NULL) {
+  /* unfinished copies, see csync_statedb_get_transfer() */
+  rc = _csync_statedb_create_transfer(db);
+  if (rc < 0) {
     return -1;
   }
-  c_strlist_destroy(result);
 
   return 0;
 }
 
+int csync_statedb_drop_tables(sqlite3* db) {
+  return csync_statedb_exec(db, "DROP TABLE IF EXISTS metadata_temp;");
+}
+
 static int _insert_metadata_visitor(void *obj, void *data) {
   csync_file_stat_t *fs = NULL;
+  char *path = NULL;
+  size_t pathlen;
   int rc = -1;
   sqlite3_stmt* stmt;
 
@@ -380,13 +564,20 @@ static int _insert_metadata_visitor(void *obj, void *data) {
     /* As we only sync the local tree we need this flag here */
   case CSYNC_INSTRUCTION_UPDATED:
   case CSYNC_INSTRUCTION_CONFLICT:
+    path = csync_file_stat_path(fs);
+    if (path == NULL) {
+      rc = -1;
+      break;
+    }
+    pathlen = csync_file_stat_pathlen(fs);
+
     CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
               "SQL statement: INSERT INTO metadata_temp \n"
               "\t\t\t(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES \n"
               "\t\t\t(%llu, %lu, %s, %llu, %u, %u, %u, %lu);",
               (long long unsigned int) fs->phash,
-              (long unsigned int) fs->pathlen,
-              fs->path,
+              (long unsigned int) pathlen,
+              path,
               (long long unsigned int) fs->inode,
               fs->uid,
               fs->gid,
@@ -397,8 +588,8 @@ static int _insert_metadata_visitor(void *obj, void *data) {
        * The phash needs to be long long unsigned int or it segfaults on PPC
        */
     sqlite3_bind_int64(stmt, 1, (long long signed int) fs->phash);
-    sqlite3_bind_int64(stmt, 2, (long unsigned int) fs->pathlen);
-    sqlite3_bind_text( stmt, 3, fs->path, fs->pathlen, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, (long unsigned int) pathlen);
+    sqlite3_bind_text( stmt, 3, path, pathlen, SQLITE_STATIC);
     sqlite3_bind_int64(stmt, 4, (long long signed int) fs->inode);
     sqlite3_bind_int(  stmt, 5, fs->uid);
     sqlite3_bind_int(  stmt, 6, fs->gid);
@@ -412,12 +603,13 @@ static int _insert_metadata_visitor(void *obj, void *data) {
     }
 
     sqlite3_reset(stmt);
+    SAFE_FREE(path);
 
     break;
   default:
     CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
-              "file: %s, instruction: %s (%d), not added to statedb!",
-              fs->path, csync_instruction_str(fs->instruction), fs->instruction);
+              "file: " CSYNC_PATH_FMT ", instruction: %s (%d), not added to statedb!",
+              CSYNC_PATH_ARGS(fs), csync_instruction_str(fs->instruction), fs->instruction);
     rc = 1;
     break;
   }
@@ -426,58 +618,45 @@ static int _insert_metadata_visitor(void *obj, void *data) {
 }
 
 int csync_statedb_insert_metadata(CSYNC *ctx, sqlite3 *db) {
-  c_strlist_t *result = NULL;
   struct timespec start, step1, step2, finish;
-  int rc;
-
-  char buffer[] = "INSERT INTO metadata_temp VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)";
   sqlite3_stmt* stmt;
 
   csync_gettime(&start);
 
-  /* prepare the INSERT statement */
-  rc = sqlite3_prepare_v2(db, buffer, strlen(buffer), &stmt, NULL);
-  if (rc != SQLITE_OK) {
+  /* Use transactions as that really speeds up processing */
+  csync_statedb_exec(db, "BEGIN TRANSACTION;");
+
+  /* prepare the INSERT statement, the table has just been created */
+  stmt = csync_statedb_prepare(db,
+      "INSERT INTO metadata_temp VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)");
+  if (stmt == NULL) {
+    csync_statedb_exec(db, "ROLLBACK TRANSACTION;");
     return -1;
   }
 
-  /* Use transactions as that really speeds up processing */
-  result = csync_statedb_query(db, "BEGIN TRANSACTION;");
-  c_strlist_destroy(result);
-
-  if (c_rbtree_walk(ctx->local.tree, stmt, _insert_metadata_visitor) < 0) {
+  if (c_hash_walk(ctx->local.tree, stmt, _insert_metadata_visitor) < 0) {
     /* inserting failed. Drop the metadata_temp table. */
-    result = csync_statedb_query(db, "ROLLBACK TRANSACTION;");
-    c_strlist_destroy(result);
-
-    result = csync_statedb_query(db, "DROP TABLE IF EXISTS metadata_temp;");
-    c_strlist_destroy(result);
+    sqlite3_reset(stmt);
+    csync_statedb_exec(db, "ROLLBACK TRANSACTION;");
+    csync_statedb_exec(db, "DROP TABLE IF EXISTS metadata_temp;");
 
     return -1;
   }
 
-  result = csync_statedb_query(db, "COMMIT TRANSACTION;");
-  c_strlist_destroy(result);
+  csync_statedb_exec(db, "COMMIT TRANSACTION;");
 
-  sqlite3_finalize(stmt);
   csync_gettime(&step1);
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
                 "Transaction1 took %.2f seconds",
                  c_secdiff(step1, start));
 
   /* Drop table metadata */
-  result = csync_statedb_query(db, "BEGIN TRANSACTION;");
-  c_strlist_destroy(result);
-
-  result = csync_statedb_query(db, "DROP TABLE IF EXISTS metadata;");
-  c_strlist_destroy(result);
+  csync_statedb_exec(db, "BEGIN TRANSACTION;");
+  csync_statedb_exec(db, "DROP TABLE IF EXISTS metadata;");
 
   /* Rename temp table to real table. */
-  result = csync_statedb_query(db, "ALTER TABLE metadata_temp RENAME TO metadata;");
-  c_strlist_destroy(result);
-
-  result = csync_statedb_query(db, "COMMIT TRANSACTION;");
-  c_strlist_destroy(result);
+  csync_statedb_exec(db, "ALTER TABLE metadata_temp RENAME TO metadata;");
+  csync_statedb_exec(db, "COMMIT TRANSACTION;");
 
   csync_gettime(&step2);
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
@@ -485,25 +664,27 @@ int csync_statedb_insert_metadata(CSYNC *ctx, sqlite3 *db) {
                 c_secdiff(step2, step1));
 
   /* Recreate indices */
-  result = csync_statedb_query(db, "BEGIN TRANSACTION;");
-  c_strlist_destroy(result);
+  csync_statedb_exec(db, "BEGIN TRANSACTION;");
 
-  result = csync_statedb_query(db,
-      "CREATE INDEX IF NOT EXISTS metadata_phash ON metadata(phash);");
-  if (result == NULL) {
+  if (csync_statedb_exec(db,
+        "CREATE INDEX IF NOT EXISTS metadata_phash ON metadata(phash);") < 0) {
     return -1;
   }
-  c_strlist_destroy(result);
 
-  result = csync_statedb_query(db,
-      "CREATE INDEX IF NOT EXISTS metadata_inode ON metadata(inode);");
-  if (result == NULL) {
+  if (csync_statedb_exec(db,
+        "CREATE INDEX IF NOT EXISTS metadata_inode ON metadata(inode);") < 0) {
     return -1;
   }
-  c_strlist_destroy(result);
 
-  result = csync_statedb_query(db, "COMMIT TRANSACTION;");
-  c_strlist_destroy(result);
+  /* the incremental update looks up the entries below a directory */
+  if (ctx->options.full_scan_interval > 0) {
+    if (csync_statedb_exec(db,
+          "CREATE INDEX IF NOT EXISTS metadata_path ON metadata(path);") < 0) {
+      return -1;
+    }
+  }
+
+  csync_statedb_exec(db, "COMMIT TRANSACTION;");
 
   csync_gettime(&finish);
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
@@ -514,309 +695,1023 @@ int csync_statedb_insert_metadata(CSYNC *ctx, sqlite3 *db) {
   return 0;
 }
 
-/* caller must free the memory */
-csync_file_stat_t *csync_statedb_get_stat_by_hash(sqlite3 *db,
-                                                  uint64_t phash)
-{
+/* phash, pathlen, path, inode, uid, gid, mode, modtime */
+static void _csync_statedb_decode(sqlite3_stmt *stmt, csync_file_stat_t *st) {
+  /* the phash is stored as a signed INTEGER(8), cast it back */
+  st->phash = (uint64_t) sqlite3_column_int64(stmt, 0);
+  st->inode = (ino_t) sqlite3_column_int64(stmt, 3);
+  st->uid = sqlite3_column_int(stmt, 4);
+  st->gid = sqlite3_column_int(stmt, 5);
+  st->mode = sqlite3_column_int(stmt, 6);
+  st->modtime = (time_t) sqlite3_column_int64(stmt, 7);
+  st->instruction = CSYNC_INSTRUCTION_NONE;
+}
+
+/* take the path of a decoded row from the pool */
+static int _csync_statedb_decode_path(sqlite3_stmt *stmt,
+                                      csync_path_pool_t *paths,
+                                      csync_file_stat_t *st) {
+  const char *path;
+  size_t len;
+
+  path = (const char *) sqlite3_column_text(stmt, 2);
+  len = path ? (size_t) sqlite3_column_bytes(stmt, 2) : 0;
+
+  st->path = csync_path_get(paths, st->phash, (len ? path : ""), len);
+  if (st->path == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Fetch the next row, the statement is reset afterwards if reset is set. */
+static csync_file_stat_t *_csync_statedb_get_stat(sqlite3_stmt *stmt,
+                                                  csync_path_pool_t *paths,
+                                                  int reset) {
   csync_file_stat_t *st = NULL;
-  c_strlist_t *result = NULL;
-  char *stmt = NULL;
-  size_t len = 0;
 
-  /* Use %lld instead of %llu otherwise there is an overflow in sqlite
-   * which only supports signed */
-  stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE phash='%lld'",
-      (long long int) phash);
-  if (stmt == NULL) {
-    return NULL;
+  if (sqlite3_step(stmt) != SQLITE_ROW) {
+    goto out;
   }
 
-  result = csync_statedb_query(db, stmt);
-  sqlite3_free(stmt);
-  if (result == NULL) {
-    return NULL;
+  st = c_malloc(sizeof(csync_file_stat_t));
+  if (st == NULL) {
+    goto out;
   }
 
-  if (result->count <= 6) {
-    c_strlist_destroy(result);
-    return NULL;
+  _csync_statedb_decode(stmt, st);
+  if (_csync_statedb_decode_path(stmt, paths, st) < 0) {
+    SAFE_FREE(st);
+  }
+
+out:
+  if (reset) {
+    sqlite3_reset(stmt);
   }
-  /* phash, pathlen, path, inode, uid, gid, mode, modtime */
-  len = strlen(result->vector[2]);
-  st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
+  return st;
+}
+
+void csync_statedb_stat_free(csync_path_pool_t *paths, csync_file_stat_t *st) {
   if (st == NULL) {
-    c_strlist_destroy(result);
-    return NULL;
+    return;
   }
 
-  /*
-   * FIXME:
-   * We use an INTEGER(8) which is signed to the phash in the sqlite3 db,
-   * but the phash is an uint64_t. So for some values we get a string like
-   * "1.66514565505016e+19". For such a string strtoull() returns 1.
-   * phash = 1
-   *
-   * st->phash = strtoull(result->vector[0], NULL, 10);
-   */
+  csync_path_put(paths, st->path);
+  SAFE_FREE(st);
+}
 
-   /* The query suceeded so use the phash we pass to the function. */
-  st->phash = phash;
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_stat_by_hash(sqlite3 *db,
+                                                  csync_path_pool_t *paths,
+                                                  uint64_t phash)
+{
+  sqlite3_stmt *stmt = NULL;
 
-  st->pathlen = atoi(result->vector[1]);
-  memcpy(st->path, (len ? result->vector[2] : ""), len + 1);
-  st->inode = atoi(result->vector[3]);
-  st->uid = atoi(result->vector[4]);
-  st->gid = atoi(result->vector[5]);
-  st->mode = atoi(result->vector[6]);
-  st->modtime = strtoul(result->vector[7], NULL, 10);
+  stmt = csync_statedb_prepare(db,
+      CSYNC_STATEDB_SELECT_METADATA " WHERE phash=?1;");
+  if (stmt == NULL) {
+    return NULL;
+  }
 
-  c_strlist_destroy(result);
+  /* sqlite only supports signed integers */
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64) phash);
 
-  return st;
+  return _csync_statedb_get_stat(stmt, paths, 1);
 }
 
 /* caller must free the memory */
 csync_file_stat_t *csync_statedb_get_stat_by_inode(sqlite3 *db,
+                                                   csync_path_pool_t *paths,
                                                    ino_t inode) {
-  csync_file_stat_t *st = NULL;
-  c_strlist_t *result = NULL;
-  char *stmt = NULL;
-  size_t len = 0;
+  sqlite3_stmt *stmt = NULL;
 
 #ifdef _WIN32
   /* no idea about inodes. */
-  return st;
+  return NULL;
 #endif
 
-  stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE inode='%llu'",
-                         (long long unsigned int)inode);
+  stmt = csync_statedb_prepare(db,
+      CSYNC_STATEDB_SELECT_METADATA " WHERE inode=?1;");
   if (stmt == NULL) {
     return NULL;
   }
 
-  result = csync_statedb_query(db, stmt);
-  sqlite3_free(stmt);
-  if (result == NULL) {
-    return NULL;
-  }
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64) inode);
 
-  if (result->count <= 6) {
-    c_strlist_destroy(result);
-    return NULL;
+  return _csync_statedb_get_stat(stmt, paths, 1);
+}
+
+int csync_statedb_get_below_path(sqlite3 *db, csync_path_pool_t *paths,
+                                 const char *path, c_list_t **list) {
+  sqlite3_stmt *stmt = NULL;
+  csync_file_stat_t *st = NULL;
+  c_list_t *result = NULL;
+  c_list_t *tmp = NULL;
+  char *lower = NULL;
+  char *upper = NULL;
+  int count = 0;
+
+  stmt = csync_statedb_prepare(db,
+      CSYNC_STATEDB_SELECT_METADATA " WHERE path > ?1 AND path < ?2;");
+  if (stmt == NULL) {
+    return -1;
   }
 
-  /* phash, pathlen, path, inode, uid, gid, mode, modtime */
-  len = strlen(result->vector[2]);
-  st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
-  if (st == NULL) {
-    c_strlist_destroy(result);
-    return NULL;
+  /* everything starting with "path/" sorts between "path/" and "path0" */
+  if (asprintf(&lower, "%s/", path) < 0 || asprintf(&upper, "%s0", path) < 0) {
+    count = -1;
+    goto out;
+  }
+  sqlite3_bind_text(stmt, 1, lower, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, upper, -1, SQLITE_STATIC);
+
+  while ((st = _csync_statedb_get_stat(stmt, paths, 0)) != NULL) {
+    tmp = c_list_prepend(result, st);
+    if (tmp == NULL) {
+      csync_statedb_stat_free(paths, st);
+      count = -1;
+      goto out;
+    }
+    result = tmp;
+    count++;
   }
 
-  st->phash = strtoull(result->vector[0], NULL, 10);
-  st->pathlen = atoi(result->vector[1]);
-  memcpy(st->path, (len ? result->vector[2] : ""), len + 1);
-  st->inode = atoi(result->vector[3]);
-  st->uid = atoi(result->vector[4]);
-  st->gid = atoi(result->vector[5]);
-  st->mode = atoi(result->vector[6]);
-  st->modtime = strtoul(result->vector[7], NULL, 10);
+out:
+  sqlite3_reset(stmt);
+  SAFE_FREE(lower);
+  SAFE_FREE(upper);
 
-  c_strlist_destroy(result);
+  if (count < 0) {
+    for (tmp = result; tmp != NULL; tmp = c_list_next(tmp)) {
+      csync_statedb_stat_free(paths, tmp->data);
+    }
+    c_list_free(result);
+    return -1;
+  }
+  *list = result;
 
-  return st;
+  return count;
 }
 
-/* query the statedb, caller must free the memory */
-c_strlist_t *csync_statedb_query(sqlite3 *db,
-                                 const char *statement) {
-  int err = SQLITE_OK;
-  int rc = SQLITE_OK;
-  size_t i = 0;
-  size_t busy_count = 0;
-  size_t retry_count = 0;
-  size_t column_count = 0;
-  sqlite3_stmt *stmt;
-  const char *tail = NULL;
-  c_strlist_t *result = NULL;
+int csync_statedb_get_value(sqlite3 *db, const char *key, int64_t *value) {
+  sqlite3_stmt *stmt = NULL;
+  int rc = -1;
 
-  do {
-    /* compile SQL program into a virtual machine, reattempteing if busy */
-    do {
-      if (busy_count) {
-        /* sleep 100 msec */
-        usleep(100000);
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "sqlite3_prepare: BUSY counter: %zu", busy_count);
-      }
-      err = sqlite3_prepare(db, statement, -1, &stmt, &tail);
-    } while (err == SQLITE_BUSY && busy_count ++ < 120);
+  stmt = csync_statedb_prepare(db, "SELECT value FROM state WHERE key=?1;");
+  if (stmt == NULL) {
+    return -1;
+  }
+  sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
 
-    if (err != SQLITE_OK) {
-      if (err == SQLITE_BUSY) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Gave up waiting for lock to clear");
-      }
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
-                "sqlite3_compile error: %s - on query %s",
-                sqlite3_errmsg(db), statement);
-      break;
-    } else {
-      busy_count = 0;
-      column_count = sqlite3_column_count(stmt);
-
-      /* execute virtual machine by iterating over rows */
-      for(;;) {
-        err = sqlite3_step(stmt);
-
-        if (err == SQLITE_BUSY) {
-          if (busy_count++ > 120) {
-            CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Busy counter has reached its maximum. Aborting this sql statement");
-            break;
-          }
-          /* sleep 100 msec */
-          usleep(100000);
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "sqlite3_step: BUSY counter: %zu", busy_count);
-          continue;
-        }
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    *value = sqlite3_column_int64(stmt, 0);
+    rc = 0;
+  }
+  sqlite3_reset(stmt);
 
-        if (err == SQLITE_MISUSE) {
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_step: MISUSE!!");
-        }
+  return rc;
+}
 
-        if (err == SQLITE_DONE) {
-          if (result == NULL) {
-            result = c_strlist_new(1);
-          }
-          break;
-        }
+int csync_statedb_set_value(sqlite3 *db, const char *key, int64_t value) {
+  sqlite3_stmt *stmt = NULL;
+  int rc;
 
-        if (err == SQLITE_ERROR) {
-          break;
-        }
+  rc = csync_statedb_exec(db,
+      "CREATE TABLE IF NOT EXISTS state("
+      "key VARCHAR(64),"
+      "value INTEGER,"
+      "PRIMARY KEY(key)"
+      ");");
+  if (rc < 0) {
+    return -1;
+  }
 
-        /* If something went wrong make sure we don't leak memory */
-        if (result != NULL) {
-          c_strlist_destroy(result);
-        }
-        result = c_strlist_new(column_count);
-        if (result == NULL) {
-          return NULL;
-        }
+  stmt = csync_statedb_prepare(db,
+      "INSERT OR REPLACE INTO state (key, value) VALUES (?1, ?2);");
+  if (stmt == NULL) {
+    return -1;
+  }
+  sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, value);
 
-        /* iterate over columns */
-        for (i = 0; i < column_count; i++) {
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "sqlite3_column_text: %s", (char *) sqlite3_column_text(stmt, i));
-          if (c_strlist_add(result, (char *) sqlite3_column_text(stmt, i)) < 0) {
-            c_strlist_destroy(result);
-            return NULL;
-          }
-        }
-      } /* end infinite for loop */
+  rc = sqlite3_step(stmt) == SQLITE_DONE ? 0 : -1;
+  sqlite3_reset(stmt);
 
-      /* deallocate vm resources */
-      rc = sqlite3_finalize(stmt);
+  return rc;
+}
 
-      if (err != SQLITE_DONE && rc != SQLITE_SCHEMA) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite_step error: %s - on query: %s", sqlite3_errmsg(db), statement);
-        if (result != NULL) {
-          c_strlist_destroy(result);
-        }
-        result = c_strlist_new(1);
-      }
+csync_etag_t *csync_statedb_etag_new(const char *path, const char *etag) {
+  csync_etag_t *e = NULL;
+  size_t len = strlen(path);
 
-      if (rc == SQLITE_SCHEMA) {
-        retry_count ++;
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "SQLITE_SCHEMA error occurred on query: %s", statement);
-        if (retry_count < 10) {
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Retrying now.");
-        } else {
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "RETRY count has reached its maximum. Aborting statement: %s", statement);
-          if (result != NULL) {
-            c_strlist_destroy(result);
-          }
-          result = c_strlist_new(1);
-        }
-      }
-    }
-  } while (rc == SQLITE_SCHEMA && retry_count < 10);
+  e = c_malloc(sizeof(csync_etag_t) + len + 1 + strlen(etag) + 1);
+  if (e == NULL) {
+    return NULL;
+  }
+  e->phash = c_jhash64((uint8_t *) path, len, 0);
+  e->pathlen = len;
+  memcpy(e->path, path, len + 1);
+  e->etag = e->path + len + 1;
+  strcpy(e->etag, etag);
 
-  return result;
+  return e;
 }
 
-int csync_statedb_insert(sqlite3 *db, const char *statement) {
-  int err;
-  int rc = 0;
-  int busy_count = 0;
-  int retry_count = 0;
-  sqlite3_stmt *stmt;
-  const char *tail;
+char *csync_statedb_get_etag(sqlite3 *db, uint64_t phash) {
+  sqlite3_stmt *stmt = NULL;
+  char *etag = NULL;
 
-  if (!statement[0]) {
-    return 0;
+  /* the table doesn't exist before the first write */
+  stmt = csync_statedb_prepare(db, "SELECT etag FROM etag WHERE phash=?1;");
+  if (stmt == NULL) {
+    return NULL;
   }
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64) phash);
 
-  do {
-    /* compile SQL program into a virtual machine, reattempteing if busy */
-    do {
-      if (busy_count) {
-        /* sleep 100 msec */
-        usleep(100000);
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "sqlite3_prepare: BUSY counter: %d", busy_count);
-      }
-      err = sqlite3_prepare(db, statement, -1, &stmt, &tail);
-    } while (err == SQLITE_BUSY && busy_count++ < 120);
+  if (sqlite3_step(stmt) == SQLITE_ROW &&
+      sqlite3_column_text(stmt, 0) != NULL) {
+    etag = c_strdup((const char *) sqlite3_column_text(stmt, 0));
+  }
+  sqlite3_reset(stmt);
 
-    if (err != SQLITE_OK) {
-      if (err == SQLITE_BUSY) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Gave up waiting for lock to clear");
-      }
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_compile error: %s on query %s", sqlite3_errmsg(db), statement);
-      break;
-    } else {
-      busy_count = 0;
+  return etag;
+}
 
-      /* execute virtual machine by iterating over rows */
-      for(;;) {
-        err = sqlite3_step(stmt);
+int csync_statedb_get_etags_below_path(sqlite3 *db, const char *path,
+                                       c_list_t **list) {
+  sqlite3_stmt *stmt = NULL;
+  csync_etag_t *e = NULL;
+  c_list_t *result = NULL;
+  c_list_t *tmp = NULL;
+  char *lower = NULL;
+  char *upper = NULL;
+  int count = 0;
+
+  stmt = csync_statedb_prepare(db,
+      "SELECT path, etag FROM etag WHERE path > ?1 AND path < ?2;");
+  if (stmt == NULL) {
+    return -1;
+  }
 
-        if (err == SQLITE_BUSY) {
-          if (busy_count++ > 120) {
-            CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Busy counter has reached its maximum. Aborting this sql statement");
-            break;
-          }
-          /* sleep 100 msec */
-          usleep(100000);
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "sqlite3_step: BUSY counter: %d", busy_count);
-        }
+  /* same range as in csync_statedb_get_below_path() */
+  if (asprintf(&lower, "%s/", path) < 0 || asprintf(&upper, "%s0", path) < 0) {
+    count = -1;
+    goto out;
+  }
+  sqlite3_bind_text(stmt, 1, lower, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, upper, -1, SQLITE_STATIC);
 
-        if (err == SQLITE_MISUSE) {
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_step: MISUSE!!");
-        }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *p = (const char *) sqlite3_column_text(stmt, 0);
+    const char *etag = (const char *) sqlite3_column_text(stmt, 1);
 
-        if (err == SQLITE_DONE || err == SQLITE_ERROR) {
-          break;
-        }
-      } /* end infinite for loop */
+    if (p == NULL || etag == NULL) {
+      continue;
+    }
+    e = csync_statedb_etag_new(p, etag);
+    if (e == NULL) {
+      count = -1;
+      goto out;
+    }
+    tmp = c_list_prepend(result, e);
+    if (tmp == NULL) {
+      SAFE_FREE(e);
+      count = -1;
+      goto out;
+    }
+    result = tmp;
+    count++;
+  }
 
-      /* deallocate vm resources */
-      rc = sqlite3_finalize(stmt);
+out:
+  sqlite3_reset(stmt);
+  SAFE_FREE(lower);
+  SAFE_FREE(upper);
 
-      if (err != SQLITE_DONE && rc != SQLITE_SCHEMA) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-                  "sqlite_step error: %s on insert: %s",
-                  sqlite3_errmsg(db), statement);
+  if (count < 0) {
+    for (tmp = result; tmp != NULL; tmp = c_list_next(tmp)) {
+      SAFE_FREE(tmp->data);
+    }
+    c_list_free(result);
+    return -1;
+  }
+  *list = result;
+
+  return count;
+}
+
+csync_transfer_t *csync_statedb_transfer_new(const char *tmpname) {
+  csync_transfer_t *t = NULL;
+
+  t = c_malloc(sizeof(csync_transfer_t) + strlen(tmpname));
+  if (t == NULL) {
+    return NULL;
+  }
+  strcpy(t->tmpname, tmpname);
+
+  return t;
+}
+
+static csync_transfer_t *_csync_statedb_transfer_row(sqlite3_stmt *stmt) {
+  csync_transfer_t *t = NULL;
+  const char *tmpname = (const char *) sqlite3_column_text(stmt, 7);
+  const char *token = NULL;
+
+  if (tmpname == NULL) {
+    return NULL;
+  }
+  t = csync_statedb_transfer_new(tmpname);
+  if (t == NULL) {
+    return NULL;
+  }
+  t->phash = (uint64_t) sqlite3_column_int64(stmt, 0);
+  t->replica = sqlite3_column_int(stmt, 1);
+  t->size = sqlite3_column_int64(stmt, 2);
+  t->modtime = (time_t) sqlite3_column_int64(stmt, 3);
+  t->inode = (ino_t) sqlite3_column_int64(stmt, 4);
+  t->offset = sqlite3_column_int64(stmt, 5);
+  t->checksum = (uint64_t) sqlite3_column_int64(stmt, 6);
+  token = (const char *) sqlite3_column_text(stmt, 8);
+  if (token != NULL) {
+    strncpy(t->token, token, sizeof(t->token) - 1);
+  }
+
+  return t;
+}
+
+/* the table is created with the first transfer */
+static int _csync_statedb_has_transfers(sqlite3 *db) {
+  sqlite3_stmt *stmt = NULL;
+  int rc = 0;
+
+  stmt = csync_statedb_prepare(db,
+      "SELECT name FROM sqlite_master WHERE type='table' AND name='transfer';");
+  if (stmt == NULL) {
+    return 0;
+  }
+  rc = sqlite3_step(stmt) == SQLITE_ROW;
+  sqlite3_reset(stmt);
+
+  return rc;
+}
+
+csync_transfer_t *csync_statedb_get_transfer(sqlite3 *db, uint64_t phash) {
+  sqlite3_stmt *stmt = NULL;
+  csync_transfer_t *t = NULL;
+
+  if (!_csync_statedb_has_transfers(db)) {
+    return NULL;
+  }
+
+  stmt = csync_statedb_prepare(db,
+      "SELECT phash, replica, size, modtime, inode, offset, checksum, tmpname, "
+      "token FROM transfer WHERE phash=?1;");
+  if (stmt == NULL) {
+    return NULL;
+  }
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64) phash);
+
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    t = _csync_statedb_transfer_row(stmt);
+  }
+  sqlite3_reset(stmt);
+
+  return t;
+}
+
+int csync_statedb_get_transfers(sqlite3 *db, c_list_t **list) {
+  sqlite3_stmt *stmt = NULL;
+  csync_transfer_t *t = NULL;
+  c_list_t *result = NULL;
+  c_list_t *tmp = NULL;
+  int count = 0;
+
+  if (!_csync_statedb_has_transfers(db)) {
+    *list = NULL;
+    return 0;
+  }
+
+  stmt = csync_statedb_prepare(db,
+      "SELECT phash, replica, size, modtime, inode, offset, checksum, tmpname, "
+      "token FROM transfer;");
+  if (stmt == NULL) {
+    return -1;
+  }
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    t = _csync_statedb_transfer_row(stmt);
+    if (t == NULL) {
+      count = -1;
+      break;
+    }
+    tmp = c_list_prepend(result, t);
+    if (tmp == NULL) {
+      SAFE_FREE(t);
+      count = -1;
+      break;
+    }
+    result = tmp;
+    count++;
+  }
+  sqlite3_reset(stmt);
+
+  if (count < 0) {
+    for (tmp = result; tmp != NULL; tmp = c_list_next(tmp)) {
+      SAFE_FREE(tmp->data);
+    }
+    c_list_free(result);
+    return -1;
+  }
+  *list = result;
+
+  return count;
+}
+
+int csync_statedb_set_transfer(sqlite3 *db, const csync_transfer_t *t) {
+  sqlite3_stmt *stmt = NULL;
+  int rc = 0;
+
+  if (!_csync_statedb_has_transfers(db) &&
+      _csync_statedb_create_transfer(db) < 0) {
+    return -1;
+  }
+
+  stmt = csync_statedb_prepare(db,
+      "INSERT OR REPLACE INTO transfer "
+      "(phash, replica, size, modtime, inode, offset, checksum, tmpname, token) "
+      "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9);");
+  if (stmt == NULL) {
+    return -1;
+  }
+
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64) t->phash);
+  sqlite3_bind_int(stmt, 2, t->replica);
+  sqlite3_bind_int64(stmt, 3, t->size);
+  sqlite3_bind_int64(stmt, 4, (sqlite3_int64) t->modtime);
+  sqlite3_bind_int64(stmt, 5, (sqlite3_int64) t->inode);
+  sqlite3_bind_int64(stmt, 6, t->offset);
+  sqlite3_bind_int64(stmt, 7, (sqlite3_int64) t->checksum);
+  sqlite3_bind_text(stmt, 8, t->tmpname, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 9, t->token, -1, SQLITE_STATIC);
+
+  if (sqlite3_step(stmt) != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "sqlite insert failed!");
+    rc = -1;
+  }
+  sqlite3_reset(stmt);
+
+  return rc;
+}
+
+int csync_statedb_drop_transfer(sqlite3 *db, uint64_t phash) {
+  sqlite3_stmt *stmt = NULL;
+  int rc = 0;
+
+  if (!_csync_statedb_has_transfers(db)) {
+    return 0;
+  }
+
+  stmt = csync_statedb_prepare(db, "DELETE FROM transfer WHERE phash=?1;");
+  if (stmt == NULL) {
+    return -1;
+  }
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64) phash);
+
+  if (sqlite3_step(stmt) != SQLITE_DONE) {
+    rc = -1;
+  }
+  sqlite3_reset(stmt);
+
+  return rc;
+}
+
+/* collect the paths which didn't make it into the metadata table */
+static int _csync_statedb_unsynced_visitor(void *obj, void *data) {
+  csync_file_stat_t *fs = (csync_file_stat_t *) obj;
+  c_list_t **list = (c_list_t **) data;
+  c_list_t *tmp = NULL;
+  char *path = NULL;
+
+  if (fs->instruction != CSYNC_INSTRUCTION_ERROR &&
+      fs->instruction != CSYNC_INSTRUCTION_IGNORE) {
+    return 0;
+  }
+
+  path = csync_file_stat_path(fs);
+  if (path == NULL) {
+    return -1;
+  }
+
+  tmp = c_list_prepend(*list, path);
+  if (tmp == NULL) {
+    SAFE_FREE(path);
+    return -1;
+  }
+  *list = tmp;
+
+  return 0;
+}
+
+/*
+ * The children of a directory with an unchanged ETag are taken from the
+ * metadata table, so all of them have to be there.
+ */
+static int _csync_statedb_etag_synced(CSYNC *ctx, const csync_etag_t *e,
+                                      c_list_t *unsynced) {
+  csync_file_stat_t *fs = NULL;
+  c_list_t *it = NULL;
+
+  fs = (csync_file_stat_t *) c_hash_find(ctx->local.tree, e->phash);
+  if (fs == NULL) {
+    return 0;
+  }
+  switch (fs->instruction) {
+    case CSYNC_INSTRUCTION_NONE:
+    case CSYNC_INSTRUCTION_UPDATED:
+    case CSYNC_INSTRUCTION_CONFLICT:
+      break;
+    default:
+      return 0;
+  }
+
+  for (it = unsynced; it != NULL; it = c_list_next(it)) {
+    const char *path = (const char *) it->data;
+
+    if (strncmp(path, e->path, e->pathlen) == 0 &&
+        (path[e->pathlen] == '/' || path[e->pathlen] == '\0')) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int csync_statedb_insert_etags(CSYNC *ctx, sqlite3 *db) {
+  sqlite3_stmt *stmt = NULL;
+  c_list_t *unsynced = NULL;
+  c_list_t *it = NULL;
+  int count = 0;
+  int rc = -1;
+
+  if (c_hash_walk(ctx->local.tree, &unsynced,
+                    _csync_statedb_unsynced_visitor) < 0 ||
+      c_hash_walk(ctx->remote.tree, &unsynced,
+                    _csync_statedb_unsynced_visitor) < 0) {
+    goto out;
+  }
+
+  csync_statedb_exec(db, "BEGIN TRANSACTION;");
+
+  /* the directories which are gone have to be removed too */
+  if (csync_statedb_exec(db, "DELETE FROM etag;") < 0) {
+    goto rollback;
+  }
+
+  stmt = csync_statedb_prepare(db,
+      "INSERT OR REPLACE INTO etag (phash, path, etag) VALUES (?1, ?2, ?3);");
+  if (stmt == NULL) {
+    goto rollback;
+  }
+
+  for (it = ctx->remote.etags; it != NULL; it = c_list_next(it)) {
+    csync_etag_t *e = (csync_etag_t *) it->data;
+
+    if (!_csync_statedb_etag_synced(ctx, e, unsynced)) {
+      continue;
+    }
+
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64) e->phash);
+    sqlite3_bind_text(stmt, 2, e->path, e->pathlen, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, e->etag, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "sqlite insert failed!");
+      sqlite3_reset(stmt);
+      goto rollback;
+    }
+    sqlite3_reset(stmt);
+    count++;
+  }
+
+  csync_statedb_exec(db, "COMMIT TRANSACTION;");
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Stored the ETags of %d directories",
+      count);
+  rc = 0;
+  goto out;
+
+rollback:
+  csync_statedb_exec(db, "ROLLBACK TRANSACTION;");
+out:
+  for (it = unsynced; it != NULL; it = c_list_next(it)) {
+    SAFE_FREE(it->data);
+  }
+  c_list_free(unsynced);
+
+  return rc;
+}
+
+/*
+ * The index keeps the records in one array and two open addressing tables
+ * with the position + 1 of the record, 0 marks a free slot.
+ */
+struct csync_statedb_index_s {
+  csync_file_stat_t *records;
+  size_t capacity;
+  size_t *by_hash;
+  size_t *by_inode;
+  size_t mask;
+  size_t count;
+};
+
+static size_t _csync_statedb_index_slot(uint64_t key, size_t mask) {
+  uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+
+  return (size_t) (h >> 32) & mask;
+}
+
+static int _csync_statedb_index_add(csync_statedb_index_t *idx,
+                                    csync_path_pool_t *paths,
+                                    sqlite3_stmt *stmt) {
+  csync_file_stat_t *st = NULL;
+
+  if (idx->count == idx->capacity) {
+    size_t capacity = idx->capacity ? idx->capacity * 2 : 1024;
+    csync_file_stat_t *records;
+
+    records = c_realloc(idx->records, capacity * sizeof(csync_file_stat_t));
+    if (records == NULL) {
+      return -1;
+    }
+    idx->records = records;
+    idx->capacity = capacity;
+  }
+
+  st = &idx->records[idx->count];
+  memset(st, 0, sizeof(csync_file_stat_t));
+
+  _csync_statedb_decode(stmt, st);
+  if (_csync_statedb_decode_path(stmt, paths, st) < 0) {
+    return -1;
+  }
+
+  idx->count++;
+
+  return 0;
+}
+
+static int _csync_statedb_index_build(csync_statedb_index_t *idx) {
+  size_t nslots = 16;
+  size_t n;
+
+  while (nslots < idx->count * 2) {
+    nslots *= 2;
+  }
+  idx->mask = nslots - 1;
+
+  idx->by_hash = c_malloc(nslots * sizeof(size_t));
+  idx->by_inode = c_malloc(nslots * sizeof(size_t));
+  if (idx->by_hash == NULL || idx->by_inode == NULL) {
+    return -1;
+  }
+
+  for (n = 0; n < idx->count; n++) {
+    csync_file_stat_t *st = &idx->records[n];
+    size_t i;
+
+    for (i = _csync_statedb_index_slot(st->phash, idx->mask); idx->by_hash[i]; i = (i + 1) & idx->mask) {
+      if (idx->records[idx->by_hash[i] - 1].phash == st->phash) {
+        break;
       }
+    }
+    idx->by_hash[i] = n + 1;
 
-      if (rc == SQLITE_SCHEMA) {
-        retry_count++;
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "SQLITE_SCHEMA error occurred on insert: %s", statement);
-        if (retry_count < 10) {
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Retrying now.");
-        } else {
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "RETRY count has reached its maximum. Aborting statement: %s", statement);
-        }
+    i = _csync_statedb_index_slot(st->inode, idx->mask);
+    for (; idx->by_inode[i]; i = (i + 1) & idx->mask) {
+      if (idx->records[idx->by_inode[i] - 1].inode == st->inode) {
+        break;
+      }
+    }
+    idx->by_inode[i] = n + 1;
+  }
+
+  return 0;
+}
+
+csync_statedb_index_t *csync_statedb_index_load(sqlite3 *db,
+                                                csync_path_pool_t *paths) {
+  csync_statedb_index_t *idx = NULL;
+  const char query[] = CSYNC_STATEDB_SELECT_METADATA ";";
+  sqlite3_stmt *stmt = NULL;
+  int rc;
+
+  if (db == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  idx = c_malloc(sizeof(csync_statedb_index_t));
+  if (idx == NULL) {
+    return NULL;
+  }
+
+  stmt = csync_statedb_prepare(db, query);
+  if (stmt == NULL) {
+    goto err;
+  }
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (_csync_statedb_index_add(idx, paths, stmt) < 0) {
+      goto err;
+    }
+  }
+  if (rc != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite_step error: %s - on query: %s",
+              sqlite3_errmsg(db), query);
+    goto err;
+  }
+  sqlite3_reset(stmt);
+  stmt = NULL;
+
+  if (_csync_statedb_index_build(idx) < 0) {
+    goto err;
+  }
+
+  return idx;
+err:
+  if (stmt != NULL) {
+    sqlite3_reset(stmt);
+  }
+  csync_statedb_index_free(idx);
+  return NULL;
+}
+
+size_t csync_statedb_index_count(csync_statedb_index_t *idx) {
+  if (idx == NULL) {
+    return 0;
+  }
+
+  return idx->count;
+}
+
+const csync_file_stat_t *csync_statedb_index_get_by_hash(csync_statedb_index_t *idx,
+                                                         uint64_t phash) {
+  size_t i;
+
+  if (idx == NULL) {
+    return NULL;
+  }
+
+  for (i = _csync_statedb_index_slot(phash, idx->mask); idx->by_hash[i]; i = (i + 1) & idx->mask) {
+    csync_file_stat_t *st = &idx->records[idx->by_hash[i] - 1];
+
+    if (st->phash == phash) {
+      return st;
+    }
+  }
+
+  return NULL;
+}
+
+const csync_file_stat_t *csync_statedb_index_get_by_inode(csync_statedb_index_t *idx,
+                                                          ino_t inode) {
+  size_t i;
+
+  if (idx == NULL) {
+    return NULL;
+  }
+
+#ifdef _WIN32
+  /* no idea about inodes. */
+  return NULL;
+#endif
+
+  i = _csync_statedb_index_slot(inode, idx->mask);
+  for (; idx->by_inode[i]; i = (i + 1) & idx->mask) {
+    csync_file_stat_t *st = &idx->records[idx->by_inode[i] - 1];
+
+    if (st->inode == inode) {
+      return st;
+    }
+  }
+
+  return NULL;
+}
+
+void csync_statedb_index_free(csync_statedb_index_t *idx) {
+  if (idx == NULL) {
+    return;
+  }
+
+  SAFE_FREE(idx->records);
+  SAFE_FREE(idx->by_hash);
+  SAFE_FREE(idx->by_inode);
+  SAFE_FREE(idx);
+}
+
+/* Returns the statement cache of a handle, called with the cache lock held. */
+static struct _csync_statedb_cache_s *_csync_statedb_cache(sqlite3 *db) {
+  struct _csync_statedb_cache_s *cache;
+
+  for (cache = _csync_statedb_caches; cache != NULL; cache = cache->next) {
+    if (cache->db == db) {
+      return cache;
+    }
+  }
+
+  cache = c_malloc(sizeof(struct _csync_statedb_cache_s));
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->stmts = c_hash_new(0);
+  if (cache->stmts == NULL) {
+    SAFE_FREE(cache);
+    return NULL;
+  }
+  cache->db = db;
+  cache->next = _csync_statedb_caches;
+  _csync_statedb_caches = cache;
+
+  return cache;
+}
+
+sqlite3_stmt *csync_statedb_prepare(sqlite3 *db, const char *statement) {
+  struct _csync_statedb_cache_s *cache;
+  struct _csync_statedb_stmt_s *first;
+  struct _csync_statedb_stmt_s *e;
+  sqlite3_stmt *stmt = NULL;
+  const char *sql;
+  uint64_t key;
+
+  if (db == NULL || statement == NULL) {
+    return NULL;
+  }
+
+  key = c_jhash64((uint8_t *) statement, strlen(statement), 0);
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&_csync_statedb_caches_lock);
+#endif
+  cache = _csync_statedb_cache(db);
+  if (cache == NULL) {
+    goto out;
+  }
+
+  first = c_hash_find(cache->stmts, key);
+  for (e = first; e != NULL; e = e->next) {
+    sql = sqlite3_sql(e->stmt);
+    /* a caller which didn't reset it yet still steps it */
+    if (sql != NULL && c_streq(sql, statement) && !sqlite3_stmt_busy(e->stmt)) {
+      stmt = e->stmt;
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+      goto out;
+    }
+  }
+
+  if (sqlite3_prepare_v2(db, statement, -1, &stmt, NULL) != SQLITE_OK) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+              "sqlite3_compile error: %s - on query %s",
+              sqlite3_errmsg(db), statement);
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+    goto out;
+  }
+
+  /* if it can't be cached, csync_statedb_close() still finalizes it */
+  e = c_malloc(sizeof(struct _csync_statedb_stmt_s));
+  if (e == NULL) {
+    goto out;
+  }
+  e->stmt = stmt;
+  if (first != NULL) {
+    e->next = first->next;
+    first->next = e;
+  } else if (c_hash_insert(cache->stmts, key, e) != 0) {
+    SAFE_FREE(e);
+  }
+
+out:
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&_csync_statedb_caches_lock);
+#endif
+  return stmt;
+}
+
+int csync_statedb_exec(sqlite3 *db, const char *statement) {
+  sqlite3_stmt *stmt = NULL;
+  int err;
+
+  stmt = csync_statedb_prepare(db, statement);
+  if (stmt == NULL) {
+    return -1;
+  }
+
+  do {
+    err = sqlite3_step(stmt);
+  } while (err == SQLITE_ROW);
+  sqlite3_reset(stmt);
+
+  if (err != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite_step error: %s - on query: %s",
+              sqlite3_errmsg(db), statement);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* query the statedb, caller must free the memory */
+c_strlist_t *csync_statedb_query(sqlite3 *db,
+                                 const char *statement) {
+  int err = SQLITE_OK;
+  size_t i = 0;
+  size_t column_count = 0;
+  sqlite3_stmt *stmt = NULL;
+  c_strlist_t *result = NULL;
+
+  /* compile SQL program into a virtual machine, sqlite waits for locks */
+  err = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
+  if (err != SQLITE_OK || stmt == NULL) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+              "sqlite3_compile error: %s - on query %s",
+              sqlite3_errmsg(db), statement);
+    sqlite3_finalize(stmt);
+    return NULL;
+  }
+
+  column_count = sqlite3_column_count(stmt);
+
+  /* execute virtual machine by iterating over rows */
+  while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+    /* only the last row is returned */
+    if (result != NULL) {
+      c_strlist_destroy(result);
+    }
+    result = c_strlist_new(column_count);
+    if (result == NULL) {
+      sqlite3_finalize(stmt);
+      return NULL;
+    }
+
+    /* iterate over columns */
+    for (i = 0; i < column_count; i++) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "sqlite3_column_text: %s", (char *) sqlite3_column_text(stmt, i));
+      if (c_strlist_add(result, (char *) sqlite3_column_text(stmt, i)) < 0) {
+        c_strlist_destroy(result);
+        sqlite3_finalize(stmt);
+        return NULL;
       }
     }
-  } while (rc == SQLITE_SCHEMA && retry_count < 10);
+  }
+
+  if (err == SQLITE_DONE) {
+    if (result == NULL) {
+      result = c_strlist_new(1);
+    }
+  } else {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite_step error: %s - on query: %s", sqlite3_errmsg(db), statement);
+    if (result != NULL) {
+      c_strlist_destroy(result);
+    }
+    result = c_strlist_new(1);
+  }
+
+  /* deallocate vm resources */
+  sqlite3_finalize(stmt);
+
+  return result;
+}
+
+int csync_statedb_insert(sqlite3 *db, const char *statement) {
+  sqlite3_stmt *stmt = NULL;
+  int err;
+
+  if (!statement[0]) {
+    return 0;
+  }
+
+  /* compile SQL program into a virtual machine, sqlite waits for locks */
+  err = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
+  if (err != SQLITE_OK || stmt == NULL) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_compile error: %s on query %s", sqlite3_errmsg(db), statement);
+    sqlite3_finalize(stmt);
+    return sqlite3_last_insert_rowid(db);
+  }
+
+  do {
+    err = sqlite3_step(stmt);
+  } while (err == SQLITE_ROW);
+
+  if (err != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+              "sqlite_step error: %s on insert: %s",
+              sqlite3_errmsg(db), statement);
+  }
+
+  /* deallocate vm resources */
+  sqlite3_finalize(stmt);
 
   return sqlite3_last_insert_rowid(db);
 }
@@ -58,9 +58,179 @@ int csync_statedb_write(CSYNC *ctx, sqlite3 *db);
 
 int csync_statedb_close(const char *statedb, sqlite3 *db, int jwritten);
 
-csync_file_stat_t *csync_statedb_get_stat_by_hash(sqlite3 *db, uint64_t phash);
+/*
+ * The records returned by the queries take their path from the path pool,
+ * free them with csync_statedb_stat_free().
+ */
+csync_file_stat_t *csync_statedb_get_stat_by_hash(sqlite3 *db,
+                                                  csync_path_pool_t *paths,
+                                                  uint64_t phash);
+
+csync_file_stat_t *csync_statedb_get_stat_by_inode(sqlite3 *db,
+                                                   csync_path_pool_t *paths,
+                                                   ino_t inode);
+
+/* Free a record returned by a query and drop its path */
+void csync_statedb_stat_free(csync_path_pool_t *paths, csync_file_stat_t *st);
+
+/**
+ * @brief Get the records of all entries below a directory.
+ *
+ * @param db       The statedb.
+ * @param paths    The path pool of the records.
+ * @param path     The relative path of the directory.
+ * @param list     A list of csync_file_stat_t the caller has to free with
+ *                 csync_statedb_stat_free().
+ *
+ * @return The number of records, less than 0 on error.
+ */
+int csync_statedb_get_below_path(sqlite3 *db, csync_path_pool_t *paths,
+                                 const char *path, c_list_t **list);
+
+/**
+ * @brief Get a value stored with csync_statedb_set_value().
+ *
+ * @return 0 on success, less than 0 if the key doesn't exist.
+ */
+int csync_statedb_get_value(sqlite3 *db, const char *key, int64_t *value);
+
+int csync_statedb_set_value(sqlite3 *db, const char *key, int64_t value);
+
+/**
+ * @brief Allocate an ETag record for a remote directory.
+ *
+ * @return The record, free it with SAFE_FREE(). NULL if out of memory.
+ */
+csync_etag_t *csync_statedb_etag_new(const char *path, const char *etag);
+
+/**
+ * @brief Get the ETag a remote directory had at the last synchronization.
+ *
+ * @param db       The statedb.
+ * @param phash    The hash of the relative path of the directory.
+ *
+ * @return The ETag the caller has to free, NULL if none is recorded.
+ */
+char *csync_statedb_get_etag(sqlite3 *db, uint64_t phash);
+
+/**
+ * @brief Get the ETags of all directories below a directory.
+ *
+ * @param db       The statedb.
+ * @param path     The relative path of the directory.
+ * @param list     A list of csync_etag_t the caller has to free.
+ *
+ * @return The number of records, less than 0 on error.
+ */
+int csync_statedb_get_etags_below_path(sqlite3 *db, const char *path,
+                                       c_list_t **list);
+
+/**
+ * @brief Store the ETags of the remote directories seen in this run.
+ *
+ * Only directories which have been synchronized completely are stored, a
+ * directory with a failed or ignored entry below it has to be listed again
+ * in the next run.
+ *
+ * @param ctx      The csync context.
+ * @param db       The statedb.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+int csync_statedb_insert_etags(CSYNC *ctx, sqlite3 *db);
+
+/**
+ * @brief Allocate a transfer record.
+ *
+ * @return The record, free it with SAFE_FREE(). NULL if out of memory.
+ */
+csync_transfer_t *csync_statedb_transfer_new(const char *tmpname);
 
-csync_file_stat_t *csync_statedb_get_stat_by_inode(sqlite3 *db, ino_t inode);
+/**
+ * @brief Get the unfinished transfer of a file.
+ *
+ * The transfers of a run which didn't write the statedb are taken over by
+ * csync_statedb_load(), so a transfer survives a crash.
+ *
+ * @param db       The statedb.
+ * @param phash    The hash of the relative path of the file.
+ *
+ * @return The record the caller has to free, NULL if none is recorded.
+ */
+csync_transfer_t *csync_statedb_get_transfer(sqlite3 *db, uint64_t phash);
+
+/**
+ * @brief Get all unfinished transfers.
+ *
+ * @param db       The statedb.
+ * @param list     A list of csync_transfer_t the caller has to free.
+ *
+ * @return The number of records, less than 0 on error.
+ */
+int csync_statedb_get_transfers(sqlite3 *db, c_list_t **list);
+
+/* Record a transfer or update its offset, returns less than 0 on error */
+int csync_statedb_set_transfer(sqlite3 *db, const csync_transfer_t *t);
+
+/* Forget a transfer, returns less than 0 on error */
+int csync_statedb_drop_transfer(sqlite3 *db, uint64_t phash);
+
+/**
+ * @brief Read the whole metadata table into an in-memory index.
+ *
+ * The records are read with a single prepared statement and indexed by phash
+ * and by inode. The index is read-only once loaded, so lookups don't need any
+ * locking. The records keep their paths until the path pool is freed.
+ *
+ * @param db       The statedb to read.
+ * @param paths    The path pool of the records.
+ *
+ * @return The index, NULL on error. Free it with csync_statedb_index_free().
+ */
+csync_statedb_index_t *csync_statedb_index_load(sqlite3 *db,
+                                                csync_path_pool_t *paths);
+
+size_t csync_statedb_index_count(csync_statedb_index_t *idx);
+
+/**
+ * @brief Look up a record of the index by the hash of its path.
+ *
+ * @return The record owned by the index or NULL if not found.
+ */
+const csync_file_stat_t *csync_statedb_index_get_by_hash(csync_statedb_index_t *idx,
+                                                         uint64_t phash);
+
+/**
+ * @brief Look up a record of the index by its inode.
+ *
+ * @return The record owned by the index or NULL if not found.
+ */
+const csync_file_stat_t *csync_statedb_index_get_by_inode(csync_statedb_index_t *idx,
+                                                          ino_t inode);
+
+void csync_statedb_index_free(csync_statedb_index_t *idx);
+
+/**
+ * @brief Get a prepared statement cached with the database handle.
+ *
+ * The statement is prepared on the first use and reused afterwards, it is
+ * reset and its bindings are cleared. While a caller steps it, ie. until it
+ * is reset, a second statement is prepared for the same SQL. Reset it when
+ * done and don't finalize it, csync_statedb_close() does that.
+ *
+ * @param db        The statedb.
+ * @param statement The SQL of the statement, bind parameters as ?1, ?2, ...
+ *
+ * @return The statement or NULL if it doesn't compile.
+ */
+sqlite3_stmt *csync_statedb_prepare(sqlite3 *db, const char *statement);
+
+/**
+ * @brief Run a cached statement without fetching any results.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+int csync_statedb_exec(sqlite3 *db, const char *statement);
 
 /**
  * @brief A generic statedb query.
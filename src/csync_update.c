@@ -26,18 +26,25 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "c_lib.h"
 #include "c_jhash.h"
 
 #include "csync_private.h"
 #include "csync_exclude.h"
+#include "csync_path.h"
 #include "csync_statedb.h"
 #include "csync_update.h"
 #include "csync_util.h"
+#include "csync_watch.h"
 #include "csync_misc.h"
+#include "csync_time.h"
 
 #include "vio/csync_vio.h"
 
@@ -45,98 +52,200 @@
 #include "csync_log.h"
 #include "c_strerror.h"
 
-static int _csync_detect_update(CSYNC *ctx, const char *file,
-    const csync_vio_file_stat_t *fs, const int type) {
-  uint64_t h = 0;
-  size_t len = 0;
-  size_t size = 0;
-  const char *path = NULL;
-  csync_file_stat_t *st = NULL;
-  csync_file_stat_t *tmp = NULL;
+/* the stat fields the update detection needs from a directory listing */
+#define CSYNC_FTW_STAT_FIELDS (CSYNC_VIO_FILE_STAT_FIELDS_TYPE | \
+                               CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS | \
+                               CSYNC_VIO_FILE_STAT_FIELDS_SIZE | \
+                               CSYNC_VIO_FILE_STAT_FIELDS_MTIME)
 
-  if ((file == NULL) || (fs == NULL)) {
-    errno = EINVAL;
-    ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
-    return -1;
+static void _csync_walk_lock(CSYNC *ctx) {
+#ifdef HAVE_PTHREAD
+  if (ctx->walk_lock != NULL) {
+    pthread_mutex_lock(ctx->walk_lock);
   }
+#else
+  (void) ctx;
+#endif
+}
+
+static void _csync_walk_unlock(CSYNC *ctx) {
+#ifdef HAVE_PTHREAD
+  if (ctx->walk_lock != NULL) {
+    pthread_mutex_unlock(ctx->walk_lock);
+  }
+#else
+  (void) ctx;
+#endif
+}
+
+/*
+ * The walker threads share the context, its status is set under the walk
+ * lock. The caller must not hold the lock.
+ */
+static void _csync_walk_status(CSYNC *ctx, enum csync_status_codes_e status) {
+  _csync_walk_lock(ctx);
+  ctx->status_code = status;
+  _csync_walk_unlock(ctx);
+}
+
+/* Turn the status of a failed walk into an update error. */
+static void _csync_walk_update_error(CSYNC *ctx) {
+  _csync_walk_lock(ctx);
+  if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
+    ctx->status_code = CSYNC_STATUS_UPDATE_ERROR;
+  }
+  _csync_walk_unlock(ctx);
+}
+
+/* the temporary file of a transfer the next propagation continues */
+static bool _csync_update_partial(CSYNC *ctx, uint64_t h, const char *path) {
+  const csync_transfer_t *t = NULL;
+  c_hash_t *partials = NULL;
+  const char *uri = NULL;
 
-  path = file;
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (strlen(path) <= strlen(ctx->local.uri)) {
-        ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
-        return -1;
-      }
-      path += strlen(ctx->local.uri) + 1;
+      partials = ctx->local.partials;
+      uri = ctx->local.uri;
       break;
     case REMOTE_REPLICA:
-      if (strlen(path) <= strlen(ctx->remote.uri)) {
-        ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
-        return -1;
-      }
-      path += strlen(ctx->remote.uri) + 1;
+      partials = ctx->remote.partials;
+      uri = ctx->remote.uri;
       break;
     default:
-      path = NULL;
-      ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
-      return -1;
-      break;
+      return false;
+  }
+  if (partials == NULL) {
+    return false;
   }
+
+  t = (const csync_transfer_t *) c_hash_find(partials, h);
+
+  return t != NULL && c_streq(t->tmpname + strlen(uri) + 1, path);
+}
+
+/* update detection for a path relative to the replica root */
+static int _csync_detect_update_path(CSYNC *ctx, const char *path,
+    const csync_vio_file_stat_t *fs, const int type) {
+  uint64_t h = 0;
+  size_t len = 0;
+  enum csync_instructions_e instruction = CSYNC_INSTRUCTION_NONE;
+  csync_file_stat_t *st = NULL;
+  csync_file_stat_t *tmp = NULL;
+  c_hash_t *tree = NULL;
+  const csync_file_stat_t *old = NULL;
+  const csync_path_t *old_path = NULL;
+
   len = strlen(path);
 
   h = c_jhash64((uint8_t *) path, len, 0);
-  size = sizeof(csync_file_stat_t) + len + 1;
 
-  st = c_malloc(size);
-  if (st == NULL) {
-    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-    return -1;
-  }
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "file: %s - hash %llu, st size: %zu",
-      path, (long long unsigned int) h, size);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "file: %s - hash %llu",
+      path, (long long unsigned int) h);
 
-  /* Set instruction by default to none */
-  st->instruction = CSYNC_INSTRUCTION_NONE;
+  if (type == CSYNC_FTW_TYPE_FILE && _csync_update_partial(ctx, h, path)) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "partial copy: %s", path);
+    return 0;
+  }
 
   /* check hardlink count */
   if (type == CSYNC_FTW_TYPE_FILE && fs->nlink > 1) {
-    st->instruction = CSYNC_INSTRUCTION_IGNORE;
+    instruction = CSYNC_INSTRUCTION_IGNORE;
     goto out;
   }
 
   /* Update detection */
   if (csync_get_statedb_exists(ctx)) {
-    tmp = csync_statedb_get_stat_by_hash(ctx->statedb.db, h);
-    if (tmp && tmp->phash == h) {
+    /* the preloaded index is read-only, only the statedb needs the lock */
+    if (ctx->statedb.index != NULL) {
+      old = csync_statedb_index_get_by_hash(ctx->statedb.index, h);
+    } else {
+      _csync_walk_lock(ctx);
+      tmp = csync_statedb_get_stat_by_hash(ctx->statedb.db, ctx->paths, h);
+      old = tmp;
+    }
+    if (old && old->phash == h) {
       /* we have an update! */
-      if (fs->mtime > tmp->modtime) {
-        st->instruction = CSYNC_INSTRUCTION_EVAL;
+      if (fs->mtime > old->modtime) {
+        instruction = CSYNC_INSTRUCTION_EVAL;
       } else {
-        st->instruction = CSYNC_INSTRUCTION_NONE;
+        instruction = CSYNC_INSTRUCTION_NONE;
       }
     } else {
       /* check if the file has been renamed */
       if (ctx->current == LOCAL_REPLICA) {
-        SAFE_FREE(tmp);
-        tmp = csync_statedb_get_stat_by_inode(ctx->statedb.db, fs->inode);
-        if (tmp && tmp->inode == fs->inode) {
+        if (ctx->statedb.index != NULL) {
+          old = csync_statedb_index_get_by_inode(ctx->statedb.index, fs->inode);
+        } else {
+          csync_statedb_stat_free(ctx->paths, tmp);
+          tmp = csync_statedb_get_stat_by_inode(ctx->statedb.db, ctx->paths,
+                                                fs->inode);
+          old = tmp;
+        }
+        if (old && old->inode == fs->inode) {
           /* inode found so the file has been renamed */
-          st->instruction = CSYNC_INSTRUCTION_RENAME;
+          instruction = CSYNC_INSTRUCTION_RENAME;
+          /*
+           * an unmodified file can be moved on the other replica, the
+           * content of a directory is checked file by file
+           */
+          if (type == CSYNC_FTW_TYPE_DIR || fs->mtime <= old->modtime) {
+            old_path = csync_path_ref(ctx->paths, old->path);
+          }
         } else {
           /* file not found in statedb */
-          st->instruction = CSYNC_INSTRUCTION_NEW;
+          instruction = CSYNC_INSTRUCTION_NEW;
         }
       } else {
         /* remote and file not found in statedb */
-        st->instruction = CSYNC_INSTRUCTION_NEW;
+        instruction = CSYNC_INSTRUCTION_NEW;
       }
     }
+    if (ctx->statedb.index == NULL) {
+      _csync_walk_unlock(ctx);
+    }
   } else  {
-    st->instruction = CSYNC_INSTRUCTION_NEW;
+    instruction = CSYNC_INSTRUCTION_NEW;
   }
 
 out:
-  SAFE_FREE(tmp);
+  csync_statedb_stat_free(ctx->paths, tmp);
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      tree = ctx->local.tree;
+      break;
+    case REMOTE_REPLICA:
+      tree = ctx->remote.tree;
+      break;
+    default:
+      return 0;
+  }
+
+  /* the arena is shared with the other walkers, allocate under the lock */
+  _csync_walk_lock(ctx);
+  st = csync_file_stat_new(ctx, h, path, len);
+  if (st == NULL) {
+    _csync_walk_unlock(ctx);
+    csync_path_put(ctx->paths, old_path);
+    if (errno == EEXIST) {
+      /*
+       * the records are keyed by the hash, skipping the file would let the
+       * reconciler take it for deleted
+       */
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+          "file: %s, hash %llu collides with another path, can't sync it",
+          path, (long long unsigned int) h);
+      _csync_walk_status(ctx, CSYNC_STATUS_UPDATE_ERROR);
+      errno = EEXIST;
+      return -1;
+    }
+    _csync_walk_status(ctx, CSYNC_STATUS_MEMORY_ERROR);
+    return -1;
+  }
+
+  st->instruction = instruction;
+  st->old_path = old_path;
   st->inode = fs->inode;
   st->mode = fs->mode;
   st->size = fs->size;
@@ -146,32 +255,139 @@ out:
   st->nlink = fs->nlink;
   st->type = type;
 
-  st->phash = h;
-  st->pathlen = len;
-  memcpy(st->path, (len ? path : ""), len + 1);
+  /* the record is released with the arena, even if it isn't inserted */
+  if (c_hash_insert(tree, h, st) < 0) {
+    _csync_walk_unlock(ctx);
+    _csync_walk_status(ctx, CSYNC_STATUS_TREE_ERROR);
+    return -1;
+  }
+  _csync_walk_unlock(ctx);
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "file: %s, instruction: %s", path,
+      csync_instruction_str(instruction));
+
+  return 0;
+}
+
+static int _csync_detect_update(CSYNC *ctx, const char *file,
+    const csync_vio_file_stat_t *fs, const int type) {
+  const char *path = NULL;
+
+  if ((file == NULL) || (fs == NULL)) {
+    errno = EINVAL;
+    _csync_walk_status(ctx, CSYNC_STATUS_PARAM_ERROR);
+    return -1;
+  }
 
+  path = file;
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (c_rbtree_insert(ctx->local.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
-        ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+      if (strlen(path) <= strlen(ctx->local.uri)) {
+        _csync_walk_status(ctx, CSYNC_STATUS_PARAM_ERROR);
         return -1;
       }
+      path += strlen(ctx->local.uri) + 1;
       break;
     case REMOTE_REPLICA:
-      if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
-        ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+      if (strlen(path) <= strlen(ctx->remote.uri)) {
+        _csync_walk_status(ctx, CSYNC_STATUS_PARAM_ERROR);
         return -1;
       }
+      path += strlen(ctx->remote.uri) + 1;
       break;
     default:
+      path = NULL;
+      _csync_walk_status(ctx, CSYNC_STATUS_PARAM_ERROR);
+      return -1;
       break;
   }
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "file: %s, instruction: %s", st->path,
-      csync_instruction_str(st->instruction));
 
-  return 0;
+  return _csync_detect_update_path(ctx, path, fs, type);
+}
+
+/* file the transfer under the path of its temporary file, or drop it */
+static int _csync_update_partials_add(CSYNC *ctx, csync_transfer_t *t) {
+  c_hash_t **partials = NULL;
+  const char *uri = NULL;
+  const char *path = NULL;
+  size_t len;
+  int rc;
+
+  /* the temporary file is in the replica the file is copied to */
+  if (t->replica == LOCAL_REPLICA) {
+    partials = &ctx->remote.partials;
+    uri = ctx->remote.uri;
+  } else {
+    partials = &ctx->local.partials;
+    uri = ctx->local.uri;
+  }
+
+  len = strlen(uri);
+  if (strncmp(t->tmpname, uri, len) != 0 || t->tmpname[len] != '/') {
+    SAFE_FREE(t);
+    return 0;
+  }
+  path = t->tmpname + len + 1;
+
+  if (*partials == NULL) {
+    *partials = c_hash_new(0);
+    if (*partials == NULL) {
+      SAFE_FREE(t);
+      return -1;
+    }
+  }
+
+  rc = c_hash_insert(*partials, c_jhash64((uint8_t *) path, strlen(path), 0), t);
+  if (rc != 0) {
+    /* a colliding temporary file is synced like any other file */
+    SAFE_FREE(t);
+  }
+
+  return rc < 0 ? -1 : 0;
+}
+
+int csync_update_partials_load(CSYNC *ctx) {
+  c_list_t *list = NULL;
+  c_list_t *it = NULL;
+  int rc = 0;
+
+  if (ctx->statedb.db == NULL ||
+      csync_statedb_get_transfers(ctx->statedb.db, &list) < 0) {
+    return 0;
+  }
+
+  for (it = list; it != NULL; it = c_list_next(it)) {
+    if (rc == 0) {
+      rc = _csync_update_partials_add(ctx, (csync_transfer_t *) it->data);
+    } else {
+      SAFE_FREE(it->data);
+    }
+  }
+  c_list_free(list);
+
+  if (rc < 0) {
+    csync_update_partials_free(ctx);
+  }
+
+  return rc;
+}
+
+static void _csync_update_partials_free(c_hash_t **partials) {
+  size_t i;
+
+  if (*partials == NULL) {
+    return;
+  }
+  for (i = 0; i < c_hash_size(*partials); i++) {
+    free(c_hash_at(*partials, i));
+  }
+  c_hash_free(*partials);
+  *partials = NULL;
+}
+
+void csync_update_partials_free(CSYNC *ctx) {
+  _csync_update_partials_free(&ctx->local.partials);
+  _csync_update_partials_free(&ctx->remote.partials);
 }
 
 int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
@@ -208,26 +424,299 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
   return 0;
 }
 
-/* File tree walker */
-int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
-    unsigned int depth) {
+/*
+ * Insert the statedb records of an unchanged directory into the tree of the
+ * current replica. The records are copied into the arena of the replica.
+ */
+static int _csync_ftw_insert_unchanged(CSYNC *ctx, c_list_t *list) {
+  c_hash_t *tree = NULL;
+  c_list_t *it = NULL;
+  int rc = 0;
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      tree = ctx->local.tree;
+      break;
+    case REMOTE_REPLICA:
+      tree = ctx->remote.tree;
+      break;
+    default:
+      return -1;
+  }
+
+  _csync_walk_lock(ctx);
+  for (it = list; it != NULL; it = c_list_next(it)) {
+    csync_file_stat_t *row = (csync_file_stat_t *) it->data;
+    csync_file_stat_t *st = NULL;
+    char *path = NULL;
+    int excluded;
+
+    path = csync_file_stat_path(row);
+    if (path == NULL) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+      break;
+    }
+    excluded = csync_excluded(ctx, path);
+    SAFE_FREE(path);
+    if (excluded) {
+      continue;
+    }
+
+    /* the record keeps the path of the row */
+    st = csync_file_stat_dup(ctx, row);
+    if (st == NULL) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+      break;
+    }
+    csync_statedb_stat_free(ctx->paths, row);
+    it->data = NULL;
+
+    if (S_ISDIR(st->mode)) {
+      st->type = CSYNC_FTW_TYPE_DIR;
+    } else if (S_ISLNK(st->mode)) {
+      st->type = CSYNC_FTW_TYPE_SLINK;
+    } else {
+      st->type = CSYNC_FTW_TYPE_FILE;
+    }
+    st->nlink = 1;
+    st->instruction = CSYNC_INSTRUCTION_NONE;
+
+    if (c_hash_insert(tree, st->phash, st) < 0) {
+      ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+      rc = -1;
+      break;
+    }
+  }
+  _csync_walk_unlock(ctx);
+
+  return rc;
+}
+
+/*
+ * A remote directory with the same ETag as at the last synchronization is
+ * not listed, the server changes the ETag of all parents of a changed entry.
+ * Its entries and the ETags of the directories below it are taken from the
+ * statedb.
+ *
+ * Returns 1 if the directory has been skipped, 0 if it has to be walked.
+ */
+static int _csync_ftw_skip_remote_dir(CSYNC *ctx, const char *path,
+    const csync_vio_file_stat_t *fs) {
+  csync_etag_t *e = NULL;
+  c_list_t *list = NULL;
+  c_list_t *etags = NULL;
+  c_list_t *it = NULL;
+  c_list_t *tmp = NULL;
+  char *old = NULL;
+  int count = 0;
+  int rc = 0;
+
+  if (!(fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_ETAG) || fs->etag == NULL) {
+    return 0;
+  }
+
+  e = csync_statedb_etag_new(path, fs->etag);
+  if (e == NULL) {
+    _csync_walk_status(ctx, CSYNC_STATUS_MEMORY_ERROR);
+    return -1;
+  }
+
+  _csync_walk_lock(ctx);
+  tmp = c_list_prepend(ctx->remote.etags, e);
+  if (tmp == NULL) {
+    _csync_walk_unlock(ctx);
+    SAFE_FREE(e);
+    _csync_walk_status(ctx, CSYNC_STATUS_MEMORY_ERROR);
+    return -1;
+  }
+  ctx->remote.etags = tmp;
+
+  if (!csync_get_statedb_exists(ctx)) {
+    _csync_walk_unlock(ctx);
+    return 0;
+  }
+  old = csync_statedb_get_etag(ctx->statedb.db, e->phash);
+  if (old == NULL || !c_streq(old, e->etag)) {
+    _csync_walk_unlock(ctx);
+    goto out;
+  }
+  count = csync_statedb_get_below_path(ctx->statedb.db, ctx->paths, path, &list);
+  if (count < 0 ||
+      csync_statedb_get_etags_below_path(ctx->statedb.db, path, &etags) < 0) {
+    _csync_walk_unlock(ctx);
+    goto out;
+  }
+
+  /* keep the ETags of the subdirectories for the next run */
+  for (it = etags; it != NULL; it = c_list_next(it)) {
+    tmp = c_list_prepend(ctx->remote.etags, it->data);
+    if (tmp == NULL) {
+      _csync_walk_unlock(ctx);
+      _csync_walk_status(ctx, CSYNC_STATUS_MEMORY_ERROR);
+      rc = -1;
+      goto out;
+    }
+    ctx->remote.etags = tmp;
+    it->data = NULL;
+  }
+  _csync_walk_unlock(ctx);
+
+  rc = _csync_ftw_insert_unchanged(ctx, list);
+  if (rc == 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "%s has the same etag %s, took %d entries from the statedb",
+        path, old, count);
+    rc = 1;
+  }
+
+out:
+  for (it = list; it != NULL; it = c_list_next(it)) {
+    csync_statedb_stat_free(ctx->paths, it->data);
+  }
+  c_list_free(list);
+  for (it = etags; it != NULL; it = c_list_next(it)) {
+    SAFE_FREE(it->data);
+  }
+  c_list_free(etags);
+  SAFE_FREE(old);
+
+  return rc;
+}
+
+/*
+ * In an incremental run a local directory with the same inode and mtime as in
+ * the statedb is not walked. Its entries are taken from the statedb, after
+ * checking that none of the directories below it changed either.
+ *
+ * The mtime has a resolution of one second, an entry created in the same
+ * second as the last walk read the directory doesn't change it. So every
+ * directory modified at or after the start of the last walk is walked again.
+ *
+ * Returns 1 if the directory has been skipped, 0 if it has to be walked.
+ */
+static int _csync_ftw_skip_dir(CSYNC *ctx, const char *path,
+    const csync_vio_file_stat_t *fs) {
+  csync_file_stat_t *tmp = NULL;
+  const csync_file_stat_t *old = NULL;
+  csync_vio_file_stat_t *dfs = NULL;
+  c_list_t *list = NULL;
+  c_list_t *it = NULL;
+  char *uri = NULL;
+  uint64_t h;
+  int count = 0;
+  int rc = 0;
+
+  if (ctx->current == REMOTE_REPLICA) {
+    return _csync_ftw_skip_remote_dir(ctx, path, fs);
+  }
+  if (ctx->current != LOCAL_REPLICA) {
+    return 0;
+  }
+  if (ctx->watch.enabled) {
+    /* the watcher has seen all changes */
+    if (csync_watch_is_dirty(ctx, path)) {
+      return 0;
+    }
+  } else if (!ctx->statedb.incremental) {
+    return 0;
+  }
+
+  h = c_jhash64((uint8_t *) path, strlen(path), 0);
+
+  _csync_walk_lock(ctx);
+  if (ctx->statedb.index != NULL) {
+    old = csync_statedb_index_get_by_hash(ctx->statedb.index, h);
+  } else {
+    tmp = csync_statedb_get_stat_by_hash(ctx->statedb.db, ctx->paths, h);
+    old = tmp;
+  }
+  if (old == NULL || old->inode != fs->inode || old->modtime != fs->mtime ||
+      fs->mtime >= ctx->statedb.last_scan) {
+    _csync_walk_unlock(ctx);
+    goto out;
+  }
+  count = csync_statedb_get_below_path(ctx->statedb.db, ctx->paths, path, &list);
+  _csync_walk_unlock(ctx);
+  if (count < 0) {
+    goto out;
+  }
+
+  /* a change anywhere below only touches the mtime of the parent directory */
+  for (it = list; it != NULL && !ctx->watch.enabled; it = c_list_next(it)) {
+    csync_file_stat_t *st = (csync_file_stat_t *) it->data;
+
+    if (!S_ISDIR(st->mode)) {
+      continue;
+    }
+
+    if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(st)) < 0) {
+      goto out;
+    }
+    dfs = csync_vio_file_stat_new();
+    if (dfs == NULL || csync_vio_stat(ctx, uri, dfs) < 0 ||
+        dfs->type != CSYNC_VIO_FILE_TYPE_DIRECTORY ||
+        dfs->inode != st->inode || dfs->mtime != st->modtime ||
+        dfs->mtime >= ctx->statedb.last_scan) {
+      goto out;
+    }
+    csync_vio_file_stat_destroy(dfs);
+    dfs = NULL;
+    SAFE_FREE(uri);
+  }
+
+  rc = _csync_ftw_insert_unchanged(ctx, list);
+  if (rc == 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "%s unchanged, took %d entries from the statedb", path, count);
+    rc = 1;
+  }
+
+out:
+  for (it = list; it != NULL; it = c_list_next(it)) {
+    csync_statedb_stat_free(ctx->paths, it->data);
+  }
+  c_list_free(list);
+  csync_vio_file_stat_destroy(dfs);
+  SAFE_FREE(uri);
+  csync_statedb_stat_free(ctx->paths, tmp);
+
+  return rc;
+}
+
+struct _csync_walk_worker_s;
+
+#ifdef HAVE_PTHREAD
+static int _csync_walk_push(struct _csync_walk_worker_s *w, char *uri,
+    unsigned int depth);
+#endif
+
+/*
+ * Walk one directory. Without a worker the subdirectories are walked
+ * recursively, with a worker they are queued for the thread pool.
+ */
+static int _csync_ftw_dir(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+    unsigned int depth, struct _csync_walk_worker_s *w) {
   char errbuf[256] = {0};
   char *filename = NULL;
   char *d_name = NULL;
   csync_vio_handle_t *dh = NULL;
   csync_vio_file_stat_t *dirent = NULL;
   csync_vio_file_stat_t *fs = NULL;
+  int readdir_stat = 0;
+  int skip = 0;
   int rc = 0;
 
   if (uri[0] == '\0') {
     errno = ENOENT;
-    ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
+    _csync_walk_status(ctx, CSYNC_STATUS_PARAM_ERROR);
     goto error;
   }
 
   if ((dh = csync_vio_opendir(ctx, uri)) == NULL) {
     /* permission denied */
-    ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_OPENDIR_ERROR);
+    _csync_walk_status(ctx, csync_errno_to_status(errno, CSYNC_STATUS_OPENDIR_ERROR));
     if (errno == EACCES) {
       return 0;
     } else {
@@ -240,15 +729,18 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     }
   }
 
+  readdir_stat = csync_vio_readdir_stat_support(ctx);
+
   while ((dirent = csync_vio_readdir(ctx, dh))) {
     const char *path = NULL;
     size_t ulen = 0;
     int flen;
     int flag;
+    int src;
 
     d_name = dirent->name;
     if (d_name == NULL) {
-      ctx->status_code = CSYNC_STATUS_READDIR_ERROR;
+      _csync_walk_status(ctx, CSYNC_STATUS_READDIR_ERROR);
       goto error;
     }
 
@@ -264,7 +756,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     if (flen < 0) {
       csync_vio_file_stat_destroy(dirent);
       dirent = NULL;
-      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      _csync_walk_status(ctx, CSYNC_STATUS_MEMORY_ERROR);
       goto error;
     }
 
@@ -283,7 +775,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     if (((size_t)flen) < ulen) {
       csync_vio_file_stat_destroy(dirent);
       dirent = NULL;
-      ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
+      _csync_walk_status(ctx, CSYNC_STATUS_UNSUCCESSFUL);
       goto error;
     }
 
@@ -298,8 +790,18 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       continue;
     }
 
-    fs = csync_vio_file_stat_new();
-    if (csync_vio_stat(ctx, filename, fs) == 0) {
+    /* use the stat data of the listing if it is complete */
+    if (readdir_stat &&
+        (dirent->fields & CSYNC_FTW_STAT_FIELDS) == CSYNC_FTW_STAT_FIELDS) {
+      fs = dirent;
+      dirent = NULL;
+      src = 0;
+    } else {
+      fs = csync_vio_file_stat_new();
+      src = csync_vio_stat(ctx, filename, fs);
+    }
+
+    if (src == 0) {
       switch (fs->type) {
         case CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK:
           flag = CSYNC_FTW_FLAG_SLINK;
@@ -324,20 +826,31 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "walk: %s", filename);
 
     /* Call walker function for each file */
+    skip = 0;
     rc = fn(ctx, filename, fs, flag);
+    if (rc == 0 && flag == CSYNC_FTW_FLAG_DIR && depth && fn == csync_walker) {
+      skip = _csync_ftw_skip_dir(ctx, path, fs);
+      if (skip < 0) {
+        rc = -1;
+      }
+    }
     csync_vio_file_stat_destroy(fs);
 
     if (rc < 0) {
-      if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
-          ctx->status_code = CSYNC_STATUS_UPDATE_ERROR;
-      }
+      _csync_walk_update_error(ctx);
 
       csync_vio_closedir(ctx, dh);
       goto done;
     }
 
-    if (flag == CSYNC_FTW_FLAG_DIR && depth) {
-      rc = csync_ftw(ctx, filename, fn, depth - 1);
+    if (flag == CSYNC_FTW_FLAG_DIR && depth && !skip) {
+#ifdef HAVE_PTHREAD
+      if (w != NULL) {
+        rc = _csync_walk_push(w, filename, depth - 1);
+        filename = NULL;
+      } else
+#endif
+      rc = _csync_ftw_dir(ctx, filename, fn, depth - 1, NULL);
       if (rc < 0) {
         csync_vio_closedir(ctx, dh);
         goto done;
@@ -361,4 +874,989 @@ error:
   return -1;
 }
 
+/* File tree walker */
+int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+    unsigned int depth) {
+  return _csync_ftw_dir(ctx, uri, fn, depth, NULL);
+}
+
+#if defined(HAVE_OPENAT) && defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR) \
+    && !defined(_WIN32) && !defined(__APPLE__)
+#define CSYNC_FTW_FD 1
+#endif
+
+#ifdef CSYNC_FTW_FD
+/* size of the buffer for the directory entries of one directory level */
+#define CSYNC_FTW_DIRENT_BUF_SIZE (32 * 1024)
+
+/*
+ * Relative path of the entry we are looking at. It is extended and cut back
+ * while walking, so no path is allocated per entry.
+ */
+struct _csync_ftw_path_s {
+  char *buf;
+  size_t len;
+  size_t size;
+};
+
+static int _csync_ftw_path_push(struct _csync_ftw_path_s *p, const char *name) {
+  size_t nlen = strlen(name);
+  size_t need = p->len + nlen + 2;
+
+  if (need > p->size) {
+    char *buf = NULL;
+    size_t size = p->size ? p->size * 2 : 256;
+
+    while (size < need) {
+      size *= 2;
+    }
+    buf = c_realloc(p->buf, size);
+    if (buf == NULL) {
+      return -1;
+    }
+    p->buf = buf;
+    p->size = size;
+  }
+
+  if (p->len > 0) {
+    p->buf[p->len++] = '/';
+  }
+  memcpy(p->buf + p->len, name, nlen + 1);
+  p->len += nlen;
+
+  return 0;
+}
+
+static void _csync_ftw_path_pop(struct _csync_ftw_path_s *p, size_t len) {
+  p->len = len;
+  if (p->buf != NULL) {
+    p->buf[len] = '\0';
+  }
+}
+
+/* Reads the entries of a directory without allocating per entry. */
+struct _csync_ftw_dir_s {
+#ifdef HAVE_GETDENTS64
+  int fd;
+  char *buf;
+  size_t pos;
+  size_t end;
+#else
+  DIR *dh;
+#endif
+};
+
+static int _csync_ftw_dir_open(struct _csync_ftw_dir_s *dir, int fd) {
+#ifdef HAVE_GETDENTS64
+  dir->fd = fd;
+  dir->pos = dir->end = 0;
+  dir->buf = c_malloc(CSYNC_FTW_DIRENT_BUF_SIZE);
+  if (dir->buf == NULL) {
+    return -1;
+  }
+#else
+  int dfd;
+
+  /* fdopendir takes over the descriptor, the caller keeps its own */
+  dfd = dup(fd);
+  if (dfd < 0) {
+    return -1;
+  }
+  dir->dh = fdopendir(dfd);
+  if (dir->dh == NULL) {
+    close(dfd);
+    return -1;
+  }
+#endif
+
+  return 0;
+}
+
+static const char *_csync_ftw_dir_next(struct _csync_ftw_dir_s *dir) {
+#ifdef HAVE_GETDENTS64
+  struct dirent64 *dirent = NULL;
+
+  if (dir->pos >= dir->end) {
+    ssize_t n;
+
+    n = getdents64(dir->fd, dir->buf, CSYNC_FTW_DIRENT_BUF_SIZE);
+    if (n <= 0) {
+      return NULL;
+    }
+    dir->pos = 0;
+    dir->end = n;
+  }
+
+  dirent = (struct dirent64 *) (dir->buf + dir->pos);
+  dir->pos += dirent->d_reclen;
+
+  return dirent->d_name;
+#else
+  struct dirent *dirent = NULL;
+
+  dirent = readdir(dir->dh);
+  if (dirent == NULL) {
+    return NULL;
+  }
+
+  return dirent->d_name;
+#endif
+}
+
+static void _csync_ftw_dir_close(struct _csync_ftw_dir_s *dir) {
+#ifdef HAVE_GETDENTS64
+  SAFE_FREE(dir->buf);
+#else
+  closedir(dir->dh);
+#endif
+}
+
+/* Stat an entry of the directory, only the fields csync uses are filled. */
+static int _csync_ftw_fd_stat(int dirfd, const char *name,
+    csync_vio_file_stat_t *fs) {
+  mode_t mode;
+#ifdef HAVE_STATX
+  struct statx sx;
+
+  if (statx(dirfd, name, 0, STATX_TYPE | STATX_MODE | STATX_NLINK |
+        STATX_UID | STATX_GID | STATX_INO | STATX_SIZE | STATX_MTIME,
+        &sx) < 0) {
+    return -1;
+  }
+  mode = sx.stx_mode;
+  fs->inode = sx.stx_ino;
+  fs->nlink = sx.stx_nlink;
+  fs->uid = sx.stx_uid;
+  fs->gid = sx.stx_gid;
+  fs->size = sx.stx_size;
+  fs->mtime = sx.stx_mtime.tv_sec;
+#else
+  csync_stat_t sb;
+
+  if (fstatat(dirfd, name, &sb, 0) < 0) {
+    return -1;
+  }
+  mode = sb.st_mode;
+  fs->inode = sb.st_ino;
+  fs->nlink = sb.st_nlink;
+  fs->uid = sb.st_uid;
+  fs->gid = sb.st_gid;
+  fs->size = sb.st_size;
+  fs->mtime = sb.st_mtime;
+#endif
+
+  switch (mode & S_IFMT) {
+    case S_IFBLK:
+      fs->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
+      break;
+    case S_IFCHR:
+      fs->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
+      break;
+    case S_IFDIR:
+      fs->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      break;
+    case S_IFIFO:
+      fs->type = CSYNC_VIO_FILE_TYPE_FIFO;
+      break;
+    case S_IFLNK:
+      fs->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    case S_IFREG:
+      fs->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+      break;
+    case S_IFSOCK:
+      fs->type = CSYNC_VIO_FILE_TYPE_SOCKET;
+      break;
+    default:
+      fs->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
+      break;
+  }
+  fs->mode = mode;
+  fs->fields = CSYNC_VIO_FILE_STAT_FIELDS_TYPE
+      | CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS
+      | CSYNC_VIO_FILE_STAT_FIELDS_INODE
+      | CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT
+      | CSYNC_VIO_FILE_STAT_FIELDS_UID
+      | CSYNC_VIO_FILE_STAT_FIELDS_GID
+      | CSYNC_VIO_FILE_STAT_FIELDS_SIZE
+      | CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  return 0;
+}
+
+/* Returns the descriptor, -2 if the directory can't be read and -1 on error. */
+static int _csync_ftw_fd_opendir(CSYNC *ctx, int dirfd, const char *name,
+    const char *path) {
+  char errbuf[256] = {0};
+  int fd;
+
+  fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    int err = errno;
+
+    _csync_walk_status(ctx, csync_errno_to_status(err, CSYNC_STATUS_OPENDIR_ERROR));
+    /* permission denied, skip the directory */
+    if (err == EACCES) {
+      return -2;
+    }
+    c_strerror_r(err, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "opendir failed for %s - %s",
+        path,
+        errbuf);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * The same as _csync_ftw_dir() with csync_walker as walker function, but the
+ * directories are walked by file descriptor and the entries are stat'ed
+ * relative to it.
+ */
+static int _csync_ftw_fd_dir(CSYNC *ctx, int dirfd,
+    struct _csync_ftw_path_s *path, unsigned int depth,
+    struct _csync_walk_worker_s *w) {
+  struct _csync_ftw_dir_s dir;
+  csync_vio_file_stat_t fs;
+  const char *name = NULL;
+  size_t len = path->len;
+  int skip = 0;
+  int flag;
+  int rc = 0;
+
+  if (_csync_ftw_dir_open(&dir, dirfd) < 0) {
+    _csync_walk_status(ctx, csync_errno_to_status(errno, CSYNC_STATUS_OPENDIR_ERROR));
+    return -1;
+  }
+
+  while ((name = _csync_ftw_dir_next(&dir)) != NULL) {
+    /* skip "." and ".." */
+    if (name[0] == '.' && (name[1] == '\0'
+          || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    if (_csync_ftw_path_push(path, name) < 0) {
+      _csync_walk_status(ctx, CSYNC_STATUS_MEMORY_ERROR);
+      rc = -1;
+      goto out;
+    }
+
+    /* Check if file is excluded */
+    if (csync_excluded(ctx, path->buf)) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded", path->buf);
+      _csync_ftw_path_pop(path, len);
+      continue;
+    }
+
+    ZERO_STRUCT(fs);
+    if (_csync_ftw_fd_stat(dirfd, name, &fs) == 0) {
+      switch (fs.type) {
+        case CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK:
+          flag = CSYNC_FTW_FLAG_SLINK;
+          break;
+        case CSYNC_VIO_FILE_TYPE_DIRECTORY:
+          flag = CSYNC_FTW_FLAG_DIR;
+          break;
+        case CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE:
+        case CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE:
+        case CSYNC_VIO_FILE_TYPE_SOCKET:
+        case CSYNC_VIO_FILE_TYPE_FIFO:
+          flag = CSYNC_FTW_FLAG_SPEC;
+          break;
+        default:
+          flag = CSYNC_FTW_FLAG_FILE;
+          break;
+      };
+    } else {
+      flag = CSYNC_FTW_FLAG_NSTAT;
+    }
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "walk: %s", path->buf);
+
+    /* the same as csync_walker() */
+    switch (flag) {
+      case CSYNC_FTW_FLAG_FILE:
+        rc = _csync_detect_update_path(ctx, path->buf, &fs,
+            CSYNC_FTW_TYPE_FILE);
+        break;
+      case CSYNC_FTW_FLAG_DIR:
+        rc = _csync_detect_update_path(ctx, path->buf, &fs,
+            CSYNC_FTW_TYPE_DIR);
+        break;
+      default:
+        rc = 0;
+        break;
+    }
+
+    skip = 0;
+    if (rc == 0 && flag == CSYNC_FTW_FLAG_DIR && depth) {
+      skip = _csync_ftw_skip_dir(ctx, path->buf, &fs);
+      if (skip < 0) {
+        rc = -1;
+      }
+    }
+
+    if (rc < 0) {
+      _csync_walk_update_error(ctx);
+      goto out;
+    }
+
+    if (flag == CSYNC_FTW_FLAG_DIR && depth && !skip) {
+#ifdef HAVE_PTHREAD
+      if (w != NULL) {
+        rc = _csync_walk_push(w, c_strdup(path->buf), depth - 1);
+      } else
+#endif
+      {
+        int fd;
+
+        fd = _csync_ftw_fd_opendir(ctx, dirfd, name, path->buf);
+        if (fd < 0) {
+          rc = fd == -2 ? 0 : -1;
+        } else {
+          rc = _csync_ftw_fd_dir(ctx, fd, path, depth - 1, NULL);
+          close(fd);
+        }
+      }
+      if (rc < 0) {
+        goto out;
+      }
+    }
+    _csync_ftw_path_pop(path, len);
+  }
+
+out:
+  _csync_ftw_path_pop(path, len);
+  _csync_ftw_dir_close(&dir);
+
+  return rc;
+}
+#endif /* CSYNC_FTW_FD */
+
+#ifdef HAVE_PTHREAD
+struct _csync_walk_job_s {
+  char *uri;
+  unsigned int depth;
+};
+
+/*
+ * Directory queue of a worker. The owner pushes and pops at the tail, other
+ * workers steal from the head, so thieves take the oldest and usually the
+ * largest subtrees.
+ */
+struct _csync_walk_queue_s {
+  pthread_mutex_t lock;
+  struct _csync_walk_job_s *jobs;
+  size_t head;
+  size_t tail;
+  size_t size;
+};
+
+/*
+ * Logging and iconv settings are thread local, a thread started for a walk
+ * takes them over from the thread starting it.
+ */
+struct _csync_walk_env_s {
+  int log_level;
+  csync_log_callback log_cb;
+  void *log_userdata;
+  const char *iconv_codec;
+};
+
+static void _csync_walk_env_get(struct _csync_walk_env_s *env) {
+  env->log_level = csync_get_log_level();
+  env->log_cb = csync_get_log_callback();
+  env->log_userdata = csync_get_log_userdata();
+#ifdef WITH_ICONV
+  env->iconv_codec = csync_get_iconv_codec();
+#endif
+}
+
+static void _csync_walk_env_set(const struct _csync_walk_env_s *env) {
+  csync_set_log_level(env->log_level);
+  if (env->log_cb != NULL) {
+    csync_set_log_callback(env->log_cb);
+  }
+  csync_set_log_userdata(env->log_userdata);
+#ifdef WITH_ICONV
+  if (env->iconv_codec != NULL) {
+    csync_set_iconv_codec(env->iconv_codec);
+  }
+#endif
+}
+
+struct _csync_walk_s {
+  CSYNC *ctx;
+  csync_walker_fn fn;
+  /* root of a descriptor based walk, the jobs are relative paths then */
+  int rootfd;
+  struct _csync_walk_worker_s *workers;
+  int nworkers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /* directories queued or being walked */
+  size_t pending;
+  /* directories queued */
+  size_t queued;
+  int abort;
+  int rc;
+
+  struct _csync_walk_env_s env;
+};
+
+struct _csync_walk_worker_s {
+  struct _csync_walk_s *walk;
+  struct _csync_walk_queue_s queue;
+#ifdef CSYNC_FTW_FD
+  struct _csync_ftw_path_s path;
+#endif
+  int id;
+  pthread_t thread;
+};
+
+static int _csync_walk_queue_put(struct _csync_walk_queue_s *q,
+    struct _csync_walk_job_s *job) {
+  pthread_mutex_lock(&q->lock);
+  if (q->tail == q->size) {
+    if (q->head > 0) {
+      memmove(q->jobs, q->jobs + q->head,
+          (q->tail - q->head) * sizeof(struct _csync_walk_job_s));
+      q->tail -= q->head;
+      q->head = 0;
+    } else {
+      struct _csync_walk_job_s *jobs = NULL;
+      size_t size = q->size ? q->size * 2 : 64;
+
+      jobs = c_realloc(q->jobs, size * sizeof(struct _csync_walk_job_s));
+      if (jobs == NULL) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+      }
+      q->jobs = jobs;
+      q->size = size;
+    }
+  }
+  q->jobs[q->tail++] = *job;
+  pthread_mutex_unlock(&q->lock);
+
+  return 0;
+}
+
+static int _csync_walk_queue_get(struct _csync_walk_queue_s *q,
+    struct _csync_walk_job_s *job, int steal) {
+  int rc = 0;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->tail > q->head) {
+    if (steal) {
+      *job = q->jobs[q->head++];
+    } else {
+      *job = q->jobs[--q->tail];
+    }
+    if (q->head == q->tail) {
+      q->head = q->tail = 0;
+    }
+    rc = 1;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return rc;
+}
+
+static int _csync_walk_push(struct _csync_walk_worker_s *w, char *uri,
+    unsigned int depth) {
+  struct _csync_walk_s *walk = w->walk;
+  struct _csync_walk_job_s job;
+
+  if (uri == NULL) {
+    _csync_walk_status(walk->ctx, CSYNC_STATUS_MEMORY_ERROR);
+    return -1;
+  }
+
+  job.uri = uri;
+  job.depth = depth;
+
+  if (_csync_walk_queue_put(&w->queue, &job) < 0) {
+    SAFE_FREE(uri);
+    _csync_walk_status(walk->ctx, CSYNC_STATUS_MEMORY_ERROR);
+    return -1;
+  }
+
+  pthread_mutex_lock(&walk->lock);
+  walk->pending++;
+  walk->queued++;
+  pthread_cond_signal(&walk->cond);
+  pthread_mutex_unlock(&walk->lock);
+
+  return 0;
+}
+
+/* Returns 1 if a job has been taken and 0 if the walk is finished. */
+static int _csync_walk_next(struct _csync_walk_worker_s *w,
+    struct _csync_walk_job_s *job) {
+  struct _csync_walk_s *walk = w->walk;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&walk->lock);
+    while (walk->queued == 0 && walk->pending > 0 && !walk->abort) {
+      pthread_cond_wait(&walk->cond, &walk->lock);
+    }
+    if (walk->pending == 0 || walk->abort) {
+      pthread_mutex_unlock(&walk->lock);
+      return 0;
+    }
+    pthread_mutex_unlock(&walk->lock);
+
+    if (_csync_walk_queue_get(&w->queue, job, 0) == 0) {
+      for (i = 1; i < walk->nworkers; i++) {
+        struct _csync_walk_worker_s *victim;
+
+        victim = &walk->workers[(w->id + i) % walk->nworkers];
+        if (_csync_walk_queue_get(&victim->queue, job, 1)) {
+          break;
+        }
+      }
+      if (i == walk->nworkers) {
+        /* someone else was faster */
+        continue;
+      }
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    walk->queued--;
+    pthread_mutex_unlock(&walk->lock);
+
+    return 1;
+  }
+}
+
+static void _csync_walk_done(struct _csync_walk_s *walk, int rc) {
+  pthread_mutex_lock(&walk->lock);
+  walk->pending--;
+  if (rc < 0 && !walk->abort) {
+    walk->abort = 1;
+    walk->rc = rc;
+  }
+  if (walk->pending == 0 || walk->abort) {
+    pthread_cond_broadcast(&walk->cond);
+  }
+  pthread_mutex_unlock(&walk->lock);
+}
+
+#ifdef CSYNC_FTW_FD
+static int _csync_walk_fd_job(struct _csync_walk_worker_s *w,
+    struct _csync_walk_job_s *job) {
+  struct _csync_walk_s *walk = w->walk;
+  int fd;
+  int rc;
+
+  if (job->uri[0] == '\0') {
+    fd = dup(walk->rootfd);
+    if (fd < 0) {
+      _csync_walk_status(walk->ctx, CSYNC_STATUS_OPENDIR_ERROR);
+      return -1;
+    }
+  } else {
+    fd = _csync_ftw_fd_opendir(walk->ctx, walk->rootfd, job->uri, job->uri);
+    if (fd < 0) {
+      return fd == -2 ? 0 : -1;
+    }
+  }
+
+  _csync_ftw_path_pop(&w->path, 0);
+  if (_csync_ftw_path_push(&w->path, job->uri) < 0) {
+    _csync_walk_status(walk->ctx, CSYNC_STATUS_MEMORY_ERROR);
+    close(fd);
+    return -1;
+  }
+  rc = _csync_ftw_fd_dir(walk->ctx, fd, &w->path, job->depth, w);
+  close(fd);
+
+  return rc;
+}
+#endif /* CSYNC_FTW_FD */
+
+static void _csync_walk_jobs(struct _csync_walk_worker_s *w) {
+  struct _csync_walk_s *walk = w->walk;
+  struct _csync_walk_job_s job;
+  int rc;
+
+  while (_csync_walk_next(w, &job)) {
+#ifdef CSYNC_FTW_FD
+    if (walk->rootfd >= 0) {
+      rc = _csync_walk_fd_job(w, &job);
+    } else
+#endif
+    rc = _csync_ftw_dir(walk->ctx, job.uri, walk->fn, job.depth, w);
+    SAFE_FREE(job.uri);
+    _csync_walk_done(walk, rc);
+  }
+}
+
+static void *_csync_walk_worker(void *arg) {
+  struct _csync_walk_worker_s *w = (struct _csync_walk_worker_s *) arg;
+  struct _csync_walk_s *walk = w->walk;
+
+  _csync_walk_env_set(&walk->env);
+
+  _csync_walk_jobs(w);
+
+#ifdef WITH_ICONV
+  c_close_iconv();
+#endif
+
+  return NULL;
+}
+
+/*
+ * Run a walk on the thread pool. With a root descriptor the directories are
+ * walked by descriptor and uri is the relative path to start with.
+ */
+static int _csync_walk_run(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+    unsigned int depth, int threads, int rootfd) {
+  struct _csync_walk_s walk;
+  struct _csync_walk_job_s job;
+  pthread_mutex_t walk_lock;
+  int own_lock = 0;
+  int started = 0;
+  int rc = -1;
+  int i;
+
+  ZERO_STRUCT(walk);
+  walk.ctx = ctx;
+  walk.fn = fn;
+  walk.rootfd = rootfd;
+  walk.nworkers = threads;
+  _csync_walk_env_get(&walk.env);
+
+  walk.workers = c_malloc(threads * sizeof(struct _csync_walk_worker_s));
+  if (walk.workers == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+
+  pthread_mutex_init(&walk.lock, NULL);
+  pthread_cond_init(&walk.cond, NULL);
+  for (i = 0; i < threads; i++) {
+    walk.workers[i].walk = &walk;
+    walk.workers[i].id = i;
+    pthread_mutex_init(&walk.workers[i].queue.lock, NULL);
+  }
+
+  /* the first worker starts with the root directory */
+  if (_csync_walk_push(&walk.workers[0], c_strdup(uri), depth) < 0) {
+    goto out;
+  }
+
+  /* a concurrent walk of the other replica shares its lock */
+  if (ctx->walk_lock == NULL) {
+    pthread_mutex_init(&walk_lock, NULL);
+    ctx->walk_lock = &walk_lock;
+    own_lock = 1;
+  }
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&walk.workers[i].thread, NULL, _csync_walk_worker,
+          &walk.workers[i]) != 0) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+          "Unable to start walker thread %d, continuing with %d threads",
+          i, started);
+      break;
+    }
+    started++;
+  }
+
+  if (started == 0) {
+    /* nothing is running, walk in this thread */
+    walk.nworkers = 1;
+    _csync_walk_jobs(&walk.workers[0]);
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(walk.workers[i].thread, NULL);
+  }
+
+  if (own_lock) {
+    ctx->walk_lock = NULL;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Walked %s with %d threads",
+      rootfd >= 0 ? "local replica" : uri, started ? started : 1);
+
+  rc = walk.abort ? walk.rc : 0;
+
+out:
+  for (i = 0; i < threads; i++) {
+    /* drop the directories left behind by an aborted walk */
+    while (_csync_walk_queue_get(&walk.workers[i].queue, &job, 0)) {
+      SAFE_FREE(job.uri);
+    }
+    SAFE_FREE(walk.workers[i].queue.jobs);
+#ifdef CSYNC_FTW_FD
+    SAFE_FREE(walk.workers[i].path.buf);
+#endif
+    pthread_mutex_destroy(&walk.workers[i].queue.lock);
+  }
+  SAFE_FREE(walk.workers);
+  if (own_lock) {
+    pthread_mutex_destroy(&walk_lock);
+  }
+  pthread_cond_destroy(&walk.cond);
+  pthread_mutex_destroy(&walk.lock);
+
+  return rc;
+}
+#endif /* HAVE_PTHREAD */
+
+/* Returns the number of walker threads to use, 1 walks in the caller. */
+static int _csync_walk_threads(CSYNC *ctx, int threads) {
+#ifdef HAVE_PTHREAD
+  if (threads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    threads = 1;
+#endif
+  }
+
+  /*
+   * A module has to serve every walker on a session of its own and sqlite
+   * has to be built with mutexes to share the connection between threads.
+   */
+  if (threads <= 1 || sqlite3_threadsafe() == 0 ||
+      (ctx->replica != LOCAL_REPLICA &&
+       !ctx->module.capabilities.concurrent_session_support)) {
+    return 1;
+  }
+
+  return threads;
+#else
+  (void) ctx;
+  (void) threads;
+
+  return 1;
+#endif
+}
+
+int csync_ftw_parallel(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+    unsigned int depth, int threads) {
+  threads = _csync_walk_threads(ctx, threads);
+  if (threads <= 1) {
+    return csync_ftw(ctx, uri, fn, depth);
+  }
+
+#ifdef HAVE_PTHREAD
+  return _csync_walk_run(ctx, uri, fn, depth, threads, -1);
+#else
+  return -1;
+#endif
+}
+
+int csync_ftw_local(CSYNC *ctx, const char *uri, unsigned int depth,
+    int threads) {
+#ifdef CSYNC_FTW_FD
+  struct _csync_ftw_path_s path;
+  char errbuf[256] = {0};
+  int rootfd;
+  int rc;
+
+  /* file names are passed through unconverted */
+  if (ctx->replica != LOCAL_REPLICA || ctx->current != LOCAL_REPLICA
+#ifdef WITH_ICONV
+      || csync_get_iconv_codec() != NULL
+#endif
+      ) {
+    return csync_ftw_parallel(ctx, uri, csync_walker, depth, threads);
+  }
+
+  if (uri[0] == '\0') {
+    errno = ENOENT;
+    ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
+    return -1;
+  }
+
+  rootfd = open(uri, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (rootfd < 0) {
+    /* permission denied */
+    ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_OPENDIR_ERROR);
+    if (errno == EACCES) {
+      return 0;
+    }
+    c_strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "opendir failed for %s - %s",
+        uri,
+        errbuf);
+    return -1;
+  }
+
+  threads = _csync_walk_threads(ctx, threads);
+#ifdef HAVE_PTHREAD
+  if (threads > 1) {
+    rc = _csync_walk_run(ctx, "", NULL, depth, threads, rootfd);
+    close(rootfd);
+    return rc;
+  }
+#endif
+
+  ZERO_STRUCT(path);
+  if (_csync_ftw_path_push(&path, "") < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    close(rootfd);
+    return -1;
+  }
+  rc = _csync_ftw_fd_dir(ctx, rootfd, &path, depth, NULL);
+  SAFE_FREE(path.buf);
+  close(rootfd);
+
+  return rc;
+#else
+  return csync_ftw_parallel(ctx, uri, csync_walker, depth, threads);
+#endif /* CSYNC_FTW_FD */
+}
+
+#ifdef HAVE_PTHREAD
+struct csync_ftw_job_s {
+  /* the walk works on a copy with its own replica state */
+  CSYNC ctx;
+  char *uri;
+  csync_walker_fn fn;
+  unsigned int depth;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct _csync_walk_env_s env;
+  int rc;
+};
+
+static void *_csync_ftw_job_run(void *arg) {
+  csync_ftw_job_t *job = (csync_ftw_job_t *) arg;
+  struct timespec start, finish;
+
+  _csync_walk_env_set(&job->env);
+
+  csync_gettime(&start);
+  job->rc = csync_ftw_parallel(&job->ctx, job->uri, job->fn, job->depth,
+      job->ctx.options.walker_threads);
+  csync_gettime(&finish);
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Walking %s took %.2f seconds",
+      job->uri, c_secdiff(finish, start));
+
+  /* a module keeps its error message per thread, take it along */
+  if (job->rc < 0 && job->ctx.error_string == NULL) {
+    const char *err = csync_vio_get_status_string(&job->ctx);
+
+    if (err != NULL) {
+      job->ctx.error_string = c_strdup(err);
+    }
+  }
+
+#ifdef WITH_ICONV
+  c_close_iconv();
+#endif
+
+  return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+csync_ftw_job_t *csync_ftw_start(CSYNC *ctx, const char *uri,
+    csync_walker_fn fn, unsigned int depth) {
+#ifdef HAVE_PTHREAD
+  csync_ftw_job_t *job = NULL;
+
+  /* both walks share the statedb connection */
+  if (sqlite3_threadsafe() == 0 || ctx->walk_lock != NULL) {
+    return NULL;
+  }
+
+  job = c_malloc(sizeof(csync_ftw_job_t));
+  if (job == NULL) {
+    return NULL;
+  }
+  job->uri = c_strdup(uri);
+  if (job->uri == NULL) {
+    SAFE_FREE(job);
+    return NULL;
+  }
+  job->fn = fn;
+  job->depth = depth;
+  _csync_walk_env_get(&job->env);
+
+  pthread_mutex_init(&job->lock, NULL);
+  ctx->walk_lock = &job->lock;
+
+  job->ctx = *ctx;
+  job->ctx.status_code = CSYNC_STATUS_OK;
+  job->ctx.error_string = NULL;
+
+  if (pthread_create(&job->thread, NULL, _csync_ftw_job_run, job) != 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "Unable to start a thread to walk %s", uri);
+    ctx->walk_lock = NULL;
+    pthread_mutex_destroy(&job->lock);
+    SAFE_FREE(job->uri);
+    SAFE_FREE(job);
+    return NULL;
+  }
+
+  return job;
+#else
+  (void) ctx;
+  (void) uri;
+  (void) fn;
+  (void) depth;
+
+  return NULL;
+#endif
+}
+
+int csync_ftw_join(CSYNC *ctx, csync_ftw_job_t *job) {
+#ifdef HAVE_PTHREAD
+  int rc;
+
+  pthread_join(job->thread, NULL);
+
+  /* hand the tree state of the walked replica back */
+  switch (job->ctx.current) {
+    case LOCAL_REPLICA:
+      ctx->local = job->ctx.local;
+      break;
+    case REMOTE_REPLICA:
+      ctx->remote = job->ctx.remote;
+      break;
+    default:
+      break;
+  }
+  rc = job->rc;
+  if (rc < 0) {
+    ctx->status_code = job->ctx.status_code;
+  }
+
+  /* the error message of the walk is handed over unless there is one */
+  if (ctx->error_string == NULL) {
+    ctx->error_string = job->ctx.error_string;
+  } else {
+    SAFE_FREE(job->ctx.error_string);
+  }
+
+  ctx->walk_lock = NULL;
+  pthread_mutex_destroy(&job->lock);
+  SAFE_FREE(job->uri);
+  SAFE_FREE(job);
+
+  return rc;
+#else
+  (void) ctx;
+  (void) job;
+
+  return -1;
+#endif
+}
+
 /* vim: set ts=8 sw=2 et cindent: */
@@ -95,6 +95,119 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth);
 
+/**
+ * @brief The parallel file tree walker.
+ *
+ * Works like csync_ftw(), but the directories are scanned by a pool of worker
+ * threads. Each worker keeps a queue of directories it discovered and steals
+ * from the other queues once its own queue runs dry. The walker function is
+ * called concurrently, so access to the replica tree and the statedb is
+ * serialized with ctx->walk_lock. The order in which the entries are visited
+ * is not defined, the exclude list and the depth limit apply exactly as in
+ * csync_ftw().
+ *
+ * A module replica is only walked in parallel if the module supports
+ * concurrent calls, otherwise or if threads are not available it falls back
+ * to csync_ftw().
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  uri          The uri/path to the directory tree to walk.
+ *
+ * @param  fn           The walker function to call once for each entry.
+ *
+ * @param  depth        The max depth to walk down the tree.
+ *
+ * @param  threads      The number of worker threads, 0 uses one per online
+ *                      cpu.
+ *
+ * @return 0 on success, < 0 on error.
+ */
+int csync_ftw_parallel(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+    unsigned int depth, int threads);
+
+/**
+ * @brief Walk the local replica and run the update detection on it.
+ *
+ * The local replica is walked with a directory descriptor per level. The
+ * entries are read with getdents64() and stat'ed with statx() or fstatat()
+ * relative to the descriptor, and the relative path is built incrementally in
+ * a reusable buffer. The update detection sees the same relative paths as
+ * with csync_ftw() and csync_walker().
+ *
+ * If the platform doesn't support this or a charset conversion of the file
+ * names is set, it falls back to csync_ftw_parallel() with csync_walker().
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  uri          The uri/path of the local replica.
+ *
+ * @param  depth        The max depth to walk down the tree.
+ *
+ * @param  threads      The number of worker threads, see csync_ftw_parallel().
+ *
+ * @return 0 on success, < 0 on error.
+ */
+int csync_ftw_local(CSYNC *ctx, const char *uri, unsigned int depth,
+    int threads);
+
+/**
+ * @brief Load the temporary files of the unfinished transfers.
+ *
+ * The next propagation continues these transfers, so the walkers skip the
+ * temporary files instead of syncing them. They are looked up by the hash
+ * of their path relative to the replica they are in.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @return 0 on success, < 0 on error.
+ */
+int csync_update_partials_load(CSYNC *ctx);
+
+/**
+ * @brief Free the transfers loaded by csync_update_partials_load().
+ *
+ * @param  ctx          The csync context to use.
+ */
+void csync_update_partials_free(CSYNC *ctx);
+
+typedef struct csync_ftw_job_s csync_ftw_job_t;
+
+/**
+ * @brief Start a file tree walk on a thread of its own.
+ *
+ * The walk runs csync_ftw() on a copy of the context, so it keeps the replica
+ * state the context has when the walk is started and the caller can work on
+ * the other replica meanwhile. Until csync_ftw_join() the walk lock is set,
+ * the trees and the statedb are only accessed with it held.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  uri          The uri/path to the directory tree to walk.
+ *
+ * @param  fn           The walker function to call once for each entry.
+ *
+ * @param  depth        The max depth to walk down the tree.
+ *
+ * @return The running walk, NULL if the walk has to be run by the caller.
+ */
+csync_ftw_job_t *csync_ftw_start(CSYNC *ctx, const char *uri,
+    csync_walker_fn fn, unsigned int depth);
+
+/**
+ * @brief Wait for a walk started with csync_ftw_start().
+ *
+ * The tree state of the walked replica and the status code of a failed walk
+ * are taken over into the context.
+ *
+ * @param  ctx          The csync context the walk has been started with.
+ *
+ * @param  job          The running walk, it is freed.
+ *
+ * @return The result of csync_ftw().
+ */
+int csync_ftw_join(CSYNC *ctx, csync_ftw_job_t *job);
+
 #endif /* _CSYNC_UPDATE_H */
 
 /* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
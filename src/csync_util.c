@@ -30,6 +30,7 @@
 #include <stdio.h>
 
 #include "c_jhash.h"
+#include "csync_path.h"
 #include "csync_util.h"
 #include "vio/csync_vio.h"
 
@@ -110,8 +111,8 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
   csync_vio_file_stat_t *vst = NULL;
 
   CSYNC *ctx = NULL;
-  c_rbtree_t *tree = NULL;
-  c_rbnode_t *node = NULL;
+  c_hash_t *tree = NULL;
+  csync_file_stat_t *tfs = NULL;
 
   char errbuf[256] = {0};
   char *uri = NULL;
@@ -138,45 +139,37 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
   }
 
   /* check if the file is new or has been synced */
-  node = c_rbtree_find(tree, &fs->phash);
-  if (node == NULL) {
+  tfs = c_hash_find(tree, fs->phash);
+  if (tfs == NULL) {
     csync_file_stat_t *new = NULL;
 
-    new = c_malloc(sizeof(csync_file_stat_t) + fs->pathlen + 1);
+    new = csync_file_stat_dup(ctx, fs);
     if (new == NULL) {
       c_strerror_r(errno, errbuf, sizeof(errbuf));
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-          "file: %s, merge malloc, error: %s",
-          fs->path,
+          "file: " CSYNC_PATH_FMT ", merge malloc, error: %s",
+          CSYNC_PATH_ARGS(fs),
           errbuf);
       rc = -1;
       goto out;
     }
-    new = memcpy(new, fs, sizeof(csync_file_stat_t) + fs->pathlen + 1);
 
-    if (c_rbtree_insert(tree, new) < 0) {
+    if (c_hash_insert(tree, new->phash, new) < 0) {
       c_strerror_r(errno, errbuf, sizeof(errbuf));
-      SAFE_FREE(new);
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-          "file: %s, rb tree insert, error: %s",
-          fs->path,
+          "file: " CSYNC_PATH_FMT ", tree insert, error: %s",
+          CSYNC_PATH_ARGS(fs),
           errbuf);
       rc = -1;
       goto out;
     }
-
-    node = c_rbtree_find(tree, &fs->phash);
-    if (node == NULL) {
-      rc = -1;
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Unable to find node");
-      goto out;
-    }
+    tfs = new;
   }
-  fs = c_rbtree_node_data(node);
+  fs = tfs;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, fs->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->local.uri, CSYNC_PATH_ARGS(fs)) < 0) {
         rc = -1;
         c_strerror_r(errno, errbuf, sizeof(errbuf));
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "file uri alloc failed: %s",
@@ -185,7 +178,7 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
       }
       break;
     case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, fs->path) < 0) {
+      if (asprintf(&uri, "%s/" CSYNC_PATH_FMT, ctx->remote.uri, CSYNC_PATH_ARGS(fs)) < 0) {
         rc = -1;
         c_strerror_r(errno, errbuf, sizeof(errbuf));
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "file uri alloc failed: %s",
@@ -240,7 +233,7 @@ int csync_merge_file_trees(CSYNC *ctx) {
   ctx->current = LOCAL_REPLICA;
   ctx->replica = ctx->local.type;
 
-  rc = c_rbtree_walk(ctx->remote.tree, ctx, _merge_file_trees_visitor);
+  rc = c_hash_walk(ctx->remote.tree, ctx, _merge_file_trees_visitor);
   if (rc < 0) {
     goto out;
   }
@@ -252,7 +245,7 @@ int csync_merge_file_trees(CSYNC *ctx) {
   ctx->current = REMOTE_REPLICA;
   ctx->replica = ctx->remote.type;
 
-  rc = c_rbtree_walk(ctx->local.tree, ctx, _merge_file_trees_visitor);
+  rc = c_hash_walk(ctx->local.tree, ctx, _merge_file_trees_visitor);
   if (rc < 0) {
     goto out;
   }
@@ -308,8 +301,8 @@ csync_vio_file_stat_t *csync_vio_convert_file_stat(csync_file_stat_t *st) {
     return NULL;
   }
   vfs->acl = NULL;
-  if (st->pathlen > 0) {
-    vfs->name = c_strdup(st->path);
+  if (csync_file_stat_pathlen(st) > 0) {
+    vfs->name = csync_file_stat_path(st);
   }
   vfs->uid   = st->uid;
   vfs->gid   = st->gid;
@@ -348,3 +341,85 @@ csync_vio_file_stat_t *csync_vio_convert_file_stat(csync_file_stat_t *st) {
 
   return vfs;
 }
+
+static c_arena_t *_csync_current_arena(CSYNC *ctx) {
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      return ctx->local.arena;
+    case REMOTE_REPLICA:
+      return ctx->remote.arena;
+    default:
+      break;
+  }
+
+  errno = EINVAL;
+  return NULL;
+}
+
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, uint64_t phash,
+                                       const char *path, size_t len) {
+  csync_file_stat_t *st = NULL;
+  c_arena_t *arena = NULL;
+
+  arena = _csync_current_arena(ctx);
+  if (arena == NULL) {
+    return NULL;
+  }
+
+  st = c_arena_alloc(arena, sizeof(csync_file_stat_t));
+  if (st == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  /* the record is released with the arena, even if this fails */
+  st->path = csync_path_get(ctx->paths, phash, path, len);
+  if (st->path == NULL) {
+    return NULL;
+  }
+  st->phash = phash;
+
+  return st;
+}
+
+csync_file_stat_t *csync_file_stat_dup(CSYNC *ctx, const csync_file_stat_t *st) {
+  csync_file_stat_t *new = NULL;
+  c_arena_t *arena = NULL;
+
+  arena = _csync_current_arena(ctx);
+  if (arena == NULL) {
+    return NULL;
+  }
+
+  new = c_arena_alloc(arena, sizeof(csync_file_stat_t));
+  if (new == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  *new = *st;
+  new->path = csync_path_ref(ctx->paths, st->path);
+  new->old_path = csync_path_ref(ctx->paths, st->old_path);
+
+  return new;
+}
+
+size_t csync_file_stat_pathlen(const csync_file_stat_t *st) {
+  if (st->path == NULL) {
+    return 0;
+  }
+
+  return csync_path_len(st->path);
+}
+
+char *csync_file_stat_path(const csync_file_stat_t *st) {
+  if (st->path == NULL) {
+    return c_strdup("");
+  }
+
+  return csync_path_str(st->path);
+}
+
+int csync_file_stat_pathcmp(const csync_file_stat_t *a, const csync_file_stat_t *b) {
+  return csync_path_cmp(a->path, b->path);
+}
@@ -34,6 +34,43 @@ int csync_merge_file_trees(CSYNC *ctx);
 
 int csync_unix_extensions(CSYNC *ctx);
 
+/**
+ * @brief Allocate a record of the current replica.
+ *
+ * The record is allocated from the arena of the replica and its path is
+ * taken from the path pool. Only the hash and the path are set. The caller
+ * has to hold the walk lock during a parallel walk.
+ *
+ * @param ctx   The csync context.
+ * @param phash The hash of the path.
+ * @param path  The relative path of the file.
+ * @param len   The length of the path.
+ *
+ * @return The record, NULL on error with errno set.
+ */
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, uint64_t phash,
+                                       const char *path, size_t len);
+
+/**
+ * @brief Copy a record into the current replica.
+ *
+ * @param ctx   The csync context.
+ * @param st    The record to copy, it may belong to the other replica or
+ *              come from the statedb. The copy shares its path.
+ *
+ * @return The copy, NULL on error with errno set.
+ */
+csync_file_stat_t *csync_file_stat_dup(CSYNC *ctx, const csync_file_stat_t *st);
+
+/* The length of the relative path of a record */
+size_t csync_file_stat_pathlen(const csync_file_stat_t *st);
+
+/* Build the relative path of a record, the caller has to free it */
+char *csync_file_stat_path(const csync_file_stat_t *st);
+
+/* Compare the relative paths of two records like strcmp() */
+int csync_file_stat_pathcmp(const csync_file_stat_t *a, const csync_file_stat_t *b);
+
 /* Convert a csync_file_stat_t to csync_vio_file_stat_t */
 csync_vio_file_stat_t *csync_vio_convert_file_stat(csync_file_stat_t *st);
 
@@ -0,0 +1,737 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_PTHREAD)
+#define CSYNC_WATCH_INOTIFY 1
+#include <sys/file.h>
+#include <sys/inotify.h>
+#endif
+
+#include "c_lib.h"
+#include "csync_private.h"
+#include "csync_statedb.h"
+#include "csync_watch.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.watch"
+#include "csync_log.h"
+
+#ifdef CSYNC_WATCH_INOTIFY
+
+#define CSYNC_WATCH_HEADER "csync-watch %d\n"
+
+#define CSYNC_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+                          IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                          IN_DONT_FOLLOW | IN_ONLYDIR)
+
+struct csync_watch_s {
+  char *uri;
+  char *file;
+  /* the journal, locked while the watcher is running */
+  int fd;
+  off_t size;
+  int generation;
+  /* the last line written, bursts of events write it only once */
+  char *last;
+
+  int ifd;
+  int wakeup[2];
+  pthread_t thread;
+
+  /* relative path of the directory of each watch descriptor */
+  char **paths;
+  int npaths;
+
+  /* a directory moved away, it might show up again with this cookie */
+  uint32_t move_cookie;
+  char *move_path;
+};
+
+static char *_csync_watch_join(const char *dir, const char *name) {
+  char *path = NULL;
+
+  if (dir[0] == '\0') {
+    return c_strdup(name);
+  }
+  if (asprintf(&path, "%s/%s", dir, name) < 0) {
+    return NULL;
+  }
+
+  return path;
+}
+
+/* Start a new journal, the next update walks everything. */
+static int _csync_watch_reset(CSYNC_WATCH *w) {
+  char buf[64];
+  int len;
+
+  if (ftruncate(w->fd, 0) < 0) {
+    return -1;
+  }
+
+  /* only a different generation is needed, the statedb has the last one */
+  w->generation = (w->generation + 1) & 0x7fffffff;
+  if (w->generation == 0) {
+    w->generation = 1;
+  }
+
+  len = snprintf(buf, sizeof(buf), CSYNC_WATCH_HEADER, w->generation);
+  if (write(w->fd, buf, len) != len) {
+    return -1;
+  }
+  w->size = len;
+  SAFE_FREE(w->last);
+
+  return 0;
+}
+
+static void _csync_watch_log(CSYNC_WATCH *w, char type, const char *path) {
+  char *line = NULL;
+  int len;
+
+  len = asprintf(&line, "%c %s\n", type, path);
+  if (len < 0) {
+    return;
+  }
+
+  if (w->last != NULL && c_streq(w->last, line)) {
+    SAFE_FREE(line);
+    return;
+  }
+
+  if (w->size + len > CSYNC_WATCH_MAX_SIZE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO, "Change journal full, starting over");
+    if (_csync_watch_reset(w) < 0) {
+      SAFE_FREE(line);
+      return;
+    }
+  }
+
+  if (write(w->fd, line, len) == len) {
+    w->size += len;
+  }
+
+  SAFE_FREE(w->last);
+  w->last = line;
+}
+
+static int _csync_watch_set_path(CSYNC_WATCH *w, int wd, const char *path) {
+  if (wd >= w->npaths) {
+    int npaths = w->npaths ? w->npaths : 64;
+    char **paths;
+
+    while (wd >= npaths) {
+      npaths *= 2;
+    }
+    paths = c_realloc(w->paths, npaths * sizeof(char *));
+    if (paths == NULL) {
+      return -1;
+    }
+    memset(paths + w->npaths, 0, (npaths - w->npaths) * sizeof(char *));
+    w->paths = paths;
+    w->npaths = npaths;
+  }
+
+  SAFE_FREE(w->paths[wd]);
+  w->paths[wd] = c_strdup(path);
+  if (w->paths[wd] == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Watch a directory and all directories below it. */
+static int _csync_watch_add(CSYNC_WATCH *w, const char *path) {
+  struct dirent *dirent;
+  struct stat sb;
+  char *uri = NULL;
+  char *child = NULL;
+  DIR *dh = NULL;
+  int wd;
+  int rc = 0;
+
+  if (path[0] == '\0') {
+    uri = c_strdup(w->uri);
+  } else if (asprintf(&uri, "%s/%s", w->uri, path) < 0) {
+    uri = NULL;
+  }
+  if (uri == NULL) {
+    return -1;
+  }
+
+  wd = inotify_add_watch(w->ifd, uri, CSYNC_WATCH_MASK);
+  if (wd < 0) {
+    /* gone or not a directory anymore */
+    if (errno == ENOENT || errno == ENOTDIR) {
+      goto out;
+    }
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Unable to watch %s: %s", uri,
+        strerror(errno));
+    rc = -1;
+    goto out;
+  }
+  if (_csync_watch_set_path(w, wd, path) < 0) {
+    rc = -1;
+    goto out;
+  }
+
+  dh = opendir(uri);
+  if (dh == NULL) {
+    goto out;
+  }
+
+  while ((dirent = readdir(dh)) != NULL) {
+    const char *name = dirent->d_name;
+
+    if (name[0] == '.' && (name[1] == '\0'
+          || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (dirent->d_type != DT_DIR && dirent->d_type != DT_UNKNOWN) {
+      continue;
+    }
+#endif
+    if (fstatat(dirfd(dh), name, &sb, AT_SYMLINK_NOFOLLOW) < 0 ||
+        !S_ISDIR(sb.st_mode)) {
+      continue;
+    }
+
+    child = _csync_watch_join(path, name);
+    if (child == NULL) {
+      rc = -1;
+      break;
+    }
+    rc = _csync_watch_add(w, child);
+    SAFE_FREE(child);
+    if (rc < 0) {
+      break;
+    }
+  }
+
+out:
+  if (dh != NULL) {
+    closedir(dh);
+  }
+  SAFE_FREE(uri);
+  return rc;
+}
+
+/* A watched directory moved inside the replica, update the paths below it. */
+static void _csync_watch_move(CSYNC_WATCH *w, const char *from,
+    const char *to) {
+  size_t len = strlen(from);
+  char *path;
+  int i;
+
+  for (i = 0; i < w->npaths; i++) {
+    if (w->paths[i] == NULL || strncmp(w->paths[i], from, len) != 0 ||
+        (w->paths[i][len] != '\0' && w->paths[i][len] != '/')) {
+      continue;
+    }
+    if (asprintf(&path, "%s%s", to, w->paths[i] + len) < 0) {
+      continue;
+    }
+    SAFE_FREE(w->paths[i]);
+    w->paths[i] = path;
+  }
+}
+
+static void _csync_watch_event(CSYNC_WATCH *w, struct inotify_event *ev) {
+  const char *dir;
+  char *path = NULL;
+
+  if (ev->mask & IN_Q_OVERFLOW) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Change journal lost events");
+    _csync_watch_log(w, 'o', "");
+    return;
+  }
+
+  if (ev->wd < 0 || ev->wd >= w->npaths || w->paths[ev->wd] == NULL) {
+    return;
+  }
+  dir = w->paths[ev->wd];
+
+  if (ev->mask & IN_IGNORED) {
+    SAFE_FREE(w->paths[ev->wd]);
+    return;
+  }
+
+  /* the parent directory reports the changes of this one */
+  if (ev->len == 0 || ev->name[0] == '\0') {
+    return;
+  }
+
+  /* our own files */
+  if (strncmp(ev->name, ".csync_journal.db", 17) == 0) {
+    return;
+  }
+
+  path = _csync_watch_join(dir, ev->name);
+  if (path == NULL) {
+    _csync_watch_log(w, 'o', "");
+    return;
+  }
+
+  if (ev->mask & IN_ISDIR) {
+    if (ev->mask & IN_MOVED_FROM) {
+      SAFE_FREE(w->move_path);
+      w->move_path = path;
+      w->move_cookie = ev->cookie;
+      path = NULL;
+    } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+      if ((ev->mask & IN_MOVED_TO) && w->move_path != NULL &&
+          w->move_cookie == ev->cookie) {
+        _csync_watch_move(w, w->move_path, path);
+        SAFE_FREE(w->move_path);
+      } else if (_csync_watch_add(w, path) < 0) {
+        _csync_watch_log(w, 'o', "");
+      }
+      _csync_watch_log(w, 'r', path);
+    }
+  }
+
+  _csync_watch_log(w, 'd', dir);
+  SAFE_FREE(path);
+}
+
+static void *_csync_watch_thread(void *arg) {
+  CSYNC_WATCH *w = (CSYNC_WATCH *) arg;
+  char buf[64 * 1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd[2];
+  ssize_t len;
+  char *p;
+
+  pfd[0].fd = w->ifd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = w->wakeup[0];
+  pfd[1].events = POLLIN;
+
+  for (;;) {
+    if (poll(pfd, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (pfd[1].revents) {
+      break;
+    }
+
+    len = read(w->ifd, buf, sizeof(buf));
+    if (len <= 0) {
+      continue;
+    }
+
+    for (p = buf; p < buf + len;) {
+      struct inotify_event *ev = (struct inotify_event *) p;
+
+      _csync_watch_event(w, ev);
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  return NULL;
+}
+
+static void _csync_watch_free(CSYNC_WATCH *w) {
+  int i;
+
+  if (w->ifd >= 0) {
+    close(w->ifd);
+  }
+  if (w->wakeup[0] >= 0) {
+    close(w->wakeup[0]);
+    close(w->wakeup[1]);
+  }
+  /* releases the lock */
+  if (w->fd >= 0) {
+    close(w->fd);
+  }
+
+  for (i = 0; i < w->npaths; i++) {
+    SAFE_FREE(w->paths[i]);
+  }
+  SAFE_FREE(w->paths);
+  SAFE_FREE(w->move_path);
+  SAFE_FREE(w->last);
+  SAFE_FREE(w->file);
+  SAFE_FREE(w->uri);
+  SAFE_FREE(w);
+}
+
+int csync_watch_start(CSYNC_WATCH **watch, const char *local) {
+  CSYNC_WATCH *w = NULL;
+  char buf[64] = {0};
+
+  if (watch == NULL || local == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  w = c_malloc(sizeof(CSYNC_WATCH));
+  if (w == NULL) {
+    return -1;
+  }
+  w->fd = w->ifd = -1;
+  w->wakeup[0] = w->wakeup[1] = -1;
+
+  w->uri = c_strdup(local);
+  if (w->uri == NULL || asprintf(&w->file, "%s/%s", local, CSYNC_WATCH_FILE) < 0) {
+    goto err;
+  }
+
+  w->fd = open(w->file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (w->fd < 0) {
+    goto err;
+  }
+  if (flock(w->fd, LOCK_EX | LOCK_NB) < 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "%s is already watched", local);
+    errno = EBUSY;
+    goto err;
+  }
+
+  /* continue with the generation of the previous watcher */
+  if (read(w->fd, buf, sizeof(buf) - 1) > 0) {
+    sscanf(buf, CSYNC_WATCH_HEADER, &w->generation);
+  }
+  if (w->generation <= 0) {
+    w->generation = (int) (time(NULL) & 0x7fffffff);
+  }
+  /* the header is written after all watches are in place */
+  if (ftruncate(w->fd, 0) < 0) {
+    goto err;
+  }
+
+  w->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w->ifd < 0 || pipe(w->wakeup) < 0) {
+    goto err;
+  }
+
+  if (_csync_watch_add(w, "") < 0) {
+    goto err;
+  }
+
+  if (_csync_watch_reset(w) < 0) {
+    goto err;
+  }
+
+  if (pthread_create(&w->thread, NULL, _csync_watch_thread, w) != 0) {
+    goto err;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Watching %s", local);
+  *watch = w;
+
+  return 0;
+err:
+  _csync_watch_free(w);
+  return -1;
+}
+
+int csync_watch_stop(CSYNC_WATCH *watch) {
+  char c = 0;
+
+  if (watch == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (write(watch->wakeup[1], &c, 1) == 1) {
+    pthread_join(watch->thread, NULL);
+  }
+  _csync_watch_free(watch);
+
+  return 0;
+}
+
+/* sorted list helpers, the key is the first len bytes of path */
+static int _csync_watch_cmp(const char *entry, const char *path, size_t len) {
+  int rc;
+
+  rc = strncmp(entry, path, len);
+  if (rc != 0) {
+    return rc;
+  }
+
+  return entry[len] == '\0' ? 0 : 1;
+}
+
+static size_t _csync_watch_lower_bound(c_strlist_t *list, const char *path,
+    size_t len) {
+  size_t lo = 0;
+  size_t hi = list->count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (_csync_watch_cmp(list->vector[mid], path, len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static int _csync_watch_strcmp(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int _csync_watch_add_path(c_strlist_t **plist, const char *path) {
+  c_strlist_t *list = *plist;
+
+  if (list->count == list->size) {
+    list = c_strlist_expand(list, list->size * 2);
+    if (list == NULL) {
+      return -1;
+    }
+    *plist = list;
+  }
+
+  return c_strlist_add(list, path);
+}
+
+int csync_watch_load(CSYNC *ctx) {
+  struct stat sb;
+  char *file = NULL;
+  char *buf = NULL;
+  char *line;
+  char *end;
+  int generation = 0;
+  int64_t last_generation = 0;
+  int64_t offset = 0;
+  int usable = 0;
+  int fd = -1;
+  ssize_t len;
+  int n = 0;
+
+  csync_watch_clear(ctx);
+
+  if (ctx->statedb.db == NULL || !csync_get_statedb_exists(ctx)) {
+    return -1;
+  }
+
+  if (asprintf(&file, "%s/%s", ctx->local.uri, CSYNC_WATCH_FILE) < 0) {
+    return -1;
+  }
+  fd = open(file, O_RDONLY | O_CLOEXEC);
+  SAFE_FREE(file);
+  if (fd < 0) {
+    return -1;
+  }
+
+  /* without a running watcher changes might be missing */
+  if (flock(fd, LOCK_SH | LOCK_NB) == 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "No watcher running");
+    goto out;
+  }
+
+  if (fstat(fd, &sb) < 0 || sb.st_size == 0 ||
+      sb.st_size > CSYNC_WATCH_MAX_SIZE) {
+    goto out;
+  }
+  buf = c_malloc(sb.st_size + 1);
+  if (buf == NULL) {
+    goto out;
+  }
+  len = pread(fd, buf, sb.st_size, 0);
+  if (len <= 0) {
+    goto out;
+  }
+  buf[len] = '\0';
+
+  if (sscanf(buf, CSYNC_WATCH_HEADER "%n", &generation, &n) != 1 || n == 0) {
+    goto out;
+  }
+
+  /* a line might still be written */
+  end = strrchr(buf, '\n');
+  if (end == NULL || end - buf < n - 1) {
+    goto out;
+  }
+  *++end = '\0';
+
+  if (csync_statedb_get_value(ctx->statedb.db, "watch_generation",
+        &last_generation) == 0 &&
+      last_generation == generation &&
+      csync_statedb_get_value(ctx->statedb.db, "watch_offset", &offset) == 0 &&
+      offset >= n && offset <= end - buf) {
+    usable = 1;
+  }
+
+  ctx->watch.dirty = c_strlist_new(64);
+  ctx->watch.tree = c_strlist_new(64);
+  if (ctx->watch.dirty == NULL || ctx->watch.tree == NULL) {
+    usable = 0;
+  }
+
+  for (line = buf + offset; usable && line < end; line = strchr(line, '\n') + 1) {
+    char *nl = strchr(line, '\n');
+
+    *nl = '\0';
+    switch (line[0]) {
+      case 'r':
+        if (_csync_watch_add_path(&ctx->watch.tree, line + 2) < 0) {
+          usable = 0;
+        }
+        /* FALLTHROUGH */
+      case 'd':
+        if (_csync_watch_add_path(&ctx->watch.dirty, line + 2) < 0) {
+          usable = 0;
+        }
+        break;
+      default:
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO, "Change journal lost events");
+        usable = 0;
+        break;
+    }
+    *nl = '\n';
+  }
+
+  /* the next run continues after what has been read now */
+  if (csync_statedb_set_value(ctx->statedb.db, "watch_generation",
+        generation) < 0 ||
+      csync_statedb_set_value(ctx->statedb.db, "watch_offset",
+        (int) (end - buf)) < 0) {
+    usable = 0;
+  }
+
+  if (usable) {
+    qsort(ctx->watch.dirty->vector, ctx->watch.dirty->count, sizeof(char *),
+        _csync_watch_strcmp);
+    qsort(ctx->watch.tree->vector, ctx->watch.tree->count, sizeof(char *),
+        _csync_watch_strcmp);
+    ctx->watch.enabled = 1;
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%zu changes in the change journal",
+        ctx->watch.dirty->count);
+  }
+
+out:
+  SAFE_FREE(buf);
+  close(fd);
+  if (!usable) {
+    csync_watch_clear(ctx);
+    return -1;
+  }
+
+  return 0;
+}
+
+int csync_watch_is_dirty(CSYNC *ctx, const char *path) {
+  c_strlist_t *list = ctx->watch.dirty;
+  size_t len = strlen(path);
+  const char *p;
+  size_t i;
+
+  if (!ctx->watch.enabled || len == 0) {
+    return 1;
+  }
+
+  /* the directory itself or something below it changed */
+  for (i = _csync_watch_lower_bound(list, path, len); i < list->count; i++) {
+    const char *entry = list->vector[i];
+
+    if (strncmp(entry, path, len) != 0 || entry[len] > '/') {
+      break;
+    }
+    if (entry[len] == '\0' || entry[len] == '/') {
+      return 1;
+    }
+  }
+
+  /* it is part of a new tree */
+  list = ctx->watch.tree;
+  for (p = path; p != NULL; p = strchr(p + 1, '/')) {
+    size_t plen = (size_t) (p - path);
+
+    if (p == path) {
+      continue;
+    }
+    i = _csync_watch_lower_bound(list, path, plen);
+    if (i < list->count && _csync_watch_cmp(list->vector[i], path, plen) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+#else /* CSYNC_WATCH_INOTIFY */
+
+int csync_watch_start(CSYNC_WATCH **watch, const char *local) {
+  (void) watch;
+  (void) local;
+
+  errno = ENOSYS;
+  return -1;
+}
+
+int csync_watch_stop(CSYNC_WATCH *watch) {
+  (void) watch;
+
+  errno = ENOSYS;
+  return -1;
+}
+
+int csync_watch_load(CSYNC *ctx) {
+  (void) ctx;
+
+  return -1;
+}
+
+int csync_watch_is_dirty(CSYNC *ctx, const char *path) {
+  (void) ctx;
+  (void) path;
+
+  return 1;
+}
+
+#endif /* CSYNC_WATCH_INOTIFY */
+
+void csync_watch_clear(CSYNC *ctx) {
+  c_strlist_destroy(ctx->watch.dirty);
+  c_strlist_destroy(ctx->watch.tree);
+  ctx->watch.dirty = NULL;
+  ctx->watch.tree = NULL;
+  ctx->watch.enabled = 0;
+}
+
+/* vim: set ts=8 sw=2 et cindent: */
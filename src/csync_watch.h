@@ -0,0 +1,92 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_WATCH_H
+#define _CSYNC_WATCH_H
+
+#include "csync_private.h"
+
+/**
+ * @file csync_watch.h
+ *
+ * @brief Change journal of the local replica
+ *
+ * A watcher started with csync_watch_start() records the directories of the
+ * local replica which changed into a journal next to the statedb. The update
+ * detection only walks these directories and takes everything else from the
+ * statedb.
+ *
+ * The journal is a text file with a header line "csync-watch <generation>"
+ * followed by one line per change:
+ *
+ *   d <path>   the entries of the directory changed
+ *   r <path>   the directory is new or moved, walk all of it
+ *   o          events got lost, walk everything
+ *
+ * The watcher keeps the journal locked while it is running. The statedb
+ * stores the generation and the offset of the journal consumed by the last
+ * synchronization.
+ *
+ * @defgroup csyncWatchInternals csync change journal internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+/* the name matches the exclude pattern of the statedb */
+#define CSYNC_WATCH_FILE ".csync_journal.db.dirty"
+
+/* a larger journal is started over, the next update walks everything */
+#define CSYNC_WATCH_MAX_SIZE (16 * 1024 * 1024)
+
+/**
+ * @brief Load the changes recorded since the last synchronization.
+ *
+ * The journal is usable if a watcher is running, it is the same journal the
+ * last synchronization consumed and no events got lost. The position up to
+ * which the journal has been read is stored in the statedb in any case.
+ *
+ * @param ctx      The csync context.
+ *
+ * @return 0 if the update detection can use the changes, less than 0 if the
+ *         local replica has to be walked completely.
+ */
+int csync_watch_load(CSYNC *ctx);
+
+/**
+ * @brief Check if a directory or anything below it changed.
+ *
+ * @param ctx      The csync context.
+ * @param path     The relative path of the directory.
+ *
+ * @return 1 if the directory has to be walked, 0 if not.
+ */
+int csync_watch_is_dirty(CSYNC *ctx, const char *path);
+
+/**
+ * @brief Free the changes loaded by csync_watch_load().
+ */
+void csync_watch_clear(CSYNC *ctx);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_WATCH_H */
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -0,0 +1,144 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdint.h>
+
+#include "c_macro.h"
+#include "c_alloc.h"
+#include "c_arena.h"
+
+#define C_ARENA_CHUNK_SIZE (1024 * 1024)
+
+/* enough for pointers, 64bit integers and doubles */
+#define C_ARENA_ALIGN 16
+#define C_ARENA_ROUND(s) (((s) + C_ARENA_ALIGN - 1) & ~((size_t) C_ARENA_ALIGN - 1))
+
+struct c_arena_chunk_s {
+  struct c_arena_chunk_s *next;
+  size_t size;
+  size_t used;
+};
+
+/* the data of a chunk starts behind the aligned header */
+#define C_ARENA_HEADER C_ARENA_ROUND(sizeof(struct c_arena_chunk_s))
+
+struct c_arena_s {
+  struct c_arena_chunk_s *chunks;
+  size_t chunk_size;
+  size_t size;
+};
+
+static struct c_arena_chunk_s *_c_arena_chunk_new(size_t size) {
+  struct c_arena_chunk_s *chunk;
+
+  /* c_malloc() zeroes the chunk, so the memory handed out is zeroed too */
+  chunk = c_malloc(C_ARENA_HEADER + size);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->size = size;
+
+  return chunk;
+}
+
+c_arena_t *c_arena_new(size_t chunk_size) {
+  c_arena_t *arena;
+
+  arena = c_malloc(sizeof(c_arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+
+  if (chunk_size == 0) {
+    chunk_size = C_ARENA_CHUNK_SIZE;
+  }
+  arena->chunk_size = C_ARENA_ROUND(chunk_size);
+
+  return arena;
+}
+
+void *c_arena_alloc(c_arena_t *arena, size_t size) {
+  struct c_arena_chunk_s *chunk;
+
+  if (arena == NULL || size == 0 || size > SIZE_MAX - C_ARENA_HEADER - C_ARENA_ALIGN) {
+    return NULL;
+  }
+  size = C_ARENA_ROUND(size);
+
+  if (size > arena->chunk_size / 4) {
+    /*
+     * Large allocations get their own chunk. It is linked behind the
+     * current chunk, so the free space of the current chunk is kept.
+     */
+    chunk = _c_arena_chunk_new(size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->used = size;
+    if (arena->chunks != NULL) {
+      chunk->next = arena->chunks->next;
+      arena->chunks->next = chunk;
+    } else {
+      arena->chunks = chunk;
+    }
+    arena->size += size;
+
+    return (char *) chunk + C_ARENA_HEADER;
+  }
+
+  chunk = arena->chunks;
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    chunk = _c_arena_chunk_new(arena->chunk_size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+
+  chunk->used += size;
+  arena->size += size;
+
+  return (char *) chunk + C_ARENA_HEADER + chunk->used - size;
+}
+
+size_t c_arena_size(const c_arena_t *arena) {
+  if (arena == NULL) {
+    return 0;
+  }
+
+  return arena->size;
+}
+
+void c_arena_free(c_arena_t *arena) {
+  struct c_arena_chunk_s *chunk;
+  struct c_arena_chunk_s *next;
+
+  if (arena == NULL) {
+    return;
+  }
+
+  for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    SAFE_FREE(chunk);
+  }
+
+  SAFE_FREE(arena);
+}
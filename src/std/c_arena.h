@@ -0,0 +1,89 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_arena.h
+ *
+ * @brief Interface of the cynapses libc arena allocator
+ *
+ * An arena hands out memory from large chunks by bumping a pointer. The
+ * memory can't be freed piece by piece, all of it is released at once with
+ * c_arena_free(). This is useful for a lot of small objects which all live
+ * as long as each other.
+ *
+ * An arena is not thread safe, the caller has to serialize the allocations.
+ *
+ * @defgroup cynArenaInternals cynapses libc arena functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+
+#ifndef _C_ARENA_H
+#define _C_ARENA_H
+
+#include <stddef.h>
+
+/* Forward declarations */
+struct c_arena_s; typedef struct c_arena_s c_arena_t;
+
+/**
+ * @brief Create a new arena.
+ *
+ * @param chunk_size  The size of the chunks to allocate, 0 for the default.
+ *
+ * @return  The new arena, NULL if no memory is left.
+ */
+c_arena_t *c_arena_new(size_t chunk_size);
+
+/**
+ * @brief Allocate memory from an arena.
+ *
+ * The memory is zeroed and suitably aligned for any kind of object.
+ * Allocations larger than a quarter of the chunk size get a chunk on their
+ * own.
+ *
+ * @param arena  The arena to allocate from.
+ * @param size   The number of bytes to allocate.
+ *
+ * @return  A pointer to the memory, NULL if no memory is left or size is 0.
+ */
+void *c_arena_alloc(c_arena_t *arena, size_t size);
+
+/**
+ * @brief Get the number of bytes allocated from an arena.
+ *
+ * @param arena  The arena.
+ *
+ * @return  The number of bytes handed out by c_arena_alloc().
+ */
+size_t c_arena_size(const c_arena_t *arena);
+
+/**
+ * @brief Release an arena and all memory allocated from it.
+ *
+ * @param arena  The arena to free, may be NULL.
+ */
+void c_arena_free(c_arena_t *arena);
+
+/**
+ * }@
+ */
+#endif /* _C_ARENA_H */
@@ -0,0 +1,206 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+
+#include "c_macro.h"
+#include "c_alloc.h"
+#include "c_hash.h"
+
+#define C_HASH_MIN_SLOTS 64
+
+/* the keys are hashes already, spread them over the table anyway */
+static size_t _c_hash_slot(uint64_t key, size_t mask) {
+  uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+
+  return (size_t) (h >> 32) & mask;
+}
+
+/* rebuild the slots for at least size entries, the table is kept half empty */
+static int _c_hash_resize(c_hash_t *table, size_t size) {
+  struct c_hash_slot_s *slots = NULL;
+  size_t nslots = C_HASH_MIN_SLOTS;
+  size_t mask;
+  size_t n;
+
+  while (nslots < size * 2) {
+    nslots *= 2;
+  }
+  if (table->slots != NULL && nslots <= table->mask + 1) {
+    return 0;
+  }
+  mask = nslots - 1;
+
+  slots = c_malloc(nslots * sizeof(struct c_hash_slot_s));
+  if (slots == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* the keys are in the old slots, move the occupied ones over */
+  if (table->slots != NULL) {
+    for (n = 0; n <= table->mask; n++) {
+      size_t i;
+
+      if (table->slots[n].item == 0) {
+        continue;
+      }
+      i = _c_hash_slot(table->slots[n].key, mask);
+      while (slots[i].item) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = table->slots[n];
+    }
+  }
+
+  SAFE_FREE(table->slots);
+  table->slots = slots;
+  table->mask = mask;
+
+  return 0;
+}
+
+static int _c_hash_grow_items(c_hash_t *table, size_t size) {
+  void **items;
+  size_t capacity = table->capacity ? table->capacity : C_HASH_MIN_SLOTS / 2;
+
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  if (capacity == table->capacity) {
+    return 0;
+  }
+
+  items = c_realloc(table->items, capacity * sizeof(void *));
+  if (items == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  table->items = items;
+  table->capacity = capacity;
+
+  return 0;
+}
+
+c_hash_t *c_hash_new(size_t size) {
+  c_hash_t *table;
+
+  table = c_malloc(sizeof(c_hash_t));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  if (c_hash_reserve(table, size) < 0) {
+    c_hash_free(table);
+    return NULL;
+  }
+
+  return table;
+}
+
+int c_hash_reserve(c_hash_t *table, size_t size) {
+  if (table == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (_c_hash_resize(table, size) < 0) {
+    return -1;
+  }
+
+  return _c_hash_grow_items(table, size);
+}
+
+void c_hash_free(c_hash_t *table) {
+  if (table == NULL) {
+    return;
+  }
+
+  SAFE_FREE(table->slots);
+  SAFE_FREE(table->items);
+  SAFE_FREE(table);
+}
+
+int c_hash_insert(c_hash_t *table, uint64_t key, void *data) {
+  size_t i;
+
+  if (table == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (table->size + 1 > table->capacity) {
+    if (_c_hash_grow_items(table, table->size + 1) < 0) {
+      return -1;
+    }
+  }
+  if ((table->size + 1) * 2 > table->mask + 1) {
+    if (_c_hash_resize(table, table->size + 1) < 0) {
+      return -1;
+    }
+  }
+
+  for (i = _c_hash_slot(key, table->mask); table->slots[i].item; i = (i + 1) & table->mask) {
+    if (table->slots[i].key == key) {
+      return 1;
+    }
+  }
+
+  table->items[table->size] = data;
+  table->size++;
+  table->slots[i].key = key;
+  table->slots[i].item = table->size;
+
+  return 0;
+}
+
+void *c_hash_find(const c_hash_t *table, uint64_t key) {
+  size_t i;
+
+  if (table == NULL || table->size == 0) {
+    return NULL;
+  }
+
+  for (i = _c_hash_slot(key, table->mask); table->slots[i].item; i = (i + 1) & table->mask) {
+    if (table->slots[i].key == key) {
+      return table->items[table->slots[i].item - 1];
+    }
+  }
+
+  return NULL;
+}
+
+int c_hash_walk(c_hash_t *table, void *data, c_hash_visit_func *visitor) {
+  size_t n;
+
+  if (table == NULL || visitor == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* the visitor may insert, so don't keep a pointer into the items */
+  for (n = 0; n < table->size; n++) {
+    if ((*visitor)(table->items[n], data) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008-2013 by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_hash.h
+ *
+ * @brief Interface of the cynapses libc hash table
+ *
+ * The hash table maps 64bit keys, usually already a hash like the result of
+ * c_jhash64(), to data pointers. It uses open addressing with linear
+ * probing and keeps the keys in the slots, so a lookup touches the data only
+ * once the key matched.
+ *
+ * The data pointers are stored in an array in the order they have been
+ * inserted. Iterating over the table is a loop over this array:
+ *
+ * @code
+ * for (i = 0; i < c_hash_size(table); i++) {
+ *   data = c_hash_at(table, i);
+ * }
+ * @endcode
+ *
+ * Entries can't be removed, the table doesn't own the data.
+ *
+ * @defgroup cynHashInternals cynapses libc hash table functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+
+#ifndef _C_HASH_H
+#define _C_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Forward declarations */
+struct c_hash_s; typedef struct c_hash_s c_hash_t;
+
+/**
+ * @brief Visit function for the c_hash_walk() function.
+ *
+ * @param obj    The data of the entry.
+ * @param data   Generic data pointer.
+ *
+ * @return 0 on success, < 0 on error.
+ */
+typedef int c_hash_visit_func(void *obj, void *data);
+
+/**
+ * Structure that represents a hash table
+ */
+struct c_hash_s {
+  /* open addressing table of key and data index + 1, 0 marks a free slot */
+  struct c_hash_slot_s {
+    uint64_t key;
+    size_t item;
+  } *slots;
+  size_t mask;
+  /* the data in insertion order */
+  void **items;
+  size_t size;
+  size_t capacity;
+};
+
+/**
+ * @brief Create a hash table.
+ *
+ * @param size   The number of entries to make room for, 0 for a small table.
+ *
+ * @return  The new table, NULL if no memory is left.
+ */
+c_hash_t *c_hash_new(size_t size);
+
+/**
+ * @brief Make room for a number of entries.
+ *
+ * Reserving the space up front avoids growing the table step by step.
+ *
+ * @param table  The table.
+ *
+ * @param size   The number of entries the table should hold.
+ *
+ * @return  0 on success, -1 if an error occured with errno set.
+ */
+int c_hash_reserve(c_hash_t *table, size_t size);
+
+/**
+ * @brief Free a hash table.
+ *
+ * The data of the entries is not freed.
+ *
+ * @param table  The table to free, may be NULL.
+ */
+void c_hash_free(c_hash_t *table);
+
+/**
+ * @brief Insert data into a hash table.
+ *
+ * @param table  The table.
+ *
+ * @param key    The key of the data.
+ *
+ * @param data   The data to insert.
+ *
+ * @return  0 on success, 1 if the key is already in the table and < 0 if an
+ *          error occured with errno set.
+ */
+int c_hash_insert(c_hash_t *table, uint64_t key, void *data);
+
+/**
+ * @brief Find the data of a key.
+ *
+ * @param table  The table to search.
+ *
+ * @param key    The key to search for.
+ *
+ * @return  The data, NULL if the key is not in the table.
+ */
+void *c_hash_find(const c_hash_t *table, uint64_t key);
+
+/**
+ * @brief Walk over a hash table in insertion order.
+ *
+ * The visitor may insert into the table, the new entries are visited too.
+ *
+ * @param table    The table to walk.
+ *
+ * @param data     Data which should be passed to the visitor function.
+ *
+ * @param visitor  Visitor function, called for the data of each entry.
+ *
+ * @return  0 on success, less than 0 if an error occured.
+ */
+int c_hash_walk(c_hash_t *table, void *data, c_hash_visit_func *visitor);
+
+/**
+ * @brief Get the number of entries of a hash table.
+ *
+ * @param T  The table.
+ *
+ * @return  The number of entries.
+ */
+#define c_hash_size(T) ((T) == NULL ? 0 : (T)->size)
+
+/**
+ * @brief Get the data of the entry at a position in insertion order.
+ *
+ * @param T  The table.
+ *
+ * @param I  The position, less than c_hash_size().
+ *
+ * @return  The data.
+ */
+#define c_hash_at(T, I) ((T)->items[(I)])
+
+/**
+ * }@
+ */
+#endif /* _C_HASH_H */
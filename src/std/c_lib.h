@@ -23,8 +23,10 @@
 
 #include "c_macro.h"
 #include "c_alloc.h"
+#include "c_arena.h"
 #include "c_dir.h"
 #include "c_file.h"
+#include "c_hash.h"
 #include "c_list.h"
 #include "c_path.h"
 #include "c_rbtree.h"
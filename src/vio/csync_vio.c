@@ -160,6 +160,8 @@ int csync_vio_init(CSYNC *ctx, const char *module, const char *args) {
   ctx->module.capabilities.atomar_copy_support = false;
   ctx->module.capabilities.put_support         = false;
   ctx->module.capabilities.get_support         = false;
+  ctx->module.capabilities.readdir_stat_support = false;
+  ctx->module.capabilities.concurrent_session_support = false;
 
   /* Load the module capabilities from the module if it implements the it. */
   if( VIO_METHOD_HAS_FUNC(m, get_capabilities)) {
@@ -280,10 +282,16 @@ int csync_vio_getfd(csync_vio_handle_t *fhandle) {
 
 }
 
-int csync_vio_put(CSYNC *ctx,
-                  csync_vio_handle_t *flocal,
-                  csync_vio_handle_t *fremote,
-                  csync_file_stat_t *st) {
+/*
+ * The token of an interrupted transfer is handed to the module in the etag
+ * of the stat, together with the offset of the remote handle it continues
+ * at. The module hands back the token to continue this transfer with, it is
+ * copied into token if it fits, else token is emptied.
+ */
+static int _csync_vio_transfer(csync_method_put_fn fn,
+                               csync_vio_handle_t *flocal,
+                               csync_vio_handle_t *fremote,
+                               csync_file_stat_t *st, char *token, size_t len) {
   int rc = 0;
   csync_vio_file_stat_t *vfs = csync_vio_convert_file_stat(st);
 
@@ -294,35 +302,93 @@ int csync_vio_put(CSYNC *ctx,
     rc = -1;
   }
 
+  if (rc == 0 && token != NULL && token[0] != '\0') {
+    vfs->etag = c_strdup(token);
+    if (vfs->etag == NULL) {
+      rc = -1;
+    }
+    vfs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+  }
+
   if (rc == 0) {
-    rc = ctx->module.method->put(flocal->method_handle,
-                                 fremote->method_handle,
-                                 vfs);
+    rc = fn(flocal->method_handle, fremote->method_handle, vfs);
+    if (token != NULL) {
+      if (vfs->etag != NULL && strlen(vfs->etag) < len) {
+        strcpy(token, vfs->etag);
+      } else {
+        token[0] = '\0';
+      }
+    }
   }
   csync_vio_file_stat_destroy(vfs);
   return rc;
 }
 
+int csync_vio_put(CSYNC *ctx,
+                  csync_vio_handle_t *flocal,
+                  csync_vio_handle_t *fremote,
+                  csync_file_stat_t *st,
+                  char *token, size_t len) {
+  return _csync_vio_transfer(ctx->module.method->put, flocal, fremote,
+                             st, token, len);
+}
+
 int csync_vio_get(CSYNC *ctx,
                   csync_vio_handle_t *flocal,
                   csync_vio_handle_t *fremote,
-                  csync_file_stat_t *st) {
-  int rc = 0;
-  csync_vio_file_stat_t *vfs = csync_vio_convert_file_stat(st);
+                  csync_file_stat_t *st,
+                  char *token, size_t len) {
+  return _csync_vio_transfer(ctx->module.method->get, flocal, fremote,
+                             st, token, len);
+}
 
-  if (flocal == NULL) {
-    rc = -1;
+/*
+ * Both handles have to be opened on ctx->replica. how is a set of the
+ * CSYNC_VIO_COPY flags, a module copies on the server with
+ * CSYNC_VIO_COPY_RANGE.
+ */
+int csync_vio_copy(CSYNC *ctx, csync_vio_handle_t *fsrc, csync_vio_handle_t *fdst,
+                   int how) {
+  int rc = -1;
+
+  if (fsrc == NULL || fdst == NULL) {
+    errno = EBADF;
+    return -1;
   }
-  if (vfs ==  NULL) {
-    rc = -1;
+
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      if ((how & CSYNC_VIO_COPY_RANGE) &&
+          VIO_METHOD_HAS_FUNC(ctx->module.method, copy)) {
+        rc = ctx->module.method->copy(fsrc->method_handle, fdst->method_handle);
+      } else {
+        errno = ENOTSUP;
+      }
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_copy(fsrc->method_handle, fdst->method_handle, how);
+      break;
+    default:
+      break;
   }
 
-  if (rc == 0) {
-    rc = ctx->module.method->get(flocal->method_handle,
-                                 fremote->method_handle,
-                                 vfs);
+  return rc;
+}
+
+int csync_vio_copy_support(CSYNC *ctx) {
+  int rc = 0;
+
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      rc = VIO_METHOD_HAS_FUNC(ctx->module.method, copy);
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_copy_support();
+      break;
+    default:
+      break;
   }
-  csync_vio_file_stat_destroy(vfs);
+
   return rc;
 }
 
@@ -387,6 +453,52 @@ off_t csync_vio_lseek(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t offset, int
   return ro;
 }
 
+/* The modules have no way to flush a file, they fail with ENOTSUP */
+int csync_vio_fsync(CSYNC *ctx, csync_vio_handle_t *fhandle) {
+  int rc = -1;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      errno = ENOTSUP;
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_fsync(fhandle->method_handle);
+      break;
+    default:
+      break;
+  }
+
+  return rc;
+}
+
+/* Set the size of a file, only the local replica can */
+int csync_vio_ftruncate(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t length) {
+  int rc = -1;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      errno = ENOTSUP;
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_ftruncate(fhandle->method_handle, length);
+      break;
+    default:
+      break;
+  }
+
+  return rc;
+}
+
 csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
   csync_vio_handle_t *h = NULL;
   csync_vio_method_handle_t *mh = NULL;
@@ -452,6 +564,23 @@ csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle
   return fs;
 }
 
+int csync_vio_readdir_stat_support(CSYNC *ctx) {
+  int rc = 0;
+
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      rc = ctx->module.capabilities.readdir_stat_support;
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_readdir_stat_support();
+      break;
+    default:
+      break;
+  }
+
+  return rc;
+}
+
 int csync_vio_mkdir(CSYNC *ctx, const char *uri, mode_t mode) {
   int rc = -1;
 
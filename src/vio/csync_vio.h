@@ -36,13 +36,18 @@ int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *handle);
 ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_t count);
 ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf, size_t count);
 off_t csync_vio_lseek(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t offset, int whence);
+int csync_vio_fsync(CSYNC *ctx, csync_vio_handle_t *fhandle);
+int csync_vio_ftruncate(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t length);
 
-int csync_vio_put(CSYNC *ctx, csync_vio_handle_t *flocal, csync_vio_handle_t *fremote, csync_file_stat_t *st);
-int csync_vio_get(CSYNC *ctx, csync_vio_handle_t *flocal, csync_vio_handle_t *fremote, csync_file_stat_t *st);
+int csync_vio_put(CSYNC *ctx, csync_vio_handle_t *flocal, csync_vio_handle_t *fremote, csync_file_stat_t *st, char *token, size_t len);
+int csync_vio_get(CSYNC *ctx, csync_vio_handle_t *flocal, csync_vio_handle_t *fremote, csync_file_stat_t *st, char *token, size_t len);
+int csync_vio_copy(CSYNC *ctx, csync_vio_handle_t *fsrc, csync_vio_handle_t *fdst, int how);
+int csync_vio_copy_support(CSYNC *ctx);
 
 csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name);
 int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle);
 csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle);
+int csync_vio_readdir_stat_support(CSYNC *ctx);
 
 int csync_vio_mkdir(CSYNC *ctx, const char *uri, mode_t mode);
 int csync_vio_mkdirs(CSYNC *ctx, const char *uri, mode_t mode);
@@ -44,6 +44,9 @@ void csync_vio_file_stat_destroy(csync_vio_file_stat_t *file_stat) {
   if (file_stat->fields == CSYNC_VIO_FILE_STAT_FIELDS_CHECKSUM) {
     SAFE_FREE(file_stat->u.checksum);
   }
+  if (file_stat->fields & CSYNC_VIO_FILE_STAT_FIELDS_ETAG) {
+    SAFE_FREE(file_stat->etag);
+  }
 
   SAFE_FREE(file_stat->name);
   SAFE_FREE(file_stat);
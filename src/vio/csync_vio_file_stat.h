@@ -69,6 +69,7 @@ enum csync_vio_file_stat_fields_e {
   CSYNC_VIO_FILE_STAT_FIELDS_ACL = 1 << 14,
   CSYNC_VIO_FILE_STAT_FIELDS_UID = 1 << 15,
   CSYNC_VIO_FILE_STAT_FIELDS_GID = 1 << 16,
+  CSYNC_VIO_FILE_STAT_FIELDS_ETAG = 1 << 17,
 };
 
 
@@ -80,6 +81,7 @@ struct csync_vio_file_stat_s {
 
   void *acl;
   char *name;
+  char *etag;
 
   uid_t uid;
   gid_t gid;
@@ -32,6 +32,17 @@
 #include "vio/csync_vio_local.h"
 #include "vio/csync_vio_handle_private.h"
 
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+/* bytes handed to the kernel per copy_file_range() or sendfile() call */
+#define CSYNC_VIO_LOCAL_COPY_CHUNK (1 << 30)
+
 typedef struct fhandle_s {
   int fd;
 } fhandle_t;
@@ -158,6 +169,212 @@ off_t csync_vio_local_lseek(csync_vio_method_handle_t *fhandle, off_t offset, in
   return lseek(handle->fd, offset, whence);
 }
 
+int csync_vio_local_fsync(csync_vio_method_handle_t *fhandle) {
+  fhandle_t *handle = NULL;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  handle = (fhandle_t *) fhandle;
+
+#ifdef _WIN32
+  return _commit(handle->fd);
+#elif defined(HAVE_FDATASYNC)
+  return fdatasync(handle->fd);
+#else
+  return fsync(handle->fd);
+#endif
+}
+
+int csync_vio_local_copy_support(void) {
+#if defined(FICLONE) || defined(HAVE_COPY_FILE_RANGE) || \
+    (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H))
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* the kernel can't do this copy, the caller has to copy through a buffer */
+static int _csync_vio_local_copy_unsupported(int err) {
+  switch (err) {
+    case ENOSYS:
+    case EXDEV:
+    case EINVAL:
+    case ENOTTY:
+    case EOPNOTSUPP:
+#if defined(ENOTSUP) && ENOTSUP != EOPNOTSUPP
+    case ENOTSUP:
+#endif
+      return 1;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+int csync_vio_local_ftruncate(csync_vio_method_handle_t *fhandle, off_t length) {
+  fhandle_t *handle = NULL;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  handle = (fhandle_t *) fhandle;
+
+  return ftruncate(handle->fd, length);
+}
+
+/*
+ * Copy the source from its offset to the end without passing the data
+ * through user space, with the ways allowed by how. A reflink shares the
+ * blocks on copy on write file systems, it needs a fresh destination and a
+ * source at offset 0. Otherwise the data is copied in the kernel, by
+ * copy_file_range() and by sendfile() if the file systems don't support
+ * that. Both move the offsets, a method failing halfway is continued by the
+ * next one.
+ */
+int csync_vio_local_copy(csync_vio_method_handle_t *fsrc,
+                         csync_vio_method_handle_t *fdst, int how) {
+  fhandle_t *src = NULL;
+  fhandle_t *dst = NULL;
+  ssize_t n = 0;
+
+  if (fsrc == NULL || fdst == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  src = (fhandle_t *) fsrc;
+  dst = (fhandle_t *) fdst;
+
+#ifdef FICLONE
+  if ((how & CSYNC_VIO_COPY_REFLINK) &&
+      lseek(src->fd, 0, SEEK_CUR) == 0 && lseek(dst->fd, 0, SEEK_END) == 0 &&
+      ioctl(dst->fd, FICLONE, src->fd) == 0) {
+    /* leave the offsets where a copy would have left them */
+    lseek(src->fd, 0, SEEK_END);
+    lseek(dst->fd, 0, SEEK_END);
+    return 0;
+  }
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+  if (how & CSYNC_VIO_COPY_RANGE) {
+    do {
+      n = copy_file_range(src->fd, NULL, dst->fd, NULL,
+                          CSYNC_VIO_LOCAL_COPY_CHUNK, 0);
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    if (n == 0) {
+      return 0;
+    }
+    if (!_csync_vio_local_copy_unsupported(errno)) {
+      return -1;
+    }
+  }
+#endif
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+  if (how & CSYNC_VIO_COPY_SENDFILE) {
+    do {
+      n = sendfile(dst->fd, src->fd, NULL, CSYNC_VIO_LOCAL_COPY_CHUNK);
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    if (n == 0) {
+      return 0;
+    }
+    if (!_csync_vio_local_copy_unsupported(errno)) {
+      return -1;
+    }
+  }
+#endif
+
+  (void) n;
+  (void) how;
+  errno = ENOTSUP;
+  return -1;
+}
+
+/* fill the stat fields csync uses from the stat result */
+static void _csync_vio_local_fill_stat(csync_vio_file_stat_t *buf,
+    csync_stat_t *sb) {
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  switch(sb->st_mode & S_IFMT) {
+    case S_IFBLK:
+      buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
+      break;
+    case S_IFCHR:
+      buf->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
+      break;
+    case S_IFDIR:
+      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      break;
+    case S_IFIFO:
+      buf->type = CSYNC_VIO_FILE_TYPE_FIFO;
+      break;
+    case S_IFLNK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    case S_IFREG:
+      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+      break;
+    case S_IFSOCK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SOCKET;
+      break;
+    default:
+      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
+      break;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+
+  buf->mode = sb->st_mode;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+
+  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+    /* FIXME: handle symlink */
+    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
+  } else {
+    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
+
+  buf->device = sb->st_dev;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DEVICE;
+
+  buf->inode = sb->st_ino;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
+
+  buf->nlink = sb->st_nlink;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
+
+  buf->uid = sb->st_uid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
+
+  buf->gid = sb->st_gid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
+
+  buf->size = sb->st_size;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+
+  /* Both values are only initialized to zero as they are not used in csync */
+  /* They are deprecated and will be rmemoved later. */
+  buf->blksize  = 0;
+  buf->blkcount = 0;
+
+  buf->atime = sb->st_atime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
+
+  buf->mtime = sb->st_mtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  buf->ctime = sb->st_ctime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+}
+
 /*
  * directory functions
  */
@@ -239,6 +456,7 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_method_handle_t *dhandl
     case DT_DIR:
       file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
       file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      break;
     case DT_REG:
       file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
       file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
@@ -251,6 +469,21 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_method_handle_t *dhandl
   }
 #endif
 
+#if defined(HAVE_FSTATAT) && !defined(_WIN32)
+  /*
+   * Stat relative to the open directory, the kernel doesn't have to resolve
+   * the full path again. If the entry vanished in the meantime, only the
+   * type is set and the caller has to stat it.
+   */
+  {
+    csync_stat_t sb;
+
+    if (fstatat(dirfd(handle->dh), dirent->d_name, &sb, 0) == 0) {
+      _csync_vio_local_fill_stat(file_stat, &sb);
+    }
+  }
+#endif
+
   return file_stat;
 
 err:
@@ -259,6 +492,14 @@ err:
   return NULL;
 }
 
+int csync_vio_local_readdir_stat_support(void) {
+#if defined(HAVE_FSTATAT) && !defined(_WIN32)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
 int csync_vio_local_mkdir(const char *uri, mode_t mode) {
   return c_mkdirs(uri, mode);
 }
@@ -288,78 +529,7 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
     c_free_locale_string(wuri);
     return -1;
   }
-  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-
-  switch(sb.st_mode & S_IFMT) {
-    case S_IFBLK:
-      buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
-      break;
-    case S_IFCHR:
-      buf->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
-      break;
-    case S_IFDIR:
-      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      break;
-    case S_IFIFO:
-      buf->type = CSYNC_VIO_FILE_TYPE_FIFO;
-      break;
-    case S_IFLNK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-    case S_IFREG:
-      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      break;
-    case S_IFSOCK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SOCKET;
-      break;
-    default:
-      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-      break;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-
-  buf->mode = sb.st_mode;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
-
-  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
-    /* FIXME: handle symlink */
-    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
-  } else {
-    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
-
-  buf->device = sb.st_dev;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DEVICE;
-
-  buf->inode = sb.st_ino;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
-
-  buf->nlink = sb.st_nlink;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
-
-  buf->uid = sb.st_uid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
-
-  buf->gid = sb.st_gid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
-
-  buf->size = sb.st_size;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-
-  /* Both values are only initialized to zero as they are not used in csync */
-  /* They are deprecated and will be rmemoved later. */
-  buf->blksize  = 0;
-  buf->blkcount = 0;
-
-  buf->atime = sb.st_atime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
-
-  buf->mtime = sb.st_mtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-
-  buf->ctime = sb.st_ctime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+  _csync_vio_local_fill_stat(buf, &sb);
 
   c_free_locale_string(wuri);
   return 0;
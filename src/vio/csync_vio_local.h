@@ -24,6 +24,16 @@
 #include "vio/csync_vio_method.h"
 #include <sys/time.h>
 
+/*
+ * The ways csync_vio_copy() may copy a file. A reflink shares the blocks of
+ * the source, a copy range lets the file system or the server copy it, both
+ * don't move the data through csync. sendfile() copies it in the kernel.
+ */
+#define CSYNC_VIO_COPY_REFLINK  0x01
+#define CSYNC_VIO_COPY_RANGE    0x02
+#define CSYNC_VIO_COPY_SENDFILE 0x04
+#define CSYNC_VIO_COPY_OFFLOAD  (CSYNC_VIO_COPY_REFLINK|CSYNC_VIO_COPY_RANGE)
+
 int csync_vio_local_getfd(csync_vio_handle_t *hnd);
 
 csync_vio_method_handle_t *csync_vio_local_open(const char *durl, int flags, mode_t mode);
@@ -32,10 +42,15 @@ int csync_vio_local_close(csync_vio_method_handle_t *fhandle);
 ssize_t csync_vio_local_read(csync_vio_method_handle_t *fhandle, void *buf, size_t count);
 ssize_t csync_vio_local_write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count);
 off_t csync_vio_local_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence);
+int csync_vio_local_fsync(csync_vio_method_handle_t *fhandle);
+int csync_vio_local_ftruncate(csync_vio_method_handle_t *fhandle, off_t length);
+int csync_vio_local_copy(csync_vio_method_handle_t *fsrc, csync_vio_method_handle_t *fdst, int how);
+int csync_vio_local_copy_support(void);
 
 csync_vio_method_handle_t *csync_vio_local_opendir(const char *name);
 int csync_vio_local_closedir(csync_vio_method_handle_t *dhandle);
 csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_method_handle_t *dhandle);
+int csync_vio_local_readdir_stat_support(void);
 
 int csync_vio_local_mkdir(const char *uri, mode_t mode);
 int csync_vio_local_rmdir(const char *uri);
@@ -37,6 +37,13 @@ struct csync_vio_capabilities_s {
  bool atomar_copy_support;
  bool get_support;
  bool put_support;
+ /* readdir fills all fields csync needs, no stat per entry is required */
+ bool readdir_stat_support;
+ /*
+  * every thread calling the methods is served on a session of its own, so
+  * they may be called from several threads at once
+  */
+ bool concurrent_session_support;
 };
 
 typedef struct csync_vio_capabilities_s csync_vio_capabilities_t;
@@ -76,12 +83,29 @@ typedef char* (*csync_method_get_error_string_fn)();
 
 typedef int (*csync_method_commit_fn)();
 
+/*
+ * Transfer a file between a local file descriptor and the server. Both
+ * handles may have been seeked to where an interrupted transfer stopped, then
+ * st->etag is the token the module handed back for it and the module
+ * continues there if it still can. On return st->etag is the token to
+ * continue this transfer with, e.g. the ETag of a download or the id of a
+ * chunked upload. A get leaves the local file at the end of what arrived, a
+ * put the remote handle at the offset the server has. A module which can't
+ * continue a transfer fails the seek of the remote handle.
+ */
 typedef int (*csync_method_get_fn)(csync_vio_method_handle_t *flocal,
                                    csync_vio_method_handle_t *fremote,
                                    csync_vio_file_stat_t *st);
 typedef int (*csync_method_put_fn)(csync_vio_method_handle_t *flocal,
                                    csync_vio_method_handle_t *fremote,
                                    csync_vio_file_stat_t *st);
+/*
+ * Copy from the offset of the source to its end, both handles belong to the
+ * method. Fails with ENOTSUP if the rest has to be copied with read and
+ * write, the offsets are left where the copy stopped.
+ */
+typedef int (*csync_method_copy_fn)(csync_vio_method_handle_t *fsrc,
+                                    csync_vio_method_handle_t *fdst);
 
 struct csync_vio_method_s {
   size_t method_table_size;           /* Used for versioning */
@@ -108,6 +132,7 @@ struct csync_vio_method_s {
   csync_method_commit_fn commit;
   csync_method_put_fn put;
   csync_method_get_fn get;
+  csync_method_copy_fn copy;
 };
 
 #endif /* _CSYNC_VIO_H */
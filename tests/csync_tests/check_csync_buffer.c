@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "csync_buffer.h"
+
+static void setup(void **state)
+{
+    csync_buffer_pool_t *pool;
+
+    pool = csync_buffer_pool_new(64 * 1024, 4 * 1024 * 1024);
+    assert_non_null(pool);
+
+    *state = pool;
+}
+
+static void teardown(void **state)
+{
+    csync_buffer_pool_free(*state);
+    *state = NULL;
+}
+
+static void check_csync_buffer_size(void **state)
+{
+    csync_buffer_pool_t *pool = *state;
+
+    /* small files get the minimum */
+    assert_int_equal(csync_buffer_size(pool, 0, false), 64 * 1024);
+    assert_int_equal(csync_buffer_size(pool, 1000, false), 64 * 1024);
+
+    /* a file fits in one buffer up to the maximum */
+    assert_int_equal(csync_buffer_size(pool, 64 * 1024 + 1, false), 128 * 1024);
+    assert_int_equal(csync_buffer_size(pool, 3 * 1024 * 1024, false),
+                     4 * 1024 * 1024);
+    assert_int_equal(csync_buffer_size(pool, 50LL * 1024 * 1024 * 1024, false),
+                     4 * 1024 * 1024);
+
+    /* local copies don't need more */
+    assert_int_equal(csync_buffer_size(pool, 3 * 1024 * 1024, true),
+                     CSYNC_BUFFER_LOCAL_MAX);
+    assert_int_equal(csync_buffer_size(pool, 100 * 1024, true), 128 * 1024);
+}
+
+static void check_csync_buffer_limits(void **state)
+{
+    csync_buffer_pool_t *pool;
+
+    (void) state;
+
+    /* sizes are rounded to a power of two, the maximum isn't below the minimum */
+    pool = csync_buffer_pool_new(100 * 1024, 1024);
+    assert_non_null(pool);
+    assert_int_equal(csync_buffer_size(pool, 0, false), 128 * 1024);
+    assert_int_equal(csync_buffer_size(pool, 1024 * 1024, false), 128 * 1024);
+    assert_int_equal(csync_buffer_size(pool, 1024 * 1024, true), 128 * 1024);
+    csync_buffer_pool_free(pool);
+}
+
+static void check_csync_buffer_reuse(void **state)
+{
+    csync_buffer_pool_t *pool = *state;
+    size_t size = csync_buffer_size(pool, 1024 * 1024, false);
+    char *a, *b, *c;
+
+    a = csync_buffer_get(pool, size);
+    assert_non_null(a);
+    memset(a, 'a', size);
+
+    b = csync_buffer_get(pool, size);
+    assert_non_null(b);
+    assert_true(a != b);
+    memset(b, 'b', size);
+
+    /* a buffer given back is taken again */
+    csync_buffer_put(pool, a, size);
+    c = csync_buffer_get(pool, size);
+    assert_true(c == a);
+
+    /* but not for another size */
+    csync_buffer_put(pool, c, size);
+    c = csync_buffer_get(pool, size * 2);
+    assert_non_null(c);
+    assert_true(c != a);
+
+    csync_buffer_put(pool, b, size);
+    csync_buffer_put(pool, c, size * 2);
+    csync_buffer_put(pool, NULL, size);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_buffer_size, setup, teardown),
+        unit_test(check_csync_buffer_limits),
+        unit_test_setup_teardown(check_csync_buffer_reuse, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
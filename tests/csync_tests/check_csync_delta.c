@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "csync_delta.h"
+
+#define BS 2048
+
+/* a file in memory, read in odd pieces to test the buffering */
+struct file_s {
+    char *data;
+    size_t size;
+    size_t pos;
+};
+
+struct patch_s {
+    struct file_s *old;
+    char *out;
+    size_t len;
+    int copies;
+};
+
+static ssize_t file_read(void *userdata, void *buf, size_t count)
+{
+    struct file_s *f = userdata;
+    size_t n = f->size - f->pos;
+
+    if (n > count) {
+        n = count;
+    }
+    if (n > 1000) {
+        n = 1000;
+    }
+    memcpy(buf, f->data + f->pos, n);
+    f->pos += n;
+
+    return n;
+}
+
+static int patch_copy(void *userdata, int64_t offset, size_t len)
+{
+    struct patch_s *p = userdata;
+
+    assert_true(offset % BS == 0);
+    assert_true(offset + len <= p->old->size);
+    memcpy(p->out + p->len, p->old->data + offset, len);
+    p->len += len;
+    p->copies++;
+
+    return 0;
+}
+
+static int patch_literal(void *userdata, const void *buf, size_t len)
+{
+    struct patch_s *p = userdata;
+
+    memcpy(p->out + p->len, buf, len);
+    p->len += len;
+
+    return 0;
+}
+
+static char *random_data(size_t size, unsigned int seed)
+{
+    char *data = malloc(size);
+    size_t i;
+
+    assert_non_null(data);
+    srand(seed);
+    for (i = 0; i < size; i++) {
+        data[i] = rand() & 0xff;
+    }
+
+    return data;
+}
+
+/* Runs a delta of new against old, returns the number of literal bytes. */
+static int64_t delta(char *old, size_t oldsize, char *new, size_t newsize,
+                     int *copies)
+{
+    struct file_s o = { old, oldsize, 0 };
+    struct file_s n = { new, newsize, 0 };
+    struct patch_s p;
+    csync_delta_sig_t *sig;
+    uint64_t hash = 0;
+    int64_t literal = -1;
+    int rc;
+
+    sig = csync_delta_signature(BS, file_read, &o);
+    assert_non_null(sig);
+    assert_int_equal(csync_delta_sig_blocks(sig), oldsize / BS);
+
+    memset(&p, 0, sizeof(p));
+    p.old = &o;
+    p.out = malloc(newsize + 1);
+    assert_non_null(p.out);
+
+    rc = csync_delta_generate(sig, file_read, &n, patch_copy, patch_literal,
+                              &p, &hash, &literal);
+    assert_int_equal(rc, 0);
+
+    /* the patched file is the new version */
+    assert_int_equal(p.len, newsize);
+    assert_memory_equal(p.out, new, newsize);
+    assert_true(hash == csync_delta_hash(CSYNC_DELTA_HASH_INIT, new, newsize));
+
+    if (copies != NULL) {
+        *copies = p.copies;
+    }
+
+    free(p.out);
+    csync_delta_sig_free(sig);
+
+    return literal;
+}
+
+static void check_csync_delta_block_size(void **state)
+{
+    (void) state;
+
+    assert_int_equal(csync_delta_block_size(0), 2048);
+    assert_int_equal(csync_delta_block_size(1024 * 1024), 2048);
+    assert_int_equal(csync_delta_block_size(100 * 1024 * 1024), 16384);
+    assert_int_equal(csync_delta_block_size(50LL * 1024 * 1024 * 1024),
+                     128 * 1024);
+}
+
+static void check_csync_delta_same(void **state)
+{
+    size_t size = 100 * BS + 123;
+    char *data = random_data(size, 1);
+    int copies = 0;
+
+    (void) state;
+
+    /* only the short last block is sent, the rest is one copy */
+    assert_int_equal(delta(data, size, data, size, &copies), 123);
+    assert_int_equal(copies, 1);
+
+    free(data);
+}
+
+static void check_csync_delta_changed(void **state)
+{
+    size_t size = 100 * BS;
+    char *old = random_data(size, 2);
+    char *new = malloc(size + 10);
+
+    (void) state;
+
+    /* a few bytes changed in the middle of a block */
+    memcpy(new, old, size);
+    memcpy(new + 50 * BS + 100, "changed", 7);
+    assert_int_equal(delta(old, size, new, size, NULL), BS);
+
+    /* bytes inserted, everything after them moved */
+    memcpy(new, old, 30 * BS);
+    memcpy(new + 30 * BS, "inserted!!", 10);
+    memcpy(new + 30 * BS + 10, old + 30 * BS, size - 30 * BS);
+    assert_int_equal(delta(old, size, new, size + 10, NULL), 10);
+
+    /* bytes removed */
+    memcpy(new, old, 30 * BS);
+    memcpy(new + 30 * BS, old + 30 * BS + 10, size - 30 * BS - 10);
+    assert_int_equal(delta(old, size, new, size - 10, NULL), BS - 10);
+
+    free(old);
+    free(new);
+}
+
+static void check_csync_delta_different(void **state)
+{
+    size_t size = 20 * BS + 5;
+    char *old = random_data(size, 3);
+    char *new = random_data(size, 4);
+
+    (void) state;
+
+    assert_int_equal(delta(old, size, new, size, NULL), size);
+
+    /* an old version smaller than a block has no blocks */
+    assert_int_equal(delta(old, 100, new, size, NULL), size);
+    assert_int_equal(delta(old, size, new, 0, NULL), 0);
+
+    free(old);
+    free(new);
+}
+
+static void check_csync_delta_repeated(void **state)
+{
+    size_t size = 40 * BS;
+    char *old = calloc(1, size);
+    int copies = 0;
+
+    (void) state;
+
+    /* blocks with the same contents are still copied in one piece */
+    assert_non_null(old);
+    assert_int_equal(delta(old, size, old, size, &copies), 0);
+    assert_int_equal(copies, 1);
+
+    free(old);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test(check_csync_delta_block_size),
+        unit_test(check_csync_delta_same),
+        unit_test(check_csync_delta_changed),
+        unit_test(check_csync_delta_different),
+        unit_test(check_csync_delta_repeated),
+    };
+
+    return run_tests(tests);
+}
@@ -100,12 +100,93 @@ static void check_csync_excluded(void **state)
     assert_int_equal(rc, 1);
 }
 
+/* the matching of the exclude list before it got compiled */
+static int excluded_fnmatch(CSYNC *csync, const char *path)
+{
+    char *bname;
+    size_t i;
+    int match = 0;
+
+    bname = c_basename(path);
+    assert_non_null(bname);
+    for (i = 0; i < csync->excludes->count; i++) {
+        if (csync_fnmatch(csync->excludes->vector[i], path, 0) == 0 ||
+            csync_fnmatch(csync->excludes->vector[i], bname, 0) == 0) {
+            match = 1;
+        }
+    }
+    free(bname);
+
+    return match;
+}
+
+static void check_csync_excluded_compiled(void **state)
+{
+    CSYNC *csync = *state;
+    const char *patterns[] = {
+        "core", "*.o", "*~", "#*#", ".*.swp", "*.tar.gz", "Thumbs.db",
+        "build*", "tmp/*", "*/cache/*", "a*b*c", "*", "file?.txt",
+        "[Dd]esktop.ini", "lit\\*", "*\\*x", "dir/sub", "**.bak", "*.*.*",
+        NULL
+    };
+    const char *paths[] = {
+        "core", "src/core", "score", "main.o", "src/main.o", "main.obj",
+        "notes~", "#buffer#", ".file.swp", "file.swp", "x.tar.gz",
+        "dir/x.tar.gz", "tar.gz", "Thumbs.db", "a/Thumbs.db", "build",
+        "build-dir/file", "rebuild", "tmp/x", "tmp", "x/tmp/y",
+        "x/cache/y", "cache/y", "aXbYc", "abc", "ab", "acb", "file1.txt",
+        "a/file22.txt", "desktop.ini", "Desktop.ini", "lit*", "litx",
+        "a*x", "ax", "dir/sub", "x/dir/sub", "dir/sub/x", "y.bak", "a.b.c",
+        "a.b", "", "trailing/", "x/trailing/", NULL
+    };
+    int i, j;
+
+    /* paths with wildcards would be excluded anyway */
+    csync->options.unix_extensions = 1;
+
+    for (i = 0; patterns[i] != NULL; i++) {
+        int rc;
+
+        /* start with a single pattern, then all of them together */
+        c_strlist_destroy(csync->excludes);
+        csync->excludes = NULL;
+        rc = _csync_exclude_add(csync, patterns[i]);
+        assert_int_equal(rc, 0);
+        _csync_exclude_matcher_free(csync->exclude_matcher);
+        csync->exclude_matcher = _csync_exclude_compile(csync->excludes);
+        assert_non_null(csync->exclude_matcher);
+
+        for (j = 0; paths[j] != NULL; j++) {
+            assert_int_equal(csync_excluded(csync, paths[j]),
+                             excluded_fnmatch(csync, paths[j]));
+        }
+    }
+
+    c_strlist_destroy(csync->excludes);
+    csync->excludes = NULL;
+    for (i = 0; patterns[i] != NULL; i++) {
+        /* the catch-all would hide everything else */
+        if (strcmp(patterns[i], "*") != 0) {
+            _csync_exclude_add(csync, patterns[i]);
+        }
+    }
+    _csync_exclude_matcher_free(csync->exclude_matcher);
+    csync->exclude_matcher = _csync_exclude_compile(csync->excludes);
+    assert_non_null(csync->exclude_matcher);
+
+    for (j = 0; paths[j] != NULL; j++) {
+        assert_int_equal(csync_excluded(csync, paths[j]),
+                         excluded_fnmatch(csync, paths[j]));
+    }
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test_setup_teardown(check_csync_exclude_add, setup, teardown),
         unit_test_setup_teardown(check_csync_exclude_load, setup, teardown),
         unit_test_setup_teardown(check_csync_excluded, setup_init, teardown),
+        unit_test_setup_teardown(check_csync_excluded_compiled, setup, teardown),
     };
 
     return run_tests(tests);
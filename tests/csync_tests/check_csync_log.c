@@ -1,6 +1,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "torture.h"
 
@@ -124,12 +127,75 @@ static void check_logging(void **state)
     assert_int_equal(rc, 0);
 }
 
+#ifdef HAVE_PTHREAD
+static int log_cb_inside;
+static int log_cb_overlaps;
+static int log_cb_calls;
+
+static void check_log_count_callback(int verbosity,
+                                     const char *function,
+                                     const char *buffer,
+                                     void *userdata)
+{
+    (void) verbosity;
+    (void) function;
+    (void) buffer;
+    (void) userdata;
+
+    if (log_cb_inside++ != 0) {
+        log_cb_overlaps++;
+    }
+    usleep(10);
+    log_cb_calls++;
+    log_cb_inside--;
+}
+
+static void *check_log_thread(void *arg)
+{
+    int i;
+
+    (void) arg;
+
+    csync_set_log_level(1);
+    csync_set_log_callback(check_log_count_callback);
+
+    for (i = 0; i < 100; i++) {
+        csync_log(1, __func__, "i = %d", i);
+    }
+
+    return NULL;
+}
+
+static void check_logging_threads(void **state)
+{
+    pthread_t threads[4];
+    int i;
+    int rc;
+
+    (void) state; /* unused */
+
+    for (i = 0; i < 4; i++) {
+        rc = pthread_create(&threads[i], NULL, check_log_thread, NULL);
+        assert_int_equal(rc, 0);
+    }
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    assert_int_equal(log_cb_overlaps, 0);
+    assert_int_equal(log_cb_calls, 400);
+}
+#endif
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test(check_set_log_level),
         unit_test(check_set_auth_callback),
         unit_test_setup_teardown(check_logging, setup, teardown),
+#ifdef HAVE_PTHREAD
+        unit_test(check_logging_threads),
+#endif
     };
 
     return run_tests(tests);
@@ -0,0 +1,143 @@
+#include <errno.h>
+#include <stdio.h>
+
+#include "torture.h"
+
+#include "c_jhash.h"
+#include "csync_path.h"
+
+static void setup(void **state)
+{
+    csync_path_pool_t *pool;
+
+    pool = csync_path_pool_new();
+    assert_non_null(pool);
+
+    *state = pool;
+}
+
+static void teardown(void **state)
+{
+    csync_path_pool_free(*state);
+    *state = NULL;
+}
+
+static void check_csync_path_get(void **state)
+{
+    csync_path_pool_t *pool = *state;
+    const csync_path_t *a, *b, *top;
+    char *str;
+
+    a = csync_path_get(pool, 1, "dir/sub/a", 9);
+    assert_non_null(a);
+    assert_int_equal(a->phash, 1);
+    assert_int_equal(a->refcount, 1);
+    assert_string_equal(a->dir->path, "dir/sub");
+    assert_string_equal(a->name, "a");
+
+    /* the same path is stored once */
+    b = csync_path_get(pool, 1, "dir/sub/a", 9);
+    assert_true(a == b);
+    assert_int_equal(a->refcount, 2);
+    assert_int_equal(csync_path_pool_count(pool), 1);
+
+    b = csync_path_get(pool, 2, "dir/sub/b", 9);
+    assert_non_null(b);
+    assert_true(a->dir == b->dir);
+
+    top = csync_path_get(pool, 3, "top", 3);
+    assert_non_null(top);
+    assert_null(top->dir);
+    assert_int_equal(csync_path_len(top), 3);
+
+    str = csync_path_str(a);
+    assert_string_equal(str, "dir/sub/a");
+    SAFE_FREE(str);
+
+    assert_int_equal(csync_path_cmp(a, a), 0);
+    assert_true(csync_path_cmp(a, b) < 0);
+    assert_true(csync_path_cmp(top, a) > 0);
+}
+
+static void check_csync_path_is_below(void **state)
+{
+    csync_path_pool_t *pool = *state;
+    const csync_path_t *a, *dir, *sub, *su, *top;
+
+    a = csync_path_get(pool, 1, "dir/sub/a", 9);
+    dir = csync_path_get(pool, 2, "dir", 3);
+    sub = csync_path_get(pool, 3, "dir/sub", 7);
+    su = csync_path_get(pool, 4, "dir/su", 6);
+    top = csync_path_get(pool, 5, "top", 3);
+
+    assert_true(csync_path_is_below(a, dir));
+    assert_true(csync_path_is_below(a, sub));
+    assert_true(csync_path_is_below(sub, dir));
+    assert_false(csync_path_is_below(a, su));
+    assert_false(csync_path_is_below(dir, dir));
+    assert_false(csync_path_is_below(top, dir));
+    assert_false(csync_path_is_below(dir, sub));
+}
+
+static void check_csync_path_collision(void **state)
+{
+    csync_path_pool_t *pool = *state;
+    const csync_path_t *p;
+
+    p = csync_path_get(pool, 1, "a", 1);
+    assert_non_null(p);
+
+    errno = 0;
+    assert_null(csync_path_get(pool, 1, "b", 1));
+    assert_int_equal(errno, EEXIST);
+    assert_int_equal(p->refcount, 1);
+}
+
+static void check_csync_path_put(void **state)
+{
+    csync_path_pool_t *pool = *state;
+    const csync_path_t *paths[1000];
+    const csync_path_t *p;
+    char buf[64];
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        int len = snprintf(buf, sizeof(buf), "dir%d/file%d", i % 10, i);
+
+        paths[i] = csync_path_get(pool, c_jhash64((uint8_t *) buf, len, 0), buf, len);
+        assert_non_null(paths[i]);
+    }
+    assert_int_equal(csync_path_pool_count(pool), 1000);
+
+    p = csync_path_ref(pool, paths[0]);
+    assert_true(p == paths[0]);
+    csync_path_put(pool, paths[0]);
+    assert_int_equal(csync_path_pool_count(pool), 1000);
+
+    /* drop every other path, the rest has to stay reachable */
+    for (i = 0; i < 1000; i += 2) {
+        csync_path_put(pool, paths[i]);
+    }
+    assert_int_equal(csync_path_pool_count(pool), 500);
+
+    for (i = 1; i < 1000; i += 2) {
+        int len = snprintf(buf, sizeof(buf), "dir%d/file%d", i % 10, i);
+
+        p = csync_path_get(pool, c_jhash64((uint8_t *) buf, len, 0), buf, len);
+        assert_true(p == paths[i]);
+        assert_int_equal(p->refcount, 2);
+    }
+    assert_int_equal(csync_path_pool_count(pool), 500);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_path_get, setup, teardown),
+        unit_test_setup_teardown(check_csync_path_is_below, setup, teardown),
+        unit_test_setup_teardown(check_csync_path_collision, setup, teardown),
+        unit_test_setup_teardown(check_csync_path_put, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,300 @@
+#include "torture.h"
+
+#include "c_jhash.h"
+#include "csync_propagate.c"
+
+#define NJOBS 12
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct _csync_propagate_s *job_p;
+static csync_file_stat_t *job_st;
+static int job_started[NJOBS];
+static size_t job_finished;
+static int job_too_early;
+static int job_fail = -1;
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    job_st = c_malloc(NJOBS * sizeof(csync_file_stat_t));
+    assert_non_null(job_st);
+    memset(job_started, 0, sizeof(job_started));
+    job_finished = 0;
+    job_too_early = 0;
+    job_fail = -1;
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    SAFE_FREE(job_st);
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    rc = system("rm -rf /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+/* Records the start of a job and checks its barrier has been reached */
+static int record_job(CSYNC *ctx, csync_file_stat_t *st)
+{
+    size_t i = st - job_st;
+    size_t j;
+
+    pthread_mutex_lock(&job_lock);
+    for (j = 0; j < job_p->njobs; j++) {
+        if (job_p->jobs[j].st == st && job_finished < job_p->jobs[j].barrier) {
+            job_too_early++;
+        }
+    }
+    job_started[i]++;
+    pthread_mutex_unlock(&job_lock);
+
+    /* give the other workers a chance to overtake */
+    usleep(2000);
+
+    if ((int) i == job_fail) {
+        ctx->status_code = CSYNC_STATUS_PROPAGATE_ERROR;
+        return -1;
+    }
+
+    pthread_mutex_lock(&job_lock);
+    job_finished++;
+    pthread_mutex_unlock(&job_lock);
+
+    return 0;
+}
+
+/* Three stages of 3, 6 and 3 jobs, the last one in two depths */
+static void add_jobs(struct _csync_propagate_s *p, CSYNC *csync)
+{
+    size_t barrier[NJOBS] = { 0, 0, 0, 3, 3, 3, 3, 3, 3, 9, 9, 11 };
+    int i;
+    int rc;
+
+    ZERO_STRUCTP(p);
+    p->ctx = csync;
+    job_p = p;
+    for (i = 0; i < NJOBS; i++) {
+        rc = _csync_propagate_add(p, &job_st[i], record_job, barrier[i]);
+        assert_int_equal(rc, 0);
+    }
+}
+
+static csync_file_stat_t *add_entry(CSYNC *csync, const char *path, int type,
+                                    enum csync_instructions_e instruction)
+{
+    csync_file_stat_t *st;
+    size_t len = strlen(path);
+
+    st = csync_file_stat_new(csync, c_jhash64((uint8_t *) path, len, 0),
+                             path, len);
+    assert_non_null(st);
+    st->type = type;
+    st->instruction = instruction;
+
+    return st;
+}
+
+static void check_csync_propagate_stages(void **state)
+{
+    CSYNC *csync = *state;
+    struct _csync_propagate_s p;
+    csync_file_stat_t *st[6];
+    size_t i;
+    int rc;
+
+    csync->current = LOCAL_REPLICA;
+    st[0] = add_entry(csync, "a/b", CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NEW);
+    st[1] = add_entry(csync, "a/b/f", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NEW);
+    st[2] = add_entry(csync, "c", CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_SYNC);
+    st[3] = add_entry(csync, "a", CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NEW);
+    st[4] = add_entry(csync, "x", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_REMOVE);
+    st[5] = add_entry(csync, "y", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE);
+
+    ZERO_STRUCT(p);
+    for (i = 0; i < 6; i++) {
+        rc = _csync_propagate_collect(st[i], &p);
+        assert_int_equal(rc, 0);
+    }
+    rc = _csync_propagate_stages(&p);
+    assert_int_equal(rc, 0);
+    assert_int_equal(p.njobs, 7);
+
+    /* the new directories, parents first */
+    assert_true(p.jobs[0].st == st[3]);
+    assert_int_equal(p.jobs[0].barrier, 0);
+    assert_true(p.jobs[1].st == st[0]);
+    assert_int_equal(p.jobs[1].barrier, 1);
+
+    /* the files once all directories exist */
+    for (i = 2; i < 4; i++) {
+        assert_true(p.jobs[i].st == st[1] || p.jobs[i].st == st[4]);
+        assert_int_equal(p.jobs[i].barrier, 2);
+    }
+
+    /* the directory attributes, children first */
+    assert_true(p.jobs[4].st == st[0]);
+    assert_int_equal(p.jobs[4].barrier, 4);
+    for (i = 5; i < 7; i++) {
+        assert_true(p.jobs[i].st == st[2] || p.jobs[i].st == st[3]);
+        assert_int_equal(p.jobs[i].barrier, 5);
+    }
+
+    SAFE_FREE(p.jobs);
+    SAFE_FREE(p.dirs);
+}
+
+static void check_csync_propagate_run_stages(void **state)
+{
+    CSYNC *csync = *state;
+    struct _csync_propagate_s p;
+    int i;
+    int rc;
+
+    add_jobs(&p, csync);
+
+    rc = _csync_propagate_run(&p, 4);
+    assert_int_equal(rc, 0);
+    assert_int_equal(job_too_early, 0);
+    assert_int_equal(job_finished, NJOBS);
+    for (i = 0; i < NJOBS; i++) {
+        assert_int_equal(job_started[i], 1);
+    }
+
+    SAFE_FREE(p.jobs);
+}
+
+static void check_csync_propagate_run_error(void **state)
+{
+    CSYNC *csync = *state;
+    struct _csync_propagate_s p;
+    int i;
+    int rc;
+
+    add_jobs(&p, csync);
+
+    /* a failed file stops the run before the directories are finished */
+    job_fail = 5;
+    rc = _csync_propagate_run(&p, 4);
+    assert_int_equal(rc, -1);
+    assert_int_equal(csync->status_code, CSYNC_STATUS_PROPAGATE_ERROR);
+    assert_int_equal(job_too_early, 0);
+    for (i = 0; i < 3; i++) {
+        assert_int_equal(job_started[i], 1);
+    }
+    for (i = 9; i < NJOBS; i++) {
+        assert_int_equal(job_started[i], 0);
+    }
+
+    SAFE_FREE(p.jobs);
+}
+
+static void check_csync_propagate_run_threads(void **state)
+{
+    CSYNC *csync = *state;
+    struct _csync_propagate_s p;
+    int rc;
+
+    /* never more workers than jobs */
+    csync->options.propagation_threads = 8;
+    assert_int_equal(_csync_propagate_threads(csync, 3), 3);
+    assert_int_equal(_csync_propagate_threads(csync, 0), 1);
+    assert_int_equal(_csync_propagate_threads(csync, 20), 8);
+
+    /* a module without a session per worker gets one */
+    csync->remote.type = REMOTE_REPLICA;
+    csync->module.capabilities.concurrent_session_support = false;
+    assert_int_equal(_csync_propagate_threads(csync, 20), 1);
+    csync->module.capabilities.concurrent_session_support = true;
+    assert_int_equal(_csync_propagate_threads(csync, 20), 8);
+    csync->remote.type = LOCAL_REPLICA;
+
+    /* more workers than jobs wait for the barriers as well */
+    add_jobs(&p, csync);
+    rc = _csync_propagate_run(&p, NJOBS + 4);
+    assert_int_equal(rc, 0);
+    assert_int_equal(job_too_early, 0);
+    assert_int_equal(job_finished, NJOBS);
+
+    SAFE_FREE(p.jobs);
+}
+
+static void check_csync_transfer_verify(void **state)
+{
+    CSYNC *csync = *state;
+    csync_transfer_t *t;
+    csync_vio_handle_t *fh;
+    const char data[] = "the copied part and the rest";
+    int rc;
+
+    t = csync_statedb_transfer_new("/tmp/check_csync2/file.abcdef");
+    assert_non_null(t);
+    t->offset = 15;
+    t->checksum = csync_delta_hash(CSYNC_DELTA_HASH_INIT, data, 15);
+
+    csync->buffers = csync_buffer_pool_new(4096, 4096);
+    assert_non_null(csync->buffers);
+    csync->replica = LOCAL_REPLICA;
+    fh = csync_vio_creat(csync, t->tmpname, 0644);
+    assert_non_null(fh);
+    assert_int_equal(csync_vio_write(csync, fh, data, sizeof(data)), sizeof(data));
+    assert_int_equal(csync_vio_close(csync, fh), 0);
+
+    fh = csync_vio_open(csync, t->tmpname, O_RDWR, 0);
+    assert_non_null(fh);
+    rc = _csync_transfer_verify(csync, t, fh);
+    assert_int_equal(rc, 0);
+
+    /* a byte of the copied part changed */
+    assert_int_equal(csync_vio_lseek(csync, fh, 4, SEEK_SET), 4);
+    assert_int_equal(csync_vio_write(csync, fh, "X", 1), 1);
+    rc = _csync_transfer_verify(csync, t, fh);
+    assert_int_equal(rc, -1);
+
+    /* the file is shorter than the copied part */
+    t->offset = sizeof(data) + 1;
+    rc = _csync_transfer_verify(csync, t, fh);
+    assert_int_equal(rc, -1);
+
+    assert_int_equal(csync_vio_close(csync, fh), 0);
+    csync_buffer_pool_free(csync->buffers);
+    csync->buffers = NULL;
+    free(t);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_propagate_stages, setup, teardown),
+        unit_test_setup_teardown(check_csync_propagate_run_stages, setup, teardown),
+        unit_test_setup_teardown(check_csync_propagate_run_error, setup, teardown),
+        unit_test_setup_teardown(check_csync_propagate_run_threads, setup, teardown),
+        unit_test_setup_teardown(check_csync_transfer_verify, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
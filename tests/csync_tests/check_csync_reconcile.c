@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "c_jhash.h"
+#include "csync_path.h"
+#include "csync_reconcile.h"
+#include "csync_util.h"
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+
+    csync = c_malloc(sizeof(CSYNC));
+    assert_non_null(csync);
+
+    csync->local.arena = c_arena_new(0);
+    csync->remote.arena = c_arena_new(0);
+    csync->local.tree = c_hash_new(0);
+    csync->remote.tree = c_hash_new(0);
+    csync->paths = csync_path_pool_new();
+    assert_non_null(csync->paths);
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+
+    c_hash_free(csync->local.tree);
+    c_hash_free(csync->remote.tree);
+    c_arena_free(csync->local.arena);
+    c_arena_free(csync->remote.arena);
+    csync_path_pool_free(csync->paths);
+    SAFE_FREE(csync);
+
+    *state = NULL;
+}
+
+static csync_file_stat_t *add_entry(CSYNC *csync, enum csync_replica_e replica,
+                                    const char *path,
+                                    enum csync_instructions_e instruction,
+                                    time_t modtime)
+{
+    csync_file_stat_t *st;
+    size_t len = strlen(path);
+    int rc;
+
+    csync->current = replica;
+    st = csync_file_stat_new(csync, c_jhash64((uint8_t *) path, len, 0),
+                             path, len);
+    assert_non_null(st);
+    st->instruction = instruction;
+    st->modtime = modtime;
+    st->type = CSYNC_FTW_TYPE_FILE;
+
+    if (replica == LOCAL_REPLICA) {
+        rc = c_hash_insert(csync->local.tree, st->phash, st);
+    } else {
+        rc = c_hash_insert(csync->remote.tree, st->phash, st);
+    }
+    assert_int_equal(rc, 0);
+
+    return st;
+}
+
+static csync_file_stat_t *add_rename(CSYNC *csync, const char *path,
+                                     const char *old_path, int type)
+{
+    csync_file_stat_t *st;
+    size_t len = strlen(old_path);
+
+    st = add_entry(csync, LOCAL_REPLICA, path, CSYNC_INSTRUCTION_RENAME, 1);
+    st->type = type;
+    st->old_path = csync_path_get(csync->paths,
+                                  c_jhash64((uint8_t *) old_path, len, 0),
+                                  old_path, len);
+    assert_non_null(st->old_path);
+
+    return st;
+}
+
+static void check_csync_reconcile_one_side(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *modified, *unchanged, *renamed, *added;
+    int rc;
+
+    modified = add_entry(csync, LOCAL_REPLICA, "modified", CSYNC_INSTRUCTION_EVAL, 1);
+    unchanged = add_entry(csync, LOCAL_REPLICA, "unchanged", CSYNC_INSTRUCTION_NONE, 1);
+    renamed = add_entry(csync, LOCAL_REPLICA, "renamed", CSYNC_INSTRUCTION_RENAME, 1);
+    added = add_entry(csync, REMOTE_REPLICA, "added", CSYNC_INSTRUCTION_NEW, 1);
+
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(modified->instruction, CSYNC_INSTRUCTION_NEW);
+    assert_int_equal(unchanged->instruction, CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(renamed->instruction, CSYNC_INSTRUCTION_NEW);
+    assert_int_equal(added->instruction, CSYNC_INSTRUCTION_NEW);
+}
+
+static void check_csync_reconcile_both_sides(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *l[4], *r[4];
+    int rc;
+
+    /* new on both, the local file is newer */
+    l[0] = add_entry(csync, LOCAL_REPLICA, "new", CSYNC_INSTRUCTION_NEW, 2);
+    r[0] = add_entry(csync, REMOTE_REPLICA, "new", CSYNC_INSTRUCTION_NEW, 1);
+    /* modified on both at the same time, the remote pass sees the result */
+    l[1] = add_entry(csync, LOCAL_REPLICA, "eval", CSYNC_INSTRUCTION_EVAL, 1);
+    r[1] = add_entry(csync, REMOTE_REPLICA, "eval", CSYNC_INSTRUCTION_EVAL, 1);
+    /* new locally, unchanged on the remote */
+    l[2] = add_entry(csync, LOCAL_REPLICA, "sync", CSYNC_INSTRUCTION_NEW, 1);
+    r[2] = add_entry(csync, REMOTE_REPLICA, "sync", CSYNC_INSTRUCTION_NONE, 1);
+    /* unchanged on both */
+    l[3] = add_entry(csync, LOCAL_REPLICA, "none", CSYNC_INSTRUCTION_NONE, 1);
+    r[3] = add_entry(csync, REMOTE_REPLICA, "none", CSYNC_INSTRUCTION_NONE, 1);
+
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(l[0]->instruction, CSYNC_INSTRUCTION_SYNC);
+    assert_int_equal(r[0]->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(l[1]->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(r[1]->instruction, CSYNC_INSTRUCTION_SYNC);
+    assert_int_equal(l[2]->instruction, CSYNC_INSTRUCTION_SYNC);
+    assert_int_equal(r[2]->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(l[3]->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(r[3]->instruction, CSYNC_INSTRUCTION_NONE);
+}
+
+static void check_csync_reconcile_rename(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *moved, *old, *modified, *changed;
+
+    /* renamed locally, unchanged at the old path on the remote */
+    moved = add_entry(csync, LOCAL_REPLICA, "moved", CSYNC_INSTRUCTION_RENAME, 1);
+    moved->old_path = csync_path_get(csync->paths,
+                                     c_jhash64((uint8_t *) "old", 3, 0), "old", 3);
+    old = add_entry(csync, REMOTE_REPLICA, "old", CSYNC_INSTRUCTION_NONE, 1);
+    /* renamed locally, modified at the old path on the remote */
+    modified = add_entry(csync, LOCAL_REPLICA, "modified", CSYNC_INSTRUCTION_RENAME, 1);
+    modified->old_path = csync_path_get(csync->paths,
+                                        c_jhash64((uint8_t *) "changed", 7, 0),
+                                        "changed", 7);
+    changed = add_entry(csync, REMOTE_REPLICA, "changed", CSYNC_INSTRUCTION_EVAL, 2);
+
+    assert_int_equal(csync_reconcile_updates(csync), 0);
+
+    assert_int_equal(moved->instruction, CSYNC_INSTRUCTION_RENAME);
+    assert_int_equal(old->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(modified->instruction, CSYNC_INSTRUCTION_NEW);
+    assert_int_equal(changed->instruction, CSYNC_INSTRUCTION_NEW);
+}
+
+static void check_csync_reconcile_rename_dir(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *dir, *moved, *modified, *old, *old_moved, *old_modified;
+
+    dir = add_rename(csync, "new", "old", CSYNC_FTW_TYPE_DIR);
+    moved = add_rename(csync, "new/moved", "old/moved", CSYNC_FTW_TYPE_FILE);
+    modified = add_entry(csync, LOCAL_REPLICA, "new/modified",
+                         CSYNC_INSTRUCTION_RENAME, 2);
+    old = add_entry(csync, REMOTE_REPLICA, "old", CSYNC_INSTRUCTION_NONE, 1);
+    old->type = CSYNC_FTW_TYPE_DIR;
+    old_moved = add_entry(csync, REMOTE_REPLICA, "old/moved",
+                          CSYNC_INSTRUCTION_NONE, 1);
+    old_modified = add_entry(csync, REMOTE_REPLICA, "old/modified",
+                             CSYNC_INSTRUCTION_NONE, 1);
+
+    assert_int_equal(csync_reconcile_updates(csync), 0);
+
+    /* one move, the modified file is transferred on top */
+    assert_int_equal(dir->instruction, CSYNC_INSTRUCTION_RENAME);
+    assert_int_equal(moved->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(modified->instruction, CSYNC_INSTRUCTION_NEW);
+    assert_int_equal(old->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(old_moved->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(old_modified->instruction, CSYNC_INSTRUCTION_NONE);
+}
+
+static void check_csync_reconcile_rename_dir_removed(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *dir, *moved, *old, *old_moved, *old_removed;
+
+    dir = add_rename(csync, "new", "old", CSYNC_FTW_TYPE_DIR);
+    moved = add_rename(csync, "new/moved", "old/moved", CSYNC_FTW_TYPE_FILE);
+    old = add_entry(csync, REMOTE_REPLICA, "old", CSYNC_INSTRUCTION_NONE, 1);
+    old->type = CSYNC_FTW_TYPE_DIR;
+    old_moved = add_entry(csync, REMOTE_REPLICA, "old/moved",
+                          CSYNC_INSTRUCTION_NONE, 1);
+    /* removed locally, the directory is moved file by file */
+    old_removed = add_entry(csync, REMOTE_REPLICA, "old/removed",
+                            CSYNC_INSTRUCTION_NONE, 1);
+
+    assert_int_equal(csync_reconcile_updates(csync), 0);
+
+    assert_int_equal(dir->instruction, CSYNC_INSTRUCTION_NEW);
+    assert_int_equal(moved->instruction, CSYNC_INSTRUCTION_RENAME);
+    assert_int_equal(old->instruction, CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(old_moved->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(old_removed->instruction, CSYNC_INSTRUCTION_REMOVE);
+}
+
+static void check_csync_reconcile_threads(void **state)
+{
+    CSYNC *csync = *state;
+    char path[32];
+    size_t n;
+    int rc;
+    int i;
+
+    /* enough records for more than one thread */
+    for (i = 0; i < 20000; i++) {
+        snprintf(path, sizeof(path), "file%d", i);
+        add_entry(csync, LOCAL_REPLICA, path, CSYNC_INSTRUCTION_EVAL, 2);
+        if (i % 2 == 0) {
+            add_entry(csync, REMOTE_REPLICA, path, CSYNC_INSTRUCTION_NONE, 1);
+        }
+    }
+    csync->options.reconcile_threads = 4;
+
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+
+    for (n = 0; n < c_hash_size(csync->local.tree); n++) {
+        csync_file_stat_t *st = c_hash_at(csync->local.tree, n);
+
+        if (n % 2 == 0) {
+            assert_int_equal(st->instruction, CSYNC_INSTRUCTION_SYNC);
+        } else {
+            assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
+        }
+    }
+    for (n = 0; n < c_hash_size(csync->remote.tree); n++) {
+        csync_file_stat_t *st = c_hash_at(csync->remote.tree, n);
+
+        assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NONE);
+    }
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_reconcile_one_side, setup, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_both_sides, setup, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_rename, setup, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_rename_dir, setup, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_rename_dir_removed, setup, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_threads, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
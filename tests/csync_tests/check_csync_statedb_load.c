@@ -132,12 +132,46 @@ static void check_csync_statedb_close(void **state)
     c_free_locale_string(testdb);
 }
 
+static void check_csync_statedb_load_transfers(void **state)
+{
+    CSYNC *csync = *state;
+    csync_transfer_t *t;
+    int rc;
+
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+
+    t = csync_statedb_transfer_new("/tmp/check_csync2/file.abcdef");
+    assert_non_null(t);
+    t->phash = 42;
+    t->offset = 4096;
+    rc = csync_statedb_set_transfer(csync->statedb.db, t);
+    assert_int_equal(rc, 0);
+    free(t);
+
+    /* the run didn't finish, the statedb is not written */
+    rc = csync_statedb_close(TESTDB, csync->statedb.db, 0);
+    assert_int_equal(rc, 0);
+
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+
+    t = csync_statedb_get_transfer(csync->statedb.db, 42);
+    assert_non_null(t);
+    assert_int_equal(t->offset, 4096);
+    free(t);
+
+    rc = csync_statedb_close(TESTDB, csync->statedb.db, 0);
+    assert_int_equal(rc, 0);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test_setup_teardown(check_csync_statedb_check, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_load, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_close, setup, teardown),
+        unit_test_setup_teardown(check_csync_statedb_load_transfers, setup, teardown),
     };
 
     return run_tests(tests);
@@ -215,10 +215,10 @@ static void check_csync_statedb_insert_metadata(void **state)
     assert_int_equal(rc, 0);
 
     for (i = 0; i < 100; i++) {
-        st = c_malloc(sizeof(csync_file_stat_t));
+        st = c_arena_alloc(csync->local.arena, sizeof(csync_file_stat_t));
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_hash_insert(csync->local.tree, st->phash, st);
         assert_int_equal(rc, 0);
     }
 
@@ -233,10 +233,10 @@ static void check_csync_statedb_write(void **state)
     int i, rc;
 
     for (i = 0; i < 100; i++) {
-        st = c_malloc(sizeof(csync_file_stat_t));
+        st = c_arena_alloc(csync->local.arena, sizeof(csync_file_stat_t));
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_hash_insert(csync->local.tree, st->phash, st);
         assert_int_equal(rc, 0);
     }
 
@@ -249,13 +249,16 @@ static void check_csync_statedb_get_stat_by_hash(void **state)
     CSYNC *csync = *state;
     csync_file_stat_t *tmp;
 
-    tmp = csync_statedb_get_stat_by_hash(csync->statedb.db, (uint64_t) 42);
+    tmp = csync_statedb_get_stat_by_hash(csync->statedb.db, csync->paths, (uint64_t) 42);
     assert_non_null(tmp);
 
     assert_int_equal(tmp->phash, 42);
     assert_int_equal(tmp->inode, 23);
+    assert_int_equal(csync_path_pool_count(csync->paths), 1);
 
-    free(tmp);
+    /* the path is dropped with the record */
+    csync_statedb_stat_free(csync->paths, tmp);
+    assert_int_equal(csync_path_pool_count(csync->paths), 0);
 }
 
 static void check_csync_statedb_get_stat_by_hash_not_found(void **state)
@@ -263,10 +266,8 @@ static void check_csync_statedb_get_stat_by_hash_not_found(void **state)
     CSYNC *csync = *state;
     csync_file_stat_t *tmp;
 
-    tmp = csync_statedb_get_stat_by_hash(csync->statedb.db, (uint64_t) 666);
+    tmp = csync_statedb_get_stat_by_hash(csync->statedb.db, csync->paths, (uint64_t) 666);
     assert_null(tmp);
-
-    free(tmp);
 }
 
 static void check_csync_statedb_get_stat_by_inode(void **state)
@@ -274,13 +275,13 @@ static void check_csync_statedb_get_stat_by_inode(void **state)
     CSYNC *csync = *state;
     csync_file_stat_t *tmp;
 
-    tmp = csync_statedb_get_stat_by_inode(csync->statedb.db, (ino_t) 23);
+    tmp = csync_statedb_get_stat_by_inode(csync->statedb.db, csync->paths, (ino_t) 23);
     assert_non_null(tmp);
 
     assert_int_equal(tmp->phash, 42);
     assert_int_equal(tmp->inode, 23);
 
-    free(tmp);
+    csync_statedb_stat_free(csync->paths, tmp);
 }
 
 static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
@@ -288,10 +289,329 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     CSYNC *csync = *state;
     csync_file_stat_t *tmp;
 
-    tmp = csync_statedb_get_stat_by_inode(csync->statedb.db, (ino_t) 666);
+    tmp = csync_statedb_get_stat_by_inode(csync->statedb.db, csync->paths, (ino_t) 666);
     assert_null(tmp);
 }
 
+static void check_csync_statedb_prepare_cached(void **state)
+{
+    CSYNC *csync = *state;
+    sqlite3_stmt *stmt1;
+    sqlite3_stmt *stmt2;
+
+    stmt1 = csync_statedb_prepare(csync->statedb.db, "SELECT * FROM metadata WHERE phash=?1;");
+    assert_non_null(stmt1);
+    stmt2 = csync_statedb_prepare(csync->statedb.db, "SELECT * FROM metadata WHERE phash=?1;");
+    assert_true(stmt1 == stmt2);
+
+    stmt2 = csync_statedb_prepare(csync->statedb.db, "SELECT;");
+    assert_null(stmt2);
+
+    /* a statement which is stepped is not handed out again */
+    stmt1 = csync_statedb_prepare(csync->statedb.db, "SELECT 1 UNION ALL SELECT 2;");
+    assert_non_null(stmt1);
+    assert_int_equal(sqlite3_step(stmt1), SQLITE_ROW);
+    stmt2 = csync_statedb_prepare(csync->statedb.db, "SELECT 1 UNION ALL SELECT 2;");
+    assert_non_null(stmt2);
+    assert_false(stmt1 == stmt2);
+    assert_int_equal(sqlite3_step(stmt1), SQLITE_ROW);
+    assert_int_equal(sqlite3_column_int(stmt1, 0), 2);
+    sqlite3_reset(stmt1);
+    assert_true(csync_statedb_prepare(csync->statedb.db, "SELECT 1 UNION ALL SELECT 2;") == stmt1);
+
+    assert_int_equal(csync_statedb_exec(csync->statedb.db, "SELECT * FROM metadata;"), 0);
+    assert_int_equal(csync_statedb_exec(csync->statedb.db, "SELECT;"), -1);
+}
+
+static void check_csync_statedb_get_stat_by_hash_large(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *tmp;
+    char *stmt = NULL;
+    uint64_t phash = 16651456550501600000ULL;
+
+    stmt = sqlite3_mprintf("INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES"
+        "(%lld, %d, '%q', %d, %d, %d, %d, %d);",
+        (long long int) phash,
+        4,
+        "file",
+        24,
+        42,
+        42,
+        42,
+        42);
+    csync_statedb_insert(csync->statedb.db, stmt);
+    sqlite3_free(stmt);
+
+    tmp = csync_statedb_get_stat_by_hash(csync->statedb.db, csync->paths, phash);
+    assert_non_null(tmp);
+    assert_true(tmp->phash == phash);
+    assert_string_equal(tmp->path->name, "file");
+    csync_statedb_stat_free(csync->paths, tmp);
+
+    tmp = csync_statedb_get_stat_by_inode(csync->statedb.db, csync->paths, (ino_t) 24);
+    assert_non_null(tmp);
+    assert_true(tmp->phash == phash);
+    csync_statedb_stat_free(csync->paths, tmp);
+}
+
+static void check_csync_statedb_get_below_path(void **state)
+{
+    CSYNC *csync = *state;
+    c_list_t *list = NULL;
+    c_list_t *it;
+    const char *paths[] = { "dir", "dir/a", "dir/b/c", "dir0", "dira", NULL };
+    char *stmt = NULL;
+    int i;
+    int rc;
+
+    for (i = 0; paths[i] != NULL; i++) {
+        stmt = sqlite3_mprintf("INSERT INTO metadata"
+            "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES"
+            "(%d, %d, '%q', %d, %d, %d, %d, %d);",
+            100 + i,
+            (int) strlen(paths[i]),
+            paths[i],
+            100 + i,
+            42,
+            42,
+            42,
+            42);
+        csync_statedb_insert(csync->statedb.db, stmt);
+        sqlite3_free(stmt);
+    }
+
+    rc = csync_statedb_get_below_path(csync->statedb.db, csync->paths, "dir", &list);
+    assert_int_equal(rc, 2);
+    for (it = list; it != NULL; it = c_list_next(it)) {
+        csync_file_stat_t *st = (csync_file_stat_t *) it->data;
+
+        char *path = csync_file_stat_path(st);
+
+        assert_true(strncmp(path, "dir/", 4) == 0);
+        free(path);
+        csync_statedb_stat_free(csync->paths, st);
+    }
+    c_list_free(list);
+
+    list = NULL;
+    rc = csync_statedb_get_below_path(csync->statedb.db, csync->paths, "dir/a", &list);
+    assert_int_equal(rc, 0);
+    assert_null(list);
+}
+
+static void check_csync_statedb_value(void **state)
+{
+    CSYNC *csync = *state;
+    int64_t value = 0;
+    int rc;
+
+    rc = csync_statedb_get_value(csync->statedb.db, "test", &value);
+    assert_int_equal(rc, -1);
+
+    rc = csync_statedb_set_value(csync->statedb.db, "test", 23);
+    assert_int_equal(rc, 0);
+    rc = csync_statedb_set_value(csync->statedb.db, "test", 42);
+    assert_int_equal(rc, 0);
+
+    rc = csync_statedb_get_value(csync->statedb.db, "test", &value);
+    assert_int_equal(rc, 0);
+    assert_int_equal(value, 42);
+}
+
+static void add_local_entry(CSYNC *csync, const char *path,
+                            enum csync_instructions_e instruction)
+{
+    csync_file_stat_t *st;
+    size_t len = strlen(path);
+    int rc;
+
+    csync->current = LOCAL_REPLICA;
+    st = csync_file_stat_new(csync, c_jhash64((uint8_t *) path, len, 0),
+                             path, len);
+    assert_non_null(st);
+    st->instruction = instruction;
+
+    rc = c_hash_insert(csync->local.tree, st->phash, st);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_statedb_etags(void **state)
+{
+    CSYNC *csync = *state;
+    const char *dirs[] = { "a", "a/b", "c", "c/d", "gone", NULL };
+    c_list_t *list = NULL;
+    c_list_t *it;
+    char *etag;
+    int i;
+    int rc;
+
+    for (i = 0; dirs[i] != NULL; i++) {
+        csync_etag_t *e = csync_statedb_etag_new(dirs[i], "\"etag\"");
+
+        assert_non_null(e);
+        csync->remote.etags = c_list_prepend(csync->remote.etags, e);
+        if (!c_streq(dirs[i], "gone")) {
+            add_local_entry(csync, dirs[i], CSYNC_INSTRUCTION_NONE);
+        }
+    }
+    /* nothing above a failed entry may be stored */
+    add_local_entry(csync, "c/d/file", CSYNC_INSTRUCTION_ERROR);
+
+    rc = csync_statedb_insert_etags(csync, csync->statedb.db);
+    assert_int_equal(rc, 0);
+
+    etag = csync_statedb_get_etag(csync->statedb.db,
+                                  c_jhash64((uint8_t *) "a/b", 3, 0));
+    assert_string_equal(etag, "\"etag\"");
+    free(etag);
+
+    for (i = 2; dirs[i] != NULL; i++) {
+        etag = csync_statedb_get_etag(csync->statedb.db,
+            c_jhash64((uint8_t *) dirs[i], strlen(dirs[i]), 0));
+        assert_null(etag);
+    }
+
+    rc = csync_statedb_get_etags_below_path(csync->statedb.db, "a", &list);
+    assert_int_equal(rc, 1);
+    for (it = list; it != NULL; it = c_list_next(it)) {
+        csync_etag_t *e = (csync_etag_t *) it->data;
+
+        assert_string_equal(e->path, "a/b");
+        assert_string_equal(e->etag, "\"etag\"");
+        free(e);
+    }
+    c_list_free(list);
+}
+
+static void check_csync_statedb_transfer(void **state)
+{
+    CSYNC *csync = *state;
+    csync_transfer_t *t;
+    csync_transfer_t *r;
+    c_list_t *list = NULL;
+    c_list_t *it;
+    int rc;
+
+    assert_null(csync_statedb_get_transfer(csync->statedb.db, 42));
+
+    t = csync_statedb_transfer_new("/tmp/check_csync2/file.abcdef");
+    assert_non_null(t);
+    t->phash = 42;
+    t->replica = LOCAL_REPLICA;
+    t->size = 1LL << 36;
+    t->modtime = 1234;
+    t->inode = 23;
+
+    rc = csync_statedb_set_transfer(csync->statedb.db, t);
+    assert_int_equal(rc, 0);
+
+    /* the offset is updated while the file is copied */
+    t->offset = 1LL << 33;
+    t->checksum = 0xcbf29ce484222325ULL;
+    rc = csync_statedb_set_transfer(csync->statedb.db, t);
+    assert_int_equal(rc, 0);
+
+    r = csync_statedb_get_transfer(csync->statedb.db, 42);
+    assert_non_null(r);
+    assert_true(r->phash == 42);
+    assert_int_equal(r->replica, LOCAL_REPLICA);
+    assert_true(r->size == 1LL << 36);
+    assert_int_equal(r->modtime, 1234);
+    assert_int_equal(r->inode, 23);
+    assert_true(r->offset == 1LL << 33);
+    assert_true(r->checksum == 0xcbf29ce484222325ULL);
+    assert_string_equal(r->tmpname, "/tmp/check_csync2/file.abcdef");
+    free(r);
+
+    rc = csync_statedb_get_transfers(csync->statedb.db, &list);
+    assert_int_equal(rc, 1);
+    for (it = list; it != NULL; it = c_list_next(it)) {
+        r = (csync_transfer_t *) it->data;
+        assert_string_equal(r->tmpname, t->tmpname);
+        free(r);
+    }
+    c_list_free(list);
+
+    rc = csync_statedb_drop_transfer(csync->statedb.db, 42);
+    assert_int_equal(rc, 0);
+    assert_null(csync_statedb_get_transfer(csync->statedb.db, 42));
+
+    free(t);
+}
+
+static void check_csync_statedb_index_load(void **state)
+{
+    CSYNC *csync = *state;
+    csync_statedb_index_t *idx;
+    const csync_file_stat_t *st;
+
+    idx = csync_statedb_index_load(csync->statedb.db, csync->paths);
+    assert_non_null(idx);
+    assert_int_equal(csync_statedb_index_count(idx), 1);
+
+    st = csync_statedb_index_get_by_hash(idx, (uint64_t) 42);
+    assert_non_null(st);
+    assert_int_equal(st->phash, 42);
+    assert_int_equal(st->inode, 23);
+    assert_int_equal(st->modtime, 42);
+    assert_string_equal(st->path->name, "It's a rainy day");
+    /* a record of a tree gets the same path */
+    assert_true(csync_path_get(csync->paths, 42, "It's a rainy day", 16) == st->path);
+
+    st = csync_statedb_index_get_by_inode(idx, (ino_t) 23);
+    assert_non_null(st);
+    assert_int_equal(st->phash, 42);
+
+    assert_null(csync_statedb_index_get_by_hash(idx, (uint64_t) 666));
+    assert_null(csync_statedb_index_get_by_inode(idx, (ino_t) 666));
+
+    csync_statedb_index_free(idx);
+}
+
+static void check_csync_statedb_index_load_many(void **state)
+{
+    CSYNC *csync = *state;
+    csync_statedb_index_t *idx;
+    const csync_file_stat_t *st;
+    char *stmt = NULL;
+    uint64_t i;
+
+    for (i = 1; i <= 1000; i++) {
+        /* large hashes are stored as negative numbers */
+        stmt = sqlite3_mprintf("INSERT INTO metadata"
+            "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES"
+            "(%lld, %d, 'file%llu', %llu, %d, %d, %d, %d);",
+            (long long int) (i << 54),
+            8,
+            (long long unsigned int) i,
+            (long long unsigned int) (i + 100),
+            42,
+            42,
+            42,
+            42);
+        csync_statedb_insert(csync->statedb.db, stmt);
+        sqlite3_free(stmt);
+    }
+
+    idx = csync_statedb_index_load(csync->statedb.db, csync->paths);
+    assert_non_null(idx);
+    assert_int_equal(csync_statedb_index_count(idx), 1001);
+
+    for (i = 1; i <= 1000; i++) {
+        st = csync_statedb_index_get_by_hash(idx, i << 54);
+        assert_non_null(st);
+        assert_true(st->inode == (ino_t) (i + 100));
+
+        st = csync_statedb_index_get_by_inode(idx, (ino_t) (i + 100));
+        assert_non_null(st);
+        assert_true(st->phash == i << 54);
+    }
+
+    csync_statedb_index_free(idx);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -308,6 +628,14 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_prepare_cached, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_large, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_get_below_path, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_value, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_etags, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_transfer, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_index_load, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_index_load_many, setup_db, teardown),
     };
 
     return run_tests(tests);
@@ -157,6 +157,22 @@ static int failing_fn(CSYNC *ctx,
   return -1;
 }
 
+static int failing_msg_fn(CSYNC *ctx,
+                          const char *file,
+                          const csync_vio_file_stat_t *fs,
+                          enum csync_ftw_flags_e flag)
+{
+  (void) file;
+  (void) fs;
+  (void) flag;
+
+  if (ctx->error_string == NULL) {
+      ctx->error_string = c_strdup("walk failed");
+  }
+
+  return -1;
+}
+
 /* detect a new file */
 static void check_csync_detect_update(void **state)
 {
@@ -175,7 +191,7 @@ static void check_csync_detect_update(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hash_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -204,7 +220,7 @@ static void check_csync_detect_update_db_none(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hash_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -230,7 +246,7 @@ static void check_csync_detect_update_db_eval(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hash_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -279,7 +295,7 @@ static void check_csync_detect_update_db_rename(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to rename */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hash_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_RENAME);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -308,7 +324,7 @@ static void check_csync_detect_update_db_new(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hash_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -339,7 +355,7 @@ static void check_csync_detect_update_nlink(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to ignore */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hash_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_IGNORE);
 
     csync_vio_file_stat_destroy(fs);
@@ -369,6 +385,35 @@ static void check_csync_detect_update_null(void **state)
     csync_vio_file_stat_destroy(fs);
 }
 
+/* a path with the hash of another one is an error, not skipped */
+static void check_csync_detect_update_collision(void **state)
+{
+    CSYNC *csync = *state;
+    const csync_path_t *other;
+    csync_vio_file_stat_t *fs;
+    int rc;
+
+    other = csync_path_get(csync->paths,
+                           c_jhash64((uint8_t *) "file.txt", 8, 0),
+                           "other.txt", 9);
+    assert_non_null(other);
+
+    fs = create_fstat("file.txt", 0, 1, 0);
+    assert_non_null(fs);
+
+    rc = _csync_detect_update(csync,
+                              "/tmp/check_csync1/file.txt",
+                              fs,
+                              CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EEXIST);
+    assert_int_equal(csync->status_code, CSYNC_STATUS_UPDATE_ERROR);
+    assert_int_equal(c_hash_size(csync->local.tree), 0);
+
+    csync_path_put(csync->paths, other);
+    csync_vio_file_stat_destroy(fs);
+}
+
 static void check_csync_ftw(void **state)
 {
     CSYNC *csync = *state;
@@ -396,6 +441,312 @@ static void check_csync_ftw_failing_fn(void **state)
     assert_int_equal(rc, -1);
 }
 
+static void check_csync_ftw_parallel(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b/c /tmp/check_csync1/d");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/f1 /tmp/check_csync1/a/b/f2 "
+                "/tmp/check_csync1/a/b/c/f3 /tmp/check_csync1/d/f4");
+    assert_int_equal(rc, 0);
+
+    rc = csync_ftw_parallel(csync, "/tmp/check_csync1", csync_walker,
+                            MAX_DEPTH, 4);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->local.tree), 8);
+}
+
+static void check_csync_ftw_parallel_depth(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b /tmp/check_csync1/d");
+    assert_int_equal(rc, 0);
+
+    rc = csync_ftw_parallel(csync, "/tmp/check_csync1", csync_walker, 0, 4);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->local.tree), 2);
+}
+
+static void check_csync_ftw_parallel_failing_fn(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_ftw_parallel(csync, "/tmp", failing_fn, MAX_DEPTH, 4);
+    assert_int_equal(rc, -1);
+}
+
+static void check_csync_ftw_local(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b/c /tmp/check_csync1/d");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/f1 /tmp/check_csync1/a/b/f2 "
+                "/tmp/check_csync1/a/b/c/f3 /tmp/check_csync1/d/f4");
+    assert_int_equal(rc, 0);
+
+    rc = csync_ftw_local(csync, "/tmp/check_csync1", MAX_DEPTH, 1);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->local.tree), 8);
+}
+
+static void check_csync_ftw_local_parallel(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b/c /tmp/check_csync1/d");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/f1 /tmp/check_csync1/a/b/f2 "
+                "/tmp/check_csync1/a/b/c/f3 /tmp/check_csync1/d/f4");
+    assert_int_equal(rc, 0);
+
+    rc = csync_ftw_local(csync, "/tmp/check_csync1", MAX_DEPTH, 4);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->local.tree), 8);
+}
+
+static void check_csync_ftw_local_partial(void **state)
+{
+    CSYNC *csync = *state;
+    csync_transfer_t *t;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/a");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/f1 /tmp/check_csync1/a/.f1.abcdef");
+    assert_int_equal(rc, 0);
+
+    /* a download from the remote replica into the local one */
+    rc = csync_statedb_create_tables(csync->statedb.db);
+    assert_int_equal(rc, 0);
+    t = csync_statedb_transfer_new("/tmp/check_csync1/a/.f1.abcdef");
+    assert_non_null(t);
+    t->phash = 42;
+    t->replica = REMOTE_REPLICA;
+    rc = csync_statedb_set_transfer(csync->statedb.db, t);
+    assert_int_equal(rc, 0);
+    free(t);
+
+    rc = csync_update_partials_load(csync);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->local.partials), 1);
+    assert_int_equal(c_hash_size(csync->remote.partials), 0);
+
+    rc = csync_ftw_local(csync, "/tmp/check_csync1", MAX_DEPTH, 1);
+    assert_int_equal(rc, 0);
+    csync_update_partials_free(csync);
+    assert_null(csync->local.partials);
+
+    /* the temporary file isn't synced */
+    assert_int_equal(c_hash_size(csync->local.tree), 2);
+    assert_null(c_hash_find(csync->local.tree,
+                            c_jhash64((uint8_t *) "a/.f1.abcdef", 12, 0)));
+}
+
+static void check_csync_ftw_local_depth(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b /tmp/check_csync1/d");
+    assert_int_equal(rc, 0);
+
+    rc = csync_ftw_local(csync, "/tmp/check_csync1", 0, 1);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->local.tree), 2);
+}
+
+static void check_csync_ftw_local_enoent(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_ftw_local(csync, "/tmp/check_csync1/nonexistent", MAX_DEPTH, 1);
+    assert_int_equal(rc, -1);
+}
+
+static void check_csync_ftw_start(void **state)
+{
+    CSYNC *csync = *state;
+    csync_ftw_job_t *job;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/a /tmp/check_csync2/b/c");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/f1 /tmp/check_csync2/b/f2 "
+                "/tmp/check_csync2/b/c/f3");
+    assert_int_equal(rc, 0);
+
+    csync->current = REMOTE_REPLICA;
+    csync->replica = csync->remote.type;
+    job = csync_ftw_start(csync, "/tmp/check_csync2", csync_walker, MAX_DEPTH);
+
+    /* walk the other replica meanwhile */
+    csync->current = LOCAL_REPLICA;
+    csync->replica = csync->local.type;
+    rc = csync_ftw_local(csync, "/tmp/check_csync1", MAX_DEPTH, 2);
+    assert_int_equal(rc, 0);
+
+    if (job != NULL) {
+        rc = csync_ftw_join(csync, job);
+        assert_int_equal(rc, 0);
+#ifdef HAVE_PTHREAD
+        assert_null(csync->walk_lock);
+#endif
+        assert_int_equal(c_hash_size(csync->remote.tree), 4);
+    }
+    assert_int_equal(c_hash_size(csync->local.tree), 2);
+}
+
+static void check_csync_ftw_start_error(void **state)
+{
+    CSYNC *csync = *state;
+    csync_ftw_job_t *job;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync2/b && touch /tmp/check_csync2/b/f2");
+    assert_int_equal(rc, 0);
+
+    csync->current = REMOTE_REPLICA;
+    csync->replica = csync->remote.type;
+    job = csync_ftw_start(csync, "/tmp/check_csync2", failing_msg_fn, MAX_DEPTH);
+    if (job == NULL) {
+        return;
+    }
+
+    /* the message of the walk is handed over */
+    rc = csync_ftw_join(csync, job);
+    assert_int_equal(rc, -1);
+    assert_string_equal(csync->error_string, "walk failed");
+
+    /* but doesn't replace one of the caller */
+    job = csync_ftw_start(csync, "/tmp/check_csync2", failing_msg_fn, MAX_DEPTH);
+    assert_non_null(job);
+    SAFE_FREE(csync->error_string);
+    csync->error_string = c_strdup("earlier error");
+    rc = csync_ftw_join(csync, job);
+    assert_int_equal(rc, -1);
+    assert_string_equal(csync->error_string, "earlier error");
+}
+
+static void insert_etag_dir(CSYNC *csync, const char *path, const char *etag)
+{
+    char *stmt = NULL;
+    uint64_t h = c_jhash64((uint8_t *) path, strlen(path), 0);
+
+    stmt = sqlite3_mprintf("INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES"
+        "(%lld, %d, '%q', %d, %d, %d, %d, %d);",
+        (long long) h,
+        (int) strlen(path),
+        path,
+        42,
+        42,
+        42,
+        S_IFDIR | 0755,
+        42);
+    csync_statedb_insert(csync->statedb.db, stmt);
+    sqlite3_free(stmt);
+
+    stmt = sqlite3_mprintf("INSERT INTO etag (phash, path, etag) VALUES"
+        "(%lld, '%q', '%q');",
+        (long long) h,
+        path,
+        etag);
+    csync_statedb_insert(csync->statedb.db, stmt);
+    sqlite3_free(stmt);
+}
+
+static void check_csync_skip_remote_dir(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_file_stat_t *fs;
+    int rc;
+
+    rc = csync_statedb_create_tables(csync->statedb.db);
+    assert_int_equal(rc, 0);
+    insert_etag_dir(csync, "dir", "\"1\"");
+    insert_etag_dir(csync, "dir/sub", "\"2\"");
+    insert_etag_dir(csync, "other", "\"3\"");
+    csync_set_statedb_exists(csync, 1);
+    csync->current = REMOTE_REPLICA;
+
+    fs = create_fstat("dir", 0, 1, 42);
+    assert_non_null(fs);
+    fs->etag = c_strdup("\"1\"");
+    fs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+
+    rc = _csync_ftw_skip_dir(csync, "dir", fs);
+    assert_int_equal(rc, 1);
+    assert_int_equal(c_hash_size(csync->remote.tree), 1);
+    assert_int_equal(c_list_length(csync->remote.etags), 2);
+
+    csync_vio_file_stat_destroy(fs);
+}
+
+static void check_csync_skip_remote_dir_changed(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_file_stat_t *fs;
+    int rc;
+
+    rc = csync_statedb_create_tables(csync->statedb.db);
+    assert_int_equal(rc, 0);
+    insert_etag_dir(csync, "dir", "\"1\"");
+    insert_etag_dir(csync, "dir/sub", "\"2\"");
+    csync_set_statedb_exists(csync, 1);
+    csync->current = REMOTE_REPLICA;
+
+    fs = create_fstat("dir", 0, 1, 42);
+    assert_non_null(fs);
+    fs->etag = c_strdup("\"4\"");
+    fs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+
+    rc = _csync_ftw_skip_dir(csync, "dir", fs);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->remote.tree), 0);
+    assert_int_equal(c_list_length(csync->remote.etags), 1);
+
+    csync_vio_file_stat_destroy(fs);
+}
+
+static void check_csync_skip_local_dir(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_file_stat_t *fs;
+    int rc;
+
+    rc = csync_statedb_create_tables(csync->statedb.db);
+    assert_int_equal(rc, 0);
+    insert_etag_dir(csync, "dir", "\"1\"");
+    csync_set_statedb_exists(csync, 1);
+    csync->current = LOCAL_REPLICA;
+    csync->statedb.incremental = 1;
+
+    fs = create_fstat("dir", 42, 1, 42);
+    assert_non_null(fs);
+
+    /* modified in the same second as the last walk read it */
+    csync->statedb.last_scan = 42;
+    rc = _csync_ftw_skip_dir(csync, "dir", fs);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(csync->local.tree), 0);
+
+    /* unchanged since before the last walk */
+    csync->statedb.last_scan = 43;
+    rc = _csync_ftw_skip_dir(csync, "dir", fs);
+    assert_int_equal(rc, 1);
+
+    csync_vio_file_stat_destroy(fs);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -406,10 +757,24 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_detect_update_db_new, setup, teardown_rm),
         unit_test_setup_teardown(check_csync_detect_update_nlink, setup, teardown_rm),
         unit_test_setup_teardown(check_csync_detect_update_null, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_detect_update_collision, setup, teardown_rm),
 
         unit_test_setup_teardown(check_csync_ftw, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_empty_uri, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_failing_fn, setup_ftw, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_parallel, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_parallel_depth, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_parallel_failing_fn, setup_ftw, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_local, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_local_parallel, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_local_partial, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_local_depth, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_local_enoent, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_start, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_start_error, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_skip_remote_dir, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_skip_remote_dir_changed, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_skip_local_dir, setup, teardown_rm),
     };
 
     return run_tests(tests);
@@ -1,5 +1,6 @@
 #include "torture.h"
 
+#include "csync_path.h"
 #include "csync_util.h"
 
 static void check_csync_instruction_str(void **state)
@@ -22,11 +23,122 @@ static void check_csync_memstat(void **state)
   csync_memstat_check();
 }
 
+static void setup_replicas(void **state)
+{
+    CSYNC *csync;
+
+    csync = c_malloc(sizeof(CSYNC));
+    assert_non_null(csync);
+
+    csync->local.arena = c_arena_new(0);
+    csync->remote.arena = c_arena_new(0);
+    csync->paths = csync_path_pool_new();
+    assert_non_null(csync->paths);
+    csync->current = LOCAL_REPLICA;
+
+    *state = csync;
+}
+
+static void teardown_replicas(void **state)
+{
+    CSYNC *csync = *state;
+
+    c_arena_free(csync->local.arena);
+    c_arena_free(csync->remote.arena);
+    csync_path_pool_free(csync->paths);
+    SAFE_FREE(csync);
+
+    *state = NULL;
+}
+
+static void check_csync_file_stat_new(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *a, *b, *top;
+    char *path;
+
+    a = csync_file_stat_new(csync, 1, "dir/sub/a", 9);
+    assert_non_null(a);
+    assert_int_equal(a->phash, 1);
+    assert_non_null(a->path->dir);
+    assert_string_equal(a->path->dir->path, "dir/sub");
+    assert_string_equal(a->path->name, "a");
+
+    /* the directory is shared */
+    b = csync_file_stat_new(csync, 2, "dir/sub/b", 9);
+    assert_non_null(b);
+    assert_true(a->path->dir == b->path->dir);
+
+    top = csync_file_stat_new(csync, 3, "top", 3);
+    assert_non_null(top);
+    assert_null(top->path->dir);
+    assert_string_equal(top->path->name, "top");
+
+    assert_int_equal(csync_file_stat_pathlen(a), 9);
+    path = csync_file_stat_path(a);
+    assert_string_equal(path, "dir/sub/a");
+    SAFE_FREE(path);
+
+    path = csync_file_stat_path(top);
+    assert_string_equal(path, "top");
+    SAFE_FREE(path);
+}
+
+static void check_csync_file_stat_dup(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *st, *copy, *remote;
+
+    st = csync_file_stat_new(csync, 42, "dir/file", 8);
+    assert_non_null(st);
+    st->inode = 23;
+    st->instruction = CSYNC_INSTRUCTION_UPDATED;
+
+    csync->current = REMOTE_REPLICA;
+    copy = csync_file_stat_dup(csync, st);
+    assert_non_null(copy);
+    assert_true(copy->path == st->path);
+    assert_int_equal(copy->path->refcount, 2);
+    assert_int_equal(copy->phash, 42);
+    assert_int_equal(copy->inode, 23);
+    assert_int_equal(copy->instruction, CSYNC_INSTRUCTION_UPDATED);
+
+    /* the same path seen on the other replica */
+    remote = csync_file_stat_new(csync, 42, "dir/file", 8);
+    assert_non_null(remote);
+    assert_true(remote->path == st->path);
+    assert_int_equal(csync_path_pool_count(csync->paths), 1);
+    assert_int_equal(csync_file_stat_pathcmp(remote, st), 0);
+}
+
+static void check_csync_file_stat_pathcmp(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *a, *b, *c;
+
+    a = csync_file_stat_new(csync, 1, "a/b", 3);
+    b = csync_file_stat_new(csync, 2, "a/b/c", 5);
+    c = csync_file_stat_new(csync, 3, "a-b", 3);
+    assert_non_null(a);
+    assert_non_null(b);
+    assert_non_null(c);
+
+    assert_int_equal(csync_file_stat_pathcmp(a, a), 0);
+    assert_true(csync_file_stat_pathcmp(a, b) < 0);
+    assert_true(csync_file_stat_pathcmp(b, a) > 0);
+    /* like strcmp() on the paths, '-' is less than '/' */
+    assert_true(csync_file_stat_pathcmp(c, a) < 0);
+    assert_true(csync_file_stat_pathcmp(c, b) < 0);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test(check_csync_instruction_str),
         unit_test(check_csync_memstat),
+        unit_test_setup_teardown(check_csync_file_stat_new, setup_replicas, teardown_replicas),
+        unit_test_setup_teardown(check_csync_file_stat_dup, setup_replicas, teardown_replicas),
+        unit_test_setup_teardown(check_csync_file_stat_pathcmp, setup_replicas, teardown_replicas),
     };
 
     return run_tests(tests);
@@ -0,0 +1,155 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "torture.h"
+
+#include "csync_watch.c"
+
+#define TEST_DIR "/tmp/check_csync1"
+#define TEST_JOURNAL TEST_DIR "/" CSYNC_WATCH_FILE
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("rm -rf /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync /tmp/check_csync1/a/b /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+static char *read_journal(void)
+{
+    static char buf[4096];
+    ssize_t len;
+    int fd;
+
+    fd = open(TEST_JOURNAL, O_RDONLY);
+    assert_true(fd >= 0);
+    len = read(fd, buf, sizeof(buf) - 1);
+    assert_true(len > 0);
+    buf[len] = '\0';
+    close(fd);
+
+    return buf;
+}
+
+static void check_csync_watch_start_stop(void **state)
+{
+    CSYNC_WATCH *watch = NULL;
+    CSYNC_WATCH *watch2 = NULL;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = csync_watch_start(&watch, TEST_DIR);
+    assert_int_equal(rc, 0);
+    assert_true(strncmp(read_journal(), "csync-watch ", 12) == 0);
+
+    /* only one watcher per replica */
+    rc = csync_watch_start(&watch2, TEST_DIR);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EBUSY);
+
+    rc = csync_watch_stop(watch);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_watch_changes(void **state)
+{
+    CSYNC_WATCH *watch = NULL;
+    char *journal;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = csync_watch_start(&watch, TEST_DIR);
+    assert_int_equal(rc, 0);
+
+    rc = system("touch /tmp/check_csync1/a/b/file && "
+                "mkdir -p /tmp/check_csync1/c/d");
+    assert_int_equal(rc, 0);
+    usleep(200000);
+
+    journal = read_journal();
+    assert_non_null(strstr(journal, "\nd a/b\n"));
+    assert_non_null(strstr(journal, "\nr c\n"));
+
+    rc = csync_watch_stop(watch);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_watch_load_no_watcher(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_watch_load(csync);
+    assert_int_equal(rc, -1);
+    assert_int_equal(csync->watch.enabled, 0);
+}
+
+static void check_csync_watch_is_dirty(void **state)
+{
+    CSYNC *csync = *state;
+
+    csync->watch.dirty = c_strlist_new(4);
+    csync->watch.tree = c_strlist_new(4);
+    c_strlist_add(csync->watch.dirty, "a-b");
+    c_strlist_add(csync->watch.dirty, "a/b/c");
+    c_strlist_add(csync->watch.dirty, "n");
+    c_strlist_add(csync->watch.tree, "n");
+    csync->watch.enabled = 1;
+
+    assert_int_equal(csync_watch_is_dirty(csync, "a"), 1);
+    assert_int_equal(csync_watch_is_dirty(csync, "a/b"), 1);
+    assert_int_equal(csync_watch_is_dirty(csync, "a/b/c"), 1);
+    assert_int_equal(csync_watch_is_dirty(csync, "a/b/c/d"), 0);
+    assert_int_equal(csync_watch_is_dirty(csync, "a/x"), 0);
+    assert_int_equal(csync_watch_is_dirty(csync, "b"), 0);
+    assert_int_equal(csync_watch_is_dirty(csync, "n/m/o"), 1);
+    assert_int_equal(csync_watch_is_dirty(csync, "nm"), 0);
+
+    csync_watch_clear(csync);
+    assert_int_equal(csync->watch.enabled, 0);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_watch_start_stop, setup, teardown),
+        unit_test_setup_teardown(check_csync_watch_changes, setup, teardown),
+        unit_test_setup_teardown(check_csync_watch_load_no_watcher, setup, teardown),
+        unit_test_setup_teardown(check_csync_watch_is_dirty, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
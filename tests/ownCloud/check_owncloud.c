@@ -0,0 +1,661 @@
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "torture.h"
+
+#include "csync_owncloud.c"
+#include "vio/csync_vio_local.h"
+
+#define TESTDIR "/tmp/check_owncloud"
+#define FILE_SIZE (200 * 1000)
+#define NTHREADS 8
+#define NFILES 5
+#define DROP_SIZE (100 * 1000)
+
+static pid_t server_pid;
+static unsigned int server_port;
+static char server_url[64];
+
+static pthread_mutex_t prompt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prompt_cond = PTHREAD_COND_INITIALIZER;
+static int prompts;
+static int prompt_open;
+static int prompt_answered;
+static int prompt_timed_out;
+
+/*
+ * Starts davserver.py with the NULL terminated options, see the description
+ * there. A restarted server listens on the same port.
+ */
+static void start_server(const char *const *options)
+{
+    struct timespec wait = { 0, 50 * 1000 * 1000 };
+    const char *argv[32];
+    char port_arg[16];
+    FILE *fp;
+    unsigned int port = 0;
+    int argc = 0;
+    int i;
+
+    snprintf(port_arg, sizeof(port_arg), "%u", server_port);
+    argv[argc++] = PYTHON_EXECUTABLE;
+    argv[argc++] = DAVSERVER;
+    argv[argc++] = "--root";
+    argv[argc++] = TESTDIR "/root";
+    argv[argc++] = "--chunks";
+    argv[argc++] = TESTDIR "/chunks";
+    argv[argc++] = "--port-file";
+    argv[argc++] = TESTDIR "/port";
+    argv[argc++] = "--port";
+    argv[argc++] = port_arg;
+    argv[argc++] = "--log";
+    argv[argc++] = TESTDIR "/log";
+    for (i = 0; options != NULL && options[i] != NULL; i++) {
+        argv[argc++] = options[i];
+    }
+    argv[argc] = NULL;
+
+    server_pid = fork();
+    assert_true(server_pid >= 0);
+    if (server_pid == 0) {
+#ifdef __linux__
+        /* don't leave the server behind if a test fails */
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        execv(PYTHON_EXECUTABLE, (char *const *) argv);
+        _exit(127);
+    }
+
+    for (i = 0; i < 200; i++) {
+        fp = fopen(TESTDIR "/port", "r");
+        if (fp != NULL) {
+            assert_int_equal(fscanf(fp, "%u", &port), 1);
+            fclose(fp);
+            break;
+        }
+        nanosleep(&wait, NULL);
+    }
+    assert_true(port > 0);
+    server_port = port;
+
+    snprintf(server_url, sizeof(server_url), "owncloud://127.0.0.1:%u/dav", port);
+}
+
+static void stop_server(void)
+{
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+    unlink(TESTDIR "/port");
+}
+
+/* Restarts the server with other options, the files and chunks are kept */
+static void restart_server(const char *const *options)
+{
+    stop_server();
+    unlink(TESTDIR "/log");
+    start_server(options);
+}
+
+static void create_file(const char *path, size_t size)
+{
+    FILE *fp;
+    size_t i;
+
+    fp = fopen(path, "w");
+    assert_non_null(fp);
+    for (i = 0; i < size; i++) {
+        fputc((int) (i * 7 % 251), fp);
+    }
+    fclose(fp);
+}
+
+static void setup_server(const char *const *options, csync_auth_callback cb)
+{
+    int64_t chunk_size = 64 * 1024;
+    int rc;
+
+    rc = system("rm -rf " TESTDIR);
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p " TESTDIR "/root/dav " TESTDIR "/chunks");
+    assert_int_equal(rc, 0);
+
+    server_port = 0;
+    start_server(options);
+
+    assert_non_null(vio_module_init("owncloud", NULL, cb, NULL));
+    rc = owncloud_set_property("chunk_size", &chunk_size);
+    assert_int_equal(rc, 0);
+}
+
+static void setup(void **state)
+{
+    (void) state;
+
+    setup_server(NULL, NULL);
+}
+
+static void setup_refuse(void **state)
+{
+    static const char *const options[] = { "--refuse-chunk", "2", NULL };
+
+    (void) state;
+
+    setup_server(options, NULL);
+}
+
+static void setup_drop_chunk(void **state)
+{
+    static const char *const options[] = { "--drop-chunk", "2", NULL };
+
+    (void) state;
+
+    setup_server(options, NULL);
+}
+
+static void setup_drop_get(void **state)
+{
+    static const char *const options[] = { "--drop-get", "100000", NULL };
+
+    (void) state;
+
+    setup_server(options, NULL);
+    create_file(TESTDIR "/root/dav/file", FILE_SIZE);
+}
+
+/* Answers the password prompt only when the test allows it */
+static int auth_cb(const char *prompt, char *buf, size_t len, int echo,
+                   int verify, void *userdata)
+{
+    struct timespec timeout;
+
+    (void) echo;
+    (void) verify;
+    (void) userdata;
+
+    pthread_mutex_lock(&prompt_lock);
+    prompts++;
+    if (strstr(prompt, "username") != NULL) {
+        snprintf(buf, len, "user");
+    } else {
+        prompt_open = 1;
+        pthread_cond_broadcast(&prompt_cond);
+
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_sec += 5;
+        while (!prompt_answered && !prompt_timed_out) {
+            if (pthread_cond_timedwait(&prompt_cond, &prompt_lock, &timeout) != 0) {
+                prompt_timed_out = 1;
+            }
+        }
+        snprintf(buf, len, "secret");
+    }
+    pthread_mutex_unlock(&prompt_lock);
+
+    return 0;
+}
+
+static void setup_auth(void **state)
+{
+    static const char *const options[] = { "--auth", "user:secret", NULL };
+
+    (void) state;
+
+    prompts = 0;
+    prompt_open = 0;
+    prompt_answered = 0;
+    prompt_timed_out = 0;
+    setup_server(options, auth_cb);
+}
+
+static void setup_delay(void **state)
+{
+    static const char *const options[] = { "--delay", "0.02", NULL };
+    int rc;
+    int i, j;
+    char path[256];
+
+    (void) state;
+
+    setup_server(options, NULL);
+
+    /* d<i>/f<j> has i * 10 + j bytes */
+    for (i = 0; i < NTHREADS; i++) {
+        snprintf(path, sizeof(path), TESTDIR "/root/dav/d%d", i);
+        rc = mkdir(path, 0755);
+        assert_int_equal(rc, 0);
+        for (j = 0; j < NFILES; j++) {
+            snprintf(path, sizeof(path), TESTDIR "/root/dav/d%d/f%d", i, j);
+            create_file(path, i * 10 + j);
+        }
+    }
+}
+
+static void teardown(void **state)
+{
+    int rc;
+
+    (void) state;
+
+    vio_module_shutdown(&_method);
+    _chunk_size = DEFAULT_CHUNK_SIZE;
+    dav_session.pool_size = DEFAULT_SESSION_POOL_SIZE;
+
+    stop_server();
+
+    rc = system("rm -rf " TESTDIR);
+    assert_int_equal(rc, 0);
+}
+
+static int count_chunks(void)
+{
+    DIR *dir;
+    struct dirent *d;
+    int count = 0;
+
+    dir = opendir(TESTDIR "/chunks");
+    assert_non_null(dir);
+    while ((d = readdir(dir)) != NULL) {
+        if (d->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+
+    return count;
+}
+
+/* Counts the requests in the server log which contain the string */
+static int count_requests(const char *request)
+{
+    FILE *fp;
+    char line[1024];
+    int count = 0;
+
+    fp = fopen(TESTDIR "/log", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, request) != NULL) {
+            count++;
+        }
+    }
+    fclose(fp);
+
+    return count;
+}
+
+/*
+ * Transfers the file with owncloud_put or owncloud_get, like the propagation
+ * does: the transfer starts at the offset, with the token as vfs->etag. The
+ * offset and token of the remote handle are returned in both.
+ */
+static int transfer_file(const char *local, const char *name, bool put,
+                         off_t *offset, char **token)
+{
+    csync_vio_method_handle_t *flocal;
+    csync_vio_method_handle_t *fremote;
+    csync_vio_file_stat_t *vfs;
+    char url[256];
+    int rc;
+
+    snprintf(url, sizeof(url), "%s/%s", server_url, name);
+
+    if (put) {
+        flocal = csync_vio_local_open(local, O_RDONLY, 0);
+        fremote = owncloud_creat(url, 0644);
+    } else {
+        flocal = csync_vio_local_open(local, O_WRONLY | O_CREAT, 0644);
+        fremote = owncloud_open(url, O_RDONLY, 0);
+    }
+    assert_non_null(flocal);
+    assert_non_null(fremote);
+    if (!put) {
+        assert_int_equal(csync_vio_local_lseek(flocal, *offset, SEEK_SET), *offset);
+    }
+    assert_int_equal(owncloud_lseek(fremote, *offset, SEEK_SET), *offset);
+
+    vfs = csync_vio_file_stat_new();
+    assert_non_null(vfs);
+    vfs->size = FILE_SIZE;
+    vfs->etag = *token;
+
+    rc = put ? owncloud_put(flocal, fremote, vfs) : owncloud_get(flocal, fremote, vfs);
+
+    *offset = owncloud_lseek(fremote, 0, SEEK_CUR);
+    *token = vfs->etag;
+    vfs->etag = NULL;
+    csync_vio_file_stat_destroy(vfs);
+    assert_int_equal(owncloud_close(fremote), 0);
+    assert_int_equal(csync_vio_local_close(flocal), 0);
+
+    return rc;
+}
+
+/* Uploads the local file with owncloud_put */
+static int put_file(const char *local, const char *name)
+{
+    off_t offset = 0;
+    char *token = NULL;
+    int rc;
+
+    rc = transfer_file(local, name, true, &offset, &token);
+    SAFE_FREE(token);
+
+    return rc;
+}
+
+static void check_owncloud_put_chunked(void **state)
+{
+    int rc;
+
+    (void) state;
+
+    create_file(TESTDIR "/file", FILE_SIZE);
+
+    rc = put_file(TESTDIR "/file", "file");
+    assert_int_equal(rc, 0);
+
+    rc = system("cmp " TESTDIR "/file " TESTDIR "/root/dav/file");
+    assert_int_equal(rc, 0);
+    assert_int_equal(count_chunks(), 0);
+}
+
+static void check_owncloud_put_chunked_refused(void **state)
+{
+    csync_stat_t sb;
+    int rc;
+
+    (void) state;
+
+    create_file(TESTDIR "/file", FILE_SIZE);
+
+    /* the third chunk is refused, the first two are deleted again */
+    rc = put_file(TESTDIR "/file", "file");
+    assert_int_equal(rc, 1);
+
+    assert_int_equal(count_chunks(), 0);
+    rc = stat(TESTDIR "/root/dav/file", &sb);
+    assert_int_equal(rc, 0);
+    assert_int_equal(sb.st_size, 0);
+}
+
+static void check_owncloud_put_chunked_resumed(void **state)
+{
+    off_t offset = 0;
+    char *token = NULL;
+    int rc;
+
+    (void) state;
+
+    create_file(TESTDIR "/file", FILE_SIZE);
+
+    /* the connection breaks with the third chunk, the first two are kept */
+    rc = transfer_file(TESTDIR "/file", "file", true, &offset, &token);
+    assert_int_equal(rc, 1);
+    assert_int_equal(offset, 2 * 64 * 1024);
+    assert_non_null(token);
+    assert_int_equal(count_chunks(), 2);
+
+    /* only the missing chunks are uploaded after the server is back */
+    restart_server(NULL);
+    rc = transfer_file(TESTDIR "/file", "file", true, &offset, &token);
+    assert_int_equal(rc, 0);
+    assert_int_equal(offset, FILE_SIZE);
+
+    rc = system("cmp " TESTDIR "/file " TESTDIR "/root/dav/file");
+    assert_int_equal(rc, 0);
+    assert_int_equal(count_chunks(), 0);
+    assert_int_equal(count_requests("-chunking-"), 2);
+    assert_int_equal(count_requests("-4-2 201"), 1);
+    assert_int_equal(count_requests("-4-3 201"), 1);
+    SAFE_FREE(token);
+}
+
+static void check_owncloud_get_resumed(void **state)
+{
+    off_t offset = 0;
+    char *token = NULL;
+    char *etag;
+    csync_stat_t sb;
+    int rc;
+
+    (void) state;
+
+    /* the connection breaks after DROP_SIZE bytes of the file */
+    rc = transfer_file(TESTDIR "/file", "file", false, &offset, &token);
+    assert_int_equal(rc, -1);
+    rc = stat(TESTDIR "/file", &sb);
+    assert_int_equal(rc, 0);
+    assert_int_equal(sb.st_size, DROP_SIZE);
+    assert_non_null(token);
+
+    /* the rest is got after the server is back */
+    restart_server(NULL);
+    etag = c_strdup(token);
+    offset = DROP_SIZE;
+    rc = transfer_file(TESTDIR "/file", "file", false, &offset, &token);
+    assert_int_equal(rc, 0);
+    assert_string_equal(token, etag);
+    assert_int_equal(count_requests("GET /dav/file 206"), 1);
+
+    rc = system("cmp " TESTDIR "/file " TESTDIR "/root/dav/file");
+    assert_int_equal(rc, 0);
+    SAFE_FREE(etag);
+    SAFE_FREE(token);
+}
+
+static void check_owncloud_get_restarted(void **state)
+{
+    static const char *const no_range[] = { "--no-range", NULL };
+    off_t offset;
+    char *token;
+    int rc;
+
+    (void) state;
+
+    create_file(TESTDIR "/root/dav/file", FILE_SIZE);
+
+    /* the file changed on the server since the part was got */
+    rc = system("echo changed > " TESTDIR "/file");
+    assert_int_equal(rc, 0);
+    offset = 5;
+    token = c_strdup("\"changed\"");
+    rc = transfer_file(TESTDIR "/file", "file", false, &offset, &token);
+    assert_int_equal(rc, 0);
+    rc = system("cmp " TESTDIR "/file " TESTDIR "/root/dav/file");
+    assert_int_equal(rc, 0);
+
+    /* without the ETag of the part, the file is got from the start */
+    rc = system("echo changed > " TESTDIR "/file");
+    assert_int_equal(rc, 0);
+    SAFE_FREE(token);
+    offset = 5;
+    rc = transfer_file(TESTDIR "/file", "file", false, &offset, &token);
+    assert_int_equal(rc, 0);
+    rc = system("cmp " TESTDIR "/file " TESTDIR "/root/dav/file");
+    assert_int_equal(rc, 0);
+
+    /* a server without ranges sends all of it */
+    restart_server(no_range);
+    rc = system("echo changed > " TESTDIR "/file");
+    assert_int_equal(rc, 0);
+    offset = 5;
+    rc = transfer_file(TESTDIR "/file", "file", false, &offset, &token);
+    assert_int_equal(rc, 0);
+    rc = system("cmp " TESTDIR "/file " TESTDIR "/root/dav/file");
+    assert_int_equal(rc, 0);
+    assert_int_equal(count_requests("GET /dav/file 200"), 1);
+    SAFE_FREE(token);
+}
+
+static void check_owncloud_chunk_transfer_id(void **state)
+{
+    unsigned int id[32];
+    size_t i, j;
+
+    (void) state;
+
+    /* ids of uploads started in the same second differ */
+    for (i = 0; i < 32; i++) {
+        id[i] = chunk_transfer_id();
+        for (j = 0; j < i; j++) {
+            assert_true(id[i] != id[j]);
+        }
+    }
+}
+
+/* Lists d<i> and stats its files, like a thread of the remote walk */
+static void *walk_dir(void *arg)
+{
+    long i = (long) arg;
+    csync_vio_method_handle_t *dh;
+    csync_vio_file_stat_t *fs;
+    char url[256];
+    long errors = 0;
+    int found = 0;
+    int j;
+
+    snprintf(url, sizeof(url), "%s/d%ld", server_url, i);
+    dh = owncloud_opendir(url);
+    if (dh == NULL) {
+        return (void *) 1;
+    }
+    while ((fs = owncloud_readdir(dh)) != NULL) {
+        if (sscanf(fs->name, "f%d", &j) != 1 || fs->size != i * 10 + j) {
+            errors++;
+        }
+        found++;
+        csync_vio_file_stat_destroy(fs);
+    }
+    owncloud_closedir(dh);
+    if (found != NFILES) {
+        errors++;
+    }
+
+    /* without the readdir cache, each stat is a request of its own */
+    for (j = 0; j < NFILES; j++) {
+        snprintf(url, sizeof(url), "%s/d%ld/f%d", server_url, i, j);
+        fs = csync_vio_file_stat_new();
+        if (owncloud_stat(url, fs) != 0 || fs->size != i * 10 + j) {
+            errors++;
+        }
+        csync_vio_file_stat_destroy(fs);
+    }
+
+    return (void *) errors;
+}
+
+static void check_owncloud_parallel_walk(void **state)
+{
+    pthread_t threads[NTHREADS];
+    void *errors;
+    int pool_size = 3;
+    long i;
+    int rc;
+
+    (void) state;
+
+    rc = owncloud_set_property("session_pool_size", &pool_size);
+    assert_int_equal(rc, 0);
+
+    for (i = 0; i < NTHREADS; i++) {
+        rc = pthread_create(&threads[i], NULL, walk_dir, (void *) i);
+        assert_int_equal(rc, 0);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        rc = pthread_join(threads[i], &errors);
+        assert_int_equal(rc, 0);
+        assert_true(errors == NULL);
+    }
+
+    /* the threads shared the sessions of the pool, and all came back */
+    assert_int_equal(dav_session.count, pool_size);
+    assert_int_equal(dav_session.idle, pool_size);
+}
+
+static void *stat_root(void *arg)
+{
+    csync_vio_file_stat_t *fs;
+    char url[256];
+    int rc;
+
+    (void) arg;
+
+    snprintf(url, sizeof(url), "%s/", server_url);
+    fs = csync_vio_file_stat_new();
+    rc = owncloud_stat(url, fs);
+    csync_vio_file_stat_destroy(fs);
+
+    return rc == 0 ? NULL : (void *) 1;
+}
+
+static void check_owncloud_auth_prompt(void **state)
+{
+    pthread_t threads[NTHREADS];
+    ne_session *session;
+    void *errors;
+    int pool_size = NTHREADS;
+    int i;
+    int rc;
+
+    (void) state;
+
+    rc = pthread_create(&threads[0], NULL, stat_root, NULL);
+    assert_int_equal(rc, 0);
+
+    pthread_mutex_lock(&prompt_lock);
+    while (!prompt_open) {
+        pthread_cond_wait(&prompt_cond, &prompt_lock);
+    }
+    pthread_mutex_unlock(&prompt_lock);
+
+    /* the session pool is usable while the user is asked */
+    rc = owncloud_set_property("session_pool_size", &pool_size);
+    assert_int_equal(rc, 0);
+    session = dav_session_get(NULL);
+    assert_non_null(session);
+    dav_session_put(session);
+
+    pthread_mutex_lock(&prompt_lock);
+    prompt_answered = 1;
+    pthread_cond_broadcast(&prompt_cond);
+    pthread_mutex_unlock(&prompt_lock);
+
+    rc = pthread_join(threads[0], &errors);
+    assert_int_equal(rc, 0);
+    assert_true(errors == NULL);
+    assert_int_equal(prompt_timed_out, 0);
+
+    /* the other sessions use the credentials without asking again */
+    for (i = 0; i < NTHREADS; i++) {
+        rc = pthread_create(&threads[i], NULL, stat_root, NULL);
+        assert_int_equal(rc, 0);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        rc = pthread_join(threads[i], &errors);
+        assert_int_equal(rc, 0);
+        assert_true(errors == NULL);
+    }
+    assert_int_equal(prompts, 2);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_owncloud_put_chunked, setup, teardown),
+        unit_test_setup_teardown(check_owncloud_put_chunked_refused, setup_refuse, teardown),
+        unit_test_setup_teardown(check_owncloud_put_chunked_resumed, setup_drop_chunk, teardown),
+        unit_test_setup_teardown(check_owncloud_get_resumed, setup_drop_get, teardown),
+        unit_test_setup_teardown(check_owncloud_get_restarted, setup, teardown),
+        unit_test_setup_teardown(check_owncloud_chunk_transfer_id, setup, teardown),
+        unit_test_setup_teardown(check_owncloud_parallel_walk, setup_delay, teardown),
+        unit_test_setup_teardown(check_owncloud_auth_prompt, setup_auth, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+#
+# davserver.py - a local WebDAV stand-in for the ownCloud module tests
+#
+# It serves a directory with the subset of WebDAV the owncloud module
+# uses: PROPFIND, GET, PUT, DELETE, MKCOL, MOVE and PROPPATCH. PUT requests
+# with the OC-Chunked header are handled like ownCloud does: the chunks
+# <file>-chunking-<id>-<count>-<index> are kept in a separate chunk
+# directory and the file is assembled after the last one arrived. GET
+# requests with a Range header are answered with the rest of the file
+# (206 Partial Content), unless an If-Range header doesn't match the ETag.
+#
+# Usage: davserver.py --root DIR --chunks DIR --port-file FILE [--port N]
+#                     [--refuse-chunk N] [--drop-chunk N] [--drop-get BYTES]
+#                     [--no-range] [--auth USER:PASSWORD] [--delay SECONDS]
+#                     [--log FILE]
+#
+# The server listens on the given or a free port of 127.0.0.1 and writes
+# it to the port file once it accepts connections. With --refuse-chunk,
+# the chunk with index N of every upload is answered with 403 Forbidden.
+# With --drop-chunk, the connection is closed instead of answering it.
+# With --drop-get, the connection is closed after that many bytes of the
+# body of every GET. With --no-range, Range headers are ignored. With
+# --auth, every request needs these credentials (HTTP basic auth). With
+# --delay, every request is answered after the given time, which keeps
+# concurrent requests in flight. With --log, the method, path and status
+# of every request are appended to the file.
+
+import argparse
+import base64
+import email.utils
+import os
+import re
+import shutil
+import sys
+import threading
+import time
+import urllib.parse
+from http import HTTPStatus
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from xml.sax.saxutils import escape
+
+CHUNK_RE = re.compile(r'^(.*)-chunking-(\d+)-(\d+)-(\d+)$')
+
+
+class DavHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    server_version = 'davserver/1.0'
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            sys.stderr.write('davserver: %s\n' % (fmt % args))
+
+    def local_path(self, path=None):
+        if path is None:
+            path = self.path
+        path = urllib.parse.unquote(urllib.parse.urlsplit(path).path)
+        path = os.path.normpath('/' + path).lstrip('/')
+        return os.path.join(self.server.root, path)
+
+    def read_body(self):
+        if self.headers.get('Transfer-Encoding', '').lower() == 'chunked':
+            body = b''
+            while True:
+                length = int(self.rfile.readline().split(b';')[0], 16)
+                body += self.rfile.read(length)
+                self.rfile.readline()
+                if length == 0:
+                    return body
+        length = int(self.headers.get('Content-Length', 0))
+        return self.rfile.read(length) if length > 0 else b''
+
+    def log_request(self, code='-', size='-'):
+        if isinstance(code, HTTPStatus):
+            code = code.value
+        BaseHTTPRequestHandler.log_request(self, code, size)
+        if self.server.log is None:
+            return
+        with self.server.log_lock:
+            with open(self.server.log, 'a') as f:
+                path = urllib.parse.urlsplit(self.path).path
+                f.write('%s %s %s\n' % (self.command,
+                        urllib.parse.unquote(path), code))
+
+    def drop(self):
+        self.log_request('dropped')
+        self.close_connection = True
+
+    def reply(self, code, body=b'', content_type=None, headers=None):
+        self.send_response(code)
+        if content_type:
+            self.send_header('Content-Type', content_type)
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        if body and self.command != 'HEAD':
+            self.wfile.write(body)
+
+    def handle_one_request(self):
+        if self.server.delay:
+            time.sleep(self.server.delay)
+        BaseHTTPRequestHandler.handle_one_request(self)
+
+    def parse_request(self):
+        if not BaseHTTPRequestHandler.parse_request(self):
+            return False
+        if self.server.auth is None or \
+                self.headers.get('Authorization') == self.server.auth:
+            return True
+        self.read_body()
+        self.reply(401, headers={'WWW-Authenticate': 'Basic realm="davserver"'})
+        return False
+
+    @staticmethod
+    def etag(st):
+        return '"%x-%x"' % (int(st.st_mtime), st.st_size)
+
+    def propstat(self, href, path):
+        st = os.stat(path)
+        props = '<d:getlastmodified>%s</d:getlastmodified>' % \
+            email.utils.formatdate(st.st_mtime, usegmt=True)
+        if os.path.isdir(path):
+            props += '<d:resourcetype><d:collection/></d:resourcetype>'
+        else:
+            props += '<d:resourcetype/>'
+            props += '<d:getcontentlength>%d</d:getcontentlength>' % st.st_size
+        props += '<d:getetag>%s</d:getetag>' % escape(self.etag(st))
+        return ('<d:response><d:href>%s</d:href><d:propstat><d:prop>%s'
+                '</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat>'
+                '</d:response>' % (escape(urllib.parse.quote(href)), props))
+
+    def do_PROPFIND(self):
+        self.read_body()
+        path = self.local_path()
+        if not os.path.exists(path):
+            return self.reply(404)
+        href = urllib.parse.unquote(urllib.parse.urlsplit(self.path).path)
+        responses = [self.propstat(href, path)]
+        if os.path.isdir(path) and self.headers.get('Depth', '1') != '0':
+            base = href if href.endswith('/') else href + '/'
+            for name in sorted(os.listdir(path)):
+                responses.append(self.propstat(base + name,
+                                               os.path.join(path, name)))
+        body = ('<?xml version="1.0" encoding="utf-8"?>'
+                '<d:multistatus xmlns:d="DAV:">%s</d:multistatus>'
+                % ''.join(responses)).encode('utf-8')
+        self.reply(207, body, 'application/xml; charset=utf-8')
+
+    def do_PROPPATCH(self):
+        body = self.read_body().decode('utf-8', 'replace')
+        path = self.local_path()
+        if not os.path.exists(path):
+            return self.reply(404)
+        match = re.search(r'lastmodified[^>]*>\s*(\d+)\s*<', body)
+        if match:
+            mtime = int(match.group(1))
+            os.utime(path, (mtime, mtime))
+        self.reply(207, b'<?xml version="1.0" encoding="utf-8"?>'
+                   b'<d:multistatus xmlns:d="DAV:"/>',
+                   'application/xml; charset=utf-8')
+
+    def do_HEAD(self):
+        self.do_GET()
+
+    def do_GET(self):
+        path = self.local_path()
+        if not os.path.isfile(path):
+            return self.reply(404)
+        with open(path, 'rb') as f:
+            body = f.read()
+        etag = self.etag(os.stat(path))
+        headers = {'ETag': etag}
+        code = 200
+        match = re.match(r'^bytes=(\d+)-$', self.headers.get('Range', ''))
+        if match and not self.server.no_range and \
+                self.headers.get('If-Range', etag) == etag:
+            start = int(match.group(1))
+            if start >= len(body):
+                return self.reply(416, headers={
+                    'Content-Range': 'bytes */%d' % len(body)})
+            headers['Content-Range'] = 'bytes %d-%d/%d' % \
+                (start, len(body) - 1, len(body))
+            body = body[start:]
+            code = 206
+        if self.server.drop_get < 0 or self.command == 'HEAD':
+            return self.reply(code, body, 'application/octet-stream', headers)
+
+        self.send_response(code)
+        for key, value in headers.items():
+            self.send_header(key, value)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body[:self.server.drop_get])
+        self.drop()
+
+    def put_chunk(self, path, body):
+        match = CHUNK_RE.match(os.path.basename(path))
+        target, transfer_id, count, index = match.groups()
+        count = int(count)
+        index = int(index)
+        if index == self.server.refuse_chunk:
+            return self.reply(403)
+        if index == self.server.drop_chunk:
+            return self.drop()
+
+        prefix = '%s-chunking-%s-%d-' % (target, transfer_id, count)
+        with open(os.path.join(self.server.chunks, prefix + str(index)),
+                  'wb') as f:
+            f.write(body)
+
+        with self.server.lock:
+            names = [prefix + str(i) for i in range(count)]
+            if not all(os.path.exists(os.path.join(self.server.chunks, n))
+                       for n in names):
+                return self.reply(201)
+            final = os.path.join(os.path.dirname(path), target)
+            with open(final, 'wb') as out:
+                for name in names:
+                    chunk = os.path.join(self.server.chunks, name)
+                    with open(chunk, 'rb') as f:
+                        shutil.copyfileobj(f, out)
+                    os.unlink(chunk)
+        self.reply(201, headers={'ETag': self.etag(os.stat(final))})
+
+    def do_PUT(self):
+        body = self.read_body()
+        path = self.local_path()
+        if not os.path.isdir(os.path.dirname(path)):
+            return self.reply(409)
+        if self.headers.get('OC-Chunked') and \
+                CHUNK_RE.match(os.path.basename(path)):
+            return self.put_chunk(path, body)
+        with open(path, 'wb') as f:
+            f.write(body)
+        self.reply(201, headers={'ETag': self.etag(os.stat(path))})
+
+    def do_DELETE(self):
+        path = self.local_path()
+        if CHUNK_RE.match(os.path.basename(path)):
+            path = os.path.join(self.server.chunks, os.path.basename(path))
+        if os.path.isdir(path):
+            shutil.rmtree(path)
+        elif os.path.exists(path):
+            os.unlink(path)
+        else:
+            return self.reply(404)
+        self.reply(204)
+
+    def do_MKCOL(self):
+        self.read_body()
+        path = self.local_path()
+        if os.path.exists(path):
+            return self.reply(405)
+        if not os.path.isdir(os.path.dirname(path)):
+            return self.reply(409)
+        os.mkdir(path)
+        self.reply(201)
+
+    def do_MOVE(self):
+        path = self.local_path()
+        destination = self.headers.get('Destination')
+        if not os.path.exists(path):
+            return self.reply(404)
+        if destination is None:
+            return self.reply(400)
+        os.replace(path, self.local_path(destination))
+        self.reply(201)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--root', required=True)
+    parser.add_argument('--chunks', required=True)
+    parser.add_argument('--port-file', required=True)
+    parser.add_argument('--port', type=int, default=0)
+    parser.add_argument('--refuse-chunk', type=int, default=-1)
+    parser.add_argument('--drop-chunk', type=int, default=-1)
+    parser.add_argument('--drop-get', type=int, default=-1)
+    parser.add_argument('--no-range', action='store_true')
+    parser.add_argument('--auth')
+    parser.add_argument('--delay', type=float, default=0)
+    parser.add_argument('--log')
+    parser.add_argument('--verbose', action='store_true')
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer(('127.0.0.1', args.port), DavHandler)
+    server.daemon_threads = True
+    server.root = os.path.abspath(args.root)
+    server.chunks = os.path.abspath(args.chunks)
+    server.refuse_chunk = args.refuse_chunk
+    server.drop_chunk = args.drop_chunk
+    server.drop_get = args.drop_get
+    server.no_range = args.no_range
+    server.auth = None
+    if args.auth:
+        server.auth = 'Basic ' + \
+            base64.b64encode(args.auth.encode('utf-8')).decode('ascii')
+    server.delay = args.delay
+    server.log = args.log
+    server.verbose = args.verbose
+    server.lock = threading.Lock()
+    server.log_lock = threading.Lock()
+
+    tmp = args.port_file + '.tmp'
+    with open(tmp, 'w') as f:
+        f.write('%d\n' % server.server_address[1])
+    os.rename(tmp, args.port_file)
+
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
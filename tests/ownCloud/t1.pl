@@ -96,6 +96,13 @@ system( "sleep 2 && touch $srcFile" );
 csync();
 assertLocalAndRemoteDir( 'remoteToLocal1', 1);
 
+# upload a file larger than the chunk size of the module (10 MB)
+print "\nUpload a file in chunks.\n";
+createLocalDir( 'chunked' );
+createLocalFile( 'chunked/large.dat', 25 * 1024 * 1024 );
+csync();
+assertLocalAndRemoteDir( 'chunked', 0);
+
 # ==================================================================
 
 cleanup();
@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "std/c_arena.h"
+
+struct test_s {
+    uint64_t key;
+    char name[3];
+};
+
+static void check_c_arena_alloc(void **state)
+{
+    c_arena_t *arena = NULL;
+    struct test_s *p = NULL;
+    struct test_s *q = NULL;
+
+    (void) state; /* unused */
+
+    arena = c_arena_new(0);
+    assert_non_null(arena);
+
+    p = c_arena_alloc(arena, sizeof(struct test_s));
+    assert_non_null(p);
+    assert_int_equal(p->key, 0);
+    p->key = 42;
+
+    q = c_arena_alloc(arena, sizeof(struct test_s));
+    assert_non_null(q);
+    assert_true(q != p);
+    assert_int_equal(q->key, 0);
+    assert_int_equal(p->key, 42);
+
+    /* the memory is aligned */
+    assert_int_equal((uintptr_t) q % sizeof(uint64_t), 0);
+    assert_true(c_arena_size(arena) >= 2 * sizeof(struct test_s));
+
+    c_arena_free(arena);
+}
+
+static void check_c_arena_alloc_zero(void **state)
+{
+    c_arena_t *arena = NULL;
+
+    (void) state; /* unused */
+
+    arena = c_arena_new(0);
+    assert_non_null(arena);
+
+    assert_null(c_arena_alloc(arena, 0));
+    assert_null(c_arena_alloc(NULL, 8));
+    assert_int_equal(c_arena_size(arena), 0);
+
+    c_arena_free(arena);
+    c_arena_free(NULL);
+}
+
+static void check_c_arena_chunks(void **state)
+{
+    c_arena_t *arena = NULL;
+    unsigned char *p = NULL;
+    unsigned char *large = NULL;
+    int i;
+
+    (void) state; /* unused */
+
+    /* a small chunk size to use a lot of chunks */
+    arena = c_arena_new(256);
+    assert_non_null(arena);
+
+    for (i = 0; i < 1000; i++) {
+        p = c_arena_alloc(arena, 24);
+        assert_non_null(p);
+        assert_int_equal(p[0], 0);
+        assert_int_equal(p[23], 0);
+        memset(p, 0xff, 24);
+    }
+
+    /* larger than the chunk */
+    large = c_arena_alloc(arena, 4096);
+    assert_non_null(large);
+    assert_int_equal(large[0], 0);
+    assert_int_equal(large[4095], 0);
+    memset(large, 0xff, 4096);
+
+    p = c_arena_alloc(arena, 24);
+    assert_non_null(p);
+    assert_int_equal(p[0], 0);
+
+    c_arena_free(arena);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test(check_c_arena_alloc),
+      unit_test(check_c_arena_alloc_zero),
+      unit_test(check_c_arena_chunks),
+  };
+
+  return run_tests(tests);
+}
@@ -0,0 +1,190 @@
+#include <errno.h>
+
+#include "torture.h"
+
+#include "std/c_alloc.h"
+#include "std/c_hash.h"
+
+typedef struct test_s {
+    uint64_t key;
+    int number;
+} test_t;
+
+static void setup(void **state) {
+    c_hash_t *table = NULL;
+
+    table = c_hash_new(0);
+    assert_non_null(table);
+
+    *state = table;
+}
+
+static void setup_complete_table(void **state) {
+    c_hash_t *table = NULL;
+    int i, rc;
+
+    table = c_hash_new(0);
+    assert_non_null(table);
+
+    for (i = 0; i < 1000; i++) {
+        test_t *testdata = NULL;
+
+        testdata = c_malloc(sizeof(test_t));
+        assert_non_null(testdata);
+        testdata->key = i;
+        testdata->number = i;
+
+        rc = c_hash_insert(table, testdata->key, testdata);
+        assert_int_equal(rc, 0);
+    }
+
+    *state = table;
+}
+
+static void teardown(void **state) {
+    c_hash_t *table = *state;
+    size_t i;
+
+    for (i = 0; i < c_hash_size(table); i++) {
+        free(c_hash_at(table, i));
+    }
+    c_hash_free(table);
+
+    *state = NULL;
+}
+
+static int visitor(void *obj, void *data) {
+    test_t *a = (test_t *) obj;
+    int *sum = (int *) data;
+
+    *sum += a->number;
+
+    return 0;
+}
+
+static int visitor_fail(void *obj, void *data) {
+    (void) obj;
+    (void) data;
+
+    return -1;
+}
+
+static void check_c_hash_new_free(void **state)
+{
+    c_hash_t *table = NULL;
+
+    (void) state; /* unused */
+
+    table = c_hash_new(100000);
+    assert_non_null(table);
+    assert_int_equal(c_hash_size(table), 0);
+    assert_null(c_hash_find(table, 42));
+
+    c_hash_free(table);
+    c_hash_free(NULL);
+}
+
+static void check_c_hash_insert(void **state)
+{
+    c_hash_t *table = *state;
+    test_t *testdata = NULL;
+    int rc;
+
+    testdata = c_malloc(sizeof(test_t));
+    assert_non_null(testdata);
+    testdata->key = 42;
+
+    rc = c_hash_insert(table, testdata->key, testdata);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(table), 1);
+    assert_true(c_hash_at(table, 0) == testdata);
+
+    /* the key is already there */
+    rc = c_hash_insert(table, testdata->key, testdata);
+    assert_int_equal(rc, 1);
+    assert_int_equal(c_hash_size(table), 1);
+
+    rc = c_hash_insert(NULL, testdata->key, testdata);
+    assert_int_equal(rc, -1);
+}
+
+static void check_c_hash_find(void **state)
+{
+    c_hash_t *table = *state;
+    test_t *testdata = NULL;
+    int i;
+
+    assert_int_equal(c_hash_size(table), 1000);
+
+    for (i = 0; i < 1000; i++) {
+        testdata = c_hash_find(table, i);
+        assert_non_null(testdata);
+        assert_int_equal(testdata->number, i);
+    }
+
+    assert_null(c_hash_find(table, 1000));
+    assert_null(c_hash_find(table, (uint64_t) -1));
+    assert_null(c_hash_find(NULL, 1));
+}
+
+static void check_c_hash_order(void **state)
+{
+    c_hash_t *table = *state;
+    test_t *testdata = NULL;
+    size_t i;
+
+    /* the entries stay in insertion order when the table grows */
+    for (i = 0; i < c_hash_size(table); i++) {
+        testdata = c_hash_at(table, i);
+        assert_int_equal(testdata->number, i);
+    }
+}
+
+static void check_c_hash_reserve(void **state)
+{
+    c_hash_t *table = *state;
+    test_t *testdata = NULL;
+    int rc;
+
+    rc = c_hash_reserve(table, 100000);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hash_size(table), 1000);
+
+    testdata = c_hash_find(table, 999);
+    assert_non_null(testdata);
+    assert_int_equal(testdata->number, 999);
+
+    rc = c_hash_reserve(NULL, 1);
+    assert_int_equal(rc, -1);
+}
+
+static void check_c_hash_walk(void **state)
+{
+    c_hash_t *table = *state;
+    int sum = 0;
+    int rc;
+
+    rc = c_hash_walk(table, &sum, visitor);
+    assert_int_equal(rc, 0);
+    assert_int_equal(sum, 999 * 1000 / 2);
+
+    rc = c_hash_walk(table, &sum, visitor_fail);
+    assert_int_equal(rc, -1);
+
+    rc = c_hash_walk(table, &sum, NULL);
+    assert_int_equal(rc, -1);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test(check_c_hash_new_free),
+      unit_test_setup_teardown(check_c_hash_insert, setup, teardown),
+      unit_test_setup_teardown(check_c_hash_find, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_hash_order, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_hash_reserve, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_hash_walk, setup_complete_table, teardown),
+  };
+
+  return run_tests(tests);
+}
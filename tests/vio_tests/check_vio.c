@@ -9,6 +9,7 @@
 
 #include "csync_private.h"
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
 
 #define CSYNC_TEST_DIR "/tmp/csync/"
 #define CSYNC_TEST_DIRS "/tmp/csync/this/is/a/mkdirs/test"
@@ -232,6 +233,38 @@ static void check_csync_vio_readdir(void **state)
     assert_int_equal(rc, 0);
 }
 
+static void check_csync_vio_readdir_stat(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_method_handle_t *dh;
+    csync_vio_file_stat_t *dirent;
+    int rc;
+
+    if (!csync_vio_readdir_stat_support(csync)) {
+        return;
+    }
+
+    dh = csync_vio_opendir(csync, CSYNC_TEST_DIR);
+    assert_non_null(dh);
+
+    while ((dirent = csync_vio_readdir(csync, dh)) != NULL) {
+        if (strcmp(dirent->name, "file.txt") == 0) {
+            break;
+        }
+        csync_vio_file_stat_destroy(dirent);
+    }
+    assert_non_null(dirent);
+
+    assert_true(dirent->fields & CSYNC_VIO_FILE_STAT_FIELDS_MTIME);
+    assert_true(dirent->fields & CSYNC_VIO_FILE_STAT_FIELDS_SIZE);
+    assert_int_equal(dirent->type, CSYNC_VIO_FILE_TYPE_REGULAR);
+    assert_int_equal(dirent->size, 15);
+
+    csync_vio_file_stat_destroy(dirent);
+    rc = csync_vio_closedir(csync, dh);
+    assert_int_equal(rc, 0);
+}
+
 /*
  * Test file functions (open, read, write, close ...)
  */
@@ -380,6 +413,46 @@ static void check_csync_vio_lseek(void **state)
     assert_int_equal(rc, 0);
 }
 
+static void check_csync_vio_copy(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_method_handle_t *sfh;
+    csync_vio_method_handle_t *dfh;
+    char test[16] = {0};
+    int rc;
+
+    sfh = csync_vio_open(csync, CSYNC_TEST_FILE, O_RDONLY, 0644);
+    assert_non_null(sfh);
+
+    dfh = csync_vio_creat(csync, CSYNC_TEST_DIR "copy.txt", 0644);
+    assert_non_null(dfh);
+
+    rc = csync_vio_copy(csync, sfh, dfh,
+                        CSYNC_VIO_COPY_OFFLOAD|CSYNC_VIO_COPY_SENDFILE);
+    if (rc < 0) {
+        /* the file system can't, it would be copied with read and write */
+        assert_int_equal(errno, ENOTSUP);
+    }
+
+    assert_int_equal(csync_vio_close(csync, sfh), 0);
+    assert_int_equal(csync_vio_close(csync, dfh), 0);
+
+    if (rc < 0) {
+        return;
+    }
+
+    dfh = csync_vio_open(csync, CSYNC_TEST_DIR "copy.txt", O_RDONLY, 0644);
+    assert_non_null(dfh);
+
+    rc = csync_vio_read(csync, dfh, test, sizeof(test));
+    assert_int_equal(rc, 15);
+
+    assert_string_equal(test, "This is a test\n");
+
+    rc = csync_vio_close(csync, dfh);
+    assert_int_equal(rc, 0);
+}
+
 /*
  * Test for general functions (stat, chmod, chown, ...)
  */
@@ -543,6 +616,7 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_vio_opendir_perm, setup, teardown),
         unit_test(check_csync_vio_closedir_null),
         unit_test_setup_teardown(check_csync_vio_readdir, setup_dir, teardown),
+        unit_test_setup_teardown(check_csync_vio_readdir_stat, setup_file, teardown),
 
         unit_test_setup_teardown(check_csync_vio_close_null, setup_dir, teardown),
         unit_test_setup_teardown(check_csync_vio_creat_close, setup_dir, teardown),
@@ -553,6 +627,7 @@ int torture_run_tests(void)
         unit_test(check_csync_vio_write_null),
         unit_test_setup_teardown(check_csync_vio_write, setup_dir, teardown),
         unit_test_setup_teardown(check_csync_vio_lseek, setup_file, teardown),
+        unit_test_setup_teardown(check_csync_vio_copy, setup_file, teardown),
 
         unit_test_setup_teardown(check_csync_vio_stat_dir, setup_dir, teardown),
         unit_test_setup_teardown(check_csync_vio_stat_file, setup_file, teardown),